@@ -8,17 +8,17 @@
 CL_Global_Snapshot::CL_Global_Snapshot(ReliableMulticast *rm, const client_server::TCP_Server& serv)
 : rm(rm), server(serv), locsnap{}, amInitiator(false), inboundMessageBuffer(), outboundMessageBuffer() {
     num_hosts = rm->num_hosts;
-    hostNames = rm->hostNames;
+    hosts = &rm->hosts;
     curr_container_id = rm->current_container_id;
     curr_container_name = rm->current_container_name;
 }
 
-CL_Global_Snapshot::CL_Global_Snapshot(ReliableMulticast *rm)
-        : rm(rm), server(SNAP_SHOT_PORT, BACKLOG), locsnap{}, amInitiator(false) {
+CL_Global_Snapshot::CL_Global_Snapshot(ReliableMulticast *rm, int port)
+        : rm(rm), server(port, BACKLOG), locsnap{}, amInitiator(false) {
     if (rm == nullptr)
         return;
     num_hosts = rm->num_hosts;
-    hostNames = rm->hostNames;
+    hosts = &rm->hosts;
     curr_container_id = rm->current_container_id;
     curr_container_name = rm->current_container_name;
 }
@@ -26,7 +26,7 @@ CL_Global_Snapshot::CL_Global_Snapshot(ReliableMulticast *rm)
 void CL_Global_Snapshot::set_rm(ReliableMulticast *p) {
     rm = p;
     num_hosts = rm->num_hosts;
-    hostNames = rm->hostNames;
+    hosts = &rm->hosts;
     curr_container_id = rm->current_container_id;
     curr_container_name = rm->current_container_name;
 }
@@ -50,10 +50,10 @@ void CL_Global_Snapshot::broadcast_markers() const {
     const char * our_ids = our_id.c_str();
 //    printf("[debug broadcast_marker] preparing to send packet %s.\n", our_ids);
     for (int i = 0; i < num_hosts; i++){
-        if (strcmp(hostNames[i], curr_container_name) != 0){
+        if (strcmp(hosts->name_of(i), curr_container_name) != 0){
 //            printf("[debug broadcast_marker] Found host %s to send to.\n", hostNames[i]);
 //            int to_send_id = extract_int_from_string(std::string(hostNames[i]));
-            int to_send_sock = server.connect_and_get_socket(hostNames[i]);
+            int to_send_sock = server.connect_and_get_socket(hosts->name_of(i));
 //            hostToSockMutex.lock();
 //            if (hostToSockFD.count(to_send_id) == 0){  // if we haven't had a channel to talk with this hostID
 //                printf("[debug clgs:broadcast_marker]: haven't found hostToSockFd for %s\n",
@@ -118,24 +118,16 @@ void CL_Global_Snapshot::listen_for_incoming_connections() {
 //        printf("[debug clgs:listening_for]: this is the %d marker!\n", sofar);
         inboundMessageBufferMutex.lock();
         while(!inboundMessageBuffer.empty()){
-            unsigned char temp[MAX_STRUCT_SIZE];
-            ByteVector b = inboundMessageBuffer.front();
-            for (int i = 0; i < MAX_STRUCT_SIZE; i++){
-                temp[i] = b[i];
-            }
-            handle_message(temp, INBOUND);
+            ByteVector b = inboundMessageBuffer.front();  // msgs are recorded with their real size (a JOIN is longer)
+            handle_message(b.data(), b.size(), INBOUND);
             inboundMessageBuffer.pop();
         }
         inboundMessageBufferMutex.unlock();
 
         outboundMessageBufferMutex.lock();
         while(!outboundMessageBuffer.empty()){
-            unsigned char temp[MAX_STRUCT_SIZE];
             ByteVector b = outboundMessageBuffer.front();
-            for (int i = 0; i < MAX_STRUCT_SIZE; i++){
-                temp[i] = b[i];
-            }
-            handle_message(temp, OUTBOUND);
+            handle_message(b.data(), b.size(), OUTBOUND);
             outboundMessageBuffer.pop();
         }
         outboundMessageBufferMutex.unlock();
@@ -181,19 +173,25 @@ void CL_Global_Snapshot::add_msg_to_outbound(int sender, const std::string& s) {
     outboundChannelState[sender].push_back(s);
 }
 
-void CL_Global_Snapshot::handle_message(unsigned char *msg, int inorout) {
+void CL_Global_Snapshot::handle_message(unsigned char *msg, size_t size, int inorout) {
     unsigned long type = unpacku32(&msg[0]);
 //        DPRINTF(("Received msg is of type: %lu\n", type));
     DataMessage dataMessage;
     AckMessage ackMessage;
     SeqMessage seqMessage;
+    FlushMessage flushMessage;
+    FlushDoneMessage flushDoneMessage;
+    JoinedMessage joinedMessage;
+    JoinedAckMessage joinedAckMessage;
+    AggAckMessage aggAckMessage;
+    NakMessage nakMessage;
     int sender;
     char buff[100];
     switch (type) {
         case DATAMSG_TYPE:
-            deserialize_data_message(msg, dataMessage);
-            sprintf(buff, "DataMessage: sender %d, msg_id %d, data %d",
-                    dataMessage.sender, dataMessage.msg_id, dataMessage.data);
+            deserialize_data_message(msg, size, dataMessage);
+            sprintf(buff, "DataMessage: sender %d, msg_id %d, %lu bytes, kind %d",
+                    dataMessage.sender, dataMessage.msg_id, dataMessage.payload.size(), dataMessage.kind);
             sender = dataMessage.sender;
             break;
         case ACKMSG_TYPE:
@@ -208,6 +206,46 @@ void CL_Global_Snapshot::handle_message(unsigned char *msg, int inorout) {
                     seqMessage.sender, seqMessage.msg_id, seqMessage.final_seq, seqMessage.final_seq_proposer);
             sender = seqMessage.sender;
             break;
+        case HBTMSG_TYPE:  // heartbeats are not part of the channel state
+            return;
+        case FLUSHMSG_TYPE:
+            deserialize_flush_message(msg, flushMessage);
+            sprintf(buff, "FlushMessage: from %d, failed %d, msg_id %d, seq %d, proposer %d",
+                    flushMessage.from, flushMessage.failed, flushMessage.msg_id, flushMessage.final_seq,
+                    flushMessage.final_seq_proposer);
+            sender = flushMessage.from;
+            break;
+        case FLUSHDONEMSG_TYPE:
+            deserialize_flush_done_message(msg, flushDoneMessage);
+            sprintf(buff, "FlushDoneMessage: from %d, failed %d, count %d",
+                    flushDoneMessage.from, flushDoneMessage.failed, flushDoneMessage.count);
+            sender = flushDoneMessage.from;
+            break;
+        case JOINEDMSG_TYPE:
+            deserialize_joined_message(msg, joinedMessage);
+            sprintf(buff, "JoinedMessage: from %d, joiner %d, next msg_id %d",
+                    joinedMessage.from, joinedMessage.joiner, joinedMessage.next_msg_id);
+            sender = joinedMessage.from;
+            break;
+        case JOINEDACKMSG_TYPE:
+            deserialize_joined_ack_message(msg, joinedAckMessage);
+            sprintf(buff, "JoinedAckMessage: from %d, joiner %d", joinedAckMessage.from, joinedAckMessage.joiner);
+            sender = joinedAckMessage.from;
+            break;
+        case AGGACKMSG_TYPE:
+            if (!deserialize_agg_ack_message(msg, size, aggAckMessage)) return;  // the receiver dropped it too
+            sprintf(buff, "AggAckMessage: sender %d, msg_id %d, seq %d by %d, from %d, %lu acks",
+                    aggAckMessage.sender, aggAckMessage.msg_id, aggAckMessage.proposed_seq, aggAckMessage.proposer,
+                    aggAckMessage.from, aggAckMessage.acked.size());
+            sender = aggAckMessage.from;
+            break;
+        case NAKMSG_TYPE:
+            deserialize_nak_message(msg, nakMessage);
+            sprintf(buff, "NakMessage: from %d, sender %d, %s, %lu ranges",
+                    nakMessage.from, nakMessage.sender, nakMessage.what == NAK_DATA ? "DATA" : "SEQ",
+                    nakMessage.ranges.size());
+            sender = nakMessage.from;
+            break;
         default:
             fprintf(stderr, "Received message wrong type: %lu....\n", type);
             exit(1);
@@ -221,12 +259,14 @@ void CL_Global_Snapshot::handle_message(unsigned char *msg, int inorout) {
 void CL_Global_Snapshot::tell_rm_to_start_recording_channel() const {
     rm->recordMessagesMutex.lock();
     rm->recordMessages = true;
+    rm->snapshotStarted_ns = rm->runtime->now_ns();
     rm->recordMessagesMutex.unlock();
 }
 
 void CL_Global_Snapshot::tell_rm_to_stop_recording() const {
     rm->recordMessagesMutex.lock();
     rm->recordMessages = false;
+    rm->metrics.observe(H_SNAPSHOT, rm->runtime->now_ns() - rm->snapshotStarted_ns);
     rm->recordMessagesMutex.unlock();
 }
 
@@ -11,12 +11,14 @@
 #include <queue>
 
 #include "networkagent.h"
+#include "membership.h"
+#include "payload.h"
 
 #define SNAP_SHOT_PORT 9345
 #define MAX_MARKER_SIZE 3
 #define INBOUND 1
 #define OUTBOUND 2
-#define MAX_STRUCT_SIZE     20  // 20 bytes for 5 uint32_t
+#define MAX_STRUCT_SIZE     24  // 24 bytes for 6 uint32_t
 
 #define DUPPRINT(fp, fmt...) do {printf(fmt);fprintf(fp,fmt);} while(0)
 
@@ -29,8 +31,13 @@ typedef struct {
     unsigned char   status;     // 0 means undeliverable while 1 means deliverable
     uint32_t        sender;    // sender's id
     uint32_t        msg_id;    // the id of message generated by sender
-    uint32_t        data;      // a dummy integer
+    uint32_t        member;    // the joining/leaving host for membership msgs
     uint32_t        proposer;      // process id of proposer
+    uint32_t        kind;      // APP_MSG or a membership change (JOIN_MSG/LEAVE_MSG)
+    uint32_t        view_epoch;  // number of joins the sender had delivered when it sent the msg
+    uint64_t        final_ns;    // when it became deliverable (0: not yet or unknown). for the metrics
+    uint64_t        queued_ns;   // when it went into the delivery queue (0: unknown). for the metrics too
+    Payload         payload;     // shares the bytes of the DATA it came in (or that we sent)
 } QueuedMessage;
 
 
@@ -51,7 +58,7 @@ class CL_Global_Snapshot{
      * Then it sends out a marker to everybody */
 public:
     explicit CL_Global_Snapshot(ReliableMulticast *rm, const client_server::TCP_Server& server);
-    explicit CL_Global_Snapshot(ReliableMulticast *rm);
+    explicit CL_Global_Snapshot(ReliableMulticast *rm, int port = SNAP_SHOT_PORT);  // port 0: any free one (simulator)
 
     ~CL_Global_Snapshot();
 
@@ -61,7 +68,7 @@ public:
     // logistic var
     LocalStateSnapshot locsnap;
     int num_hosts;
-    char ** hostNames;
+    const HostTable * hosts;
     int curr_container_id;
     const char * curr_container_name;
     bool amInitiator;
@@ -91,7 +98,7 @@ public:
     void add_msg_to_outbound(int id, const std::string& s);
     void set_rm(ReliableMulticast *rm);
 
-    void handle_message(unsigned char *msg, int inorout);
+    void handle_message(unsigned char *msg, size_t size, int inorout);
     void print_local_snapshot();
 
     friend class ReliableMulticast;
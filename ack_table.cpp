@@ -0,0 +1,199 @@
+//
+// Flat, pooled table of the ack records for our outstanding (not yet finalized) messages,
+// and the log of the ACKs we sent for everybody else's.
+//
+
+#include <algorithm>
+
+#include "ack_table.h"
+
+
+AckTable::AckTable()
+        : slots(ACK_TABLE_INITIAL_SLOTS, nullptr), mask(ACK_TABLE_INITIAL_SLOTS - 1){
+    grow_pool();
+}
+
+
+AckTable::~AckTable(){
+    for (AckRecord * slab : slabs) delete [] slab;
+}
+
+
+void AckTable::grow_pool(){
+    auto * slab = new AckRecord[ACK_POOL_SLAB_SIZE];
+    slabs.push_back(slab);
+    for (int i = ACK_POOL_SLAB_SIZE - 1; i >= 0; i--){
+        slab[i].next_free = freeList;
+        freeList = &slab[i];
+    }
+    pooled += ACK_POOL_SLAB_SIZE;
+}
+
+
+void AckTable::place(AckRecord * r){
+    size_t i = r->msg_id & mask;
+    while (slots[i] != nullptr) i = (i + 1) & mask;
+    slots[i] = r;
+}
+
+
+void AckTable::grow_index(){
+    std::vector<AckRecord *> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, nullptr);
+    mask = slots.size() - 1;
+    for (AckRecord * r : old) if (r != nullptr) place(r);
+}
+
+
+AckRecord * AckTable::insert(uint32_t msg_id, uint64_t sent_at_ns){
+    if (find(msg_id) != nullptr) return nullptr;
+    if ((count + 1) * 2 > slots.size()) grow_index();  // keep the probes short
+    if (freeList == nullptr) grow_pool();
+    AckRecord * r = freeList;
+    freeList = r->next_free;
+    r->msg_id = msg_id;
+    r->acks = AckCollector();
+    r->quorum.reset();
+    r->resent.reset();
+    r->sent_at_ns = sent_at_ns;
+    r->next_free = nullptr;
+    place(r);
+    count++;
+    return r;
+}
+
+
+AckRecord * AckTable::find(uint32_t msg_id) const {
+    size_t i = msg_id & mask;
+    while (slots[i] != nullptr){
+        if (slots[i]->msg_id == msg_id) return slots[i];
+        i = (i + 1) & mask;
+    }
+    return nullptr;
+}
+
+
+void AckTable::release(uint32_t msg_id){
+    size_t i = msg_id & mask;
+    while (slots[i] != nullptr && slots[i]->msg_id != msg_id) i = (i + 1) & mask;
+    if (slots[i] == nullptr) return;  // not outstanding
+    AckRecord * r = slots[i];
+    slots[i] = nullptr;
+    count--;
+    // backward shift deletion: pull later entries of the probe run into the hole so find() never stops early
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (slots[j] != nullptr){
+        size_t home = slots[j]->msg_id & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)){  // home is not between hole and j (cyclically)
+            slots[hole] = slots[j];
+            slots[j] = nullptr;
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    r->next_free = freeList;
+    freeList = r;
+}
+
+
+void AckLog::fit(Stream &s, uint32_t lo, uint32_t hi){
+    // make the ring hold msg_ids lo..hi-1, moving over what's in that range
+    size_t size = s.slots.empty() ? ACK_LOG_INITIAL_SLOTS : s.slots.size();
+    while (hi - lo > size) size *= 2;
+    if (size == s.slots.size()) return;
+    std::vector<Slot> slots(size, Slot{UINT32_MAX, 0, false});
+    for (const Slot &e : s.slots){
+        if (e.msg_id != UINT32_MAX && e.msg_id >= lo && e.msg_id < hi) slots[e.msg_id & (size - 1)] = e;
+    }
+    s.slots.swap(slots);
+}
+
+
+void AckLog::advance(Stream &s){
+    // pull done up over the msgs whose SEQ we got and, below the trail, over those we never acked
+    if (s.done < s.lo) s.done = std::max(s.done, std::min(s.lo, s.trail));
+    while (s.done < s.hi){
+        const Slot &e = s.slots[s.done & (s.slots.size() - 1)];
+        if (e.msg_id == s.done ? !e.sequenced : s.done >= s.trail) return;
+        s.done++;
+    }
+    s.done = std::max(s.done, s.trail);
+}
+
+
+void AckLog::anchor(uint32_t sender, uint32_t first){
+    std::lock_guard<std::mutex> lock(mutex);
+    Stream &s = streams[sender];
+    if (s.anchored) return;
+    s.anchored = true;
+    s.done = s.trail = first;
+    advance(s);
+}
+
+
+void AckLog::put(uint32_t sender, uint32_t msg_id, uint32_t proposal){
+    std::lock_guard<std::mutex> lock(mutex);
+    Stream &s = streams[sender];
+    if (s.anchored && msg_id < std::max(s.done, s.trail)) return;
+    uint32_t lo = std::min(s.lo, msg_id);
+    uint32_t hi = std::max(s.hi, msg_id + 1);
+    fit(s, s.anchored ? std::max(s.done, lo) : lo, hi);  // below done nothing has to stay
+    s.lo = lo;
+    s.hi = hi;
+    s.slots[msg_id & (s.slots.size() - 1)] = Slot{msg_id, proposal, false};
+}
+
+
+int AckLog::find(uint32_t sender, uint32_t msg_id, uint32_t &proposal){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = streams.find(sender);
+    if (it == streams.end()) return 0;
+    const Stream &s = it->second;
+    if (s.anchored && msg_id < std::max(s.done, s.trail)) return -1;
+    if (s.slots.empty()) return 0;
+    const Slot &e = s.slots[msg_id & (s.slots.size() - 1)];
+    if (e.msg_id != msg_id) return 0;
+    proposal = e.proposal;
+    return 1;
+}
+
+
+void AckLog::sequenced(uint32_t sender, uint32_t msg_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = streams.find(sender);
+    if (it == streams.end() || it->second.slots.empty()) return;
+    Stream &s = it->second;
+    Slot &e = s.slots[msg_id & (s.slots.size() - 1)];
+    if (e.msg_id != msg_id) return;
+    e.sequenced = true;
+    if (s.anchored) advance(s);
+}
+
+
+bool AckLog::has_seq(uint32_t sender, uint32_t msg_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = streams.find(sender);
+    if (it == streams.end()) return false;
+    const Stream &s = it->second;
+    if (s.anchored && msg_id < s.done) return true;
+    if (s.slots.empty()) return false;
+    const Slot &e = s.slots[msg_id & (s.slots.size() - 1)];
+    return e.msg_id == msg_id && e.sequenced;
+}
+
+
+void AckLog::advertised(uint32_t sender, uint32_t trail){
+    std::lock_guard<std::mutex> lock(mutex);
+    Stream &s = streams[sender];
+    if (trail > s.trail) s.trail = trail;
+    s.anchored = true;
+    advance(s);
+}
+
+
+void AckLog::forget(uint32_t sender){
+    std::lock_guard<std::mutex> lock(mutex);
+    streams.erase(sender);
+}
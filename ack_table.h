@@ -0,0 +1,112 @@
+//
+// Flat, pooled table of the ack records for our outstanding (not yet finalized) messages,
+// and the log of the ACKs we sent for everybody else's.
+//
+
+#ifndef PRJ1_ACK_TABLE_H
+#define PRJ1_ACK_TABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "membership.h"
+
+#define ACK_TABLE_INITIAL_SLOTS 1024    // slots of the index (a power of 2). doubles when half full
+#define ACK_POOL_SLAB_SIZE      256     // records carved out at a time when the pool runs dry
+#define ACK_LOG_INITIAL_SLOTS   256     // acks kept per sender (a power of 2). doubles when its window doesn't fit
+
+
+struct AckRecord{
+    uint32_t        msg_id;         // our msg_id this record is for
+    AckCollector    acks;           // ack bitset + max proposal (and its proposer)
+    HostSet         quorum;         // the view when the DATA went out: hosts that joined later never see it
+    uint64_t        sent_at_ns;     // monotonic time the DATA first went out
+    HostSet         resent;         // hosts we sent the DATA (or a piece of it) again: their acks aren't rtt samples
+    AckRecord *     next_free;      // pool free list (only meaningful while the record is free)
+};
+
+
+class AckTable{
+    /* ackHistory used to be std::map<int, std::map<int,int>>: an outer node and one inner node per ack,
+     * plus operator[] silently inserting entries for unknown msg_ids.
+     * Now every outstanding message owns one AckRecord taken from a slab pool, found through an
+     * open-addressed index on msg_id. Our msg_ids are consecutive so the index is really a ring
+     * (slot = msg_id & mask) and linear probing only kicks in when the window wraps.
+     * Records go back to the pool when the message is finalized so in steady state nothing is allocated. */
+public:
+    AckTable();
+    ~AckTable();
+    AckTable(const AckTable&) = delete;
+    AckTable& operator=(const AckTable&) = delete;
+
+    AckRecord * insert(uint32_t msg_id, uint64_t sent_at_ns);  // nullptr if msg_id is already outstanding
+    AckRecord * find(uint32_t msg_id) const;  // nullptr if msg_id is not outstanding (never sent or finalized)
+    void release(uint32_t msg_id);  // finalized: recycle the record
+    size_t size() const {
+        return count;
+    };
+    size_t capacity() const {
+        return pooled;
+    };
+    template <typename F> void for_each(F f) const {
+        for (AckRecord * r : slots) if (r != nullptr) f(*r);
+    };
+
+private:
+    std::vector<AckRecord *> slots;  // nullptr means empty
+    size_t mask;
+    size_t count = 0;
+    std::vector<AckRecord *> slabs;
+    AckRecord * freeList = nullptr;
+    size_t pooled = 0;  // number of records carved out so far
+
+    void grow_pool();
+    void grow_index();
+    void place(AckRecord * r);
+};
+
+
+class AckLog{
+    /* the proposal we acked every msg of the other senders with, for when its DATA comes again (our ACK got lost),
+     * and whether its SEQ came. Replaces alreadyAckedMessages and seqMessageHistory, vectors that were scanned on
+     * every DATA (and by every ack watchdog) and never pruned.
+     * Per sender a ring by msg_id (its msg_ids are consecutive) and two marks:
+     * -- trail: from its heartbeats. every msg_id below it is final at the sender
+     * -- done: every msg_id below it that we acked has its SEQ here (and those we didn't ack are final)
+     * a late copy of a DATA below either needs no answer, and a slot is reused once its msg is below done. done only
+     * moves once the stream is anchored (we know where its msgs that include us start: 0 for a host of the Hostfile
+     * or one that joined after us, otherwise its first heartbeat). If the sender's window doesn't fit, its ring doubles. */
+public:
+    void anchor(uint32_t sender, uint32_t first);
+    void put(uint32_t sender, uint32_t msg_id, uint32_t proposal);  // we acked it
+    // 1 if we acked it (with proposal), 0 if we haven't and -1 if it's final at the sender anyway
+    int find(uint32_t sender, uint32_t msg_id, uint32_t &proposal);
+    void sequenced(uint32_t sender, uint32_t msg_id);
+    bool has_seq(uint32_t sender, uint32_t msg_id);  // we acked it and its SEQ came
+    void advertised(uint32_t sender, uint32_t trail);  // from a sender heartbeat
+    void forget(uint32_t sender);  // the sender was removed from the view
+
+private:
+    struct Slot{
+        uint32_t msg_id;    // UINT32_MAX: empty
+        uint32_t proposal;
+        bool sequenced;
+    };
+    struct Stream{
+        bool anchored = false;
+        uint32_t trail = 0;
+        uint32_t done = 0;
+        uint32_t lo = UINT32_MAX;   // lowest msg_id we acked (what an unanchored ring has to reach back to)
+        uint32_t hi = 0;            // one past the highest
+        std::vector<Slot> slots;
+    };
+    std::mutex mutex;
+    std::map<uint32_t, Stream> streams;
+    static void fit(Stream &s, uint32_t lo, uint32_t hi);
+    static void advance(Stream &s);
+};
+
+#endif //PRJ1_ACK_TABLE_H
@@ -0,0 +1,85 @@
+//
+// Scaling benchmark for the ack bookkeeping: std::map<int,int> per message (the old ProposerSeq)
+// against the AckCollector bitset + running max, for group sizes from 4 to MAX_GROUP_SIZE.
+//
+// g++ -O2 -o ack_scaling_bench bench/ack_scaling_bench.cpp membership.cpp
+// ./ack_scaling_bench [messages_per_size]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../membership.h"
+
+typedef std::map<int, int> ProposerSeq;  // the old per-message ack map: proposer id --> proposed seq
+
+static volatile uint32_t sink;  // so the compiler can't throw the results away
+
+
+static double bench_map(int numHosts, int numMsgs, const std::vector<int> &ackOrder,
+                        const std::vector<uint32_t> &proposals){
+    auto start = std::chrono::steady_clock::now();
+    for (int m = 0; m < numMsgs; m++){
+        ProposerSeq acks;
+        for (int k = 0; k < numHosts; k++){
+            int proposer = ackOrder[k];
+            if (acks.count(proposer) == 0){
+                acks.insert(std::make_pair(proposer, proposals[(m + k) % proposals.size()]));
+                if ((int) acks.size() == numHosts){  // same as get_max_sequence_from_proposerseq_map
+                    uint32_t result_seq = 0, result_proposer = 0;
+                    for (auto const &kv : acks){
+                        if ((uint32_t) kv.second > result_seq){
+                            result_seq = kv.second;
+                            result_proposer = kv.first;
+                        }
+                    }
+                    sink = result_seq + result_proposer;
+                }
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / numMsgs;
+}
+
+
+static double bench_bitset(int numHosts, int numMsgs, const std::vector<int> &ackOrder,
+                           const std::vector<uint32_t> &proposals){
+    auto start = std::chrono::steady_clock::now();
+    for (int m = 0; m < numMsgs; m++){
+        AckCollector acks;
+        for (int k = 0; k < numHosts; k++){
+            int rank = ackOrder[k];
+            if (acks.add(rank, proposals[(m + k) % proposals.size()], rank) && acks.num_acked() == numHosts){
+                sink = acks.max_seq + acks.max_proposer;
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / numMsgs;
+}
+
+
+int main(int argc, char *argv[]){
+    int numMsgs = argc > 1 ? atoi(argv[1]) : 20000;
+    std::mt19937 rng(42);
+    std::vector<uint32_t> proposals(4096);
+    for (uint32_t &p : proposals) p = rng() % 100000 + 1;
+
+    printf("%10s %18s %18s %10s\n", "hosts", "map ns/msg", "bitset ns/msg", "speedup");
+    for (int numHosts : {4, 8, 16, 32, 64, 128, 256}){
+        if (numHosts > MAX_GROUP_SIZE) break;
+        std::vector<int> ackOrder(numHosts);
+        for (int i = 0; i < numHosts; i++) ackOrder[i] = i;
+        std::shuffle(ackOrder.begin(), ackOrder.end(), rng);  // acks come back in any order
+        double mapNs = bench_map(numHosts, numMsgs, ackOrder, proposals);
+        double bitsetNs = bench_bitset(numHosts, numMsgs, ackOrder, proposals);
+        printf("%10d %18.1f %18.1f %9.1fx\n", numHosts, mapNs, bitsetNs, mapNs / bitsetNs);
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+//
+// A whole group in one process: N ReliableMulticast nodes on the simulator's in-memory network, in virtual time.
+// Every node sends its msgs at a fixed interval; we run until everybody delivered everything and report how long it
+// took (virtual and wall clock), the datagrams it cost and whether all nodes delivered in the same order. The same
+// seed gives the same run (compare the order digest).
+//
+// g++ -O2 -pthread -o cluster_sim bench/cluster_sim.cpp simulator.cpp runtime.cpp shm_transport.cpp link_emulator.cpp membership.cpp ack_table.cpp failure_detector.cpp nak_stream.cpp fec.cpp fragmentation.cpp flow_control.cpp metrics.cpp trace.cpp logger.cpp completion.cpp payload.cpp networkagent.cpp waittosync.cpp CL_global_snapshot.cpp reliable_multicast.cpp -lanl
+// ./cluster_sim [nodes] [msgs_per_node] [send_interval_us] [delay_us] [jitter_us] [loss] [seed] [mode]
+//      mode: unicast (default), tree<k>, mcast, nak or fec<n>,<k>
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+
+#include "../simulator.h"
+#include "../reliable_multicast.h"
+
+#define DEADLINE_S  600     // virtual seconds before we give up on a run
+
+
+int main(int argc, char *argv[]){
+    int numNodes = argc > 1 ? atoi(argv[1]) : 4;
+    int numMsgs = argc > 2 ? atoi(argv[2]) : 500;
+    int interval_us = argc > 3 ? atoi(argv[3]) : 1000;
+    SimLink link{argc > 4 ? atoi(argv[4]) : 500, argc > 5 ? atoi(argv[5]) : 100, argc > 6 ? atof(argv[6]) : 0.0};
+    uint32_t seed = argc > 7 ? (uint32_t) strtoul(argv[7], nullptr, 10) : 1;
+    const char *mode = argc > 8 ? argv[8] : "unicast";
+    int fanout = 0, fec_n = 0, fec_k = 0;
+    bool nak = false, mcast = false;
+    if (strncmp(mode, "tree", 4) == 0) fanout = atoi(mode + 4);
+    else if (strcmp(mode, "mcast") == 0) mcast = true;
+    else if (strcmp(mode, "nak") == 0) nak = true;
+    else if (strncmp(mode, "fec", 3) == 0 && sscanf(mode + 3, "%d,%d", &fec_n, &fec_k) != 2){
+        fprintf(stderr, "Bad mode %s\n", mode);
+        return 1;
+    }
+    // no line per delivery, and the nodes' other output goes away: keep our own stdout for the report
+    Logger::get().set_level(LOG_WARN);
+    fflush(stdout);
+    FILE *report = fdopen(dup(1), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 1);
+
+    auto *sim = new Simulator(seed, link, mcast);
+    std::vector<ReliableMulticast *> nodes;
+    std::vector<Runtime *> runtimes;
+    uint64_t start_ns = 0, done_ns = 0;
+    auto wallStart = std::chrono::steady_clock::now();
+    sim->run([&]{
+        std::vector<std::string> names;
+        for (int i = 1; i <= numNodes; i++) names.push_back("container" + std::to_string(i));
+        for (const std::string &name : names){
+            Runtime *rt = sim->add_node(name);
+            auto *rm = new ReliableMulticast(*rt, names, name.c_str(), FAILURE_TIMEOUT, fanout, nak, fec_n, fec_k);
+            rm->set_max_recv(INT_MAX);  // a long run gets more than RECV_CAP packets
+            rt->spawn([rm]{ ReliableMulticast::start_msg_receiver(rm); });
+            runtimes.push_back(rt);
+            nodes.push_back(rm);
+        }
+        start_ns = sim->now_ns();
+        for (int i = 0; i < numNodes; i++){
+            ReliableMulticast *rm = nodes[i];
+            Runtime *rt = runtimes[i];
+            rt->spawn([=]{
+                for (int m = 0; m < numMsgs; m++){
+                    rm->multicast_datamsg(m * 198 % 27);
+                    rt->sleep_us(interval_us);
+                }
+            });
+        }
+        uint64_t total = (uint64_t) numNodes * numMsgs;
+        while (sim->now_ns() - start_ns < (uint64_t) DEADLINE_S * 1000000000){
+            runtimes[0]->sleep_us(1000);
+            bool all = true;
+            for (ReliableMulticast *rm : nodes) if (rm->get_delivered_count() < total) all = false;
+            if (all){
+                done_ns = sim->now_ns();
+                break;
+            }
+        }
+    });
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    // everybody must have delivered the same msgs in the same order
+    std::vector<QueuedMessage> first = nodes[0]->get_delivered_messages();
+    bool agree = true;
+    for (ReliableMulticast *rm : nodes){
+        std::vector<QueuedMessage> order = rm->get_delivered_messages();
+        size_t common = std::min(order.size(), first.size());
+        for (size_t i = 0; i < common && agree; i++)
+            if (order[i].sender != first[i].sender || order[i].msg_id != first[i].msg_id) agree = false;
+    }
+    uint64_t digest = 1469598103934665603ULL;  // fnv-1a of the delivery order
+    for (const QueuedMessage &qm : first){
+        for (uint32_t v : {qm.sender, qm.msg_id}){
+            digest ^= v;
+            digest *= 1099511628211ULL;
+        }
+    }
+    fprintf(report, "%d nodes x %d msgs every %.3f ms, link %.3f +- %.3f ms, loss %.3f, seed %u, mode %s\n",
+            numNodes, numMsgs, interval_us / 1e3, link.delay_us / 1e3, link.jitter_us / 1e3, link.loss, seed, mode);
+    if (done_ns == 0) fprintf(report, "NOT everything was delivered after %d virtual s\n", DEADLINE_S);
+    else fprintf(report, "everything delivered after %.3f virtual s (%.0f msgs/s), %.3f s wall clock\n",
+                 (double) (done_ns - start_ns) / 1e9, (double) numNodes * numMsgs * 1e9 / (double) (done_ns - start_ns),
+                 wall_s);
+    fprintf(report, "datagrams: %lu sent, %lu lost (%.1f per msg)\n", sim->datagrams_sent(), sim->datagrams_lost(),
+            (double) sim->datagrams_sent() / ((double) numNodes * numMsgs));
+    fprintf(report, "total order: %s, digest %016lx\n", agree ? "all nodes agree" : "NODES DISAGREE", digest);
+    fflush(report);
+    _exit(done_ns != 0 && agree ? 0 : 1);  // the nodes' threads are parked for good
+}
@@ -0,0 +1,127 @@
+//
+// The cost of handing delivered msgs to the application, with a consumer that does nothing with them.
+// 1. DeliveryRing alone: one thread pushes batches of msgs, another polls them. msgs/s by batch size.
+// 2. The whole protocol on the simulator with a no-op delivery callback: every node sends all its msgs at once (peak
+//    rate, in the NAK mode), and we count the msgs and batches the callback gets. Reports delivered msgs/s of wall clock, the mean
+//    batch and whether every callback saw the total order.
+//
+// g++ -O2 -pthread -o delivery_bench bench/delivery_bench.cpp delivery_ring.cpp simulator.cpp runtime.cpp shm_transport.cpp link_emulator.cpp membership.cpp ack_table.cpp failure_detector.cpp nak_stream.cpp fec.cpp fragmentation.cpp flow_control.cpp metrics.cpp trace.cpp logger.cpp completion.cpp payload.cpp networkagent.cpp waittosync.cpp CL_global_snapshot.cpp reliable_multicast.cpp -lanl
+// ./delivery_bench [ring_msgs] [nodes] [msgs_per_node]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+
+#include "../delivery_ring.h"
+#include "../simulator.h"
+#include "../reliable_multicast.h"
+
+#define POLL_BATCH  1024    // the most msgs the consumer takes at once
+
+
+double ring_rate(uint64_t numMsgs, size_t batchSize){
+    DeliveryRing ring;
+    std::vector<QueuedMessage> batch(batchSize);
+    for (size_t i = 0; i < batchSize; i++) batch[i].msg_id = (uint32_t) i;
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]{
+        std::vector<QueuedMessage> out(POLL_BATCH);
+        uint64_t got = 0;
+        while (got < numMsgs){
+            size_t n = ring.poll(out.data(), POLL_BATCH);
+            for (size_t i = 0; i < n; i++) sum += out[i].msg_id;  // the no-op consumer
+            got += n;
+        }
+    });
+    for (uint64_t sent = 0; sent < numMsgs; sent += batchSize) ring.push(batch.data(), batchSize);
+    consumer.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (sum == 1) printf(" ");  // keep the consumer's loads
+    return (double) numMsgs / s;
+}
+
+
+int main(int argc, char *argv[]){
+    uint64_t ringMsgs = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000000;
+    int numNodes = argc > 2 ? atoi(argv[2]) : 4;
+    int numMsgs = argc > 3 ? atoi(argv[3]) : 2000;
+    if (numNodes < 1 || numMsgs < 1){
+        fprintf(stderr, "Need at least 1 node and 1 msg\n");
+        exit(1);
+    }
+
+    printf("DeliveryRing, %lu msgs of %lu bytes:\n", ringMsgs, sizeof(QueuedMessage));
+    for (size_t batchSize : {1, 16, 256}){
+        uint64_t n = ringMsgs - ringMsgs % batchSize;
+        printf("  batches of %3lu: %6.1f M msgs/s\n", batchSize, ring_rate(n, batchSize) / 1e6);
+    }
+
+    // only the callback hears about deliveries, and the nodes' other output goes away
+    Logger::get().set_level(LOG_WARN);
+    fflush(stdout);
+    FILE *report = fdopen(dup(1), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 1);
+    std::vector<std::string> names;
+    for (int i = 1; i <= numNodes; i++) names.push_back("container" + std::to_string(i));
+    auto *simulator = new Simulator(1, SimLink{100, 0, 0.0});
+    std::vector<ReliableMulticast *> nodes;
+    std::vector<std::vector<QueuedMessage>> seen(numNodes);  // what each callback got
+    std::vector<uint64_t> batches(numNodes, 0);
+    uint64_t total = (uint64_t) numNodes * numMsgs;
+    auto start = std::chrono::steady_clock::now();
+    simulator->run([&]{
+        std::vector<Runtime *> runtimes;
+        for (const std::string &name : names) runtimes.push_back(simulator->add_node(name));
+        for (int i = 0; i < numNodes; i++){
+            // with NAKs: no watchdog thread per msg, so a burst of msgs doesn't run out of threads
+            auto *rm = new ReliableMulticast(*runtimes[i], names, names[i].c_str(), FAILURE_TIMEOUT, 0, true);
+            rm->set_max_recv(INT_MAX);
+            std::vector<QueuedMessage> *mine = &seen[i];
+            uint64_t *count = &batches[i];
+            mine->reserve(total);
+            rm->set_delivery_callback([mine, count](const QueuedMessage *msgs, size_t n){
+                mine->insert(mine->end(), msgs, msgs + n);
+                (*count)++;
+            });
+            runtimes[i]->spawn([rm]{ ReliableMulticast::start_msg_receiver(rm); });
+            nodes.push_back(rm);
+        }
+        for (int i = 0; i < numNodes; i++){
+            ReliableMulticast *rm = nodes[i];
+            runtimes[i]->spawn([rm, numMsgs]{ for (int m = 0; m < numMsgs; m++) rm->multicast_datamsg((uint32_t) m); });
+        }
+        while (true){
+            runtimes[0]->sleep_us(1000);
+            bool all = true;
+            for (int i = 0; i < numNodes; i++) if (seen[i].size() < total) all = false;
+            if (all) break;
+        }
+    });
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool agree = true;
+    uint64_t allBatches = 0;
+    for (int i = 0; i < numNodes; i++){
+        std::vector<QueuedMessage> order = nodes[i]->get_delivered_messages();
+        if (order.size() != seen[i].size()) agree = false;
+        for (size_t k = 0; k < order.size() && agree; k++){
+            if (order[k].sender != seen[i][k].sender || order[k].msg_id != seen[i][k].msg_id ||
+                seen[i][k].sender != seen[0][k].sender || seen[i][k].msg_id != seen[0][k].msg_id) agree = false;
+        }
+        allBatches += batches[i];
+    }
+    fprintf(report, "protocol on the simulator, %d nodes x %d msgs at once (NAK mode), no-op callback:\n", numNodes,
+            numMsgs);
+    fprintf(report, "  %.0f msgs/s delivered per node (wall clock), %.1f msgs per callback\n", (double) total / s,
+            (double) (total * numNodes) / (double) allBatches);
+    fprintf(report, "  callbacks %s\n", agree ? "saw the same total order everywhere" : "DISAGREE WITH THE DELIVERY ORDER");
+    fflush(report);
+    _exit(agree ? 0 : 1);  // the nodes' threads are still around
+}
@@ -0,0 +1,250 @@
+//
+// End-to-end throughput and latency of the whole protocol under an open-loop load, on one box.
+// The first S of N nodes each submit msgs at a fixed rate, on schedule whether or not earlier msgs got through
+// (a slow group doesn't slow the load down, so its queueing shows up in the latencies). A msg's latency is from its
+// scheduled submit time to its delivery, on every node. Runs on the in-process simulator (virtual time) or on real
+// udp sockets over loopback (every node in this process on its own port) or over shared memory. Reports throughput and the latency
+// percentiles, as a summary plus HdrHistogram's percentile distribution (.hgrm), or as CSV or JSON. The summary also
+// breaks down where node 1's time went: datagrams waiting in the socket, being handled, msgs in the delivery queue, rtt.
+//
+// g++ -O2 -pthread -o e2e_bench bench/e2e_bench.cpp simulator.cpp runtime.cpp shm_transport.cpp link_emulator.cpp membership.cpp ack_table.cpp failure_detector.cpp nak_stream.cpp fec.cpp fragmentation.cpp flow_control.cpp metrics.cpp trace.cpp logger.cpp completion.cpp payload.cpp networkagent.cpp waittosync.cpp CL_global_snapshot.cpp reliable_multicast.cpp -lanl
+// ./e2e_bench [-T sim|loopback|shm] [-n nodes] [-s senders] [-r msgs_per_s_per_sender] [-c msgs_per_sender]
+//             [-t delay_us] [-J jitter_us] [-d loss] [-S seed] [-k fanout] [-N 0|1] [-o text|csv|json] [-H hgrm_file]
+//             [-Z trace_prefix] [-K sw|hw]
+//      -t, -J, -d and -S are for the simulator. on loopback, nodes are on ports LOOPBACK_PORT + 1..N
+//      on shm, their inboxes are /dev/shm/prj1.SHM_GROUP.1..N
+//      -Z traces every node into <trace_prefix>.<node>.trace (tools/trace2chrome.cpp)
+//      -K stamps every datagram on loopback as it comes in, so the socket queue shows up in the breakdown (the
+//      simulator and shm always know when a datagram arrived)
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+
+#include "../simulator.h"
+#include "../reliable_multicast.h"
+#include "hdr_histogram.h"
+
+#define DEADLINE_S      600     // seconds (virtual on the simulator) before we give up on a run
+#define LOOPBACK_PORT   5700
+#define SHM_GROUP       "e2e_bench"
+#define START_DELAY_US  10000   // the senders start together this long after the nodes are up
+
+const char *transport = "sim";
+int numNodes = 4;
+int numSenders = 4;
+double rate = 1000;     // msgs/s per sender
+int numMsgs = 1000;     // per sender
+SimLink simLink{100, 0, 0.0};
+uint32_t seed = 1;
+int fanout = 0;
+int nak = 0;
+const char *format = "text";
+const char *hgrmFileName = nullptr;
+const char *tracePrefix = nullptr;
+int timestamps = TS_NONE;
+
+void handle_param(int argc, char *argv[]);
+
+
+double quantile_us(const std::string &metrics, const char *name, const char *q){
+    // out of ReliableMulticast::metrics_text()
+    std::string key = std::string(name) + "{quantile=\"" + q + "\"} ";
+    size_t at = metrics.find(key);
+    return at == std::string::npos ? 0 : strtod(metrics.c_str() + at + key.size(), nullptr) / 1e3;
+}
+
+
+int main(int argc, char *argv[]){
+    handle_param(argc, argv);
+    bool sim = strcmp(transport, "sim") == 0;
+    // no line per delivery, and the nodes' other output goes away: keep our own stdout for the report
+    Logger::get().set_level(LOG_WARN);
+    fflush(stdout);
+    FILE *report = fdopen(dup(1), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 1);
+
+    std::vector<std::string> names;
+    for (int i = 1; i <= numNodes; i++) names.push_back("container" + std::to_string(i));
+    Simulator *simulator = sim ? new Simulator(seed, simLink) : nullptr;
+    std::vector<Runtime *> runtimes;
+    std::vector<ReliableMulticast *> nodes;
+    std::vector<std::vector<uint64_t>> scheduled(numSenders, std::vector<uint64_t>(numMsgs, 0));
+    uint64_t total = (uint64_t) numSenders * numMsgs;
+    // by node, by sender * numMsgs + msg: when it was delivered there (the delivered history doesn't keep payloads)
+    std::vector<std::vector<uint64_t>> deliveredAt(numNodes, std::vector<uint64_t>(total, 0));
+    uint64_t start_ns = 0;
+    bool done = false;
+    auto wallStart = std::chrono::steady_clock::now();
+
+    auto driver = [&]{
+        // every socket is bound before anybody sends
+        for (const std::string &name : names){
+            if (sim) runtimes.push_back(simulator->add_node(name));
+            else if (strcmp(transport, "shm") == 0) runtimes.push_back(new ShmRuntime(name.c_str(), SHM_GROUP));
+            else {
+                auto *rt = new LoopbackRuntime(name.c_str(), LOOPBACK_PORT);
+                if (timestamps != TS_NONE && rt->enable_timestamps(timestamps) == -1) _exit(1);
+                runtimes.push_back(rt);
+            }
+        }
+        for (int i = 0; i < numNodes; i++){
+            auto *rm = new ReliableMulticast(*runtimes[i], names, names[i].c_str(), FAILURE_TIMEOUT, fanout, nak != 0);
+            rm->set_max_recv(INT_MAX);
+            Runtime *rt = runtimes[i];
+            std::vector<uint64_t> *at = &deliveredAt[i];
+            rm->set_delivery_callback([=](const QueuedMessage *msgs, size_t n){
+                for (size_t k = 0; k < n; k++){
+                    int s = (int) msgs[k].sender - 1;
+                    uint32_t m = msgs[k].payload.to_u32();
+                    if (msgs[k].kind != APP_MSG || s < 0 || s >= numSenders || m >= (uint32_t) numMsgs) continue;
+                    (*at)[(size_t) s * numMsgs + m] = rt->now_ns();
+                }
+            });
+            if (tracePrefix != nullptr)
+                rm->start_tracing((std::string(tracePrefix) + "." + std::to_string(i + 1) + ".trace").c_str());
+            runtimes[i]->spawn([rm]{ ReliableMulticast::start_msg_receiver(rm); });
+            nodes.push_back(rm);
+        }
+        start_ns = runtimes[0]->now_ns() + (uint64_t) START_DELAY_US * 1000;
+        uint64_t interval_ns = (uint64_t) (1e9 / rate);
+        for (int s = 0; s < numSenders; s++){
+            ReliableMulticast *rm = nodes[s];
+            Runtime *rt = runtimes[s];
+            std::vector<uint64_t> *times = &scheduled[s];
+            rt->spawn([=]{
+                for (int m = 0; m < numMsgs; m++){
+                    uint64_t at = start_ns + (uint64_t) m * interval_ns;
+                    uint64_t now = rt->now_ns();
+                    if (at > now) rt->sleep_us((at - now) / 1000);
+                    (*times)[m] = at;  // open loop: late submits count against us
+                    rm->multicast_datamsg((uint32_t) m);
+                }
+            });
+        }
+        while (runtimes[0]->now_ns() < start_ns + (uint64_t) DEADLINE_S * 1000000000){
+            runtimes[0]->sleep_us(1000);
+            bool all = true;
+            for (ReliableMulticast *rm : nodes) if (rm->get_delivered_count() < total) all = false;
+            if (all){
+                done = true;
+                break;
+            }
+        }
+    };
+    if (sim) simulator->run(driver);
+    else driver();
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    for (ReliableMulticast *rm : nodes) rm->flush_trace();
+
+    // latency of every msg on every node, and whether they all delivered in the same order
+    HdrHistogram latency;
+    uint64_t end_ns = start_ns;
+    std::vector<QueuedMessage> first = nodes[0]->get_delivered_messages();
+    bool agree = true;
+    for (int i = 0; i < numNodes; i++){
+        std::vector<QueuedMessage> order = nodes[i]->get_delivered_messages();
+        for (size_t k = 0; k < order.size() && k < first.size(); k++)
+            if (order[k].sender != first[k].sender || order[k].msg_id != first[k].msg_id) agree = false;
+        for (uint64_t j = 0; j < total; j++){
+            uint64_t at = deliveredAt[i][j];
+            if (at == 0) continue;
+            latency.record(at - scheduled[j / numMsgs][j % numMsgs]);
+            if (at > end_ns) end_ns = at;
+        }
+    }
+    double elapsed_s = (double) (end_ns - start_ns) / 1e9;
+    double throughput = elapsed_s > 0 ? (double) total / elapsed_s : 0;
+    const char *mode = nak ? "nak" : fanout > 0 ? "tree" : "unicast";
+
+    if (strcmp(format, "csv") == 0){
+        fprintf(report, "transport,nodes,senders,rate,msgs_per_sender,mode,delivered,complete,agree,elapsed_s,"
+                        "throughput,mean_us,p50_us,p99_us,p999_us,max_us\n");
+        fprintf(report, "%s,%d,%d,%.0f,%d,%s,%lu,%d,%d,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n", transport, numNodes,
+                numSenders, rate, numMsgs, mode, latency.count(), done, agree, elapsed_s, throughput,
+                latency.mean() / 1e3, latency.value_at(50) / 1e3, latency.value_at(99) / 1e3,
+                latency.value_at(99.9) / 1e3, latency.max() / 1e3);
+    } else if (strcmp(format, "json") == 0){
+        fprintf(report, "{\"transport\": \"%s\", \"nodes\": %d, \"senders\": %d, \"rate\": %.0f, \"msgs_per_sender\": %d, "
+                        "\"mode\": \"%s\", \"delivered\": %lu, \"complete\": %s, \"agree\": %s, \"elapsed_s\": %.6f, "
+                        "\"throughput\": %.1f, \"latency_us\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, "
+                        "\"p999\": %.3f, \"max\": %.3f}}\n", transport, numNodes, numSenders, rate, numMsgs, mode,
+                latency.count(), done ? "true" : "false", agree ? "true" : "false", elapsed_s, throughput,
+                latency.mean() / 1e3, latency.value_at(50) / 1e3, latency.value_at(99) / 1e3,
+                latency.value_at(99.9) / 1e3, latency.max() / 1e3);
+    } else {
+        fprintf(report, "%s: %d nodes, %d senders x %d msgs at %.0f msgs/s each, mode %s\n", transport, numNodes,
+                numSenders, numMsgs, rate, mode);
+        if (!done) fprintf(report, "NOT everything was delivered after %d s\n", DEADLINE_S);
+        fprintf(report, "delivered %lu msgs (all nodes) in %.3f s%s: %.0f msgs/s per node, %.3f s wall clock\n",
+                latency.count(), elapsed_s, sim ? " virtual" : "", throughput, wall_s);
+        fprintf(report, "latency us: mean %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n", latency.mean() / 1e3,
+                latency.value_at(50) / 1e3, latency.value_at(99) / 1e3, latency.value_at(99.9) / 1e3,
+                latency.max() / 1e3);
+        fprintf(report, "total order: %s\n", agree ? "all nodes agree" : "NODES DISAGREE");
+        std::string m = nodes[0]->metrics_text();
+        fprintf(report, "on %s, us p50/p99: socket queue %.1f/%.1f, processing %.1f/%.1f, delivery queue %.1f/%.1f, "
+                        "rtt %.1f/%.1f\n\n", names[0].c_str(),
+                quantile_us(m, "socket_queue_ns", "0.5"), quantile_us(m, "socket_queue_ns", "0.99"),
+                quantile_us(m, "processing_ns", "0.5"), quantile_us(m, "processing_ns", "0.99"),
+                quantile_us(m, "delivery_queue_ns", "0.5"), quantile_us(m, "delivery_queue_ns", "0.99"),
+                quantile_us(m, "rtt_ns", "0.5"), quantile_us(m, "rtt_ns", "0.99"));
+        if (hgrmFileName == nullptr) latency.print_percentiles(report, 1e3);
+    }
+    if (hgrmFileName != nullptr){
+        FILE *fp = fopen(hgrmFileName, "w");
+        if (fp == nullptr){
+            perror("Couldn't open the hgrm file");
+            _exit(1);
+        }
+        latency.print_percentiles(fp, 1e3);
+        fclose(fp);
+    }
+    fflush(report);
+    _exit(done && agree ? 0 : 1);  // the nodes' threads are still around
+}
+
+
+void handle_param(int argc, char *argv[]){
+    if (argc % 2 == 0){
+        printf("Usage: %s [-T sim|loopback|shm] [-n nodes] [-s senders] [-r rate] [-c msgs] [-t delay_us] [-J jitter_us] "
+               "[-d loss] [-S seed] [-k fanout] [-N 0|1] [-o text|csv|json] [-H hgrm_file] [-Z trace_prefix] [-K sw|hw]\n", argv[0]);
+        exit(1);
+    }
+    for (int i = 1; i < argc; i += 2){
+        if (strcmp(argv[i], "-T") == 0) transport = argv[i+1];
+        else if (strcmp(argv[i], "-n") == 0) numNodes = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-s") == 0) numSenders = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-r") == 0) rate = atof(argv[i+1]);
+        else if (strcmp(argv[i], "-c") == 0) numMsgs = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-t") == 0) simLink.delay_us = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-J") == 0) simLink.jitter_us = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-d") == 0) simLink.loss = atof(argv[i+1]);
+        else if (strcmp(argv[i], "-S") == 0) seed = (uint32_t) strtoul(argv[i+1], nullptr, 10);
+        else if (strcmp(argv[i], "-k") == 0) fanout = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-N") == 0) nak = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-o") == 0) format = argv[i+1];
+        else if (strcmp(argv[i], "-H") == 0) hgrmFileName = argv[i+1];
+        else if (strcmp(argv[i], "-Z") == 0) tracePrefix = argv[i+1];
+        else if (strcmp(argv[i], "-K") == 0) timestamps = strcmp(argv[i+1], "hw") == 0 ? TS_HARDWARE : TS_SOFTWARE;
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (strcmp(transport, "sim") != 0 && strcmp(transport, "loopback") != 0 && strcmp(transport, "shm") != 0){
+        fprintf(stderr, "Bad transport: %s. Please use sim, loopback or shm\n", transport);
+        exit(1);
+    }
+    if (numNodes < 1 || numSenders < 1 || numSenders > numNodes || rate <= 0 || numMsgs < 1){
+        fprintf(stderr, "Need 1 <= senders <= nodes, a rate > 0 and msgs >= 1\n");
+        exit(1);
+    }
+}
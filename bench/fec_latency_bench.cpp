@@ -0,0 +1,129 @@
+//
+// p50/p99 delivery latency of a stream of DATA msgs against the drop rate, with fec (-F n,k) off and on.
+// A discrete event simulation of one sender --> receiver link with the real FecEncoder/FecDecoder: every frame is
+// dropped with the drop rate (like send_msg_with_drop_and_delay), acks too, and a msg that isn't acked gets resent
+// every TIMEOUT (like datamsg_watchdog, resends go through the encoder as well). Latency is from the first send until
+// the receiver first has the msg.
+//
+// g++ -O2 -o fec_latency_bench bench/fec_latency_bench.cpp fec.cpp
+// ./fec_latency_bench [messages] [send_interval_us] [link_delay_us]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../fec.h"
+
+#define TIMEOUT_MS  5000    // TIMEOUT in reliable_multicast.h
+#define MSG_SIZE    24      // a DataMessage without a name
+#define NEVER       UINT64_MAX
+
+typedef std::vector<unsigned char> Frame;
+
+struct Event{
+    uint64_t t;
+    int kind;       // SEND, FLUSH or ARRIVE
+    uint32_t msg;   // SEND: the msg
+    Frame frame;    // ARRIVE: what's on the wire
+    bool operator>(const Event &o) const {
+        return t > o.t;
+    };
+};
+enum {SEND, FLUSH, ARRIVE};
+
+
+struct Result{
+    double p50_ms, p99_ms, max_ms, frames_per_msg, recovered_pct;
+};
+
+
+static Result run(int numMsgs, uint64_t interval_ns, uint64_t delay_ns, double dropRate, int n, int k, uint32_t seed){
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    FecEncoder encoder(n > 0 ? n : 1, k, 1);
+    FecDecoder decoder;
+    uint32_t block = 0;
+    std::vector<uint64_t> sentAt(numMsgs), receivedAt(numMsgs, NEVER), ackedAt(numMsgs, NEVER);
+    uint64_t frames = 0;
+
+    auto put_on_wire = [&](uint64_t t, const std::vector<Frame> &out){
+        for (const Frame &f : out){
+            frames++;
+            if (uniform(rng) >= dropRate) events.push(Event{t + delay_ns, ARRIVE, 0, f});
+        }
+    };
+    for (int i = 0; i < numMsgs; i++){
+        sentAt[i] = i * interval_ns;
+        events.push(Event{sentAt[i], SEND, (uint32_t) i, Frame()});
+    }
+    while (!events.empty()){
+        Event e = events.top();
+        events.pop();
+        if (e.kind == SEND){
+            if (ackedAt[e.msg] <= e.t) continue;  // the watchdog found the ack
+            Frame pkt(MSG_SIZE, 0);
+            for (int b = 0; b < 4; b++) pkt[8 + b] = (unsigned char) (e.msg >> (24 - 8 * b));  // msg_id like packi32
+            std::vector<Frame> out;
+            if (n > 0){
+                if (!encoder.in_block()){
+                    block++;
+                    events.push(Event{e.t + (uint64_t) FEC_FLUSH * 1000000, FLUSH, 0, Frame()});
+                }
+                encoder.add(pkt.data(), pkt.size(), block, e.t, out);
+            } else out.push_back(pkt);
+            put_on_wire(e.t, out);
+            events.push(Event{e.t + (uint64_t) TIMEOUT_MS * 1000000, SEND, e.msg, Frame()});
+        } else if (e.kind == FLUSH){
+            std::vector<Frame> out;
+            encoder.flush(e.t, out);
+            put_on_wire(e.t, out);
+        } else {
+            std::vector<Frame> pkts;
+            if (n > 0) decoder.receive(e.frame.data(), e.frame.size(), pkts);
+            else pkts.push_back(e.frame);
+            for (const Frame &pkt : pkts){
+                uint32_t msg = ((uint32_t) pkt[8] << 24) | ((uint32_t) pkt[9] << 16) | ((uint32_t) pkt[10] << 8) | pkt[11];
+                if (msg >= (uint32_t) numMsgs) continue;
+                if (receivedAt[msg] == NEVER) receivedAt[msg] = e.t;
+                if (uniform(rng) >= dropRate) ackedAt[msg] = std::min(ackedAt[msg], e.t + delay_ns);  // (re)ack
+            }
+        }
+    }
+    std::vector<double> latency;
+    for (int i = 0; i < numMsgs; i++) latency.push_back((double) (receivedAt[i] - sentAt[i]) / 1e6);
+    std::sort(latency.begin(), latency.end());
+    Result r{};
+    r.p50_ms = latency[latency.size() / 2];
+    r.p99_ms = latency[std::min(latency.size() - 1, latency.size() * 99 / 100)];
+    r.max_ms = latency.back();
+    r.frames_per_msg = (double) frames / numMsgs;
+    r.recovered_pct = 100.0 * (double) decoder.recovered_count() / numMsgs;
+    return r;
+}
+
+
+int main(int argc, char *argv[]){
+    int numMsgs = argc > 1 ? atoi(argv[1]) : 20000;
+    uint64_t interval_ns = (argc > 2 ? atoi(argv[2]) : 1000) * 1000ULL;
+    uint64_t delay_ns = (argc > 3 ? atoi(argv[3]) : 500) * 1000ULL;
+    printf("%d msgs, one every %.3f ms, link delay %.3f ms, TIMEOUT %d ms, FEC_FLUSH %d ms\n", numMsgs,
+           interval_ns / 1e6, delay_ns / 1e6, TIMEOUT_MS, FEC_FLUSH);
+    printf("%6s %8s %10s %10s %10s %12s %10s\n", "drop", "fec", "p50 ms", "p99 ms", "max ms", "frames/msg", "rebuilt");
+    const int configs[][2] = {{0, 0}, {8, 1}, {8, 2}, {8, 4}, {4, 4}, {4, 8}};
+    for (double dropRate : {0.0, 0.05, 0.1, 0.2, 0.3, 0.4, 0.5}){
+        for (const auto &c : configs){
+            Result r = run(numMsgs, interval_ns, delay_ns, dropRate, c[0], c[1], 42);
+            char name[16];
+            if (c[0] == 0) snprintf(name, sizeof name, "off");
+            else snprintf(name, sizeof name, "%d,%d", c[0], c[1]);
+            printf("%6.2f %8s %10.2f %10.2f %10.2f %12.2f %9.1f%%\n", dropRate, name, r.p50_ms, r.p99_ms, r.max_ms,
+                   r.frames_per_msg, r.recovered_pct);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+//
+// Local fan-out of delivered msgs through the shared memory feed (delivery_feed.h) to reader processes.
+// This process is the writer: it publishes msgs of size bytes in batches every millisecond, at rate msgs/s, as the
+// delivery callback of a daemon would. Every reader is a forked process that reads them in place and checks them.
+// Two runs: all readers keep up, then the same with the last reader stalling SLOW_US on every msg. Reports, per
+// reader, the msgs it read, how many it skipped after being lapped, the latency from publish to read and whether it
+// ever saw a msg out of order or overwritten.
+//
+// g++ -O2 -pthread -o feed_bench bench/feed_bench.cpp delivery_feed.cpp payload.cpp
+// ./feed_bench [readers] [msgs] [size] [rate]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../delivery_feed.h"
+#include "../clock.h"
+
+#define FEED_NAME   "feed_bench"
+#define END_KIND    0xffffffff  // the last msg
+#define SLOW_US     50
+
+int numReaders = 4;
+int numMsgs = 500000;
+int msgSize = 64;
+int rate = 200000;
+
+
+typedef struct {
+    int reader;
+    uint64_t read, skipped, lapped, torn, unordered;
+    double p50_us, p99_us, max_us;
+} ReaderResult;
+
+
+void read_feed(int out, int index, bool slow){
+    FeedReader reader(FEED_NAME);
+    if (!reader.attached()) _exit(1);
+    ReaderResult r{};
+    r.reader = index;
+    std::vector<double> lat;
+    lat.reserve(numMsgs);
+    uint64_t expect = 0;  // the msg number we should read next (unless we skipped)
+    FeedEntry e;
+    while (true){
+        int rv = reader.next(e);
+        if (rv == FEED_EMPTY){
+            reader.wait(100);
+            continue;
+        }
+        if (rv == FEED_LAGGED){
+            r.lapped++;
+            r.skipped += reader.catch_up();
+            continue;
+        }
+        if (e.kind == END_KIND) break;
+        uint64_t now = monotonic_now_ns();
+        uint64_t number;
+        memcpy(&number, e.payload, 8);
+        if (slow) usleep(SLOW_US);
+        if (!reader.intact(e)){
+            r.torn++;  // we were too slow even for the msg in our hands
+            continue;
+        }
+        if (number < expect) r.unordered++;
+        expect = number + 1;
+        lat.push_back((double) (now - e.published_ns) / 1e3);
+        r.read++;
+    }
+    std::sort(lat.begin(), lat.end());
+    if (!lat.empty()){
+        r.p50_us = lat[lat.size() / 2];
+        r.p99_us = lat[std::min(lat.size() - 1, (size_t) (0.99 * (double) lat.size()))];
+        r.max_us = lat.back();
+    }
+    if (write(out, &r, sizeof(r)) != sizeof(r)) _exit(1);
+    _exit(0);
+}
+
+
+void run(FeedWriter &writer, bool slowLast){
+    int fds[2];
+    if (pipe(fds) == -1){perror("pipe"); exit(1);}
+    std::vector<pid_t> children;
+    for (int i = 0; i < numReaders; i++){
+        pid_t pid = fork();
+        if (pid == -1){perror("fork"); exit(1);}
+        if (pid == 0){
+            close(fds[0]);
+            read_feed(fds[1], i, slowLast && i == numReaders - 1);
+        }
+        children.push_back(pid);
+    }
+    close(fds[1]);
+    while ((int) writer.readers().size() < numReaders) usleep(1000);  // they read from the next msg
+
+    int perBatch = std::max(1, rate / 1000);
+    std::vector<QueuedMessage> batch(perBatch);
+    for (QueuedMessage &qm : batch){
+        qm.kind = 0;  // APP_MSG
+        qm.sender = 1;
+    }
+    uint64_t start = monotonic_now_ns();
+    uint64_t maxBehind = 0;
+    for (int m = 0; m < numMsgs; m += perBatch){
+        uint64_t at = start + (uint64_t) (m / perBatch) * 1000000;
+        uint64_t now = monotonic_now_ns();
+        if (at > now) usleep((at - now) / 1000);
+        int n = std::min(perBatch, numMsgs - m);
+        for (int i = 0; i < n; i++){
+            uint64_t number = (uint64_t) (m + i);
+            batch[i].msg_id = (uint32_t) number;
+            batch[i].payload = Payload::allocate(msgSize);
+            memset(batch[i].payload.mutable_data(), (int) (number & 0xff), msgSize);
+            memcpy(batch[i].payload.mutable_data(), &number, 8);
+        }
+        writer.publish(batch.data(), n);
+        if ((m / perBatch) % 100 == 0){
+            std::vector<FeedReaderInfo> attached = writer.readers();
+            if (!attached.empty()) maxBehind = std::max(maxBehind, attached[0].behind);
+        }
+    }
+    double publish_s = (double) (monotonic_now_ns() - start) / 1e9;
+    QueuedMessage end{};
+    end.kind = END_KIND;
+    writer.publish(&end, 1);
+
+    printf("%s: %d msgs of %d bytes at %d msgs/s to %d readers, published in %.2f s, slowest reader was at most "
+           "%lu msgs behind\n", slowLast ? "last reader slow" : "all keep up", numMsgs, msgSize, rate, numReaders,
+           publish_s, maxBehind);
+    printf("%7s %10s %10s %8s %10s %10s %10s %6s %10s\n", "reader", "read", "skipped", "lapped", "p50 us", "p99 us",
+           "max us", "torn", "unordered");
+    for (int i = 0; i < numReaders; i++){
+        ReaderResult r{};
+        if (read(fds[0], &r, sizeof(r)) != sizeof(r)) break;
+        printf("%7d %10lu %10lu %8lu %10.1f %10.1f %10.1f %6lu %10lu\n", r.reader, r.read, r.skipped, r.lapped, r.p50_us,
+               r.p99_us, r.max_us, r.torn, r.unordered);
+    }
+    printf("\n");
+    fflush(stdout);
+    close(fds[0]);
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc > 1) numReaders = atoi(argv[1]);
+    if (argc > 2) numMsgs = atoi(argv[2]);
+    if (argc > 3) msgSize = atoi(argv[3]);
+    if (argc > 4) rate = atoi(argv[4]);
+    if (numReaders < 1 || numReaders > FEED_READERS || numMsgs < 1 || msgSize < 8 || msgSize > PAYLOAD_MAX_BUFFER || rate < 1){
+        fprintf(stderr, "Need 1 to %d readers, at least 1 msg, a size in [8, %d] and a rate\n", FEED_READERS, PAYLOAD_MAX_BUFFER);
+        exit(1);
+    }
+    FeedWriter writer(FEED_NAME);
+    run(writer, false);
+    run(writer, true);
+}
@@ -0,0 +1,168 @@
+//
+// Flow control under overload: one sender offers 10x what the group can take, on the simulator (virtual time).
+// The last node is a slow consumer: its delivery callback costs cost_us per msg, so the group sustains 1e6/cost_us
+// msgs/s. Every node's socket holds rcvbuf datagrams and drops the rest. The sender submits a msg every cost_us/10
+// in each mode:
+//   off    no flow control (only the NAK mode's send ring holds the sender back)
+//   block  multicast_datamsg() waits for credit (the sender falls behind its schedule and sends as fast as it may)
+//   try    try_multicast(): a msg that finds the window full is refused (counted) and the sender moves on
+// Reports, for every mode, the slow node's delivered msgs/s and the latency (msg on the wire --> delivered at the
+// slow node) per period, then the totals and the datagrams dropped by full sockets.
+//
+// g++ -O2 -pthread -o flow_bench bench/flow_bench.cpp simulator.cpp runtime.cpp shm_transport.cpp link_emulator.cpp membership.cpp ack_table.cpp failure_detector.cpp nak_stream.cpp fec.cpp fragmentation.cpp flow_control.cpp metrics.cpp trace.cpp logger.cpp completion.cpp payload.cpp networkagent.cpp waittosync.cpp CL_global_snapshot.cpp reliable_multicast.cpp -lanl
+// ./flow_bench [nodes] [cost_us] [seconds] [rcvbuf]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../simulator.h"
+#include "../reliable_multicast.h"
+
+#define OVERLOAD        10      // offered rate / sustainable rate
+#define PERIOD_MS       500     // one line of the report per period (virtual time)
+#define DRAIN_S         30      // virtual seconds we wait for the msgs already sent once the sender stops
+
+int numNodes = 3;
+int cost_us = 100;
+int seconds = 1;
+int rcvbuf = 1024;
+FILE *report;
+
+
+struct Result{
+    uint64_t sent = 0;
+    uint64_t refused = 0;
+    uint64_t overflowed = 0;
+    std::vector<uint64_t> sentAt;       // by msg_id: when multicast returned
+    std::vector<uint64_t> deliveredAt;  // by msg_id, at the slow node (0: not yet)
+    uint64_t start = 0;
+};
+
+
+double percentile(std::vector<double> v, double p){
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (p * (double) v.size()))];
+}
+
+
+void run(const char *mode){
+    Result r;
+    std::vector<std::string> names;
+    for (int i = 1; i <= numNodes; i++) names.push_back("container" + std::to_string(i));
+    auto *simulator = new Simulator(1, SimLink{100, 0, 0.0, rcvbuf});  // never destroyed (see simulator.h)
+    uint64_t interval_ns = (uint64_t) cost_us * 1000 / OVERLOAD;
+    uint64_t duration_ns = (uint64_t) seconds * 1000000000;
+    bool done = false;
+    simulator->run([&]{
+        std::vector<Runtime *> runtimes;
+        for (const std::string &name : names) runtimes.push_back(simulator->add_node(name));
+        std::vector<ReliableMulticast *> nodes;
+        for (int i = 0; i < numNodes; i++){
+            // NAK mode: no watchdog thread per msg. no failure detection: the slow node is late, not dead
+            auto *rm = new ReliableMulticast(*runtimes[i], names, names[i].c_str(), 0, 0, true);
+            rm->set_max_recv(INT_MAX);
+            if (strcmp(mode, "off") == 0) rm->set_flow_window(0);
+            if (i == numNodes - 1){
+                Runtime *rt = runtimes[i];
+                rm->set_delivery_callback([&r, rt](const QueuedMessage *msgs, size_t n){
+                    uint64_t now = rt->now_ns();
+                    for (size_t k = 0; k < n; k++){
+                        if (msgs[k].sender != 1) continue;
+                        if (r.deliveredAt.size() <= msgs[k].msg_id) r.deliveredAt.resize(msgs[k].msg_id + 1, 0);
+                        r.deliveredAt[msgs[k].msg_id] = now + (k + 1) * (uint64_t) cost_us * 1000;
+                    }
+                    rt->sleep_us(n * (uint64_t) cost_us);  // the slow consumer
+                });
+            }
+            runtimes[i]->spawn([rm]{ ReliableMulticast::start_msg_receiver(rm); });
+            nodes.push_back(rm);
+        }
+        Runtime *rt = runtimes[0];
+        ReliableMulticast *sender = nodes[0];
+        rt->spawn([&, rt, sender, interval_ns, duration_ns]{
+            r.start = rt->now_ns();
+            uint64_t next = r.start;
+            while (next < r.start + duration_ns){
+                uint64_t now = rt->now_ns();
+                if (now < next) rt->sleep_us((next - now) / 1000);
+                next += interval_ns;
+                if (strcmp(mode, "try") == 0){
+                    if (!sender->try_multicast(Payload::from_u32((uint32_t) r.sent))){
+                        r.refused++;
+                        continue;
+                    }
+                } else sender->multicast_datamsg((uint32_t) r.sent);
+                r.sentAt.push_back(rt->now_ns());
+                r.sent++;
+            }
+            done = true;
+        });
+        uint64_t deadline = 0;
+        while (true){
+            runtimes[0]->sleep_us(PERIOD_MS * 1000);
+            if (!done) continue;
+            if (deadline == 0) deadline = runtimes[0]->now_ns() + (uint64_t) DRAIN_S * 1000000000;
+            size_t got = 0;
+            for (uint64_t t : r.deliveredAt) if (t != 0) got++;
+            if (got >= r.sent || runtimes[0]->now_ns() > deadline) break;
+        }
+    });
+    r.overflowed = simulator->datagrams_overflowed();
+
+    // per period of delivery at the slow node
+    fprintf(report, "%s:\n  %8s %10s %12s %12s\n", mode, "t (ms)", "msgs/s", "lat p50 ms", "lat max ms");
+    std::vector<std::vector<double>> periods;
+    std::vector<double> all;
+    uint64_t last = r.start + 1;
+    for (size_t id = 0; id < r.deliveredAt.size() && id < r.sentAt.size(); id++){
+        if (r.deliveredAt[id] == 0) continue;
+        last = std::max(last, r.deliveredAt[id]);
+        size_t p = (r.deliveredAt[id] - r.start) / ((uint64_t) PERIOD_MS * 1000000);
+        if (periods.size() <= p) periods.resize(p + 1);
+        double lat = (double) (r.deliveredAt[id] - r.sentAt[id]) / 1e6;
+        periods[p].push_back(lat);
+        all.push_back(lat);
+    }
+    for (size_t p = 0; p < periods.size(); p++){
+        double max = periods[p].empty() ? 0 : *std::max_element(periods[p].begin(), periods[p].end());
+        fprintf(report, "  %8lu %10.0f %12.2f %12.2f\n", (p + 1) * PERIOD_MS,
+                (double) periods[p].size() * 1000.0 / PERIOD_MS, percentile(periods[p], 0.5), max);
+    }
+    double span_s = (double) (last - r.start) / 1e9;
+    fprintf(report, "  sent %lu, refused %lu, delivered %lu at the slow node (%.0f msgs/s), latency p50 %.2f ms "
+                    "p99 %.2f ms, %lu datagrams dropped by full sockets\n\n", r.sent, r.refused, all.size(),
+            (double) all.size() / span_s, percentile(all, 0.5), percentile(all, 0.99), r.overflowed);
+    fflush(report);
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc > 1) numNodes = atoi(argv[1]);
+    if (argc > 2) cost_us = atoi(argv[2]);
+    if (argc > 3) seconds = atoi(argv[3]);
+    if (argc > 4) rcvbuf = atoi(argv[4]);
+    if (numNodes < 2 || cost_us < OVERLOAD || seconds < 1 || rcvbuf < 0){
+        fprintf(stderr, "Need at least 2 nodes, cost_us >= %d, 1 s and rcvbuf >= 0\n", OVERLOAD);
+        exit(1);
+    }
+    // only the report goes to stdout
+    Logger::get().set_level(LOG_WARN);
+    fflush(stdout);
+    report = fdopen(dup(1), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 1);
+    fprintf(report, "%d nodes, the slow one takes %d us per msg (%.0f msgs/s), offered %.0f msgs/s for %d s, "
+                    "sockets hold %d datagrams, window %d\n\n", numNodes, cost_us, 1e6 / cost_us,
+            1e6 * OVERLOAD / cost_us, seconds, rcvbuf, FLOW_WINDOW);
+    for (const char *mode : {"off", "block", "try"}) run(mode);
+    _exit(0);  // the nodes' threads are still around
+}
@@ -0,0 +1,147 @@
+//
+// Big msgs on the simulator (virtual time): fragmentation against splitting them up in the application.
+// One sender multicasts msgs of size bytes to the group, one every interval_us, in NAK mode, in each mode:
+//   frag    one multicast_datamsg() per msg: it goes out in FRAG_MTU fragments and is ordered once
+//   chunks  the application cuts every msg into FRAG_BYTES pieces and multicasts each (one ordering round each)
+// for a few loss rates. Reports the latency (multicast --> the last node has all of the msg), how long the whole
+// run took and the datagrams per msg (everything: DATA, fragments, ACKs, SEQs, NAKs, heartbeats).
+//
+// g++ -std=c++20 -O2 -pthread -o frag_bench bench/frag_bench.cpp simulator.cpp runtime.cpp shm_transport.cpp link_emulator.cpp membership.cpp ack_table.cpp failure_detector.cpp nak_stream.cpp fec.cpp fragmentation.cpp flow_control.cpp metrics.cpp trace.cpp logger.cpp completion.cpp payload.cpp networkagent.cpp waittosync.cpp CL_global_snapshot.cpp reliable_multicast.cpp -lanl
+// ./frag_bench [nodes] [size] [msgs] [interval_us]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../simulator.h"
+#include "../reliable_multicast.h"
+
+#define DRAIN_S     60      // virtual seconds we wait for everything to be delivered
+
+int numNodes = 4;
+int msgSize = 32768;
+int numMsgs = 200;
+int interval_us = 5000;
+FILE *report;
+
+
+struct Result{
+    std::vector<uint64_t> sentAt;                   // by msg
+    std::vector<std::vector<int>> pieces;           // by node, by msg: pieces delivered
+    std::vector<uint64_t> completeAt;               // by msg: when the last node had all of it
+    std::vector<int> complete;                      // by msg: nodes that have all of it
+    bool intact = true;
+};
+
+
+double percentile(std::vector<double> v, double p){
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (p * (double) v.size()))];
+}
+
+
+void run(const char *mode, double loss){
+    bool chunks = strcmp(mode, "chunks") == 0;
+    int perMsg = chunks ? (msgSize + FRAG_BYTES - 1) / FRAG_BYTES : 1;
+    Result r;
+    r.sentAt.assign(numMsgs, 0);
+    r.pieces.assign(numNodes, std::vector<int>(numMsgs, 0));
+    r.completeAt.assign(numMsgs, 0);
+    r.complete.assign(numMsgs, 0);
+    std::vector<std::string> names;
+    for (int i = 1; i <= numNodes; i++) names.push_back("container" + std::to_string(i));
+    auto *simulator = new Simulator(1, SimLink{100, 20, loss, 0});  // never destroyed (see simulator.h)
+    int done = 0;
+    uint64_t start = 0, end = 0;
+    simulator->run([&]{
+        std::vector<Runtime *> runtimes;
+        for (const std::string &name : names) runtimes.push_back(simulator->add_node(name));
+        std::vector<ReliableMulticast *> nodes;
+        for (int i = 0; i < numNodes; i++){
+            auto *rm = new ReliableMulticast(*runtimes[i], names, names[i].c_str(), 0, 0, true);
+            rm->set_max_recv(INT_MAX);
+            Runtime *rt = runtimes[i];
+            rm->set_delivery_callback([&, i, rt, perMsg](const QueuedMessage *msgs, size_t n){
+                for (size_t k = 0; k < n; k++){
+                    if (msgs[k].kind != APP_MSG || msgs[k].sender != 1 || msgs[k].payload.size() < 4) continue;
+                    const unsigned char *b = msgs[k].payload.data();
+                    uint32_t msg = ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+                    if (msg >= (uint32_t) numMsgs) continue;
+                    size_t len = chunks ? std::min((size_t) FRAG_BYTES, msgs[k].payload.size()) : (size_t) msgSize;
+                    if (msgs[k].payload.size() != len || b[len - 1] != (unsigned char) msg) r.intact = false;
+                    if (++r.pieces[i][msg] < perMsg) continue;
+                    if (++r.complete[msg] == numNodes){
+                        r.completeAt[msg] = rt->now_ns();
+                        done++;
+                    }
+                }
+            });
+            runtimes[i]->spawn([rm]{ ReliableMulticast::start_msg_receiver(rm); });
+            nodes.push_back(rm);
+        }
+        Runtime *rt = runtimes[0];
+        ReliableMulticast *sender = nodes[0];
+        rt->spawn([&, rt, sender, perMsg]{
+            start = rt->now_ns();
+            for (int m = 0; m < numMsgs; m++){
+                uint64_t next = start + (uint64_t) m * interval_us * 1000;
+                uint64_t now = rt->now_ns();
+                if (now < next) rt->sleep_us((next - now) / 1000);
+                r.sentAt[m] = rt->now_ns();
+                for (int c = 0; c < perMsg; c++){  // the msg number first and last (to check it arrived whole)
+                    size_t len = chunks ? std::min((size_t) FRAG_BYTES, (size_t) msgSize - (size_t) c * FRAG_BYTES)
+                                        : (size_t) msgSize;
+                    Payload p = Payload::allocate(len);
+                    memset(p.mutable_data(), 0, len);
+                    p.mutable_data()[3] = (unsigned char) m;
+                    p.mutable_data()[2] = (unsigned char) (m >> 8);
+                    p.mutable_data()[len - 1] = (unsigned char) m;
+                    sender->multicast_datamsg(p);
+                }
+            }
+        });
+        uint64_t deadline = runtimes[0]->now_ns() + (uint64_t) DRAIN_S * 1000000000;
+        while (done < numMsgs && runtimes[0]->now_ns() < deadline) runtimes[0]->sleep_us(10000);
+        end = runtimes[0]->now_ns();
+    });
+    std::vector<double> lat;
+    for (int m = 0; m < numMsgs; m++) if (r.completeAt[m] != 0) lat.push_back((double) (r.completeAt[m] - r.sentAt[m]) / 1e6);
+    fprintf(report, "%6.2f %8s %10d %10.2f %10.2f %10.2f %12.1f %8s\n", loss, mode, (int) lat.size(), percentile(lat, 0.5),
+            percentile(lat, 0.99), (double) (end - start) / 1e9, (double) simulator->datagrams_sent() / numMsgs,
+            r.intact ? "yes" : "NO");
+    fflush(report);
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc > 1) numNodes = atoi(argv[1]);
+    if (argc > 2) msgSize = atoi(argv[2]);
+    if (argc > 3) numMsgs = atoi(argv[3]);
+    if (argc > 4) interval_us = atoi(argv[4]);
+    if (numNodes < 2 || msgSize < 4 || msgSize > MAX_PAYLOAD || numMsgs < 1 || numMsgs > 65536 || interval_us < 1){
+        fprintf(stderr, "Need at least 2 nodes, a size in [4, %d], 1 to 65536 msgs and an interval\n", MAX_PAYLOAD);
+        exit(1);
+    }
+    // only the report goes to stdout
+    Logger::get().set_level(LOG_WARN);
+    fflush(stdout);
+    report = fdopen(dup(1), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 1);
+    fprintf(report, "%d nodes, %d msgs of %d bytes, one every %.3f ms, fragments of %d bytes (%d per msg)\n\n",
+            numNodes, numMsgs, msgSize, interval_us / 1e3, FRAG_MTU, Fragmenter::count(msgSize + MAX_STRUCT_SIZE));
+    fprintf(report, "%6s %8s %10s %10s %10s %10s %12s %8s\n", "loss", "mode", "complete", "p50 ms", "p99 ms", "run s",
+            "dgrams/msg", "intact");
+    for (double loss : {0.0, 0.01, 0.05}){
+        for (const char *mode : {"frag", "chunks"}) run(mode, loss);
+    }
+    _exit(0);  // the nodes' threads are still around
+}
@@ -0,0 +1,114 @@
+//
+// A small HdrHistogram for the benchmarks: constant relative precision over the whole range, fixed cost per
+// record, and the percentile distribution printed in HdrHistogram's .hgrm format (so its plotter reads it).
+//
+
+#ifndef PRJ1_HDR_HISTOGRAM_H
+#define PRJ1_HDR_HISTOGRAM_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#define HDR_SUB_BITS    10      // 2^10 sub-buckets per power of 2: values are kept to within 0.1%
+
+
+class HdrHistogram{
+    /* values below 2^(HDR_SUB_BITS+1) have a bucket each. above that every power of 2 is split into 2^HDR_SUB_BITS
+     * equal sub-buckets. a value is reported as the highest one its bucket holds, like HdrHistogram does */
+public:
+    void record(uint64_t v){
+        size_t i = index_of(v);
+        if (i >= counts.size()) counts.resize(i + 1, 0);
+        counts[i]++;
+        total++;
+        sum += (double) v;
+        sumSquares += (double) v * (double) v;
+        if (v > maxValue) maxValue = v;
+        if (total == 1 || v < minValue) minValue = v;
+    };
+    void add(const HdrHistogram &o){
+        if (o.counts.size() > counts.size()) counts.resize(o.counts.size(), 0);
+        for (size_t i = 0; i < o.counts.size(); i++) counts[i] += o.counts[i];
+        if (o.total > 0 && (total == 0 || o.minValue < minValue)) minValue = o.minValue;
+        if (o.maxValue > maxValue) maxValue = o.maxValue;
+        total += o.total;
+        sum += o.sum;
+        sumSquares += o.sumSquares;
+    };
+    uint64_t count() const {
+        return total;
+    };
+    uint64_t max() const {
+        return maxValue;
+    };
+    uint64_t min() const {
+        return minValue;
+    };
+    double mean() const {
+        return total == 0 ? 0 : sum / (double) total;
+    };
+    double stddev() const {
+        if (total == 0) return 0;
+        double m = mean();
+        return std::sqrt(std::max(0.0, sumSquares / (double) total - m * m));
+    };
+    uint64_t value_at(double percentile) const {  // percentile in [0, 100]
+        if (total == 0) return 0;
+        uint64_t want = (uint64_t) std::ceil(percentile / 100.0 * (double) total);
+        if (want == 0) want = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++){
+            seen += counts[i];
+            if (seen >= want) return std::min(highest_of(i), maxValue);
+        }
+        return maxValue;
+    };
+    void print_percentiles(FILE *fp, double unit) const {
+        /* the .hgrm percentile distribution. values are divided by unit (e.g. 1e3 to print ns as us). the steps
+         * halve every time the distance to 100% halves, 5 of them per halving */
+        fprintf(fp, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+        double p = 0;
+        while (total > 0){
+            uint64_t v = value_at(p);
+            uint64_t below = 0;  // values in v's bucket and below
+            for (size_t i = 0; i < counts.size() && i <= index_of(v); i++) below += counts[i];
+            if (below >= total){
+                fprintf(fp, "%12.3f %14.12f %10lu\n", (double) v / unit, 1.0, below);
+                break;
+            }
+            fprintf(fp, "%12.3f %14.12f %10lu %14.2f\n", (double) v / unit, p / 100, below, 100 / (100 - p));
+            int halvings = (int) std::floor(std::log2(100.0 / (100.0 - p)));
+            p += 100.0 / (5.0 * std::pow(2.0, halvings + 1));
+            if (p > 100) p = 100;
+        }
+        fprintf(fp, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean() / unit, stddev() / unit);
+        fprintf(fp, "#[Max     = %12.3f, Total count    = %12lu]\n", (double) maxValue / unit, total);
+        fprintf(fp, "#[Buckets = %12lu, SubBuckets     = %12lu]\n", counts.size() / SUB, SUB);
+    };
+
+private:
+    static const size_t SUB = (size_t) 1 << HDR_SUB_BITS;
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+    uint64_t minValue = 0;
+    double sum = 0;
+    double sumSquares = 0;
+
+    static size_t index_of(uint64_t v){
+        if (v < 2 * SUB) return (size_t) v;
+        int shift = (63 - __builtin_clzll(v)) - HDR_SUB_BITS;  // >= 1
+        return 2 * SUB + (size_t) (shift - 1) * SUB + (size_t) ((v >> shift) - SUB);
+    };
+    static uint64_t highest_of(size_t i){
+        if (i < 2 * SUB) return (uint64_t) i;
+        size_t shift = (i - 2 * SUB) / SUB + 1;
+        uint64_t top = SUB + (i - 2 * SUB) % SUB;
+        return ((top + 1) << shift) - 1;
+    };
+};
+
+#endif //PRJ1_HDR_HISTOGRAM_H
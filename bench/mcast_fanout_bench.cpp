@@ -0,0 +1,115 @@
+//
+// Sender CPU per message: unicast fan-out (one sendto per receiver, what multicast_datamsg does without -m)
+// against one sendto to an IPv4 multicast group (-m), for group sizes from 2 to 32. Runs on a single box:
+// every receiver is a forked process with its own UDP_Server (its own port) that joined the group over loopback.
+//
+// g++ -O2 -o mcast_fanout_bench bench/mcast_fanout_bench.cpp networkagent.cpp
+// ./mcast_fanout_bench [messages_per_size] [group] [iface]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "../networkagent.h"
+
+#define BENCH_PORT      5200    // receiver i listens on BENCH_PORT + i
+#define BENCH_MCAST     5199    // the group's port
+#define BENCH_SENDER    5198
+#define MSG_SIZE        24      // a DataMessage without a name (MAX_STRUCT_SIZE)
+#define STOP            0xffffffff
+
+
+static double thread_cpu_ns(){
+    struct timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+
+static void receiver(int port, const char *group, const char *iface, int out){
+    // count datagrams until the stop marker and report the count through the pipe
+    client_server::UDP_Server server(port);
+    if (server.join_group(group, BENCH_MCAST, 1, true, iface) == -1) exit(1);
+    if (write(out, "r", 1) != 1) exit(1);  // ready
+    char buf[64];
+    uint32_t count = 0;
+    while (true){
+        int n = server.recv(buf, sizeof buf);
+        if (n >= 4 && *(uint32_t *) buf == STOP) break;
+        count++;
+    }
+    if (write(out, &count, sizeof count) != sizeof count) _exit(1);
+    _exit(0);  // not exit(): that would flush the parent's stdio buffers a second time
+}
+
+
+static double run(int numReceivers, int numMsgs, bool multicast, const char *group, const char *iface, double &delivered){
+    int fds[2];
+    if (pipe(fds) == -1){perror("pipe"); exit(1);}
+    std::vector<pid_t> pids;
+    fflush(stdout);
+    for (int i = 0; i < numReceivers; i++){
+        pid_t pid = fork();
+        if (pid == 0){close(fds[0]); receiver(BENCH_PORT + i, group, iface, fds[1]);}
+        pids.push_back(pid);
+    }
+    char c;
+    for (int i = 0; i < numReceivers; i++){
+        if (read(fds[0], &c, 1) != 1){fprintf(stderr, "a receiver couldn't join %s\n", group); exit(1);}
+    }
+
+    client_server::UDP_Server sender(BENCH_SENDER);
+    if (sender.join_group(group, BENCH_MCAST, 1, true, iface) == -1) exit(1);
+    std::vector<struct sockaddr_in> addrs(numReceivers);
+    for (int i = 0; i < numReceivers; i++){  // resolved once: this is the cheapest unicast fan-out can get
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_port = htons(BENCH_PORT + i);
+        inet_pton(AF_INET, "127.0.0.1", &addrs[i].sin_addr);
+    }
+    unsigned char msg[MSG_SIZE] = {0};
+    double start = thread_cpu_ns();
+    for (int m = 0; m < numMsgs; m++){
+        *(uint32_t *) msg = m;
+        if (multicast) sender.send_to_group((const char *) msg, MSG_SIZE);
+        else for (int i = 0; i < numReceivers; i++)
+            sendto(sender.get_socket(), msg, MSG_SIZE, 0, (struct sockaddr *) &addrs[i], sizeof addrs[i]);
+        if (m % 64 == 63) usleep(200);  // let the receivers keep up (sleeping costs no cpu)
+    }
+    double cpuNs = thread_cpu_ns() - start;
+
+    uint32_t stop = STOP;
+    usleep(100 * 1000);
+    for (int i = 0; i < numReceivers; i++)
+        sendto(sender.get_socket(), &stop, sizeof stop, 0, (struct sockaddr *) &addrs[i], sizeof addrs[i]);
+    uint64_t total = 0;
+    for (int i = 0; i < numReceivers; i++){
+        uint32_t count;
+        if (read(fds[0], &count, sizeof count) == sizeof count) total += count;
+    }
+    for (pid_t pid : pids) waitpid(pid, nullptr, 0);
+    close(fds[0]);
+    close(fds[1]);
+    delivered = 100.0 * (double) total / ((double) numMsgs * numReceivers);
+    return cpuNs / numMsgs;
+}
+
+
+int main(int argc, char *argv[]){
+    int numMsgs = argc > 1 ? atoi(argv[1]) : 20000;
+    const char *group = argc > 2 ? argv[2] : "239.255.46.46";
+    const char *iface = argc > 3 ? argv[3] : "127.0.0.1";
+    printf("%d msgs of %d bytes per size, group %s on %s\n", numMsgs, MSG_SIZE, group, iface);
+    printf("%10s %18s %12s %18s %12s %10s\n", "hosts", "unicast ns/msg", "delivered", "multicast ns/msg", "delivered", "ratio");
+    for (int numHosts : {2, 4, 8, 16, 32}){
+        double uniDelivered, mcastDelivered;
+        double uniNs = run(numHosts - 1, numMsgs, false, group, iface, uniDelivered);
+        double mcastNs = run(numHosts - 1, numMsgs, true, group, iface, mcastDelivered);
+        printf("%10d %18.1f %11.1f%% %18.1f %11.1f%% %9.1fx\n", numHosts, uniNs, uniDelivered, mcastNs, mcastDelivered,
+               uniNs / mcastNs);
+    }
+    return 0;
+}
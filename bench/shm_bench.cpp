@@ -0,0 +1,145 @@
+//
+// The shared memory transport against udp over loopback, between two processes on this box (no protocol).
+// For every datagram size and both transports:
+//   ping    container1 sends a datagram, container2 sends it back, pings times: the round trip percentiles
+//   blast   container1 sends blast datagrams as fast as it can: how many container2 got, and how fast
+// A full socket buffer loses the datagram (counted as lost). A full ring is refused (send returns -22), so on shm
+// we try again after a yield: what a sender that knows the receiver is behind can do.
+//
+// g++ -O2 -pthread -o shm_bench bench/shm_bench.cpp runtime.cpp shm_transport.cpp link_emulator.cpp membership.cpp networkagent.cpp
+// ./shm_bench [pings] [blast] [size...]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <thread>
+
+#include "../runtime.h"
+#include "../shm_transport.h"
+
+#define LOOPBACK_PORT   5800
+#define SHM_GROUP       "shm_bench"
+#define DRAIN_US        100000  // after a blast, before we ask how many got there
+#define BUF_SIZE        65536
+#define MAX_SIZE        65507   // the biggest udp datagram
+
+int numPings = 20000;
+int numBlast = 200000;
+std::vector<int> sizes = {64, 1400, 16384};
+
+
+Runtime * make_runtime(const char *transport, const char *name){
+    if (strcmp(transport, "shm") == 0) return new ShmRuntime(name, SHM_GROUP);
+    return new LoopbackRuntime(name, LOOPBACK_PORT);
+}
+
+
+void echo(const char *transport){
+    // container2: pings go back, blasts are counted. 'E' answers with the count and the time from the first to
+    // the last, 'Q' ends it
+    Runtime *rt = make_runtime(transport, "container2");
+    std::vector<unsigned char> buf(BUF_SIZE);
+    buf[0] = 'R';
+    rt->send_to("container1", buf.data(), 1);
+    uint32_t count = 0;
+    uint64_t first = 0, last = 0;
+    while (true){
+        int n = rt->recv(buf.data(), BUF_SIZE);
+        if (n <= 0) continue;
+        if (buf[0] == 'P') rt->reply(buf.data(), n);
+        else if (buf[0] == 'B'){
+            last = rt->now_ns();
+            if (count++ == 0) first = last;
+        } else if (buf[0] == 'E'){
+            uint64_t span = last - first;
+            memcpy(&buf[1], &count, 4);
+            memcpy(&buf[5], &span, 8);
+            rt->reply(buf.data(), 13);
+            count = 0;
+        } else if (buf[0] == 'Q') _exit(0);
+    }
+}
+
+
+double percentile(std::vector<double> &v, double p){  // v is sorted
+    return v.empty() ? 0 : v[std::min(v.size() - 1, (size_t) (p * (double) v.size()))];
+}
+
+
+void run(const char *transport){
+    Runtime *rt = make_runtime(transport, "container1");  // before the child says it's ready
+    pid_t child = fork();
+    if (child == -1){
+        perror("fork");
+        exit(1);
+    }
+    if (child == 0) echo(transport);
+    std::vector<unsigned char> buf(BUF_SIZE, 0);
+    while (rt->recv(buf.data(), BUF_SIZE) < 1 || buf[0] != 'R');
+
+    for (int size : sizes){
+        std::vector<unsigned char> msg(size, 0xab);
+        std::vector<double> rtt;
+        msg[0] = 'P';
+        for (int i = 0; i < numPings; i++){
+            uint64_t t0 = rt->now_ns();
+            if (rt->send_to("container2", msg.data(), size) != size) continue;
+            rt->recv(buf.data(), BUF_SIZE);
+            rtt.push_back((double) (rt->now_ns() - t0) / 1e3);
+        }
+        std::sort(rtt.begin(), rtt.end());
+
+        msg[0] = 'B';
+        uint64_t t0 = rt->now_ns();
+        bool retry = strcmp(transport, "shm") == 0;
+        for (int i = 0; i < numBlast; i++){
+            while (rt->send_to("container2", msg.data(), size) == -22 && retry) std::this_thread::yield();
+        }
+        double send_s = (double) (rt->now_ns() - t0) / 1e9;
+        rt->sleep_us(DRAIN_US);
+        buf[0] = 'E';
+        rt->send_to("container2", buf.data(), 1);
+        while (rt->recv(buf.data(), BUF_SIZE) != 13 || buf[0] != 'E');
+        uint32_t got;
+        uint64_t span;
+        memcpy(&got, &buf[1], 4);
+        memcpy(&span, &buf[5], 8);
+        double recv_s = span > 0 ? (double) span / 1e9 : send_s;
+        printf("%9s %7d %9.2f %9.2f %9.2f %12.0f %10.1f %8.2f\n", transport, size, percentile(rtt, 0.5),
+               percentile(rtt, 0.99), percentile(rtt, 0.999), got / recv_s, got * (double) size / recv_s / 1e6,
+               100.0 * (numBlast - got) / numBlast);
+        fflush(stdout);
+    }
+    buf[0] = 'Q';
+    rt->send_to("container2", buf.data(), 1);
+    waitpid(child, nullptr, 0);
+    delete rt;
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc > 1) numPings = atoi(argv[1]);
+    if (argc > 2) numBlast = atoi(argv[2]);
+    if (argc > 3) sizes.clear();
+    for (int i = 3; i < argc; i++) sizes.push_back(atoi(argv[i]));
+    for (int size : sizes){
+        if (size < 1 || size > MAX_SIZE){
+            fprintf(stderr, "Bad size %d. Please use sizes in [1, %d]\n", size, MAX_SIZE);
+            exit(1);
+        }
+    }
+    if (numPings < 1 || numBlast < 1){
+        fprintf(stderr, "Need at least 1 ping and 1 datagram to blast\n");
+        exit(1);
+    }
+    printf("%d pings and %d datagrams blasted per size, between two processes\n\n", numPings, numBlast);
+    printf("%9s %7s %9s %9s %9s %12s %10s %8s\n", "transport", "size", "rtt p50", "rtt p99", "rtt p999", "dgrams/s",
+           "MB/s", "lost %");
+    for (const char *transport : {"loopback", "shm"}) run(transport);
+}
@@ -0,0 +1,17 @@
+//
+// The one clock everything is timed with.
+//
+
+#ifndef PRJ1_CLOCK_H
+#define PRJ1_CLOCK_H
+
+#include <cstdint>
+#include <chrono>
+
+
+inline uint64_t monotonic_now_ns(){  // CLOCK_MONOTONIC: the same for every process on the box
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif //PRJ1_CLOCK_H
@@ -0,0 +1,120 @@
+//
+// Completions of async multicasts: pooled slots, and the handle the sender keeps to learn its msg's final sequence.
+//
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "completion.h"
+
+
+MulticastHandle& MulticastHandle::operator=(MulticastHandle &&other) noexcept{
+    if (this != &other){
+        if (pool != nullptr) pool->release(slot);
+        pool = other.pool;
+        slot = other.slot;
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+
+MulticastHandle::~MulticastHandle(){
+    if (pool != nullptr) pool->release(slot);
+}
+
+
+bool MulticastHandle::ready() const {
+    return pool != nullptr && pool->at(slot).done.load(std::memory_order_acquire);
+}
+
+
+uint32_t MulticastHandle::wait() const {
+    return pool == nullptr ? 0 : pool->wait(slot);
+}
+
+
+uint32_t MulticastHandle::final_seq() const {
+    return ready() ? pool->at(slot).final_seq : 0;
+}
+
+
+uint32_t MulticastHandle::proposer() const {
+    return ready() ? pool->at(slot).proposer : 0;
+}
+
+
+CompletionPool::~CompletionPool(){
+    for (auto &chunk : chunks) delete[] chunk.load();
+    if (efd >= 0) close(efd);
+}
+
+
+uint32_t CompletionPool::acquire(CompletionFn fn, void *arg){
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeSlots.empty()){
+        if (numChunks == COMPLETION_MAX_CHUNKS) return NO_COMPLETION;
+        chunks[numChunks].store(new Slot[COMPLETION_CHUNK], std::memory_order_release);
+        for (uint32_t i = COMPLETION_CHUNK; i > 0; i--) freeSlots.push_back(numChunks * COMPLETION_CHUNK + i - 1);
+        numChunks++;
+    }
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    Slot &s = at(slot);
+    s.done.store(false, std::memory_order_relaxed);
+    s.owners.store(2, std::memory_order_relaxed);  // the handle and the protocol
+    s.fn = fn;
+    s.arg = arg;
+    return slot;
+}
+
+
+void CompletionPool::complete(uint32_t slot, uint32_t final_seq, uint32_t proposer){
+    Slot &s = at(slot);
+    s.final_seq = final_seq;
+    s.proposer = proposer;
+    s.done.store(true);
+    if (s.fn != nullptr) s.fn(s.arg, final_seq, proposer);
+    int fd = efd.load(std::memory_order_acquire);
+    if (fd >= 0){
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof one) == -1) perror("CompletionPool: eventfd write");
+    }
+    if (waiters.load() > 0){  // done is set before we look, and a waiter counts itself before it looks at done
+        std::lock_guard<std::mutex> lock(mutex);
+        completed.notify_all();
+    }
+    release(slot);
+}
+
+
+int CompletionPool::event_fd(){
+    int fd = efd.load(std::memory_order_acquire);
+    if (fd >= 0) return fd;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (efd.load() < 0){
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1) perror("CompletionPool: eventfd");
+        else efd.store(fd, std::memory_order_release);
+    }
+    return efd.load();
+}
+
+
+void CompletionPool::release(uint32_t slot){
+    if (at(slot).owners.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    freeSlots.push_back(slot);
+}
+
+
+uint32_t CompletionPool::wait(uint32_t slot){
+    Slot &s = at(slot);
+    if (!s.done.load(std::memory_order_acquire)){
+        std::unique_lock<std::mutex> lock(mutex);
+        waiters++;
+        completed.wait(lock, [&s]{ return s.done.load(); });
+        waiters--;
+    }
+    return s.final_seq;
+}
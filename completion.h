@@ -0,0 +1,92 @@
+//
+// Completions of async multicasts: pooled slots, and the handle the sender keeps to learn its msg's final sequence.
+//
+
+#ifndef PRJ1_COMPLETION_H
+#define PRJ1_COMPLETION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#define COMPLETION_CHUNK        1024    // slots are added this many at a time (and never move)
+#define COMPLETION_MAX_CHUNKS   1024    // so at most a million msgs can be waited on at once
+#define NO_COMPLETION           UINT32_MAX
+
+// called once the msg is delivered locally, from a protocol thread that holds no locks. keep it short
+typedef void (*CompletionFn)(void *arg, uint32_t final_seq, uint32_t proposer);
+
+class CompletionPool;
+
+
+class MulticastHandle{
+    /* what multicast_async() returns: 16 bytes, move-only. use it like a future (ready(), wait()), or ignore it and
+     * rely on the callback or the eventfd. the slot goes back to the pool once both the handle is gone and the
+     * msg is delivered, whichever is last */
+public:
+    MulticastHandle() = default;
+    MulticastHandle(CompletionPool *pool, uint32_t slot) : pool(pool), slot(slot) {};
+    MulticastHandle(MulticastHandle &&other) noexcept : pool(other.pool), slot(other.slot) {
+        other.pool = nullptr;
+    };
+    MulticastHandle& operator=(MulticastHandle &&other) noexcept;
+    MulticastHandle(const MulticastHandle&) = delete;
+    MulticastHandle& operator=(const MulticastHandle&) = delete;
+    ~MulticastHandle();
+
+    bool valid() const {
+        return pool != nullptr;
+    };
+    bool ready() const;  // delivered here yet?
+    uint32_t wait() const;  // blocks until it is and returns the final seq. not on the simulator (it can't see us block)
+    uint32_t final_seq() const;  // once ready
+    uint32_t proposer() const;  // of the final seq, once ready
+
+private:
+    CompletionPool *pool = nullptr;
+    uint32_t slot = NO_COMPLETION;
+};
+
+
+class CompletionPool{
+    /* Slots live in chunks that are allocated once and reused: after warming up, an async multicast costs no
+     * allocation. A slot has two owners, the handle and the protocol, and is free again when both let go. */
+public:
+    CompletionPool() = default;
+    ~CompletionPool();
+    CompletionPool(const CompletionPool&) = delete;
+    CompletionPool& operator=(const CompletionPool&) = delete;
+
+    uint32_t acquire(CompletionFn fn, void *arg);  // NO_COMPLETION if the pool is exhausted
+    void complete(uint32_t slot, uint32_t final_seq, uint32_t proposer);  // the protocol's side. call with no locks held
+    int event_fd();  // an eventfd that counts completions (for poll/epoll). made on first use, -1 if that fails
+
+private:
+    friend class MulticastHandle;
+    struct Slot{
+        std::atomic<bool> done{false};
+        std::atomic<int> owners{0};
+        uint32_t final_seq = 0;
+        uint32_t proposer = 0;
+        CompletionFn fn = nullptr;
+        void *arg = nullptr;
+    };
+    std::atomic<Slot *> chunks[COMPLETION_MAX_CHUNKS] = {};
+    uint32_t numChunks = 0;  // mutex
+    std::vector<uint32_t> freeSlots;  // mutex
+    std::mutex mutex;  // guards the free list and the waits
+    std::condition_variable completed;
+    std::atomic<int> waiters{0};
+    std::atomic<int> efd{-1};
+
+    Slot & at(uint32_t slot) const {
+        return chunks[slot / COMPLETION_CHUNK].load(std::memory_order_acquire)[slot % COMPLETION_CHUNK];
+    };
+    void release(uint32_t slot);
+    uint32_t wait(uint32_t slot);
+};
+
+#endif //PRJ1_COMPLETION_H
@@ -0,0 +1,164 @@
+//
+// C++20 coroutines on top of the protocol: awaitable multicasts and deliveries, run by a single-threaded executor.
+// Needs -std=c++20.
+//
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "coroutines.h"
+
+
+Task::promise_type::~promise_type(){
+    if (executor != nullptr) executor->numLive--;
+}
+
+
+Executor::Executor(){
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1){
+        perror("Executor: eventfd");
+        exit(1);
+    }
+}
+
+
+Executor::~Executor(){
+    close(efd);
+}
+
+
+void Executor::spawn(Task task){
+    task.handle.promise().executor = this;
+    numLive++;
+    post(task.handle);
+}
+
+
+void Executor::post(std::coroutine_handle<> h){
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        inbox.push_back(h);
+    }
+    if (sleeping.exchange(false)){  // only a sleeping executor needs the syscall
+        uint64_t one = 1;
+        if (write(efd, &one, sizeof one) == -1) perror("Executor: eventfd write");
+    }
+}
+
+
+void Executor::add_poller(std::function<void()> poller){
+    pollers.push_back(std::move(poller));
+}
+
+
+void Executor::run_ready(){
+    uint64_t count;
+    if (read(efd, &count, sizeof count) == -1 && errno != EAGAIN) perror("Executor: eventfd read");
+    for (auto &poller : pollers) poller();
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        ready.swap(inbox);
+    }
+    for (std::coroutine_handle<> h : ready) h.resume();  // a resumed coroutine may post more: they're for next turn
+    ready.clear();
+}
+
+
+void Executor::run(){
+    while (numLive > 0){
+        run_ready();
+        // sleep unless something was posted meanwhile. a post after this sees sleeping and wakes us
+        sleeping.store(true);
+        bool empty;
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+            empty = inbox.empty();
+        }
+        if (empty && numLive > 0){
+            struct pollfd pfd{efd, POLLIN, 0};
+            if (poll(&pfd, 1, -1) == -1 && errno != EINTR) perror("Executor: poll");
+        }
+        sleeping.store(false);
+    }
+}
+
+
+Group::Group(ReliableMulticast &rm, Executor &executor, bool deliveries) : rm(rm), executor(executor){
+    rm.set_credit_callback([this]{
+        creditReturned = true;
+        this->executor.post(std::noop_coroutine());
+    });
+    executor.add_poller([this]{ pump(); });
+    if (!deliveries) return;
+    rm.set_delivery_callback([this](const QueuedMessage *msgs, size_t n){
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+            wake = inbox.empty();
+            inbox.insert(inbox.end(), msgs, msgs + n);
+        }
+        // the consumers are resumed by pump(), on the executor's next turn. an empty post just wakes it up
+        if (wake) this->executor.post(std::noop_coroutine());
+    });
+}
+
+
+void Group::pump(){
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        deliveries.insert(deliveries.end(), inbox.begin(), inbox.end());
+        inbox.clear();
+    }
+    while (!deliveries.empty() && !consumers.empty()){
+        DeliveryAwaiter *consumer = consumers.front();
+        consumers.pop_front();
+        consumer->msg = deliveries.front();
+        deliveries.pop_front();
+        executor.post(consumer->waiting);
+    }
+    if (blocked.empty() || !creditReturned.exchange(false)) return;
+    while (!blocked.empty()){
+        MulticastAwaiter *sender = blocked.front();
+        MulticastHandle handle;
+        if (!rm.try_multicast_async(sender->payload, handle, &MulticastAwaiter::completed, sender)) break;  // called back
+        blocked.pop_front();
+        if (!handle.valid()) executor.post(sender->waiting);
+    }
+}
+
+
+bool Group::MulticastAwaiter::await_suspend(std::coroutine_handle<> h){
+    waiting = h;
+    if (group->blocked.empty()){
+        // the completion may come before we return: it only posts us, and we run on the executor once we're out of here
+        MulticastHandle handle;
+        if (group->rm.try_multicast_async(payload, handle, &MulticastAwaiter::completed, this))
+            return handle.valid();  // if not, nothing will ever complete: carry on right away
+    }
+    group->blocked.push_back(this);  // no credit: pump() sends it once the credit callback says there is
+    return true;
+}
+
+
+void Group::MulticastAwaiter::completed(void *arg, uint32_t final_seq, uint32_t /*proposer*/){
+    auto *awaiter = static_cast<MulticastAwaiter *>(arg);
+    awaiter->final_seq = final_seq;
+    awaiter->group->executor.post(awaiter->waiting);
+}
+
+
+bool Group::DeliveryAwaiter::await_ready(){
+    group->pump();
+    if (!group->consumers.empty() || group->deliveries.empty()) return false;  // the ones before us go first
+    msg = group->deliveries.front();
+    group->deliveries.pop_front();
+    return true;
+}
+
+
+void Group::DeliveryAwaiter::await_suspend(std::coroutine_handle<> h){
+    waiting = h;
+    group->consumers.push_back(this);
+}
@@ -0,0 +1,143 @@
+//
+// C++20 coroutines on top of the protocol: awaitable multicasts and deliveries, run by a single-threaded executor.
+// Needs -std=c++20.
+//
+
+#ifndef PRJ1_COROUTINES_H
+#define PRJ1_COROUTINES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "reliable_multicast.h"
+
+class Executor;
+
+
+class Task{
+    /* a coroutine that nobody awaits: Executor::spawn() starts it and it cleans up after itself when it returns */
+public:
+    struct promise_type{
+        Executor *executor = nullptr;
+        Task get_return_object(){
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        };
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        };
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        };
+        void return_void(){};
+        void unhandled_exception(){
+            fprintf(stderr, "A task threw an exception. Exiting.\n");
+            exit(1);
+        };
+        ~promise_type();
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+
+class Executor{
+    /* Runs coroutines on the thread that calls run(), one at a time: thousands of producers and consumers cost a
+     * coroutine frame each instead of a thread. The protocol's threads only post() the coroutines whose msg was
+     * delivered or completed. When nothing is ready the executor sleeps on an eventfd, so it can also be driven
+     * from another event loop: poll fd() and call run_ready(). Not for the simulator (it sleeps for real). */
+public:
+    Executor();
+    ~Executor();
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void spawn(Task task);  // it starts on the executor's next turn
+    void post(std::coroutine_handle<> h);  // from any thread: resume h on the executor
+    void add_poller(std::function<void()> poller);  // called on every turn, before the ready coroutines run
+    void run_ready();  // run what's ready now. on the executor's thread
+    void run();  // until every task returned
+    int fd() const {
+        return efd;
+    };
+    size_t live() const {
+        return numLive;
+    };
+
+private:
+    friend struct Task::promise_type;
+    int efd;
+    std::mutex inboxMutex;
+    std::vector<std::coroutine_handle<>> inbox;  // posted, not yet taken (inboxMutex)
+    std::vector<std::coroutine_handle<>> ready;  // being run (only the executor's thread)
+    std::vector<std::function<void()>> pollers;
+    std::atomic<bool> sleeping{false};
+    size_t numLive = 0;
+};
+
+
+class Group{
+    /* a ReliableMulticast for coroutines:
+     *     uint32_t seq = co_await group.multicast(payload); resumes once the msg is delivered here
+     *     QueuedMessage m = co_await group.next_delivery(); the delivered msgs in the total order (JOINs/LEAVEs too)
+     * every msg goes to one next_delivery(): several consumers share the stream. deliveries nobody waited for are
+     * kept until somebody does. a multicast that finds the flow control window full waits for credit in line with
+     * the others, without holding up the executor. make it before the receiver starts: it takes the delivery
+     * callback (unless deliveries is false: then there's only multicast()) and the credit callback */
+public:
+    Group(ReliableMulticast &rm, Executor &executor, bool deliveries = true);
+    Group(const Group&) = delete;
+    Group& operator=(const Group&) = delete;
+
+    struct MulticastAwaiter{
+        Group *group;
+        Payload payload;
+        uint32_t final_seq = 0;
+        std::coroutine_handle<> waiting{};
+        bool await_ready() const noexcept {
+            return false;
+        };
+        bool await_suspend(std::coroutine_handle<> h);
+        uint32_t await_resume() const noexcept {
+            return final_seq;  // 0 if it couldn't be waited on (too many outstanding)
+        };
+        static void completed(void *arg, uint32_t final_seq, uint32_t proposer);
+    };
+    struct DeliveryAwaiter{
+        Group *group;
+        QueuedMessage msg{};
+        std::coroutine_handle<> waiting{};
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> h);
+        QueuedMessage await_resume() const noexcept {
+            return msg;
+        };
+    };
+
+    MulticastAwaiter multicast(Payload payload){
+        return MulticastAwaiter{this, std::move(payload)};
+    };
+    MulticastAwaiter multicast(uint32_t data){  // a 4 byte payload
+        return MulticastAwaiter{this, Payload::from_u32(data)};
+    };
+    DeliveryAwaiter next_delivery(){
+        return DeliveryAwaiter{this};
+    };
+
+private:
+    ReliableMulticast &rm;
+    Executor &executor;
+    std::mutex inboxMutex;
+    std::vector<QueuedMessage> inbox;  // from the delivery callback (inboxMutex)
+    std::deque<QueuedMessage> deliveries;  // nobody has taken yet (executor's thread)
+    std::deque<DeliveryAwaiter *> consumers;  // waiting for a delivery (executor's thread)
+    std::deque<MulticastAwaiter *> blocked;  // waiting for credit, in the order they came (executor's thread)
+    std::atomic<bool> creditReturned{false};
+    void pump();  // inbox --> deliveries --> consumers, and the blocked multicasts once there's credit
+};
+
+#endif //PRJ1_COROUTINES_H
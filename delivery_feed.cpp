@@ -0,0 +1,278 @@
+//
+// The delivered msgs in shared memory: one writer (the daemon), any number of local reader processes.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "delivery_feed.h"
+#include "clock.h"
+
+#define FEED_NONE   UINT64_MAX  // an index entry that is being rewritten
+
+
+static size_t align64(size_t n){
+    return (n + 63) & ~(size_t) 63;
+}
+
+
+static size_t index_offset(){
+    return align64(sizeof(FeedHeader));
+}
+
+
+static size_t records_offset(uint32_t slots){
+    return align64(index_offset() + (size_t) slots * sizeof(FeedIndexEntry));
+}
+
+
+static std::string feed_path(const char *name){
+    return std::string("/prj1.feed.") + name;
+}
+
+
+static void put(unsigned char *&p, uint32_t v){
+    memcpy(p, &v, 4);
+    p += 4;
+}
+
+
+static uint32_t get(const unsigned char *&p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    p += 4;
+    return v;
+}
+
+
+FeedWriter::FeedWriter(const char *name, uint32_t slots, uint64_t bytes){
+    if (slots == 0 || (slots & (slots - 1)) != 0 || (bytes & (bytes - 1)) != 0 ||
+        bytes < 4 * (uint64_t) (FEED_RECORD_HEADER + PAYLOAD_MAX_BUFFER)){
+        fprintf(stderr, "Bad feed size: %u slots and %lu bytes (powers of 2, at least %d bytes). Exiting.\n", slots,
+                bytes, 4 * (FEED_RECORD_HEADER + PAYLOAD_MAX_BUFFER));
+        exit(1);
+    }
+    mapped = records_offset(slots) + bytes;
+    int fd = shm_open(feed_path(name).c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd == -1){perror("shm_open"); exit(1);}
+    fchmod(fd, 0666);  // readers may run as other users
+    struct stat st{};
+    if (fstat(fd, &st) == -1 || ftruncate(fd, mapped) == -1){perror("ftruncate"); exit(1);}
+    void *mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED){perror("mmap"); exit(1);}
+    header = static_cast<FeedHeader *>(mem);
+    index = reinterpret_cast<FeedIndexEntry *>(static_cast<unsigned char *>(mem) + index_offset());
+    records = static_cast<unsigned char *>(mem) + records_offset(slots);
+    bool resume = (size_t) st.st_size == mapped && header->magic.load(std::memory_order_acquire) == FEED_MAGIC &&
+                  header->slots == slots && header->bytes == bytes;
+    if (!resume){
+        header->magic.store(0);
+        header->slots = slots;
+        header->bytes = bytes;
+        for (uint32_t i = 0; i < slots; i++) index[i].seq.store(FEED_NONE, std::memory_order_relaxed);
+        header->next.store(0);
+        header->reserved.store(0);
+        header->magic.store(FEED_MAGIC, std::memory_order_release);
+    }
+}
+
+
+FeedWriter::~FeedWriter(){
+    munmap(header, mapped);
+}
+
+
+void FeedWriter::publish(const QueuedMessage *msgs, size_t n){
+    uint64_t seq = header->next.load(std::memory_order_relaxed);
+    uint64_t reserved = header->reserved.load(std::memory_order_relaxed);
+    uint64_t bytes = header->bytes;
+    uint64_t now = monotonic_now_ns();
+    for (size_t i = 0; i < n; i++){
+        const QueuedMessage &qm = msgs[i];
+        size_t size = (FEED_RECORD_HEADER + qm.payload.size() + 7) & ~(size_t) 7;
+        size_t off = reserved & (bytes - 1);
+        if (bytes - off < size){  // records don't wrap: readers get the payload in one piece
+            reserved += bytes - off;
+            off = 0;
+        }
+        FeedIndexEntry &entry = index[seq & (header->slots - 1)];
+        // claim the bytes (and kill the entry) before writing: a reader that read any of them then sees the claim
+        entry.seq.store(FEED_NONE, std::memory_order_relaxed);
+        header->reserved.store(reserved + size, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        unsigned char *p = &records[off];
+        memcpy(p, &seq, 8);
+        memcpy(p + 8, &now, 8);
+        p += 16;
+        put(p, qm.sequence_number);
+        put(p, qm.sender);
+        put(p, qm.msg_id);
+        put(p, qm.proposer);
+        put(p, qm.kind);
+        put(p, qm.member);
+        put(p, qm.view_epoch);
+        put(p, (uint32_t) qm.payload.size());
+        if (!qm.payload.empty()) memcpy(p, qm.payload.data(), qm.payload.size());
+        entry.pos.store(reserved, std::memory_order_relaxed);
+        entry.size.store((uint32_t) (FEED_RECORD_HEADER + qm.payload.size()), std::memory_order_relaxed);
+        entry.seq.store(seq, std::memory_order_release);
+        reserved += size;
+        seq++;
+    }
+    header->next.store(seq, std::memory_order_release);
+    header->wake.fetch_add(1);
+    if (header->sleepers.load() != 0)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->wake), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+
+std::vector<FeedReaderInfo> FeedWriter::readers(){
+    std::vector<FeedReaderInfo> attached;
+    uint64_t next = header->next.load(std::memory_order_acquire);
+    for (FeedReaderSlot &slot : header->readers){
+        int32_t pid = slot.pid.load(std::memory_order_acquire);
+        if (pid == 0) continue;
+        if (kill(pid, 0) == -1 && errno == ESRCH){  // it died without detaching
+            slot.pid.compare_exchange_strong(pid, 0);
+            continue;
+        }
+        uint64_t cursor = slot.cursor.load(std::memory_order_relaxed);
+        attached.push_back(FeedReaderInfo{pid, cursor < next ? next - cursor : 0,
+                                          slot.lapped.load(std::memory_order_relaxed)});
+    }
+    std::sort(attached.begin(), attached.end(), [](const FeedReaderInfo &a, const FeedReaderInfo &b){
+        return a.behind > b.behind;
+    });
+    return attached;
+}
+
+
+FeedReader::FeedReader(const char *name, bool from_oldest){
+    int fd = shm_open(feed_path(name).c_str(), O_RDWR, 0);
+    if (fd == -1) return;
+    struct stat st{};
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(FeedHeader))
+        mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return;
+    auto *h = static_cast<FeedHeader *>(mem);
+    if (h->magic.load(std::memory_order_acquire) != FEED_MAGIC || records_offset(h->slots) + h->bytes != (size_t) st.st_size){
+        munmap(mem, st.st_size);  // the writer is still setting it up
+        return;
+    }
+    header = h;
+    mapped = st.st_size;
+    index = reinterpret_cast<FeedIndexEntry *>(static_cast<unsigned char *>(mem) + index_offset());
+    records = static_cast<unsigned char *>(mem) + records_offset(h->slots);
+    uint64_t next = header->next.load(std::memory_order_acquire);
+    next_seq = next;
+    if (from_oldest){
+        next_seq = next > header->slots ? next - header->slots : 0;
+        catch_up();
+    }
+    for (FeedReaderSlot &s : header->readers){
+        int32_t free = 0;
+        if (s.pid.load(std::memory_order_relaxed) == 0 && s.pid.compare_exchange_strong(free, getpid())){
+            s.lapped.store(0, std::memory_order_relaxed);
+            s.cursor.store(next_seq, std::memory_order_relaxed);
+            slot = &s;
+            break;
+        }
+    }
+}
+
+
+FeedReader::~FeedReader(){
+    if (header == nullptr) return;
+    if (slot != nullptr) slot->pid.store(0, std::memory_order_release);
+    munmap(header, mapped);
+}
+
+
+bool FeedReader::locate(uint64_t seq, uint64_t &pos, uint32_t &size) const {
+    const FeedIndexEntry &entry = index[seq & (header->slots - 1)];
+    if (entry.seq.load(std::memory_order_acquire) != seq) return false;
+    pos = entry.pos.load(std::memory_order_relaxed);
+    size = entry.size.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != seq) return false;  // it was rewritten while we read it
+    return header->reserved.load(std::memory_order_relaxed) <= pos + header->bytes;
+}
+
+
+int FeedReader::next(FeedEntry &e){
+    if (next_seq >= header->next.load(std::memory_order_acquire)) return FEED_EMPTY;
+    uint64_t pos;
+    uint32_t size;
+    if (!locate(next_seq, pos, size) || size < FEED_RECORD_HEADER || size > header->bytes){
+        if (slot != nullptr) slot->lapped.fetch_add(1, std::memory_order_relaxed);
+        return FEED_LAGGED;
+    }
+    const unsigned char *p = &records[pos & (header->bytes - 1)];
+    memcpy(&e.seq, p, 8);
+    memcpy(&e.published_ns, p + 8, 8);
+    p += 16;
+    e.sequence_number = get(p);
+    e.sender = get(p);
+    e.msg_id = get(p);
+    e.proposer = get(p);
+    e.kind = get(p);
+    e.member = get(p);
+    e.view_epoch = get(p);
+    p += 4;  // the payload's size: the index has it already
+    e.payload = p;
+    e.size = size - FEED_RECORD_HEADER;
+    e.pos = pos;
+    if (!intact(e)){  // overwritten while we copied the header
+        if (slot != nullptr) slot->lapped.fetch_add(1, std::memory_order_relaxed);
+        return FEED_LAGGED;
+    }
+    next_seq++;
+    if (slot != nullptr) slot->cursor.store(next_seq, std::memory_order_relaxed);
+    return FEED_OK;
+}
+
+
+bool FeedReader::intact(const FeedEntry &e) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->reserved.load(std::memory_order_relaxed) <= e.pos + header->bytes;
+}
+
+
+uint64_t FeedReader::catch_up(){
+    uint64_t end = header->next.load(std::memory_order_acquire);
+    uint64_t seq = std::max(next_seq, end > header->slots ? end - header->slots : (uint64_t) 0);
+    uint64_t pos;
+    uint32_t size;
+    while (seq < end && !locate(seq, pos, size)) seq++;
+    uint64_t skipped = seq - next_seq;
+    next_seq = seq;
+    if (slot != nullptr) slot->cursor.store(next_seq, std::memory_order_relaxed);
+    return skipped;
+}
+
+
+void FeedReader::wait(int timeout_ms){
+    // like the inbox of the shm transport: say we sleep, then look once more
+    header->sleepers.fetch_add(1);
+    uint32_t wake = header->wake.load();
+    if (next_seq >= header->next.load(std::memory_order_acquire)){
+        struct timespec ts{timeout_ms / 1000, (long) (timeout_ms % 1000) * 1000000};
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->wake), FUTEX_WAIT, wake, &ts, nullptr, 0);
+    }
+    header->sleepers.fetch_sub(1);
+}
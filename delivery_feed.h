@@ -0,0 +1,141 @@
+//
+// The delivered msgs in shared memory: one writer (the daemon), any number of local reader processes.
+//
+
+#ifndef PRJ1_DELIVERY_FEED_H
+#define PRJ1_DELIVERY_FEED_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "CL_global_snapshot.h"  // QueuedMessage
+
+#define FEED_SLOTS          65536       // msgs a reader can be behind before it's lapped (a power of 2)
+#define FEED_BYTES          (64 << 20)  // of records (a power of 2). a reader this many bytes behind is lapped too
+#define FEED_READERS        64          // readers the writer can see. more can read, unseen
+#define FEED_RECORD_HEADER  48          // + the payload, 8 byte aligned
+#define FEED_MAGIC          0x66656564  // "feed": the writer has set it up
+
+// what FeedReader::next() found
+#define FEED_OK         0   // the next msg
+#define FEED_EMPTY      1   // nothing new yet
+#define FEED_LAGGED     2   // the writer overwrote the next msg: catch_up() to go on
+
+
+struct FeedIndexEntry{
+    /* where msg seq is in the records. seq is stored last, so a reader that reads seq, then the rest, then seq
+     * again, and gets the same seq both times has the entry of that msg */
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> pos;  // in bytes ever written
+    std::atomic<uint32_t> size;  // of the record
+};
+
+
+struct FeedReaderSlot{
+    alignas(64) std::atomic<int32_t> pid;  // 0: free
+    std::atomic<uint64_t> cursor;  // the next msg it reads
+    std::atomic<uint64_t> lapped;  // times the writer overwrote what it was about to read
+};
+
+
+struct FeedHeader{
+    /* shm_open("/prj1.feed.<name>"): this, then the index (slots entries), then the records (bytes). msgs are numbered
+     * from 0 in the total order. the records are a byte ring: the writer claims the bytes of a record (reserved)
+     * before it writes them, so a reader that has read a record and then sees reserved - bytes <= its position
+     * knows nothing overwrote it meanwhile */
+    std::atomic<uint32_t> magic;
+    uint32_t slots;
+    uint64_t bytes;
+    alignas(64) std::atomic<uint64_t> next;      // the number of the next msg: everything below is published
+    std::atomic<uint64_t> reserved;              // bytes ever claimed by the writer
+    alignas(64) std::atomic<uint32_t> wake;      // the futex readers sleep on: bumped after every batch
+    std::atomic<uint32_t> sleepers;
+    FeedReaderSlot readers[FEED_READERS];
+};
+
+
+typedef struct {
+    uint64_t seq;           // its place in the feed
+    uint64_t published_ns;  // CLOCK_MONOTONIC when the writer published it
+    uint32_t sequence_number, sender, msg_id, proposer, kind, member, view_epoch;
+    const unsigned char *payload;  // in the shared memory: see FeedReader::intact()
+    size_t size;
+    uint64_t pos;
+} FeedEntry;
+
+
+typedef struct {
+    int pid;
+    uint64_t behind;  // msgs published that it hasn't read
+    uint64_t lapped;
+} FeedReaderInfo;
+
+
+class FeedWriter{
+    /* the daemon's side. hand it every delivered msg:
+     *     rm.set_delivery_callback([&feed](const QueuedMessage *m, size_t n){ feed.publish(m, n); });
+     * a publish copies the msgs into the shared memory once (what readers get are views of that copy) and never
+     * waits for readers: a reader that falls FEED_SLOTS msgs or FEED_BYTES bytes behind loses what got overwritten
+     * and finds out. a restarted writer goes on with the numbers of the feed it finds, if it's the same size */
+public:
+    explicit FeedWriter(const char *name, uint32_t slots = FEED_SLOTS, uint64_t bytes = FEED_BYTES);
+    ~FeedWriter();
+    FeedWriter(const FeedWriter&) = delete;
+    FeedWriter& operator=(const FeedWriter&) = delete;
+
+    void publish(const QueuedMessage *msgs, size_t n);  // one writer thread (the delivery callback is)
+    uint64_t published() const {
+        return header->next.load(std::memory_order_relaxed);
+    };
+    std::vector<FeedReaderInfo> readers();  // the readers attached, slowest first. frees the slots of dead ones
+
+private:
+    FeedHeader *header;
+    FeedIndexEntry *index;
+    unsigned char *records;
+    size_t mapped;
+};
+
+
+class FeedReader{
+    /* a local process reading the feed in the total order, at its own pace:
+     *     FeedEntry e;
+     *     while (true){
+     *         int rv = reader.next(e);
+     *         if (rv == FEED_EMPTY) reader.wait(100);
+     *         else if (rv == FEED_LAGGED) reader.catch_up();
+     *         else if (use(e.payload, e.size), reader.intact(e)) ...  // otherwise what use() read was overwritten
+     *     }
+     * the payload is read where the writer put it, so a reader that is slow while it holds an entry may find it was
+     * overwritten (intact() is false). copy it out first if that matters */
+public:
+    explicit FeedReader(const char *name, bool from_oldest = false);  // from the next msg published, or the oldest kept
+    ~FeedReader();
+    FeedReader(const FeedReader&) = delete;
+    FeedReader& operator=(const FeedReader&) = delete;
+
+    bool attached() const {  // false: there is no such feed (yet)
+        return header != nullptr;
+    };
+    int next(FeedEntry &e);
+    bool intact(const FeedEntry &e) const;  // nothing overwrote it since next() returned it
+    uint64_t catch_up();  // to the oldest msg still there. returns the msgs skipped
+    void wait(int timeout_ms);  // until something is published (or the timeout)
+    uint64_t cursor() const {
+        return next_seq;
+    };
+
+private:
+    FeedHeader *header = nullptr;
+    FeedIndexEntry *index = nullptr;
+    unsigned char *records = nullptr;
+    size_t mapped = 0;
+    FeedReaderSlot *slot = nullptr;  // nullptr if they were all taken
+    uint64_t next_seq = 0;
+    bool locate(uint64_t seq, uint64_t &pos, uint32_t &size) const;  // msg seq is still there
+};
+
+#endif //PRJ1_DELIVERY_FEED_H
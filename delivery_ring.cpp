@@ -0,0 +1,44 @@
+//
+// A single-producer single-consumer ring of delivered msgs, for an application that consumes them on its own thread.
+//
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+#include "delivery_ring.h"
+
+
+DeliveryRing::DeliveryRing(size_t capacity){
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    msgs.resize(size);
+    mask = size - 1;
+}
+
+
+void DeliveryRing::push(const QueuedMessage *batch, size_t n){
+    uint64_t h = head.load(std::memory_order_relaxed);
+    while (n > 0){
+        size_t room = msgs.size() - (size_t) (h - tail.load(std::memory_order_acquire));
+        if (room == 0){  // the consumer is behind: wait for it rather than lose msgs
+            std::this_thread::yield();
+            continue;
+        }
+        size_t k = std::min(n, room);
+        for (size_t i = 0; i < k; i++) msgs[(h + i) & mask] = batch[i];
+        h += k;
+        head.store(h, std::memory_order_release);
+        batch += k;
+        n -= k;
+    }
+}
+
+
+size_t DeliveryRing::poll(QueuedMessage *out, size_t max){
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    size_t k = std::min((size_t) (head.load(std::memory_order_acquire) - t), max);
+    for (size_t i = 0; i < k; i++) out[i] = std::move(msgs[(t + i) & mask]);  // the slot lets go of the payload
+    tail.store(t + k, std::memory_order_release);
+    return k;
+}
@@ -0,0 +1,42 @@
+//
+// A single-producer single-consumer ring of delivered msgs, for an application that consumes them on its own thread.
+//
+
+#ifndef PRJ1_DELIVERY_RING_H
+#define PRJ1_DELIVERY_RING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+#include "CL_global_snapshot.h"  // QueuedMessage
+
+#define DELIVERY_RING_SIZE  65536   // default capacity in msgs (a power of 2)
+
+
+class DeliveryRing{
+    /* The producer is the delivery callback:
+     *     rm.set_delivery_callback([&ring](const QueuedMessage *m, size_t n){ ring.push(m, n); });
+     * and the consumer polls batches on its own thread. Each side only writes its own index, so a push or a poll is
+     * a copy and one release store, whatever the batch size. The order is kept.
+     * A full ring makes push() wait for the consumer (the receiver stops too): msgs are never dropped. */
+public:
+    explicit DeliveryRing(size_t capacity = DELIVERY_RING_SIZE);  // rounded up to a power of 2
+    DeliveryRing(const DeliveryRing&) = delete;
+    DeliveryRing& operator=(const DeliveryRing&) = delete;
+
+    void push(const QueuedMessage *msgs, size_t n);  // producer. waits while the ring is full
+    size_t poll(QueuedMessage *out, size_t max);  // consumer. up to max msgs, 0 if there are none
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    };
+
+private:
+    std::vector<QueuedMessage> msgs;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> head{0};  // written by the producer
+    alignas(64) std::atomic<uint64_t> tail{0};  // written by the consumer
+};
+
+#endif //PRJ1_DELIVERY_RING_H
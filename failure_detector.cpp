@@ -0,0 +1,59 @@
+//
+// Timeout based heartbeat failure detector.
+//
+
+#include "failure_detector.h"
+
+
+FailureDetector::FailureDetector(int timeoutMs)
+        : timeout_ns((uint64_t) timeoutMs * 1000000){
+}
+
+
+void FailureDetector::start(int numHosts, int selfRank, uint64_t now_ns){
+    std::lock_guard<std::mutex> lock(mutex);
+    lastHeard.assign(numHosts, now_ns);
+    self_rank = selfRank;
+}
+
+
+void FailureDetector::heard_from(int rank, uint64_t now_ns){
+    if (rank < 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((size_t) rank >= lastHeard.size()) lastHeard.resize(rank + 1, now_ns);
+    if (now_ns > lastHeard[rank]) lastHeard[rank] = now_ns;
+}
+
+
+std::vector<int> FailureDetector::check(uint64_t now_ns){
+    std::vector<int> newlySuspected;
+    if (!enabled()) return newlySuspected;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int r = 0; r < (int) lastHeard.size(); r++){
+        if (r == self_rank || suspected.test(r)) continue;
+        if (now_ns > lastHeard[r] && now_ns - lastHeard[r] > timeout_ns){
+            suspected.set(r);
+            newlySuspected.push_back(r);
+        }
+    }
+    return newlySuspected;
+}
+
+
+void FailureDetector::suspect(int rank){
+    std::lock_guard<std::mutex> lock(mutex);
+    suspected.set(rank);
+}
+
+
+bool FailureDetector::is_suspected(int rank){
+    std::lock_guard<std::mutex> lock(mutex);
+    return suspected.test(rank);
+}
+
+
+void FailureDetector::watch(int rank, uint64_t now_ns){
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((size_t) rank >= lastHeard.size()) lastHeard.resize(rank + 1, now_ns);
+    lastHeard[rank] = now_ns;
+}
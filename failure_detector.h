@@ -0,0 +1,44 @@
+//
+// Timeout based heartbeat failure detector.
+//
+
+#ifndef PRJ1_FAILURE_DETECTOR_H
+#define PRJ1_FAILURE_DETECTOR_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "membership.h"
+
+#define HEARTBEAT_INTERVAL  500     // in miliseconds. how often we send heartbeats (and check for silent hosts)
+#define FAILURE_TIMEOUT     15000   // in miliseconds. default silence after which a host is declared failed (-f)
+
+
+class FailureDetector{
+    /* We suspect a host once we haven't heard anything from it for timeout_ms.
+     * Every message we can attribute to a host counts (not only heartbeats), so a lost heartbeat from a busy host is harmless.
+     * A host is reported by check() only once: the view change takes it from there.
+     * Worst case detection time is timeout_ms + HEARTBEAT_INTERVAL (+ the emulated delay on the heartbeat). */
+public:
+    explicit FailureDetector(int timeoutMs);
+    void start(int numHosts, int selfRank, uint64_t now_ns);  // everybody counts as just heard from
+
+    void heard_from(int rank, uint64_t now_ns);
+    std::vector<int> check(uint64_t now_ns);  // ranks that just timed out
+    void suspect(int rank);  // someone else detected it first
+    void watch(int rank, uint64_t now_ns);  // a host joined: it counts as just heard from
+    bool is_suspected(int rank);
+    bool enabled() const {
+        return timeout_ns != 0;
+    };
+
+private:
+    std::mutex mutex;
+    std::vector<uint64_t> lastHeard;  // by rank
+    HostSet suspected;
+    int self_rank = -1;
+    uint64_t timeout_ns;  // 0 disables the detector
+};
+
+#endif //PRJ1_FAILURE_DETECTOR_H
@@ -0,0 +1,204 @@
+//
+// Forward error correction for the DATA and SEQ paths (-F n,k): a systematic Reed-Solomon erasure code over GF(2^8).
+//
+
+#include <algorithm>
+
+#include "fec.h"
+
+
+/* GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d): addition is xor, multiplication goes through logs */
+struct GfTables{
+    uint8_t exp[512];
+    uint8_t log[256];
+    GfTables() : exp{}, log{}{
+        int x = 1;
+        for (int i = 0; i < 255; i++){
+            exp[i] = (uint8_t) x;
+            log[x] = (uint8_t) i;
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        for (int i = 255; i < 512; i++) exp[i] = exp[i - 255];
+    }
+};
+static const GfTables gf;
+
+
+uint8_t gf_mul(uint8_t a, uint8_t b){
+    if (a == 0 || b == 0) return 0;
+    return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+
+uint8_t gf_inv(uint8_t a){
+    return gf.exp[255 - gf.log[a]];  // a must not be 0
+}
+
+
+uint8_t fec_coefficient(int row, int index){
+    // Cauchy matrix 1/(x_row + y_index) with x_row = 255 - row and y_index = index (disjoint while n + k <= 256),
+    // each column scaled so that row 0 is all ones
+    return gf_mul((uint8_t) (255 ^ index), gf_inv((uint8_t) ((255 - row) ^ index)));
+}
+
+
+static void mul_add(unsigned char *dst, const unsigned char *src, uint8_t c, size_t len){
+    // dst += c * src
+    if (c == 0) return;
+    if (c == 1){
+        for (size_t i = 0; i < len; i++) dst[i] ^= src[i];
+        return;
+    }
+    int lc = gf.log[c];
+    for (size_t i = 0; i < len; i++) if (src[i] != 0) dst[i] ^= gf.exp[lc + gf.log[src[i]]];
+}
+
+
+static std::vector<unsigned char> shard_of(const std::vector<unsigned char> &pkt, size_t len){
+    // what the code works on: the packet's length (2 bytes) then the packet, zero padded to len
+    std::vector<unsigned char> shard(len, 0);
+    shard[0] = (unsigned char) (pkt.size() >> 8);
+    shard[1] = (unsigned char) (pkt.size() & 0xff);
+    std::copy(pkt.begin(), pkt.end(), shard.begin() + 2);
+    return shard;
+}
+
+
+static void put32(unsigned char *buf, uint32_t i){  // big endian like packi32 (fec.cpp also links without the rest)
+    buf[0] = i >> 24; buf[1] = i >> 16; buf[2] = i >> 8; buf[3] = i;
+}
+
+
+static uint32_t get32(const unsigned char *buf){
+    return ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) | ((uint32_t) buf[2] << 8) | buf[3];
+}
+
+
+static void put_header(std::vector<unsigned char> &frame, uint32_t from, uint32_t block, uint32_t index, uint32_t count){
+    put32(&frame[0], FECMSG_TYPE);
+    put32(&frame[4], from);
+    put32(&frame[8], block);
+    put32(&frame[12], index);  // source index, or parity row
+    put32(&frame[16], count);  // 0 on a source frame. the number of sources in the block on a parity frame
+}
+
+
+FecEncoder::FecEncoder(int n, int k, uint32_t from) : n(n), k(k), from(from){
+}
+
+
+void FecEncoder::add(const unsigned char *pkt, size_t size, uint32_t blockID, uint64_t now_ns,
+                     std::vector<std::vector<unsigned char>> &out){
+    if (sources.empty()){
+        block = blockID;
+        started_ns = now_ns;
+    }
+    std::vector<unsigned char> frame(FEC_HEADER_SIZE + size);
+    put_header(frame, from, block, sources.size(), 0);
+    std::copy(pkt, pkt + size, frame.begin() + FEC_HEADER_SIZE);
+    out.push_back(frame);
+    sources.emplace_back(pkt, pkt + size);
+    if ((int) sources.size() == n) emit_parity(out);
+}
+
+
+void FecEncoder::flush(uint64_t now_ns, std::vector<std::vector<unsigned char>> &out){
+    if (!sources.empty() && now_ns - started_ns >= (uint64_t) FEC_FLUSH * 1000000) emit_parity(out);
+}
+
+
+void FecEncoder::emit_parity(std::vector<std::vector<unsigned char>> &out){
+    size_t len = 0;
+    for (const auto &s : sources) len = std::max(len, s.size());
+    len += 2;
+    std::vector<std::vector<unsigned char>> shards;
+    for (const auto &s : sources) shards.push_back(shard_of(s, len));
+    uint32_t count = sources.size();
+    for (int row = 0; row < k; row++){
+        std::vector<unsigned char> frame(FEC_HEADER_SIZE + len, 0);
+        put_header(frame, from, block, row, count);
+        for (uint32_t i = 0; i < count; i++)
+            mul_add(&frame[FEC_HEADER_SIZE], shards[i].data(), fec_coefficient(row, (int) i), len);
+        out.push_back(frame);
+    }
+    sources.clear();
+}
+
+
+void FecDecoder::receive(const unsigned char *frame, size_t size, std::vector<std::vector<unsigned char>> &out){
+    if (size < FEC_HEADER_SIZE) return;
+    uint32_t from = get32(&frame[4]);
+    uint32_t blockID = get32(&frame[8]);
+    uint32_t index = get32(&frame[12]);
+    uint32_t count = get32(&frame[16]);
+    if (index >= FEC_MAX_SHARDS || count > FEC_MAX_SHARDS || (count != 0 && size < FEC_HEADER_SIZE + 2)) return;
+    std::map<uint32_t, Block> &ofSender = blocks[from];
+    Block &b = ofSender[blockID];
+    std::vector<unsigned char> payload(frame + FEC_HEADER_SIZE, frame + size);
+    if (count == 0){  // a source
+        if (b.sources.count(index) != 0) return;  // rebuilt already (or a duplicate)
+        out.push_back(payload);
+        b.sources[index] = payload;
+    } else {
+        b.count = count;
+        b.parity.emplace(index, payload);
+    }
+    try_recover(b, out);
+    while (ofSender.size() > FEC_WINDOW) ofSender.erase(ofSender.begin());
+}
+
+
+void FecDecoder::try_recover(Block &b, std::vector<std::vector<unsigned char>> &out){
+    if (b.done || b.count == 0) return;
+    std::vector<int> missing;
+    for (int i = 0; i < b.count; i++) if (b.sources.count(i) == 0) missing.push_back(i);
+    if (missing.empty() || b.parity.size() < missing.size()){
+        b.done = missing.empty();
+        return;
+    }
+    /* the parity rows minus what the sources we have contribute leaves m equations in the m missing sources.
+     * every square piece of a Cauchy matrix is invertible, so Gauss-Jordan always gets through */
+    size_t m = missing.size();
+    size_t len = b.parity.begin()->second.size();
+    std::vector<std::vector<uint8_t>> a(m, std::vector<uint8_t>(m));
+    std::vector<std::vector<unsigned char>> rhs;
+    auto p = b.parity.begin();
+    for (size_t r = 0; r < m; r++, ++p){
+        if (p->second.size() != len) return;
+        rhs.push_back(p->second);
+        for (const auto &s : b.sources){
+            if (s.second.size() + 2 > len) return;
+            std::vector<unsigned char> shard = shard_of(s.second, len);
+            mul_add(rhs[r].data(), shard.data(), fec_coefficient(p->first, s.first), len);
+        }
+        for (size_t c = 0; c < m; c++) a[r][c] = fec_coefficient(p->first, missing[c]);
+    }
+    for (size_t c = 0; c < m; c++){
+        size_t pivot = c;
+        while (pivot < m && a[pivot][c] == 0) pivot++;
+        if (pivot == m) return;
+        std::swap(a[c], a[pivot]);
+        std::swap(rhs[c], rhs[pivot]);
+        uint8_t inv = gf_inv(a[c][c]);
+        for (size_t j = 0; j < m; j++) a[c][j] = gf_mul(a[c][j], inv);
+        std::vector<unsigned char> row(len, 0);
+        mul_add(row.data(), rhs[c].data(), inv, len);
+        rhs[c] = row;
+        for (size_t r = 0; r < m; r++){
+            if (r == c || a[r][c] == 0) continue;
+            uint8_t factor = a[r][c];
+            for (size_t j = 0; j < m; j++) a[r][j] ^= gf_mul(factor, a[c][j]);
+            mul_add(rhs[r].data(), rhs[c].data(), factor, len);
+        }
+    }
+    for (size_t c = 0; c < m; c++){
+        size_t size = ((size_t) rhs[c][0] << 8) | rhs[c][1];
+        if (size + 2 > len) continue;  // garbage: some frame of this block wasn't what it said
+        std::vector<unsigned char> pkt(rhs[c].begin() + 2, rhs[c].begin() + 2 + size);
+        out.push_back(pkt);
+        b.sources[missing[c]] = pkt;
+        recovered++;
+    }
+    b.done = true;
+}
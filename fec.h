@@ -0,0 +1,78 @@
+//
+// Forward error correction for the DATA and SEQ paths (-F n,k): a systematic Reed-Solomon erasure code over GF(2^8).
+//
+
+#ifndef PRJ1_FEC_H
+#define PRJ1_FEC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#define FEC_MAX_SHARDS  256     // n + k can't be more than this (the size of the field)
+#define FEC_FLUSH       10      // in miliseconds. a block that doesn't fill up gets its parity this long after it started
+#define FEC_WINDOW      64      // blocks per sender a receiver keeps (older ones are given up on)
+#define FECMSG_TYPE     14      // a frame: one source packet or one parity packet of a block
+#define FEC_HEADER_SIZE 20      // + the packet (source) or the parity bytes
+
+
+class FecEncoder{
+    /* one per destination (a host or the ip multicast group). Source packets go out right away inside a frame (the
+     * code is systematic, so a receiver that gets them never waits). After every n of them, or FEC_FLUSH after the
+     * first one of a block that doesn't fill up, k parity frames follow. Any n of the n + k frames of a block
+     * rebuild the whole block.
+     * Parity row 0 is the plain XOR of the block: with k = 1 this is the XOR code. The other rows come from a
+     * Cauchy matrix (scaled so row 0 is all ones), so any k losses in a block can be recovered. */
+public:
+    FecEncoder(int n, int k, uint32_t from);
+    // frames the packet into out, followed by the block's parity frames if it's full now
+    void add(const unsigned char *pkt, size_t size, uint32_t block, uint64_t now_ns,
+             std::vector<std::vector<unsigned char>> &out);
+    // parity of a block that has been waiting for more than FEC_FLUSH (appended to out)
+    void flush(uint64_t now_ns, std::vector<std::vector<unsigned char>> &out);
+    bool in_block() const {
+        return !sources.empty();
+    };
+
+private:
+    int n;
+    int k;
+    uint32_t from;
+    uint32_t block = 0;
+    uint64_t started_ns = 0;
+    std::vector<std::vector<unsigned char>> sources;  // packets of the current block
+    void emit_parity(std::vector<std::vector<unsigned char>> &out);
+};
+
+
+class FecDecoder{
+    /* every frame we get is unwrapped: a source packet comes out as it is, and once a block has as many frames
+     * as it has sources, the sources we missed come out rebuilt. Blocks are per sender (its block numbers are
+     * shared by all its destinations, so ours may skip some). */
+public:
+    // appends the packets this frame gives us (the source itself and/or the ones it let us rebuild)
+    void receive(const unsigned char *frame, size_t size, std::vector<std::vector<unsigned char>> &out);
+    uint64_t recovered_count() const {
+        return recovered;
+    };
+
+private:
+    struct Block{
+        int count = 0;  // number of sources (known once a parity arrived)
+        bool done = false;
+        std::map<int, std::vector<unsigned char>> sources;  // index --> packet
+        std::map<int, std::vector<unsigned char>> parity;   // parity row --> bytes
+    };
+    std::map<uint32_t, std::map<uint32_t, Block>> blocks;  // sender --> block --> what we have of it
+    uint64_t recovered = 0;
+    void try_recover(Block &b, std::vector<std::vector<unsigned char>> &out);
+};
+
+
+// helpers (exposed for the benchmark)
+uint8_t gf_mul(uint8_t a, uint8_t b);
+uint8_t gf_inv(uint8_t a);
+uint8_t fec_coefficient(int row, int index);  // parity row --> multiplier of source index
+
+#endif //PRJ1_FEC_H
@@ -0,0 +1,33 @@
+//
+// Credit based flow control: how many of our msgs may be outstanding, from the buffer space receivers advertise.
+//
+
+#include <algorithm>
+
+#include "flow_control.h"
+
+
+CreditWindow::CreditWindow(){
+    for (auto &c : credits) c.store(FLOW_WINDOW, std::memory_order_relaxed);
+}
+
+
+void CreditWindow::advertised(int rank, uint32_t credit){
+    if (rank >= 0 && rank < MAX_GROUP_SIZE) credits[rank].store(credit, std::memory_order_relaxed);
+}
+
+
+uint32_t CreditWindow::window(const HostSet &members, int selfRank) const {
+    uint32_t w = maxWindow.load();
+    if (w == 0) return 0;
+    for (int r = 0; r < MAX_GROUP_SIZE; r++){
+        if (r != selfRank && members.test(r)) w = std::min(w, credits[r].load(std::memory_order_relaxed));
+    }
+    return std::max(w, (uint32_t) 1);
+}
+
+
+uint32_t CreditWindow::credit(size_t queued, int members){
+    if (queued >= FLOW_RECV_BUFFER || members < 1) return 0;
+    return (uint32_t) ((FLOW_RECV_BUFFER - queued) / members);
+}
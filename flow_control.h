@@ -0,0 +1,43 @@
+//
+// Credit based flow control: how many of our msgs may be outstanding, from the buffer space receivers advertise.
+//
+
+#ifndef PRJ1_FLOW_CONTROL_H
+#define PRJ1_FLOW_CONTROL_H
+
+#include <cstdint>
+#include <atomic>
+
+#include "membership.h"
+
+#define FLOW_WINDOW         256     // most of our msgs that may be outstanding (not final yet) at once
+#define FLOW_RECV_BUFFER    8192    // msgs a receiver is willing to hold in its delivery queue, shared by the senders
+#define FLOW_WAIT           1000    // in microseconds. how often a blocked sender looks at its window again
+
+
+class CreditWindow{
+    /* Every receiver advertises its credit: its share of the delivery queue space it has left (FLOW_RECV_BUFFER
+     * split between the members), on every ACK and heartbeat. A sender keeps at most min(FLOW_WINDOW, the smallest
+     * credit in its view) msgs outstanding. The window is counted in msgs that aren't final yet, so it is clocked by
+     * the finalizations like a tcp window is by the acks, and a slow receiver (its queue fills up) slows everybody's
+     * senders down before its socket buffer overflows. The window never closes completely: one msg can always be
+     * outstanding, so a sender can't stall for good on a stale credit. Hosts we haven't heard from yet count as FLOW_WINDOW. */
+public:
+    CreditWindow();
+
+    void advertised(int rank, uint32_t credit);  // from an ACK or a heartbeat of the host of that rank
+    uint32_t window(const HostSet &members, int selfRank) const;  // 0 if flow control is off
+    void set_limit(uint32_t limit){  // FLOW_WINDOW by default. 0 turns flow control off
+        maxWindow.store(limit);
+    };
+    bool enabled() const {
+        return maxWindow.load() != 0;
+    };
+    static uint32_t credit(size_t queued, int members);  // what a receiver with that many msgs queued advertises
+
+private:
+    std::atomic<uint32_t> credits[MAX_GROUP_SIZE];  // by rank
+    std::atomic<uint32_t> maxWindow{FLOW_WINDOW};
+};
+
+#endif //PRJ1_FLOW_CONTROL_H
@@ -0,0 +1,160 @@
+//
+// Fragmentation of DATA datagrams bigger than the MTU, reassembly, and the NAKs for single lost fragments.
+//
+
+#include <algorithm>
+#include <cstring>
+
+#include "fragmentation.h"
+
+
+static void put32(unsigned char *buf, uint32_t i){  // big endian like packi32
+    buf[0] = i >> 24; buf[1] = i >> 16; buf[2] = i >> 8; buf[3] = i;
+}
+
+
+static uint32_t get32(const unsigned char *buf){
+    return ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) | ((uint32_t) buf[2] << 8) | buf[3];
+}
+
+
+size_t frag_nak_message_size(const FragNakMessage &fragNakMessage){
+    return FRAGNAK_HEADER_SIZE + 8 * fragNakMessage.ranges.size();
+}
+
+
+void serialize_frag_nak_message(const FragNakMessage &fragNakMessage, unsigned char * buf){
+    put32(&buf[0], fragNakMessage.type);
+    put32(&buf[4], fragNakMessage.from);
+    put32(&buf[8], fragNakMessage.sender);
+    put32(&buf[12], fragNakMessage.msg_id);
+    put32(&buf[16], fragNakMessage.ranges.size());
+    for (size_t i = 0; i < fragNakMessage.ranges.size(); i++){
+        put32(&buf[FRAGNAK_HEADER_SIZE + 8 * i], fragNakMessage.ranges[i].lo);
+        put32(&buf[FRAGNAK_HEADER_SIZE + 8 * i + 4], fragNakMessage.ranges[i].hi);
+    }
+}
+
+
+void deserialize_frag_nak_message(const unsigned char * buf, size_t size, FragNakMessage &fragNakMessage){
+    fragNakMessage.type = get32(&buf[0]);
+    fragNakMessage.from = get32(&buf[4]);
+    fragNakMessage.sender = get32(&buf[8]);
+    fragNakMessage.msg_id = get32(&buf[12]);
+    uint32_t count = std::min(get32(&buf[16]), (uint32_t) FRAG_MAX_RANGES);
+    if (size < FRAGNAK_HEADER_SIZE + 8 * (size_t) count) count = 0;
+    fragNakMessage.ranges.resize(count);
+    for (uint32_t i = 0; i < count; i++){
+        fragNakMessage.ranges[i].lo = get32(&buf[FRAGNAK_HEADER_SIZE + 8 * i]);
+        fragNakMessage.ranges[i].hi = get32(&buf[FRAGNAK_HEADER_SIZE + 8 * i + 4]);
+    }
+}
+
+
+Payload Fragmenter::fragment(const Payload &packet, uint32_t from, uint32_t index){
+    // the DATA's sender and msg_id are the 2nd and 3rd words of its header
+    size_t offset = (size_t) index * FRAG_BYTES;
+    size_t len = std::min((size_t) FRAG_BYTES, packet.size() - offset);
+    Payload frag = Payload::allocate(FRAG_HEADER_SIZE + len);
+    unsigned char *buf = frag.mutable_data();
+    put32(&buf[0], FRAGMSG_TYPE);
+    put32(&buf[4], from);
+    memcpy(&buf[8], packet.data() + 4, 8);
+    put32(&buf[16], index);
+    put32(&buf[20], packet.size());
+    memcpy(&buf[FRAG_HEADER_SIZE], packet.data() + offset, len);
+    return frag;
+}
+
+
+void Fragmenter::keep(const Payload &packet){
+    auto key = std::make_pair(get32(packet.data() + 4), get32(packet.data() + 8));
+    std::lock_guard<std::mutex> lock(mutex);
+    if (kept.count(key) == 0) order.push_back(key);
+    kept[key] = packet;  // a retransmission replaces it
+    while (order.size() > FRAG_CACHE){
+        kept.erase(order.front());
+        order.pop_front();
+    }
+}
+
+
+Payload Fragmenter::find(uint32_t sender, uint32_t msg_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = kept.find(std::make_pair(sender, msg_id));
+    return it == kept.end() ? Payload() : it->second;
+}
+
+
+int Reassembler::add(const unsigned char *frag, size_t size, uint64_t now_ns, Payload &whole){
+    if (size <= FRAG_HEADER_SIZE) return FRAG_DROPPED;
+    uint32_t from = get32(&frag[4]);
+    auto key = std::make_pair(get32(&frag[8]), get32(&frag[12]));
+    uint32_t index = get32(&frag[16]);
+    uint32_t total = get32(&frag[20]);
+    size_t len = size - FRAG_HEADER_SIZE;
+    uint32_t count = Fragmenter::count(total);
+    if (total > PAYLOAD_MAX_BUFFER || index >= count ||
+        len != std::min((size_t) FRAG_BYTES, (size_t) total - (size_t) index * FRAG_BYTES)) return FRAG_DROPPED;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (finished.count(key) != 0) return FRAG_DUPLICATE;
+    auto it = partials.find(key);
+    if (it == partials.end()){
+        if (held + total > FRAG_MEMORY) return FRAG_DROPPED;  // the sender sends it again later
+        Partial p;
+        p.buf = Payload::allocate(total);
+        p.got.assign(count, false);
+        p.missing = count;
+        p.from = from;
+        p.nak_ns = 0;
+        it = partials.emplace(key, std::move(p)).first;
+        held += total;
+    }
+    Partial &p = it->second;
+    if (p.buf.size() != total) return FRAG_DROPPED;
+    if (p.got[index]) return FRAG_DUPLICATE;
+    memcpy(p.buf.mutable_data() + (size_t) index * FRAG_BYTES, &frag[FRAG_HEADER_SIZE], len);
+    p.got[index] = true;
+    p.missing--;
+    p.last_ns = now_ns;
+    p.from = from;  // NAK whoever sent us the latest one
+    if (p.missing > 0) return FRAG_PARTIAL;
+    whole = std::move(p.buf);
+    held -= total;
+    partials.erase(it);
+    finished[key] = now_ns;
+    return FRAG_COMPLETE;
+}
+
+
+std::vector<FragNak> Reassembler::sweep(uint32_t self, uint64_t now_ns, uint64_t &expired){
+    std::vector<FragNak> naks;
+    uint64_t retry = (uint64_t) FRAG_RETRY * 1000000;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = finished.begin(); it != finished.end();){
+        if (now_ns - it->second > (uint64_t) FRAG_LINGER * 1000000) it = finished.erase(it);
+        else ++it;
+    }
+    for (auto it = partials.begin(); it != partials.end();){
+        Partial &p = it->second;
+        if (now_ns - p.last_ns > (uint64_t) FRAG_TIMEOUT * 1000000){
+            held -= p.buf.size();
+            it = partials.erase(it);
+            expired++;
+            continue;
+        }
+        if (now_ns - p.last_ns >= retry && now_ns - p.nak_ns >= retry){
+            p.nak_ns = now_ns;
+            FragNak n{p.from, FragNakMessage{FRAGNAKMSG_TYPE, self, it->first.first, it->first.second, {}}};
+            for (uint32_t i = 0; i < p.got.size() && n.nak.ranges.size() <= FRAG_MAX_RANGES; i++){
+                if (p.got[i]) continue;
+                if (!n.nak.ranges.empty() && n.nak.ranges.back().hi + 1 == i) n.nak.ranges.back().hi = i;
+                else n.nak.ranges.push_back(NakRange{i, i});
+            }
+            if (n.nak.ranges.size() > FRAG_MAX_RANGES) n.nak.ranges.pop_back();  // the rest at the next retry
+            naks.push_back(n);
+        }
+        ++it;
+    }
+    return naks;
+}
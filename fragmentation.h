@@ -0,0 +1,107 @@
+//
+// Fragmentation of DATA datagrams bigger than the MTU, reassembly, and the NAKs for single lost fragments.
+//
+
+#ifndef PRJ1_FRAGMENTATION_H
+#define PRJ1_FRAGMENTATION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "payload.h"
+#include "nak_stream.h"
+
+#define FRAG_MTU            1400    // biggest datagram we send as it is. a bigger DATA goes out in fragments this big
+#define FRAGMSG_TYPE        15      // a piece of a DATA datagram
+#define FRAGNAKMSG_TYPE     16      // a receiver asks for the fragments of a msg it's missing
+#define FRAG_HEADER_SIZE    24      // + a piece of the DATA
+#define FRAG_BYTES          (FRAG_MTU - FRAG_HEADER_SIZE)   // of the DATA in every fragment but the last
+#define FRAGNAK_HEADER_SIZE 20      // + 8 per range of fragment indexes
+#define FRAG_MAX_RANGES     32      // ranges in one FragNakMessage
+#define FRAG_RETRY          20      // in miliseconds. a partial msg that got nothing for this long NAKs what it's missing
+#define FRAG_TIMEOUT        10000   // in miliseconds. a partial msg that got nothing for this long is given up on
+#define FRAG_LINGER         500     // in miliseconds. fragments of a msg we put together this recently are duplicates
+#define FRAG_MEMORY         (32 << 20)  // bytes of partial msgs a receiver holds at once. fragments of more are dropped
+#define FRAG_CACHE          128     // DATA datagrams a host keeps to resend single fragments of
+
+
+typedef struct {
+    uint32_t type;      // must be 16
+    uint32_t from;      // process id of the host asking
+    uint32_t sender;    // sender of the DataMessage
+    uint32_t msg_id;    // the id of the DataMessage
+    std::vector<NakRange> ranges;   // fragment indexes missing (inclusive)
+} FragNakMessage;
+
+
+typedef struct {
+    uint32_t to;        // the host that sent us the fragments
+    FragNakMessage nak;
+} FragNak;
+
+size_t frag_nak_message_size(const FragNakMessage &fragNakMessage);
+void serialize_frag_nak_message(const FragNakMessage &fragNakMessage, unsigned char * buf);
+void deserialize_frag_nak_message(const unsigned char * buf, size_t size, FragNakMessage &fragNakMessage);
+
+
+class Fragmenter{
+    /* splits a DATA datagram into fragments of at most FRAG_MTU bytes. each fragment says who sent it (the sender
+     * or a tree relay): that's where its NAKs go. the last FRAG_CACHE datagrams we fragmented are kept (shared with
+     * the sender's buffers, not copied) so a NAK gets only the fragments it asks for, not the whole msg again */
+public:
+    static uint32_t count(size_t size){  // fragments of a datagram that big
+        return (uint32_t) ((size + FRAG_BYTES - 1) / FRAG_BYTES);
+    };
+    static Payload fragment(const Payload &packet, uint32_t from, uint32_t index);
+    void keep(const Payload &packet);
+    Payload find(uint32_t sender, uint32_t msg_id);  // empty if it's not kept (anymore)
+
+private:
+    std::mutex mutex;
+    std::map<std::pair<uint32_t, uint32_t>, Payload> kept;  // (sender, msg_id) --> its DATA datagram
+    std::deque<std::pair<uint32_t, uint32_t>> order;  // oldest first
+};
+
+
+// what Reassembler::add() did with a fragment
+#define FRAG_PARTIAL    0   // kept: the msg isn't complete yet
+#define FRAG_COMPLETE   1   // it was the last one missing
+#define FRAG_DUPLICATE  2   // we have it already (or the whole msg, lately)
+#define FRAG_DROPPED    3   // over FRAG_MEMORY, or doesn't make sense
+
+
+class Reassembler{
+    /* fragments are written straight into a pooled buffer the size of their DATA datagram, which is handed on once
+     * it's complete: the msg takes part in the ordering (we ack it) only then. partial msgs are capped at
+     * FRAG_MEMORY bytes and given up on after FRAG_TIMEOUT without progress (the sender then sends the whole
+     * msg again, after its watchdog or our NAK). add() and sweep() may run on different threads */
+public:
+    int add(const unsigned char *frag, size_t size, uint64_t now_ns, Payload &whole);
+    // NAKs for the partial msgs that got nothing for FRAG_RETRY (each at most once every FRAG_RETRY).
+    // drops the ones older than FRAG_TIMEOUT and counts them in expired
+    std::vector<FragNak> sweep(uint32_t self, uint64_t now_ns, uint64_t &expired);
+    size_t held_bytes(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return held;
+    };
+
+private:
+    struct Partial{
+        Payload buf;
+        std::vector<bool> got;
+        uint32_t missing;
+        uint32_t from;
+        uint64_t last_ns;   // when a fragment last came
+        uint64_t nak_ns;    // when we NAKed last (0: never)
+    };
+    std::mutex mutex;
+    std::map<std::pair<uint32_t, uint32_t>, Partial> partials;  // (sender, msg_id) --> what we have of it
+    std::map<std::pair<uint32_t, uint32_t>, uint64_t> finished;  // (sender, msg_id) --> when it was put together
+    size_t held = 0;  // bytes of partials
+};
+
+#endif //PRJ1_FRAGMENTATION_H
@@ -0,0 +1,173 @@
+//
+// netem-like emulation of lossy, slow links between the protocol and the UDP_Server (-d -t -J -D -R -S -E).
+//
+
+#include <chrono>
+#include <functional>
+
+#include "link_emulator.h"
+#include "clock.h"
+
+static std::atomic<uint64_t> emulatorGenerations{0};
+
+
+LinkEmulator::LinkEmulator(client_server::UDP_Server &comm, const LinkProfile &defaults, uint32_t seed)
+        : communicator(comm), defaults(defaults), generation(++emulatorGenerations){
+    char hostname[256] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    this->seed = ((uint64_t) seed << 32) ^ std::hash<std::string>()(std::string(hostname));
+    timerThread = std::thread(&LinkEmulator::timer_loop, this);
+}
+
+
+LinkEmulator::~LinkEmulator(){
+    timersMutex.lock();
+    stopping = true;
+    timersMutex.unlock();
+    timersCv.notify_one();
+    timerThread.join();
+}
+
+
+int LinkEmulator::load_links(const char *fileName){
+    FILE *f = fopen(fileName, "r");
+    if (f == nullptr){perror("LinkEmulator::load_links: fopen"); return -1;}
+    char line[512], name[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof line, f) != nullptr){
+        lineNumber++;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+        LinkProfile p{};
+        if (sscanf(line, "%255s %d %d %lf %lf %lf", name, &p.delay_ms, &p.jitter_ms, &p.loss, &p.duplicate,
+                   &p.reorder) != 6 || p.delay_ms < 0 || p.jitter_ms < 0 || p.loss < 0 || p.loss >= 1 ||
+            p.duplicate < 0 || p.duplicate > 1 || p.reorder < 0 || p.reorder > 1){
+            fprintf(stderr, "Bad line %d in link file %s: %s", lineNumber, fileName, line);
+            fclose(f);
+            return -1;
+        }
+        links[std::string(name)] = p;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+double LinkEmulator::uniform(){
+    // rand() is one generator behind a lock for every thread, and can't be told apart per thread or reseeded per run
+    thread_local struct {
+        uint64_t generation = 0;
+        std::mt19937_64 rng;
+    } mine;
+    if (mine.generation != generation){
+        mine.generation = generation;
+        mine.rng.seed(seed + 0x9e3779b97f4a7c15ULL * ++nextStream);
+    }
+    return std::uniform_real_distribution<double>(0.0, 1.0)(mine.rng);
+}
+
+
+const LinkProfile & LinkEmulator::profile_of(const char *hostname){
+    auto it = links.find(std::string(hostname));
+    return it == links.end() ? defaults : it->second;
+}
+
+
+const LinkProfile & LinkEmulator::profile_of_addr(const struct sockaddr_storage &addr){
+    if (links.empty() || addr.ss_family != AF_INET) return defaults;
+    std::lock_guard<std::mutex> lock(linksMutex);
+    if (!resolved){  // only once somebody replied: the other hosts may not have been up before
+        resolved = true;
+        for (const auto &kv : links){
+            struct addrinfo hints{}, *ai;
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            if (kv.first == LINK_GROUP || getaddrinfo(kv.first.c_str(), nullptr, &hints, &ai) != 0) continue;
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &((struct sockaddr_in *) ai->ai_addr)->sin_addr, ip, sizeof ip);
+            addrLinks[std::string(ip)] = kv.second;
+            freeaddrinfo(ai);
+        }
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &((const struct sockaddr_in *) &addr)->sin_addr, ip, sizeof ip);
+    auto it = addrLinks.find(std::string(ip));
+    return it == addrLinks.end() ? defaults : it->second;
+}
+
+
+int LinkEmulator::send_to(const char *hostname, const unsigned char *msg, size_t size){
+    Pending pkt{0, 0, TO_HOST, std::string(hostname), {}, std::vector<unsigned char>(msg, msg + size)};
+    return emulate(profile_of(hostname), std::move(pkt));
+}
+
+
+int LinkEmulator::reply(const unsigned char *msg, size_t size){
+    // the address is taken now: by the time a delayed reply goes out the receiver has moved on
+    Pending pkt{0, 0, TO_ADDR, std::string(), communicator.get_their_addr(), std::vector<unsigned char>(msg, msg + size)};
+    return emulate(profile_of_addr(pkt.addr), std::move(pkt));
+}
+
+
+int LinkEmulator::send_to_group(const unsigned char *msg, size_t size){
+    Pending pkt{0, 0, TO_GROUP, std::string(), {}, std::vector<unsigned char>(msg, msg + size)};
+    return emulate(profile_of(LINK_GROUP), std::move(pkt));
+}
+
+
+int LinkEmulator::emulate(const LinkProfile &p, Pending &&pkt){
+    if (p.loss > 0 && uniform() < p.loss) return -22;
+    int copies = p.duplicate > 0 && uniform() < p.duplicate ? 2 : 1;
+    int rv = (int) pkt.msg.size();
+    uint64_t now = monotonic_now_ns();
+    for (int c = 0; c < copies; c++){
+        int64_t delay_us = (int64_t) p.delay_ms * 1000;
+        if (p.jitter_ms > 0) delay_us += (int64_t) ((uniform() * 2 - 1) * p.jitter_ms * 1000);
+        if (p.reorder > 0 && uniform() < p.reorder) delay_us = 0;
+        if (delay_us <= 0){
+            if (transmit(pkt) == -1) rv = -1;
+            continue;
+        }
+        timersMutex.lock();
+        pkt.due_ns = now + (uint64_t) delay_us * 1000;
+        pkt.order = nextOrder++;
+        bool first = timers.empty() || pkt.due_ns < timers.top().due_ns;
+        timers.push(c == copies - 1 ? std::move(pkt) : pkt);
+        timersMutex.unlock();
+        if (first) timersCv.notify_one();  // the timer thread sleeps until what used to be first
+    }
+    return rv;
+}
+
+
+int LinkEmulator::transmit(const Pending &pkt){
+    const char *msg = reinterpret_cast<const char *>(pkt.msg.data());
+    switch (pkt.to){
+        case TO_HOST:
+            return communicator.send_to(pkt.hostname.c_str(), msg, pkt.msg.size());
+        case TO_ADDR:
+            return communicator.send_to_addr(pkt.addr, msg, pkt.msg.size());
+        default:
+            return communicator.send_to_group(msg, pkt.msg.size());
+    }
+}
+
+
+void LinkEmulator::timer_loop(){
+    std::unique_lock<std::mutex> lock(timersMutex);
+    while (!stopping){
+        if (timers.empty()){
+            timersCv.wait(lock);
+            continue;
+        }
+        uint64_t now = monotonic_now_ns();
+        if (timers.top().due_ns > now){
+            timersCv.wait_for(lock, std::chrono::nanoseconds(timers.top().due_ns - now));
+            continue;
+        }
+        Pending pkt = timers.top();
+        timers.pop();
+        lock.unlock();
+        if (transmit(pkt) == -1) perror("[LinkEmulator] Error sending a delayed datagram");
+        lock.lock();
+    }
+}
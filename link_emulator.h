@@ -0,0 +1,89 @@
+//
+// netem-like emulation of lossy, slow links between the protocol and the UDP_Server (-d -t -J -D -R -S -E).
+//
+
+#ifndef PRJ1_LINK_EMULATOR_H
+#define PRJ1_LINK_EMULATOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <random>
+
+#include "networkagent.h"
+
+#define LINK_GROUP          "group"     // name of the ip multicast group's link in a link file
+
+
+typedef struct {
+    int delay_ms;       // every datagram is held this long
+    int jitter_ms;      // +- uniformly on top of the delay (so datagrams can overtake each other)
+    double loss;        // probability a datagram is lost
+    double duplicate;   // probability a datagram goes out twice (the copy gets its own delay)
+    double reorder;     // probability a datagram skips the delay (overtaking the ones held back)
+} LinkProfile;
+
+
+class LinkEmulator{
+    /* every datagram the protocol sends goes through here. Loss, duplication and reordering are decided right away
+     * with a per-thread generator, and anything that has to wait is put on a timer queue that a single thread
+     * drains: the sending thread never sleeps. A datagram that doesn't wait (delay and jitter 0, or reordered)
+     * is sent on the spot.
+     * Every link uses the default profile unless the link file has a line for it:
+     *      <host name | group> <delay_ms> <jitter_ms> <loss> <duplicate> <reorder>
+     * Replies go to an address, so the link file's host names are resolved to match them.
+     * The generators are seeded from the seed and our host name (the same seed on every host doesn't give every host
+     * the same losses) and the order threads first send in. */
+public:
+    LinkEmulator(client_server::UDP_Server &comm, const LinkProfile &defaults, uint32_t seed);
+    ~LinkEmulator();
+    int load_links(const char *fileName);  // -1 if the file can't be read or has a bad line
+    // like the UDP_Server's: -1 on an error, -22 if the datagram was lost, its size otherwise
+    int send_to(const char *hostname, const unsigned char *msg, size_t size);
+    int reply(const unsigned char *msg, size_t size);  // to whoever sent the datagram we got last
+    int send_to_group(const unsigned char *msg, size_t size);
+    double uniform();  // in [0,1), from this thread's generator
+
+private:
+    enum {TO_HOST, TO_ADDR, TO_GROUP};
+    struct Pending{
+        uint64_t due_ns;
+        uint64_t order;  // datagrams due at the same time go out in the order they were sent
+        int to;
+        std::string hostname;
+        struct sockaddr_storage addr;
+        std::vector<unsigned char> msg;
+        bool operator>(const Pending &o) const {
+            return due_ns == o.due_ns ? order > o.order : due_ns > o.due_ns;
+        };
+    };
+    client_server::UDP_Server &communicator;
+    LinkProfile defaults;
+    std::map<std::string, LinkProfile> links;      // host name (or LINK_GROUP) --> its profile
+    std::map<std::string, LinkProfile> addrLinks;  // ip of a host in links --> its profile (for replies)
+    bool resolved = false;
+    std::mutex linksMutex;  // protect addrLinks and resolved
+    uint64_t seed;
+    uint64_t generation;  // tells this emulator's per-thread generators from another one's
+    std::atomic<uint64_t> nextStream{0};
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> timers;
+    uint64_t nextOrder = 0;
+    bool stopping = false;
+    std::mutex timersMutex;  // protect the three above
+    std::condition_variable timersCv;
+    std::thread timerThread;
+
+    const LinkProfile & profile_of(const char *hostname);
+    const LinkProfile & profile_of_addr(const struct sockaddr_storage &addr);
+    int emulate(const LinkProfile &p, Pending &&pkt);
+    int transmit(const Pending &pkt);
+    void timer_loop();
+};
+
+#endif //PRJ1_LINK_EMULATOR_H
@@ -0,0 +1,90 @@
+//
+// Asynchronous logger: hot paths put compact binary records in a lock-free ring and a background thread formats them.
+//
+
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+#include "logger.h"
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of 2");
+
+
+Logger & Logger::get(){
+    // never destroyed: its thread and the watchdogs may still log while the process exits
+    static Logger * logger = []{
+        Logger *l = new Logger();
+        std::thread(&Logger::run, l).detach();
+        atexit([]{ Logger::get().flush(); });
+        return l;
+    }();
+    return *logger;
+}
+
+
+Logger::Logger(){
+    for (uint64_t i = 0; i < LOG_RING_SIZE; i++) slots[i].turn.store(i, std::memory_order_relaxed);
+}
+
+
+int Logger::parse_level(const char *name){
+    static const char * names[] = {"error", "warn", "info", "debug"};
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++) if (strcmp(name, names[i]) == 0) return i;
+    return -1;
+}
+
+
+Logger::Slot * Logger::reserve(){
+    // the writers race for the head. a slot is ours once its turn is our position and we moved the head past it
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    while (true){
+        Slot *slot = &slots[pos & (LOG_RING_SIZE - 1)];
+        int64_t diff = (int64_t) slot->turn.load(std::memory_order_acquire) - (int64_t) pos;
+        if (diff == 0){
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return slot;
+        } else if (diff < 0){  // still holds a record a lap behind: the ring is full
+            numDropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else pos = head.load(std::memory_order_relaxed);  // somebody else took it
+    }
+}
+
+
+void Logger::publish(Slot *slot){
+    uint64_t pos = slot->turn.load(std::memory_order_relaxed);
+    slot->turn.store(pos + 1, std::memory_order_release);
+}
+
+
+size_t Logger::drain(){
+    // in order: a record that is reserved but not written yet holds up the ones after it
+    std::lock_guard<std::mutex> lock(drainMutex);
+    size_t n = 0;
+    while (true){
+        Slot *slot = &slots[tail & (LOG_RING_SIZE - 1)];
+        if (slot->turn.load(std::memory_order_acquire) != tail + 1) break;
+        slot->print(stdout, slot->format, slot->args);
+        slot->turn.store(tail + LOG_RING_SIZE, std::memory_order_release);  // free for the next lap
+        tail++;
+        n++;
+    }
+    uint64_t lost = numDropped.load(std::memory_order_relaxed);
+    if (lost != reportedDropped){
+        fprintf(stderr, "[logger] %lu log records dropped (%lu so far): output couldn't keep up\n",
+                lost - reportedDropped, lost);
+        reportedDropped = lost;
+    }
+    if (n > 0) fflush(stdout);
+    return n;
+}
+
+
+void Logger::flush(){
+    drain();
+}
+
+
+[[noreturn]] void Logger::run(){
+    while (true) if (drain() == 0) usleep(LOG_IDLE_US);
+}
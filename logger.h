@@ -0,0 +1,112 @@
+//
+// Asynchronous logger: hot paths put compact binary records in a lock-free ring and a background thread formats them.
+//
+
+#ifndef PRJ1_LOGGER_H
+#define PRJ1_LOGGER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+
+#define LOG_RING_SIZE       16384   // records (a power of 2). when the ring is full new records are dropped
+#define LOG_ARG_BYTES       48      // room for the arguments of a record (6 ints or doubles)
+#define LOG_IDLE_US         1000    // how long the background thread sleeps when the ring is empty
+
+enum LogLevel{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,       // the default: deliveries, membership and rates
+    LOG_DEBUG,      // dropped datagrams and the like
+};
+
+// the arguments are only evaluated when the level is on
+#define RMLOG(level, ...) do { \
+    if (Logger::get().enabled(level)) Logger::get().log(__VA_ARGS__); \
+} while (0)
+
+
+class Logger{
+    /* A record is the format (a string literal), a function that knows the argument types and the arguments as
+     * raw bytes. Writing one is a reservation in the ring (one compare and swap) and a copy of a few words: nothing
+     * is formatted and nothing waits for the terminal. The background thread takes the records out in order and
+     * fprintf()s them to stdout. If it fell so far behind that the ring is full, the record is dropped and counted.
+     * Arguments must be numbers or enums: a string could be gone by the time it's printed. Lines with strings
+     * (rare ones: failures, joins) still printf directly. */
+public:
+    static Logger & get();  // the process' logger. its thread starts on first use, and it's flushed at exit
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    bool enabled(int level) const {
+        return level <= logLevel.load(std::memory_order_relaxed);
+    };
+    void set_level(int level){  // any time, from any thread
+        logLevel.store(level, std::memory_order_relaxed);
+    };
+    static int parse_level(const char *name);  // "error", "warn", "info" or "debug". -1 if it's none of them
+
+    template<typename... Args>
+    void log(const char *format, Args... args){
+        static_assert(sizeof...(Args) == 0 || ((std::is_arithmetic<Args>::value || std::is_enum<Args>::value) && ...),
+                      "log arguments must be numbers (strings could be gone before they're printed)");
+        static_assert((0 + ... + sizeof(Args)) <= LOG_ARG_BYTES, "too many log arguments");
+        Slot *slot = reserve();
+        if (slot == nullptr) return;
+        slot->format = format;
+        slot->print = &print_record<Args...>;
+        size_t at = 0;
+        ((memcpy(slot->args + at, &args, sizeof args), at += sizeof args), ...);
+        (void) at;
+        publish(slot);
+    };
+    void flush();  // format everything logged so far, now (exit() does this too)
+    uint64_t dropped() const {
+        return numDropped.load(std::memory_order_relaxed);
+    };
+
+private:
+    struct Slot{
+        std::atomic<uint64_t> turn;  // the position it's free for (= pos) or full at (= pos + 1)
+        const char *format;
+        void (*print)(FILE *, const char *, const unsigned char *);
+        unsigned char args[LOG_ARG_BYTES];
+    };
+
+    Slot slots[LOG_RING_SIZE];
+    std::atomic<uint64_t> head{0};  // next position a writer reserves
+    uint64_t tail = 0;  // next position to print (drainMutex)
+    std::mutex drainMutex;  // one drainer at a time: the thread or flush()
+    std::atomic<int> logLevel{LOG_INFO};
+    std::atomic<uint64_t> numDropped{0};
+    uint64_t reportedDropped = 0;  // drainMutex
+
+    Logger();
+    Slot * reserve();
+    void publish(Slot *slot);
+    size_t drain();
+    [[noreturn]] void run();
+
+    template<typename... Args>
+    static void print_record(FILE *fp, const char *format, const unsigned char *bytes){
+        size_t at = 0;
+        // a braced list is evaluated left to right, so the arguments come out in the order they went in
+        std::tuple<Args...> args{take<Args>(bytes, at)...};
+        (void) at;
+        std::apply([&](Args... a){ fprintf(fp, format, a...); }, args);
+    };
+    template<typename T>
+    static T take(const unsigned char *bytes, size_t &at){
+        T v;
+        memcpy(&v, bytes + at, sizeof v);
+        at += sizeof v;
+        return v;
+    };
+};
+
+#endif //PRJ1_LOGGER_H
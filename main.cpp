@@ -3,30 +3,85 @@
 //
 
 #include "reliable_multicast.h"
+#include "coroutines.h"
+#include "delivery_feed.h"
 
 long num_msg_tosend = -1;
 double drop_rate = 0;
 int delay_in_ms = 0;
+int jitter_in_ms = 0;  // +- on top of the delay
+double dup_rate = 0;
+double reorder_rate = 0;  // datagrams that skip the delay
+uint32_t link_seed = std::random_device()();  // -S makes the emulated losses repeatable
+const char * linkFileName = nullptr;  // per-link delay/jitter/loss/duplicate/reorder
 int snapshotafter = -1;
+int failure_timeout_ms = FAILURE_TIMEOUT;
+int leave_after_ms = -1;
+int tree_fanout = 0;  // 0: unicast to everybody. k: disseminate through a k-ary tree
+const char * mcastGroup = nullptr;  // send DATA and SEQ to this ipv4 multicast group instead (acks stay unicast)
+int mcast_ttl = 1;  // 1 keeps it on the LAN
+int mcast_loopback = 1;  // needed when several processes share a box
+const char * mcastIface = nullptr;  // address of the interface for the group (e.g. 127.0.0.1 on a single box)
+int nak_mode = 0;  // 1: receivers NAK gaps instead of per-msg watchdogs on both sides
+int fec_n = 0, fec_k = 0;  // -F n,k: k parity packets per n DATA/SEQ
+const char * statsSocket = nullptr;  // unix socket that serves the metrics
+const char * statsFile = nullptr;  // file the metrics are dumped to every METRICS_DUMP_PERIOD ms
+const char * traceFile = nullptr;  // binary trace of every msg's lifecycle (tools/trace2chrome.cpp reads it)
+const char * shmGroup = nullptr;  // -Y: every member is on this box and they talk through shared memory
+const char * feedName = nullptr;  // -O: publish the delivered msgs to local readers in /dev/shm/prj1.feed.<name>
+int producers = 0;  // -P: that many coroutines send the msgs, each waiting for its last one to be delivered
+int timestamps = TS_NONE;  // -K: receive timestamps, for the socket_queue_ns metric
+const char * tsIface = nullptr;  // -K hw:<iface>: switch the NIC's stamping on
 
-const char * hostFileName;
+const char * hostFileName = nullptr;
+const char * joinSeed = nullptr;  // join a running group through this member instead of using the Hostfile
+const char * joinName = nullptr;  // our container name when joining
 void handle_param(int argc,  char* argv[]);
+Task produce(Group &group, ReliableMulticast &rm, int first);
 
 int main(int argc, char* argv[]){
     handle_param(argc, argv);  // first we obtain the count and hostFileName
     client_server::UDP_Server comm(SERVER_PORT);
+    if (mcastGroup != nullptr && comm.join_group(mcastGroup, MCAST_PORT, mcast_ttl, mcast_loopback, mcastIface) == -1){
+        fprintf(stderr, "Couldn't join multicast group %s. Exiting.\n", mcastGroup);
+        exit(1);
+    }
+    if (timestamps != TS_NONE && comm.enable_timestamps(timestamps, tsIface) == -1){
+        fprintf(stderr, "Couldn't turn on receive timestamps. Exiting.\n");
+        exit(1);
+    }
     ReliableMulticast reliableMulticast(hostFileName, comm,
-                                        drop_rate, delay_in_ms);  // this will perform the processing and communicating
+                                        LinkProfile{delay_in_ms, jitter_in_ms, drop_rate, dup_rate, reorder_rate},
+                                        failure_timeout_ms, joinSeed, joinName, tree_fanout, nak_mode != 0,
+                                        fec_n, fec_k, link_seed, linkFileName, shmGroup);  // this will perform the processing and communicating
 
+    if (statsSocket != nullptr || statsFile != nullptr) reliableMulticast.serve_metrics(statsSocket, statsFile);
+    if (traceFile != nullptr) reliableMulticast.start_tracing(traceFile);
+    if (feedName != nullptr){
+        auto *feed = new FeedWriter(feedName);  // never destroyed: the receiver may publish until we exit
+        reliableMulticast.set_delivery_callback([feed](const QueuedMessage *msgs, size_t n){ feed->publish(msgs, n); });
+    }
+    Executor executor;
+    Group group(reliableMulticast, executor, false);
     // constructing that will also start the receiver thread for this process
     std::thread receiver_thread(ReliableMulticast::start_msg_receiver, &reliableMulticast);
-    for (int i = 0; i<num_msg_tosend; i++){
+    if (producers > 0){  // no thread per producer: they all run here, on the executor
+        for (int p = 0; p < producers && p < num_msg_tosend; p++) executor.spawn(produce(group, reliableMulticast, p));
+        executor.run();
+    }
+    for (int i = 0; producers == 0 && i<num_msg_tosend; i++){
         reliableMulticast.multicast_datamsg(i*198%27);  // semi arbitrary data
 //        sleep(1);
         if (i == snapshotafter-1){  // so we take snapshot once
             reliableMulticast.initiate_snapshot();
         }
     }
+    if (leave_after_ms >= 0){
+        usleep(leave_after_ms*1000);
+        reliableMulticast.leave();
+        reliableMulticast.flush_trace();
+        exit(0);
+    }
     receiver_thread.join();
 }
 
@@ -59,6 +114,57 @@ void handle_param(int argc,  char* argv[]){
                 exit(1);
             }
         }
+        else if (strcmp(argv[i], "-J") == 0) {
+            jitter_in_ms = atoi(argv[i+1]);
+            if (jitter_in_ms < 0){
+                fprintf(stderr, "Bad jitter: %d. Please enter a value >= 0\n", jitter_in_ms);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-D") == 0) {
+            dup_rate = atof(argv[i+1]);
+            if (dup_rate < 0 || dup_rate > 1){
+                fprintf(stderr, "Bad duplication rate: %.5f. Please enter a value in [0,1]\n", dup_rate);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-R") == 0) {
+            reorder_rate = atof(argv[i+1]);
+            if (reorder_rate < 0 || reorder_rate > 1){
+                fprintf(stderr, "Bad reorder rate: %.5f. Please enter a value in [0,1]\n", reorder_rate);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-S") == 0) {
+            link_seed = strtoul(argv[i+1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-E") == 0) {
+            linkFileName = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-M") == 0) {
+            statsSocket = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-W") == 0) {
+            statsFile = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-Z") == 0) {
+            traceFile = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-P") == 0) {
+            producers = atoi(argv[i+1]);
+            if (producers < 0){
+                fprintf(stderr, "Bad number of producers: %d. Please enter a value >= 0\n", producers);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-V") == 0) {
+            int level = Logger::parse_level(argv[i+1]);
+            if (level == -1){
+                fprintf(stderr, "Bad log level: %s. Please use error, warn, info or debug\n", argv[i+1]);
+                exit(1);
+            }
+            Logger::get().set_level(level);
+        }
         else if (strcmp(argv[i], "-X") == 0) {
             snapshotafter = atoi(argv[i+1]);
             if (snapshotafter < 0 || snapshotafter > num_msg_tosend){
@@ -66,13 +172,119 @@ void handle_param(int argc,  char* argv[]){
                 exit(1);
             }
         }
+        else if (strcmp(argv[i], "-j") == 0) {
+            joinSeed = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-n") == 0) {
+            joinName = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-l") == 0) {
+            leave_after_ms = atoi(argv[i+1]);
+            if (leave_after_ms < 0){
+                fprintf(stderr, "Bad leave time: %d. Please enter a value >= 0\n", leave_after_ms);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0) {
+            tree_fanout = atoi(argv[i+1]);
+            if (tree_fanout < 0){
+                fprintf(stderr, "Bad tree fanout: %d. Please enter a value >= 0 (0 sends to everybody directly)\n", tree_fanout);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-m") == 0) {
+            mcastGroup = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-T") == 0) {
+            mcast_ttl = atoi(argv[i+1]);
+            if (mcast_ttl < 0 || mcast_ttl > 255){
+                fprintf(stderr, "Bad multicast TTL: %d. Please enter a value in [0,255]\n", mcast_ttl);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-L") == 0) {
+            mcast_loopback = atoi(argv[i+1]);
+        }
+        else if (strcmp(argv[i], "-I") == 0) {
+            mcastIface = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-Y") == 0) {
+            shmGroup = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-O") == 0) {
+            feedName = argv[i+1];
+        }
+        else if (strcmp(argv[i], "-N") == 0) {
+            nak_mode = atoi(argv[i+1]);
+        }
+        else if (strcmp(argv[i], "-K") == 0) {
+            if (strcmp(argv[i+1], "sw") == 0) timestamps = TS_SOFTWARE;
+            else if (strncmp(argv[i+1], "hw", 2) == 0 && (argv[i+1][2] == '\0' || argv[i+1][2] == ':')){
+                timestamps = TS_HARDWARE;
+                if (argv[i+1][2] == ':') tsIface = &argv[i+1][3];
+            } else {
+                fprintf(stderr, "Bad timestamps: %s. Please enter sw, hw or hw:<iface>\n", argv[i+1]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-F") == 0) {
+            if (sscanf(argv[i+1], "%d,%d", &fec_n, &fec_k) != 2 || fec_n < 1 || fec_k < 1 || fec_n + fec_k > FEC_MAX_SHARDS){
+                fprintf(stderr, "Bad fec parameters: %s. Please enter n,k with n, k >= 1 and n + k <= %d\n", argv[i+1],
+                        FEC_MAX_SHARDS);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "-f") == 0) {
+            failure_timeout_ms = atoi(argv[i+1]);
+            if (failure_timeout_ms < 0){
+                fprintf(stderr, "Bad failure timeout: %d. Please enter a value >= 0 (0 turns off failure detection)\n", failure_timeout_ms);
+                exit(1);
+            }
+        }
         else {
-            printf("Usage: %s -h <hostfile> -c <send_msg_count> [-d <drop_rate> -t <delay_in_ms> -X <snapshot-after>]\n", argv[0]);
+            printf("Usage: %s -h <hostfile> -c <send_msg_count> [-d <drop_rate> -t <delay_in_ms> -X <snapshot-after> -f <failure_timeout_ms> -l <leave_after_ms> -k <tree_fanout> -m <mcast_group> -T <mcast_ttl> -L <0|1> -I <mcast_iface> -N <0|1> -F <n,k> -J <jitter_ms> -D <dup_rate> -R <reorder_rate> -S <seed> -E <linkfile> -M <stats_socket> -W <stats_file> -Z <trace_file> -V <log_level> -P <producers> -Y <shm_group> -O <feed> -K <sw|hw[:iface]>]\n"
+               "       %s -j <member_to_join_through> -n <our_name> -c <send_msg_count> [same options]\n", argv[0], argv[0]);
             exit(1);
         }
     }
+    if ((hostFileName == nullptr) == (joinSeed == nullptr) || (joinSeed != nullptr && joinName == nullptr)){
+        printf("Please give either a Hostfile (-h) or a member to join through and our name (-j and -n).\n");
+        exit(1);
+    }
+    if (tree_fanout > 0 && mcastGroup != nullptr){
+        printf("Please use either a tree (-k) or ip multicast (-m), not both.\n");
+        exit(1);
+    }
+    if (shmGroup != nullptr && mcastGroup != nullptr){
+        printf("Please use either shared memory (-Y) or ip multicast (-m), not both.\n");
+        exit(1);
+    }
+    if (shmGroup != nullptr && (delay_in_ms != 0 || jitter_in_ms != 0 || drop_rate != 0 || dup_rate != 0 ||
+                                reorder_rate != 0 || linkFileName != nullptr)){
+        printf("The link emulation (-d -t -J -D -R -E) is for udp. It can't be used with shared memory (-Y).\n");
+        exit(1);
+    }
+    if (shmGroup != nullptr && timestamps != TS_NONE){
+        printf("Receive timestamps (-K) are for udp. Shared memory (-Y) stamps every datagram anyway.\n");
+        exit(1);
+    }
+    if (tree_fanout > 0 && nak_mode != 0){
+        printf("The NAK mode (-N) can't be used with a tree (-k).\n");
+        exit(1);
+    }
     if (num_msg_tosend == -1){
-        printf("Usage: %s -h <hostfile> -c <send_msg_count> [-d <drop_rate> -t <delay_in_ms> -X <snapshot-after>]\n", argv[0]);
+        printf("Usage: %s -h <hostfile> -c <send_msg_count> [-d <drop_rate> -t <delay_in_ms> -X <snapshot-after> -f <failure_timeout_ms> -l <leave_after_ms> -k <tree_fanout> -m <mcast_group> -T <mcast_ttl> -L <0|1> -I <mcast_iface> -N <0|1> -F <n,k> -J <jitter_ms> -D <dup_rate> -R <reorder_rate> -S <seed> -E <linkfile> -M <stats_socket> -W <stats_file> -Z <trace_file> -V <log_level> -P <producers> -Y <shm_group> -O <feed> -K <sw|hw[:iface]>]\n"
+               "       %s -j <member_to_join_through> -n <our_name> -c <send_msg_count> [same options]\n", argv[0], argv[0]);
         exit(1);
     }
-}
\ No newline at end of file
+}
+
+
+Task produce(Group &group, ReliableMulticast &rm, int first){
+    // producer number first sends msgs first, first + producers, ... and waits for each to be delivered
+    static int numDelivered = 0;  // only the executor's thread runs producers
+    for (long i = first; i < num_msg_tosend; i += producers){
+        co_await group.multicast(i*198%27);  // semi arbitrary data
+        if (++numDelivered == snapshotafter) rm.initiate_snapshot();
+    }
+}
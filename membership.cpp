@@ -0,0 +1,122 @@
+//
+// Host table and per-message ack bitsets (replaces the fixed 16 host arrays and the ProposerSeq maps).
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+#include "membership.h"
+
+
+int HostTable::add_host(const std::string &hostName){
+    std::lock_guard<std::mutex> lock(mutex);
+    if (names.size() == MAX_GROUP_SIZE){
+        fprintf(stderr, "HostTable: cannot add %s. Exceeded MAX_GROUP_SIZE (%d) hosts.\n", hostName.c_str(), MAX_GROUP_SIZE);
+        return -1;
+    }
+    uint32_t hostID = extract_int_from_string(hostName);
+    if (idToRank.count(hostID) != 0){
+        fprintf(stderr, "HostTable: %s has the same id (%d) as %s.\n", hostName.c_str(), hostID,
+                names[idToRank[hostID]].c_str());
+        return -1;
+    }
+    int rank = (int) names.size();
+    names.push_back(hostName);
+    ids.push_back(hostID);
+    idToRank.insert(std::make_pair(hostID, rank));
+    return rank;
+}
+
+
+int HostTable::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int) names.size();
+}
+
+
+int HostTable::rank_of(uint32_t hostID) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = idToRank.find(hostID);
+    if (it == idToRank.end()) return -1;
+    return it->second;
+}
+
+
+uint32_t HostTable::id_of(int rank) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ids[rank];
+}
+
+
+const char * HostTable::name_of(int rank) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return names[rank].c_str();
+}
+
+
+const char * HostTable::name_of_id(uint32_t hostID) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = idToRank.find(hostID);
+    if (it == idToRank.end()) return nullptr;
+    return names[it->second].c_str();
+}
+
+
+bool AckCollector::add(int rank, uint32_t proposed_seq, uint32_t proposer){
+    if (acked.test(rank)) return false;
+    acked.set(rank);
+    // the max in the delivery queue's order (on equal sequence the larger proposer comes later), so the final seq is
+    // never below a proposal a receiver queued the msg with
+    if (proposed_seq > max_seq || (proposed_seq == max_seq && proposer > max_proposer)){
+        max_seq = proposed_seq;
+        max_proposer = proposer;
+    }
+    return true;
+}
+
+
+static std::vector<int> tree_layout(const HostSet &members, int rootRank){
+    // the members in rank order starting at the root
+    std::vector<int> order;
+    for (int i = 0; i < MAX_GROUP_SIZE; i++){
+        int r = (rootRank + i) % MAX_GROUP_SIZE;
+        if (members.test(r)) order.push_back(r);
+    }
+    return order;
+}
+
+
+std::vector<int> tree_children(const HostSet &members, int rootRank, int rank, int fanout){
+    std::vector<int> children;
+    std::vector<int> order = tree_layout(members, rootRank);
+    auto it = std::find(order.begin(), order.end(), rank);
+    if (it == order.end() || fanout <= 0) return children;
+    size_t pos = it - order.begin();
+    for (size_t c = fanout * pos + 1; c <= fanout * pos + fanout && c < order.size(); c++) children.push_back(order[c]);
+    return children;
+}
+
+
+int tree_parent(const HostSet &members, int rootRank, int rank, int fanout){
+    std::vector<int> order = tree_layout(members, rootRank);
+    auto it = std::find(order.begin(), order.end(), rank);
+    if (it == order.end() || it == order.begin() || fanout <= 0) return -1;
+    size_t pos = it - order.begin();
+    return order[(pos - 1) / fanout];
+}
+
+
+int extract_int_from_string(std::string str){
+    // For atoi, the input string has to start with a digit, so lets search for the first digit
+    size_t i = 0;
+    for ( ; i < str.length(); i++ ){ if ( isdigit(str[i]) ) break; }
+
+    // remove the first chars, which aren't digits
+    str = str.substr(i, str.length() - i );
+
+    // convert the remaining text to an integer
+    int id = atoi(str.c_str());
+    return id;
+}
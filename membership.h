@@ -0,0 +1,75 @@
+//
+// Host table and per-message ack bitsets (replaces the fixed 16 host arrays and the ProposerSeq maps).
+//
+
+#ifndef PRJ1_MEMBERSHIP_H
+#define PRJ1_MEMBERSHIP_H
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_GROUP_SIZE      256     // width of the ack bitsets, i.e. max number of hosts in the Hostfile
+
+typedef std::bitset<MAX_GROUP_SIZE> HostSet;  // bit r <--> host of rank r (its line number in the Hostfile)
+
+
+class HostTable{
+    /* The hosts in Hostfile order. A host has two names for the protocol:
+     * -- its id: the number extracted from its container name (what goes on the wire)
+     * -- its rank: its position in the Hostfile, then the order in which hosts joined (what indexes the bitsets)
+     * The table grows as hosts are added (joins) so there is no fixed limit other than MAX_GROUP_SIZE.
+     * Ranks and ids are never reused: a host that left has to join again under a new name.
+     * Hosts are added while other threads read the table so it's guarded by a mutex. The names live in a deque
+     * so the pointers handed out by name_of stay valid. */
+public:
+    int add_host(const std::string &hostName);  // return the rank of the new host or -1 if it can't be added
+    int size() const;
+    int rank_of(uint32_t hostID) const;  // -1 if we don't know this host
+    uint32_t id_of(int rank) const;
+    const char * name_of(int rank) const;
+    const char * name_of_id(uint32_t hostID) const;  // nullptr if we don't know this host
+
+private:
+    mutable std::mutex mutex;
+    std::deque<std::string> names;
+    std::deque<uint32_t> ids;
+    std::unordered_map<uint32_t, int> idToRank;
+};
+
+
+struct AckCollector{
+    /* the acks received so far for one of our outgoing messages.
+     * "have we got all the acks" is a popcount and the max proposal is kept as a running max
+     * so nothing needs to be scanned when the last ack comes in. */
+    HostSet     acked;              // bit r is set once the host of rank r has acked
+    uint32_t    max_seq = 0;        // largest proposed sequence so far
+    uint32_t    max_proposer = 0;   // proposer of max_seq (the larger id wins ties)
+
+    bool add(int rank, uint32_t proposed_seq, uint32_t proposer);  // false if rank had already acked
+    bool has_acked(int rank) const {
+        return acked.test(rank);
+    };
+    int num_acked() const {
+        return (int) acked.count();
+    };
+    bool covers(const HostSet &members) const {  // has every host in members acked?
+        return (members & acked).count() == members.count();
+    };
+};
+
+
+/* k-ary spanning tree over the members for the msgs of one origin (fanout k, -k). The members are laid out in rank
+ * order starting at the origin (wrapping around) so every origin gets a different tree and the interior work is
+ * spread out. Position 0 is the origin and the children of position p are k*p+1 .. k*p+k.
+ * The relative rank order of the members is the same everywhere, so hosts with the same view build the same tree. */
+std::vector<int> tree_children(const HostSet &members, int rootRank, int rank, int fanout);
+int tree_parent(const HostSet &members, int rootRank, int rank, int fanout);  // -1 for the root (or a non member)
+
+int extract_int_from_string(std::string str);
+
+#endif //PRJ1_MEMBERSHIP_H
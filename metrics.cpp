@@ -0,0 +1,277 @@
+//
+// Runtime metrics of the protocol engine: per-thread counters merged on read, gauges and histograms, with a stats endpoint.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "networkagent.h"
+
+static const char * typeNames[METRIC_TYPES] = {"other", "DATA", "ACK", "SEQ", "HBT", "FLUSH", "FLUSHDONE", "JOINED",
+                                               "JOINEDACK", "VIEWREC", "RELAYREC", "SYNCDONE", "AGGACK", "NAK",
+                                               "FEC", "FRAG", "FRAGNAK"};
+static const char * counterNames[M_NUM_COUNTERS] = {"duplicate_data", "duplicate_acks", "duplicate_seqs",
+                                                    "delivered", "flow_blocked", "fragments_dropped"};
+static const char * gaugeNames[M_NUM_GAUGES] = {"delivery_queue", "outstanding", "flow_window", "reassembly_bytes"};
+static const char * histogramNames[M_NUM_HISTOGRAMS] = {"hol_blocking_ns", "ack_collection_ns", "snapshot_ns",
+                                                          "socket_queue_ns", "processing_ns", "delivery_queue_ns",
+                                                          "rtt_ns"};
+
+// the registries that are alive, so a thread that ends doesn't retire its shard into one that's gone
+static std::mutex liveMutex;
+static std::set<uint64_t> live;
+static uint64_t nextID = 1;
+
+
+struct ThreadShards{
+    /* the shards the calling thread has, in every registry it updated. the last one used is cached in plain
+     * thread_locals so the common case is two compares */
+    std::vector<std::pair<std::pair<uint64_t, Metrics *>, Metrics::Shard *>> mine;
+    ~ThreadShards(){
+        std::lock_guard<std::mutex> lock(liveMutex);
+        for (auto &m : mine) if (live.count(m.first.first) != 0) m.first.second->retire(m.second);
+    };
+};
+static thread_local ThreadShards threadShards;
+static thread_local uint64_t lastID = 0;
+static thread_local void * lastShard = nullptr;
+
+
+static int bucket_of(uint64_t v){
+    if (v < 4) return (int) v;
+    int e = 63 - __builtin_clzll(v);  // >= 2
+    return (e - 1) * 4 + (int) ((v >> (e - 2)) & 3);
+}
+
+static uint64_t highest_of(int b){  // the largest value bucket b holds
+    if (b < 4) return (uint64_t) b;
+    int e = b / 4 + 1;
+    uint64_t top = 4 + (uint64_t) (b % 4) + 1;
+    return e - 2 >= 62 ? UINT64_MAX : (top << (e - 2)) - 1;
+}
+
+
+Metrics::Shard::Shard(){
+    for (auto &c : counters) c.store(0, std::memory_order_relaxed);
+    for (auto &c : in) c.store(0, std::memory_order_relaxed);
+    for (auto &c : out) c.store(0, std::memory_order_relaxed);
+    for (auto &c : retransmits) c.store(0, std::memory_order_relaxed);
+    for (auto &h : buckets) for (auto &c : h) c.store(0, std::memory_order_relaxed);
+    for (auto &c : sums) c.store(0, std::memory_order_relaxed);
+    for (auto &c : maxes) c.store(0, std::memory_order_relaxed);
+}
+
+
+void Metrics::Shard::add_to(Shard &total) const{
+    // total is only touched by the thread that holds the registry's mutex
+    auto add = [](std::atomic<uint64_t> &to, const std::atomic<uint64_t> &from){
+        to.store(to.load(std::memory_order_relaxed) + from.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    };
+    for (int i = 0; i < M_NUM_COUNTERS; i++) add(total.counters[i], counters[i]);
+    for (int i = 0; i < METRIC_TYPES; i++){
+        add(total.in[i], in[i]);
+        add(total.out[i], out[i]);
+    }
+    for (int i = 0; i < MAX_GROUP_SIZE; i++) add(total.retransmits[i], retransmits[i]);
+    for (int h = 0; h < M_NUM_HISTOGRAMS; h++){
+        for (int b = 0; b < METRIC_BUCKETS; b++) add(total.buckets[h][b], buckets[h][b]);
+        add(total.sums[h], sums[h]);
+        uint64_t m = maxes[h].load(std::memory_order_relaxed);
+        if (m > total.maxes[h].load(std::memory_order_relaxed)) total.maxes[h].store(m, std::memory_order_relaxed);
+    }
+}
+
+
+Metrics::Metrics(){
+    for (auto &g : gauges) g.store(0, std::memory_order_relaxed);
+    for (auto &r : srtt) r.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(liveMutex);
+    id = nextID++;
+    live.insert(id);
+}
+
+
+Metrics::~Metrics(){
+    std::lock_guard<std::mutex> lock(liveMutex);
+    live.erase(id);
+    std::lock_guard<std::mutex> ours(mutex);
+    for (Shard *s : shards) delete s;
+}
+
+
+Metrics::Shard * Metrics::shard(){
+    if (lastID == id) return static_cast<Shard *>(lastShard);
+    Shard *s = nullptr;
+    for (auto &m : threadShards.mine) if (m.first.first == id) s = m.second;
+    if (s == nullptr){
+        s = new_shard();
+        threadShards.mine.push_back(std::make_pair(std::make_pair(id, this), s));
+    }
+    lastID = id;
+    lastShard = s;
+    return s;
+}
+
+
+Metrics::Shard * Metrics::new_shard(){
+    Shard *s = new Shard();
+    std::lock_guard<std::mutex> lock(mutex);
+    shards.push_back(s);
+    return s;
+}
+
+
+void Metrics::retire(Shard *s){
+    std::lock_guard<std::mutex> lock(mutex);
+    s->add_to(retired);
+    for (size_t i = 0; i < shards.size(); i++){
+        if (shards[i] == s){
+            shards[i] = shards.back();
+            shards.pop_back();
+            break;
+        }
+    }
+    delete s;
+}
+
+
+void Metrics::merge(Shard &total){
+    std::lock_guard<std::mutex> lock(mutex);
+    retired.add_to(total);
+    for (Shard *s : shards) s->add_to(total);
+}
+
+
+void Metrics::observe(MetricHistogram h, uint64_t ns){
+    Shard *s = shard();
+    bump(s->buckets[h][bucket_of(ns)], 1);
+    bump(s->sums[h], ns);
+    if (ns > s->maxes[h].load(std::memory_order_relaxed)) s->maxes[h].store(ns, std::memory_order_relaxed);
+}
+
+
+std::string Metrics::render(const HostTable &hosts){
+    Shard *total = new Shard();  // too big for some thread stacks
+    merge(*total);
+    std::string text;
+    char line[256];
+    for (int t = 0; t < METRIC_TYPES; t++){
+        uint64_t in = total->in[t].load(std::memory_order_relaxed), out = total->out[t].load(std::memory_order_relaxed);
+        if (in == 0 && out == 0) continue;
+        snprintf(line, sizeof line, "packets_in{type=\"%s\"} %lu\npackets_out{type=\"%s\"} %lu\n",
+                 typeNames[t], in, typeNames[t], out);
+        text += line;
+    }
+    for (int r = 0; r < hosts.size() && r < MAX_GROUP_SIZE; r++){
+        uint64_t n = total->retransmits[r].load(std::memory_order_relaxed);
+        if (n == 0) continue;
+        snprintf(line, sizeof line, "retransmits{peer=\"%s\"} %lu\n", hosts.name_of(r), n);
+        text += line;
+    }
+    for (int r = 0; r < hosts.size() && r < MAX_GROUP_SIZE; r++){
+        int64_t ns = srtt[r].load(std::memory_order_relaxed);
+        if (ns == 0) continue;
+        snprintf(line, sizeof line, "srtt_ns{peer=\"%s\"} %ld\n", hosts.name_of(r), ns);
+        text += line;
+    }
+    for (int c = 0; c < M_NUM_COUNTERS; c++){
+        snprintf(line, sizeof line, "%s %lu\n", counterNames[c], total->counters[c].load(std::memory_order_relaxed));
+        text += line;
+    }
+    for (int g = 0; g < M_NUM_GAUGES; g++){
+        snprintf(line, sizeof line, "%s %ld\n", gaugeNames[g], gauges[g].load(std::memory_order_relaxed));
+        text += line;
+    }
+    for (int h = 0; h < M_NUM_HISTOGRAMS; h++){
+        uint64_t count = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) count += total->buckets[h][b].load(std::memory_order_relaxed);
+        snprintf(line, sizeof line, "%s_count %lu\n%s_sum %lu\n", histogramNames[h], count, histogramNames[h],
+                 total->sums[h].load(std::memory_order_relaxed));
+        text += line;
+        for (double q : {0.5, 0.99, 0.999}){
+            uint64_t want = (uint64_t) (q * (double) count + 0.999999), seen = 0, v = 0;
+            for (int b = 0; b < METRIC_BUCKETS && count > 0; b++){
+                seen += total->buckets[h][b].load(std::memory_order_relaxed);
+                if (seen >= want){
+                    v = std::min(highest_of(b), total->maxes[h].load(std::memory_order_relaxed));
+                    break;
+                }
+            }
+            snprintf(line, sizeof line, "%s{quantile=\"%g\"} %lu\n", histogramNames[h], q, v);
+            text += line;
+        }
+        snprintf(line, sizeof line, "%s_max %lu\n", histogramNames[h], total->maxes[h].load(std::memory_order_relaxed));
+        text += line;
+    }
+    delete total;
+    return text;
+}
+
+
+int Metrics::open_socket(const char *path){
+    struct sockaddr_un addr{};
+    if (strlen(path) >= sizeof addr.sun_path){
+        fprintf(stderr, "Metrics: socket path %s is too long\n", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1){
+        perror("Metrics: socket");
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);  // left over from an earlier run
+    if (bind(fd, (struct sockaddr *) &addr, sizeof addr) == -1 || listen(fd, BACKLOG) == -1){
+        perror("Metrics: bind/listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+void Metrics::serve(int fd, const HostTable &hosts){
+    /* every connection gets the metrics and is closed. a client that sends an http GET (curl --unix-socket) gets
+     * an http response, anything else (nc -U, socat) just the text */
+    while (true){
+        int client = accept(fd, nullptr, nullptr);
+        if (client == -1){
+            if (errno == EINTR) continue;
+            perror("Metrics: accept");
+            return;
+        }
+        char request[1024];
+        ssize_t got = 0;
+        struct pollfd pfd{client, POLLIN, 0};
+        if (poll(&pfd, 1, 100) == 1) got = recv(client, request, sizeof request - 1, 0);
+        std::string body = render(hosts);
+        std::string reply;
+        if (got >= 3 && strncmp(request, "GET", 3) == 0)
+            reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size())
+                    + "\r\n\r\n";
+        reply += body;
+        client_server::TCP_Server::sendall(client, reply.data(), reply.size());
+        close(client);
+    }
+}
+
+
+void Metrics::dump(const char *fileName, const HostTable &hosts){
+    std::string tmp = std::string(fileName) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (fp == nullptr){
+        perror("Metrics: couldn't write the dump");
+        return;
+    }
+    std::string text = render(hosts);
+    fwrite(text.data(), 1, text.size(), fp);
+    fclose(fp);
+    rename(tmp.c_str(), fileName);
+}
@@ -0,0 +1,124 @@
+//
+// Runtime metrics of the protocol engine: per-thread counters merged on read, gauges and histograms, with a stats endpoint.
+//
+
+#ifndef PRJ1_METRICS_H
+#define PRJ1_METRICS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "membership.h"
+
+#define METRIC_TYPES        17      // packet types we count (FECMSG_TYPE is 14, FRAGNAKMSG_TYPE 16)
+#define METRIC_BUCKETS      256     // histogram buckets: 4 per power of 2 of ns (a value is known to within 25%)
+#define METRICS_DUMP_PERIOD 10000   // in miliseconds. how often -W rewrites its file
+#define SRTT_SHIFT          3       // the smoothed rtt moves 1/8 of the way to every sample (like tcp's)
+
+
+enum MetricCounter{
+    M_DUPLICATE_DATA,       // DATA we had acked already
+    M_DUPLICATE_ACK,        // acks from a host that had acked already
+    M_DUPLICATE_SEQ,        // SEQs for msgs that were final already
+    M_DELIVERED,
+    M_FLOW_BLOCKED,         // sends that found our flow control window full (waited or were refused)
+    M_FRAGMENTS_DROPPED,    // fragments over the reassembly memory cap, and partial msgs given up on
+    M_NUM_COUNTERS
+};
+
+enum MetricGauge{
+    G_DELIVERY_QUEUE,       // msgs in the delivery queue
+    G_OUTSTANDING,          // our msgs still collecting acks
+    G_FLOW_WINDOW,          // how many of our msgs may be outstanding (0: no flow control)
+    G_REASSEMBLY,           // bytes of partial msgs waiting for their other fragments
+    M_NUM_GAUGES
+};
+
+enum MetricHistogram{
+    H_HOL_BLOCKING,         // a final msg waiting for the ones before it in the order (SEQ --> delivery)
+    H_ACK_COLLECTION,       // our DATA going out --> its last ack
+    H_SNAPSHOT,             // a local snapshot: recording on --> off
+    // where a datagram's time goes on its way through us (socket_queue needs receive timestamps: -K)
+    H_SOCKET_QUEUE,         // it arrived (the kernel's or the NIC's stamp) --> recv() returned it
+    H_PROCESSING,           // recv() returned it --> we handled it
+    H_DELIVERY_QUEUE,       // a msg in the delivery queue: queued --> delivered
+    H_RTT,                  // our DATA going out --> a host's ack arriving (Karn: not once we resent it to that host)
+    M_NUM_HISTOGRAMS
+};
+
+
+class Metrics{
+    /* Every thread that updates the metrics gets its own shard of counters (and histogram buckets), so an update
+     * is a plain load and store on a cache line nobody else writes: no lock, no atomic read-modify-write.
+     * A read locks the list of shards and adds them up. A thread's shard is folded into the retired one when the
+     * thread ends (the watchdogs come and go). Gauges are single atomics that are just overwritten.
+     * Nothing is computed or formatted unless somebody reads (the stats socket, the -W file or render()). */
+public:
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void count(MetricCounter c, uint64_t n = 1){
+        bump(shard()->counters[c], n);
+    };
+    void packet_in(uint32_t type){
+        bump(shard()->in[type < METRIC_TYPES ? type : 0], 1);
+    };
+    void packet_out(uint32_t type){
+        bump(shard()->out[type < METRIC_TYPES ? type : 0], 1);
+    };
+    void retransmit(int rank){  // a DATA, ACK or SEQ that went out again to the host of that rank
+        if (rank >= 0 && rank < MAX_GROUP_SIZE) bump(shard()->retransmits[rank], 1);
+    };
+    void set(MetricGauge g, int64_t v){
+        gauges[g].store(v, std::memory_order_relaxed);
+    };
+    void observe(MetricHistogram h, uint64_t ns);
+    void rtt(int rank, uint64_t ns){  // an rtt sample to the host of that rank (one thread: the receiver)
+        observe(H_RTT, ns);
+        if (rank < 0 || rank >= MAX_GROUP_SIZE) return;
+        int64_t s = srtt[rank].load(std::memory_order_relaxed);
+        srtt[rank].store(s == 0 ? (int64_t) ns : s + (((int64_t) ns - s) >> SRTT_SHIFT), std::memory_order_relaxed);
+    };
+
+    std::string render(const HostTable &hosts);  // one "name value" per line
+    int open_socket(const char *path);  // the stats endpoint: a unix socket that answers every connection with render()
+    void serve(int fd, const HostTable &hosts);  // never returns
+    void dump(const char *fileName, const HostTable &hosts);  // rewrites the file (atomically, through a rename)
+
+private:
+    struct Shard{
+        std::atomic<uint64_t> counters[M_NUM_COUNTERS];
+        std::atomic<uint64_t> in[METRIC_TYPES];
+        std::atomic<uint64_t> out[METRIC_TYPES];
+        std::atomic<uint64_t> retransmits[MAX_GROUP_SIZE];
+        std::atomic<uint64_t> buckets[M_NUM_HISTOGRAMS][METRIC_BUCKETS];
+        std::atomic<uint64_t> sums[M_NUM_HISTOGRAMS];
+        std::atomic<uint64_t> maxes[M_NUM_HISTOGRAMS];
+        Shard();
+        void add_to(Shard &total) const;
+    };
+    friend struct ThreadShards;
+
+    std::mutex mutex;  // guards shards and retired
+    uint64_t id;  // what threads know us by (an address can be reused)
+    std::vector<Shard *> shards;
+    Shard retired;  // what the threads that ended had counted
+    std::atomic<int64_t> gauges[M_NUM_GAUGES];
+    std::atomic<int64_t> srtt[MAX_GROUP_SIZE];  // by rank. 0: no sample yet
+
+    static void bump(std::atomic<uint64_t> &c, uint64_t n){  // only the shard's own thread writes it
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    };
+    Shard * shard();  // the calling thread's
+    Shard * new_shard();
+    void retire(Shard *s);
+    void merge(Shard &total);
+};
+
+#endif //PRJ1_METRICS_H
@@ -0,0 +1,108 @@
+//
+// Sender ring and receiver gap tracking for the NAK reliability mode (-N).
+//
+
+#include "nak_stream.h"
+
+
+void NakTracker::advance(Stream &s){
+    // pull next up over everything received right above it
+    while (!s.above.empty() && *s.above.begin() <= s.next){
+        if (*s.above.begin() == s.next) s.next++;
+        s.above.erase(s.above.begin());
+    }
+    s.retryAt.erase(s.retryAt.begin(), s.retryAt.lower_bound(s.next));
+    if (s.lead < s.next) s.lead = s.next;
+}
+
+
+void NakTracker::anchor(uint32_t sender, uint32_t first){
+    std::lock_guard<std::mutex> lock(mutex);
+    Stream &s = streams[sender];
+    if (s.anchored) return;
+    s.anchored = true;
+    s.next = first;
+    advance(s);
+}
+
+
+void NakTracker::got_data(uint32_t sender, uint32_t msg_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    Stream &s = streams[sender];
+    if (msg_id >= s.lead) s.lead = msg_id + 1;
+    if (s.anchored && msg_id < s.next) return;  // a duplicate
+    s.above.insert(msg_id);
+    s.retryAt.erase(msg_id);
+    if (s.anchored) advance(s);
+}
+
+
+void NakTracker::acked(uint32_t sender, uint32_t msg_id, uint64_t now_ns){
+    std::lock_guard<std::mutex> lock(mutex);
+    streams[sender].awaitingSeq.emplace(msg_id, now_ns + (uint64_t) NAK_SEQ_WAIT * 1000000);
+}
+
+
+void NakTracker::sequenced(uint32_t sender, uint32_t msg_id){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = streams.find(sender);
+    if (it != streams.end()) it->second.awaitingSeq.erase(msg_id);
+}
+
+
+void NakTracker::advertised(uint32_t sender, uint32_t trail, uint32_t lead, uint64_t now_ns){
+    std::lock_guard<std::mutex> lock(mutex);
+    Stream &s = streams[sender];
+    if (!s.anchored){
+        s.anchored = true;
+        s.next = trail;
+    } else if (trail > s.next) s.next = trail;
+    if (lead > s.lead) s.lead = lead;  // a lost tail shows up as a gap below the lead
+    advance(s);
+    // the msgs below the trail are final at the sender: if we still wait for one of their SEQs, it got lost
+    for (auto it = s.awaitingSeq.begin(); it != s.awaitingSeq.end() && it->first < trail; ++it){
+        if (it->second > now_ns) it->second = now_ns;
+    }
+}
+
+
+void NakTracker::forget(uint32_t sender){
+    std::lock_guard<std::mutex> lock(mutex);
+    streams.erase(sender);
+}
+
+
+std::map<uint32_t, std::vector<NakRange>> NakTracker::sweep(int what, uint64_t now_ns){
+    std::map<uint32_t, std::vector<NakRange>> naks;
+    uint64_t retry = (uint64_t) NAK_RETRY * 1000000;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &kv : streams){
+        Stream &s = kv.second;
+        std::vector<uint32_t> due;  // ascending
+        if (what == NAK_DATA){
+            if (!s.anchored) continue;
+            uint32_t end = s.lead - s.next > NAK_RING_SIZE ? s.next + NAK_RING_SIZE : s.lead;  // older ones are gone anyway
+            for (uint32_t id = s.next; id < end; id++){
+                if (s.above.count(id) != 0) continue;
+                // a gap gets one NAK_INTERVAL to fill in by itself (reordering) before its first NAK
+                auto it = s.retryAt.emplace(id, now_ns + (uint64_t) NAK_INTERVAL * 1000000).first;
+                if (it->second <= now_ns) due.push_back(id);
+            }
+        } else {
+            for (const auto &w : s.awaitingSeq) if (w.second <= now_ns) due.push_back(w.first);
+        }
+        std::vector<NakRange> ranges;
+        for (uint32_t id : due){
+            if (!ranges.empty() && ranges.back().hi + 1 == id) ranges.back().hi = id;
+            else if (ranges.size() < NAK_MAX_RANGES) ranges.push_back(NakRange{id, id});
+            else break;  // the rest is still due: it goes out with the next sweep
+        }
+        // only what goes out now waits NAK_RETRY for its next NAK
+        std::map<uint32_t, uint64_t> &timers = what == NAK_DATA ? s.retryAt : s.awaitingSeq;
+        for (const NakRange &r : ranges){
+            for (uint64_t id = r.lo; id <= r.hi; id++) timers[(uint32_t) id] = now_ns + retry;
+        }
+        if (!ranges.empty()) naks[kv.first] = ranges;
+    }
+    return naks;
+}
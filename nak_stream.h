@@ -0,0 +1,82 @@
+//
+// Sender ring and receiver gap tracking for the NAK reliability mode (-N).
+//
+
+#ifndef PRJ1_NAK_STREAM_H
+#define PRJ1_NAK_STREAM_H
+
+#include <cstdint>
+#include <mutex>
+#include <map>
+#include <set>
+#include <vector>
+
+#define NAK_RING_SIZE   1024    // msgs a sender keeps for retransmission (a power of 2). with -N also its send window
+#define NAK_INTERVAL    100     // in miliseconds. how often a receiver looks for what it's missing
+#define NAK_RETRY       500     // in miliseconds. something still missing is NAKed again after this long
+#define NAK_SEQ_WAIT    1000    // in miliseconds. how long after our ACK we wait for the SEQ before NAKing it
+#define NAK_MAX_RANGES  64      // ranges in one NakMessage
+// what a NakMessage asks for
+#define NAK_DATA        0
+#define NAK_SEQ         1
+
+
+template <typename T>
+class SendRing{
+    /* the last NAK_RING_SIZE msgs we sent, by msg_id (slot = msg_id & mask, our msg_ids are consecutive).
+     * replaces the dataHistory map, which grew forever and was never read. */
+public:
+    SendRing() : slots(NAK_RING_SIZE), ids(NAK_RING_SIZE, UINT32_MAX){}
+    void put(uint32_t msg_id, const T &msg){
+        slots[msg_id & (NAK_RING_SIZE - 1)] = msg;
+        ids[msg_id & (NAK_RING_SIZE - 1)] = msg_id;
+    };
+    const T * get(uint32_t msg_id) const {  // nullptr if it was never sent or got overwritten
+        size_t i = msg_id & (NAK_RING_SIZE - 1);
+        return ids[i] == msg_id ? &slots[i] : nullptr;
+    };
+
+private:
+    std::vector<T> slots;
+    std::vector<uint32_t> ids;  // msg_id in each slot (UINT32_MAX: empty)
+};
+
+
+typedef struct {
+    uint32_t lo;    // first missing msg_id
+    uint32_t hi;    // last missing msg_id (inclusive)
+} NakRange;
+
+
+class NakTracker{
+    /* what we got of every sender's stream of msgs.
+     * -- every msg_id below a stream's `next` was received (or wasn't for us: the sender finalized it without us)
+     * -- msgs we acked wait for their SEQ
+     * A stream only starts NAKing once it is anchored: at 0 for a host whose msgs all include us, otherwise
+     * at the trail of the first heartbeat we get from it (its msgs below that are final, we can't be missing them).
+     * sweep() hands back what's missing, each msg_id at most once every NAK_RETRY. */
+public:
+    void anchor(uint32_t sender, uint32_t first);
+    void got_data(uint32_t sender, uint32_t msg_id);
+    void acked(uint32_t sender, uint32_t msg_id, uint64_t now_ns);  // start waiting for its SEQ
+    void sequenced(uint32_t sender, uint32_t msg_id);
+    void advertised(uint32_t sender, uint32_t trail, uint32_t lead, uint64_t now_ns);  // from a sender heartbeat
+    void forget(uint32_t sender);  // the sender was removed from the view
+    // sender --> ranges of msg_ids to NAK for their DATA (what == NAK_DATA) or their SEQ
+    std::map<uint32_t, std::vector<NakRange>> sweep(int what, uint64_t now_ns);
+
+private:
+    struct Stream{
+        bool anchored = false;
+        uint32_t next = 0;
+        uint32_t lead = 0;                          // one past the highest msg_id we know was sent
+        std::set<uint32_t> above;                   // received msg_ids above next
+        std::map<uint32_t, uint64_t> retryAt;       // missing msg_id --> when to NAK it (again)
+        std::map<uint32_t, uint64_t> awaitingSeq;   // acked msg_id --> when to NAK its SEQ
+    };
+    std::mutex mutex;
+    std::map<uint32_t, Stream> streams;
+    static void advance(Stream &s);
+};
+
+#endif //PRJ1_NAK_STREAM_H
@@ -3,6 +3,12 @@
 //
 
 #include "networkagent.h"
+#include <poll.h>
+#include <ctime>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 
 
 #define THREAD_SLEEP_TIME 3
@@ -24,6 +30,33 @@ namespace client_server
     }
 
 
+    static int64_t ns_of(const struct timespec &ts){
+        return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+
+    // the stamp recvmsg() handed us, moved from the clock it was taken on (CLOCK_REALTIME or the NIC's) to ours
+    static uint64_t received_at(struct msghdr *mh){
+        struct timespec stamp{};
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh); cmsg != nullptr; cmsg = CMSG_NXTHDR(mh, cmsg)){
+            if (cmsg->cmsg_level != SOL_SOCKET) continue;
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS) memcpy(&stamp, CMSG_DATA(cmsg), sizeof stamp);
+            else if (cmsg->cmsg_type == SCM_TIMESTAMPING){
+                struct timespec ts[3];  // the kernel's, (unused), the NIC's
+                memcpy(ts, CMSG_DATA(cmsg), sizeof ts);
+                stamp = ts[2].tv_sec != 0 || ts[2].tv_nsec != 0 ? ts[2] : ts[0];
+            }
+        }
+        if (stamp.tv_sec == 0 && stamp.tv_nsec == 0) return 0;
+        struct timespec real{}, mono{};
+        clock_gettime(CLOCK_REALTIME, &real);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        int64_t age = ns_of(real) - ns_of(stamp);  // how long it sat in the kernel
+        if (age < -1000000 || age > (int64_t) TS_MAX_AGE_NS) return 0;  // more than a ms of skew: not our clock
+        return (uint64_t) (ns_of(mono) - (age > 0 ? age : 0));
+    }
+
+
     // ========================= UDP SEVER =========================
     UDP_Server::UDP_Server(int port)
             : f_port(port), their_addr()
@@ -70,6 +103,7 @@ namespace client_server
     UDP_Server::~UDP_Server(){
         freeaddrinfo(f_addrinfo);
         close(sockfd);
+        if (mcastfd != -1) close(mcastfd);
     }
 
     int UDP_Server::get_socket() const{
@@ -97,7 +131,32 @@ namespace client_server
         struct sockaddr_storage rep_addr{};
         socklen_t addr_len = sizeof rep_addr;
         int numbytes;
-        numbytes = recvfrom(sockfd, msg, max_size-1 , 0, (struct sockaddr *)&rep_addr, &addr_len);
+        int fd = sockfd;
+        if (mcastfd != -1){  // whichever of our socket and the group's has something
+            struct pollfd pfds[2] = {{sockfd, POLLIN, 0}, {mcastfd, POLLIN, 0}};
+            while (poll(pfds, 2, -1) == -1){
+                if (errno != EINTR){perror("UDP_Server::recv: poll error.... ."); exit(1);}
+            }
+            if (!(pfds[0].revents & POLLIN)) fd = mcastfd;
+        }
+        if (timestamping == TS_NONE){
+            numbytes = recvfrom(fd, msg, max_size-1 , 0, (struct sockaddr *)&rep_addr, &addr_len);
+        } else {  // the stamp comes as ancillary data
+            struct iovec iov{msg, max_size-1};
+            union {
+                char buf[CMSG_SPACE(3 * sizeof(struct timespec))];
+                struct cmsghdr align;
+            } control{};
+            struct msghdr mh{};
+            mh.msg_name = &rep_addr;
+            mh.msg_namelen = addr_len;
+            mh.msg_iov = &iov;
+            mh.msg_iovlen = 1;
+            mh.msg_control = control.buf;
+            mh.msg_controllen = sizeof control.buf;
+            numbytes = recvmsg(fd, &mh, 0);
+            if (numbytes != -1) last_rx_ns = received_at(&mh);
+        }
         if (numbytes == -1){perror("UDP_Server::recv: recvfrom error.... ."); exit(1);}
 //        const char * their_ip = inet_ntop(rep_addr.ss_family, get_in_addr((struct sockaddr *)&rep_addr), s, sizeof s);
 //        printf("DEBUG [UDP_Server::recv] received msg %s from %s.\n", msg, their_ip);
@@ -112,6 +171,10 @@ namespace client_server
         return sendto(sockfd, msg, msg_size, 0, (const struct sockaddr *) &their_addr, sizeof(their_addr));
     }
 
+    int UDP_Server::send_to_addr(const struct sockaddr_storage &addr, const char * msg, size_t msg_size) const{
+        return sendto(sockfd, msg, msg_size, 0, (const struct sockaddr *) &addr, sizeof(addr));
+    }
+
     int  UDP_Server::send_to(const char * destination, const char * msg, size_t msg_size) const{
         struct addrinfo hints{}, *hostai;  // ai stands for addrinfo
         int rv;
@@ -133,6 +196,103 @@ namespace client_server
     }
 
 
+    int UDP_Server::join_group(const char * group, int port, int ttl, bool loopback, const char * iface){
+        struct in_addr groupAddr{}, ifaceAddr{};
+        if (inet_pton(AF_INET, group, &groupAddr) != 1 || !IN_MULTICAST(ntohl(groupAddr.s_addr))){
+            fprintf(stderr, "UDP_Server::join_group: %s is not an IPv4 multicast address\n", group);
+            return -1;
+        }
+        ifaceAddr.s_addr = htonl(INADDR_ANY);
+        if (iface != nullptr && inet_pton(AF_INET, iface, &ifaceAddr) != 1){
+            fprintf(stderr, "UDP_Server::join_group: bad interface address %s\n", iface);
+            return -1;
+        }
+        int fd, yes = 1;
+        if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1){
+            perror("UDP_Server::join_group: socket error");
+            return -1;
+        }
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1){
+            perror("UDP_Server::join_group: SO_REUSEADDR");
+            close(fd);
+            return -1;
+        }
+        struct sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        local.sin_addr = groupAddr;  // only the group's traffic
+        if (bind(fd, (struct sockaddr *) &local, sizeof local) == -1){
+            perror("UDP_Server::join_group: bind error");
+            close(fd);
+            return -1;
+        }
+        struct ip_mreq mreq{};
+        mreq.imr_multiaddr = groupAddr;
+        mreq.imr_interface = ifaceAddr;
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof mreq) == -1){
+            perror("UDP_Server::join_group: IP_ADD_MEMBERSHIP");
+            close(fd);
+            return -1;
+        }
+        // the sending side is our own socket
+        unsigned char t = ttl, loop = loopback ? 1 : 0;
+        if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof t) == -1 ||
+            setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof loop) == -1 ||
+            (iface != nullptr && setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &ifaceAddr, sizeof ifaceAddr) == -1)){
+            perror("UDP_Server::join_group: multicast send options");
+            close(fd);
+            return -1;
+        }
+        if (timestamping != TS_NONE && stamp_socket(fd, timestamping) == -1){
+            perror("UDP_Server::join_group: timestamps");
+            close(fd);
+            return -1;
+        }
+        mcastfd = fd;
+        group_addr.sin_family = AF_INET;
+        group_addr.sin_port = htons(port);
+        group_addr.sin_addr = groupAddr;
+        return 0;
+    }
+
+    int UDP_Server::send_to_group(const char * msg, size_t msg_size) const{
+        return sendto(sockfd, msg, msg_size, 0, (const struct sockaddr *) &group_addr, sizeof group_addr);
+    }
+
+    int UDP_Server::stamp_socket(int fd, int mode){
+        if (mode == TS_SOFTWARE){
+            int yes = 1;
+            return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof yes);
+        }
+        // the NIC's stamp if it has one, and the kernel's always (a NIC only stamps what its filter lets through)
+        int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                    SOF_TIMESTAMPING_SOFTWARE;
+        return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof flags);
+    }
+
+    int UDP_Server::enable_timestamps(int mode, const char * iface){
+        if (mode != TS_SOFTWARE && mode != TS_HARDWARE){
+            fprintf(stderr, "UDP_Server::enable_timestamps: bad mode %d\n", mode);
+            return -1;
+        }
+        if (mode == TS_HARDWARE && iface != nullptr){  // have the NIC stamp every datagram that comes in
+            struct hwtstamp_config config{};
+            config.tx_type = HWTSTAMP_TX_OFF;
+            config.rx_filter = HWTSTAMP_FILTER_ALL;
+            struct ifreq ifr{};
+            strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+            ifr.ifr_data = (char *) &config;
+            if (ioctl(sockfd, SIOCSHWTSTAMP, &ifr) == -1)
+                perror("UDP_Server::enable_timestamps: SIOCSHWTSTAMP (only the kernel's stamps then)");
+        }
+        if (stamp_socket(sockfd, mode) == -1 || (mcastfd != -1 && stamp_socket(mcastfd, mode) == -1)){
+            perror("UDP_Server::enable_timestamps: setsockopt");
+            return -1;
+        }
+        timestamping = mode;
+        return 0;
+    }
+
     int UDP_Server::timed_recv(char *msg, size_t max_size, int max_wait_ms)
     {
         fd_set s;
@@ -241,7 +401,7 @@ namespace client_server
 
         if ((rv = getaddrinfo(destination, decimal_port, &hints, &servinfo)) != 0) {
             fprintf(stderr, "TCP_Server::connect_and_get_socket getaddrinfo: %s\n", gai_strerror(rv));
-            return 1;
+            return -1;
         }
         // loop through all the results and connect to the first we can
         for(p = servinfo; p != nullptr; p = p->ai_next) {
@@ -259,7 +419,8 @@ namespace client_server
         }
         if (p == nullptr) {
             fprintf(stderr, "TCP_Server::connect_and_get_socket: failed to connect\n");
-            return 2;
+            freeaddrinfo(servinfo);
+            return -1;
         }
         freeaddrinfo(servinfo); // all done with this structure
         return sock;
@@ -269,6 +430,33 @@ namespace client_server
         return send(sock, msg, msg_size, 0);
     }
 
+    int TCP_Server::sendall(int sock, const char *msg, size_t msg_size) {
+        size_t sent = 0;
+        while (sent < msg_size) {
+            ssize_t n = send(sock, msg + sent, msg_size - sent, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            sent += n;
+        }
+        return (int) sent;
+    }
+
+    int TCP_Server::recvall(int sock, char *buf, size_t size) {
+        size_t got = 0;
+        while (got < size) {
+            ssize_t n = recv(sock, buf + got, size - got, 0);
+            if (n == 0) return 0;  // the other side closed
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            got += n;
+        }
+        return (int) got;
+    }
+
     int TCP_Server::get_socket() const {
         return sockfd;
     }
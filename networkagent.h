@@ -16,9 +16,17 @@
 #include <cerrno>
 #include <random>
 #include <sys/wait.h>
+#include <netinet/in.h>
+#include <cstdint>
 
 #define BACKLOG 20   // how many pending connections queue will hold
 
+// receive timestamps (UDP_Server::enable_timestamps)
+#define TS_NONE         0
+#define TS_SOFTWARE     1   // SO_TIMESTAMPNS: the kernel stamps every datagram as it comes off the driver
+#define TS_HARDWARE     2   // SO_TIMESTAMPING: the NIC's stamp where there is one, the kernel's otherwise
+#define TS_MAX_AGE_NS   10000000000ULL  // a stamp older than this (or in the future) is from a clock we can't use
+
 namespace client_server
 {
     void *get_in_addr(struct sockaddr *sa);
@@ -37,14 +45,37 @@ namespace client_server
         int                 recv(char *msg, size_t max_size);
         int                 reply(const char *msg, size_t msg_size);
         int                 send_to(const char * destination, const char * msg, size_t msg_size) const;
+        int                 send_to_addr(const struct sockaddr_storage &addr, const char * msg, size_t msg_size) const;  // e.g. a reply held back
 //        int                 send_to(const char * destination, const char * msg, size_t msg_size = -1) const;
         int                 timed_recv(char *msg, size_t max_size, int max_wait_ms);
+        /* IPv4 multicast. Group traffic comes in on a second socket bound to the group (SO_REUSEADDR, so several
+         * processes on one box can join) and recv() takes from both. We send to the group from our own socket so
+         * replies still come back here. iface: address of the interface to use (nullptr: let the kernel pick) */
+        int                 join_group(const char * group, int port, int ttl, bool loopback, const char * iface = nullptr);
+        int                 send_to_group(const char * msg, size_t msg_size) const;
+        bool                in_group() const {
+            return mcastfd != -1;
+        };
+        /* stamp every datagram we get on the way in (TS_SOFTWARE or TS_HARDWARE). recv() then knows when the datagram
+         * got here, before it sat in the socket's queue. hardware stamps need a NIC that does them: iface is the
+         * interface to switch them on for (needs CAP_NET_ADMIN; nullptr: somebody did, e.g. with hwstamp_ctl) and
+         * the NIC's clock has to be synced to the system's (phc2sys). -1 if the socket won't stamp */
+        int                 enable_timestamps(int mode, const char * iface = nullptr);
+        uint64_t            rx_ns() const {  // CLOCK_MONOTONIC when the datagram recv() got last arrived. 0: unknown
+            return last_rx_ns;
+        };
 
     private:
         int                 sockfd;
         int                 f_port;
         struct addrinfo *   f_addrinfo;
         struct sockaddr_storage their_addr{};
+        int                 mcastfd = -1;
+        struct sockaddr_in  group_addr{};
+        int                 timestamping = TS_NONE;
+        uint64_t            last_rx_ns = 0;
+
+        static int          stamp_socket(int fd, int mode);
 
     };
 
@@ -59,6 +90,8 @@ namespace client_server
         int                 accept_and_recv(char * msg, size_t max_size) const;
         int                 connect_and_get_socket(const char * destination) const;
         static int          sendtcp(int sock, const char * msg, size_t msg_size) ;
+        static int          sendall(int sock, const char * msg, size_t msg_size);  // loops until all sent
+        static int          recvall(int sock, char * buf, size_t size);  // loops until size bytes. 0 on eof
 
 
     private:
@@ -0,0 +1,171 @@
+//
+// Variable length payloads in reference counted buffers from a pool: queued, retained and delivered without copies.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "payload.h"
+
+static const size_t classSizes[PAYLOAD_CLASSES] = {256, 2048, 16384, PAYLOAD_MAX_BUFFER};
+
+
+struct PayloadBuffer{
+    std::atomic<uint32_t> refs{1};
+    uint32_t cls;
+    unsigned char * bytes(){
+        return reinterpret_cast<unsigned char *>(this + 1);
+    };
+};
+
+
+Payload::Payload(const Payload &other) : buf(other.buf), offset(other.offset), length(other.length){
+    if (buf != nullptr) buf->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+Payload& Payload::operator=(const Payload &other){
+    if (this != &other){
+        if (other.buf != nullptr) other.buf->refs.fetch_add(1, std::memory_order_relaxed);
+        release();
+        buf = other.buf;
+        offset = other.offset;
+        length = other.length;
+    }
+    return *this;
+}
+
+
+Payload& Payload::operator=(Payload &&other) noexcept{
+    if (this != &other){
+        release();
+        buf = other.buf;
+        offset = other.offset;
+        length = other.length;
+        other.buf = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+
+Payload::~Payload(){
+    release();
+}
+
+
+void Payload::release(){
+    if (buf != nullptr && buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) PayloadPool::get().give(buf);
+    buf = nullptr;
+}
+
+
+Payload Payload::allocate(size_t size){
+    Payload p;
+    if (size == 0) return p;
+    p.buf = PayloadPool::get().take(size);
+    if (p.buf == nullptr){
+        fprintf(stderr, "A payload of %lu bytes is more than the %d we can hold. Exiting.\n", size, PAYLOAD_MAX_BUFFER);
+        exit(1);
+    }
+    p.length = (uint32_t) size;
+    return p;
+}
+
+
+Payload Payload::copy_of(const void *bytes, size_t size){
+    Payload p = allocate(size);
+    if (size > 0) memcpy(p.mutable_data(), bytes, size);
+    return p;
+}
+
+
+Payload Payload::from_u32(uint32_t v){
+    Payload p = allocate(4);
+    unsigned char *b = p.mutable_data();
+    b[0] = (unsigned char) (v >> 24);
+    b[1] = (unsigned char) (v >> 16);
+    b[2] = (unsigned char) (v >> 8);
+    b[3] = (unsigned char) v;
+    return p;
+}
+
+
+Payload Payload::slice(size_t from, size_t size) const {
+    Payload p;
+    if (buf == nullptr || size == 0 || from + size > length) return p;
+    p = *this;
+    p.offset = offset + (uint32_t) from;
+    p.length = (uint32_t) size;
+    return p;
+}
+
+
+const unsigned char * Payload::data() const {
+    return buf == nullptr ? nullptr : buf->bytes() + offset;
+}
+
+
+unsigned char * Payload::mutable_data(){
+    return buf == nullptr ? nullptr : buf->bytes() + offset;
+}
+
+
+bool Payload::shared() const {
+    return buf != nullptr && buf->refs.load(std::memory_order_acquire) > 1;
+}
+
+
+size_t Payload::capacity() const {
+    return buf == nullptr ? 0 : classSizes[buf->cls];
+}
+
+
+uint32_t Payload::to_u32() const {
+    if (length != 4) return 0;
+    const unsigned char *b = data();
+    return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | (uint32_t) b[3];
+}
+
+
+PayloadPool & PayloadPool::get(){
+    static PayloadPool * pool = new PayloadPool();
+    return *pool;
+}
+
+
+PayloadBuffer * PayloadPool::take(size_t size){
+    uint32_t cls = 0;
+    while (cls < PAYLOAD_CLASSES && classSizes[cls] < size) cls++;
+    if (cls == PAYLOAD_CLASSES) return nullptr;
+    inUse.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeBuffers[cls].empty()){
+            PayloadBuffer *b = freeBuffers[cls].back();
+            freeBuffers[cls].pop_back();
+            b->refs.store(1, std::memory_order_relaxed);
+            return b;
+        }
+    }
+    void *mem = ::operator new(sizeof(PayloadBuffer) + classSizes[cls]);
+    auto *b = new (mem) PayloadBuffer();
+    b->cls = cls;
+    return b;
+}
+
+
+void PayloadPool::give(PayloadBuffer *b){
+    inUse.fetch_sub(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeBuffers[b->cls].size() < PAYLOAD_POOL_BYTES / classSizes[b->cls]){
+            freeBuffers[b->cls].push_back(b);
+            return;
+        }
+    }
+    b->~PayloadBuffer();
+    ::operator delete(b);
+}
@@ -0,0 +1,79 @@
+//
+// Variable length payloads in reference counted buffers from a pool: queued, retained and delivered without copies.
+//
+
+#ifndef PRJ1_PAYLOAD_H
+#define PRJ1_PAYLOAD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define PAYLOAD_CLASSES     4           // buffer sizes: 256 B, 2 KB, 16 KB and 64 KB
+#define PAYLOAD_MAX_BUFFER  65536       // the largest buffer (a whole udp datagram fits)
+#define PAYLOAD_POOL_BYTES  (16 << 20)  // free buffers the pool keeps per size class. the rest go back to the heap
+
+struct PayloadBuffer;
+
+
+class Payload{
+    /* a view of bytes in a pooled buffer: 16 bytes, copied by bumping the buffer's count (an atomic add), never by
+     * copying the bytes. the buffer goes back to the pool with its last view. what the application multicasts, what
+     * we keep for retransmission, what sits in the delivery queue and what the delivery callback gets all share
+     * the one buffer the bytes were written (or received) into. the bytes must not change once the payload is shared */
+public:
+    Payload() = default;
+    Payload(const Payload &other);
+    Payload(Payload &&other) noexcept : buf(other.buf), offset(other.offset), length(other.length) {
+        other.buf = nullptr;
+        other.length = 0;
+    };
+    Payload& operator=(const Payload &other);
+    Payload& operator=(Payload &&other) noexcept;
+    ~Payload();
+
+    static Payload allocate(size_t size);  // to fill in through mutable_data() before it's shared
+    static Payload copy_of(const void *bytes, size_t size);
+    static Payload from_u32(uint32_t v);  // 4 bytes, big endian
+    Payload slice(size_t from, size_t size) const;  // a part of this one, in the same buffer
+
+    const unsigned char * data() const;
+    unsigned char * mutable_data();
+    size_t size() const {
+        return length;
+    };
+    bool empty() const {
+        return length == 0;
+    };
+    bool shared() const;  // another view has the buffer too
+    size_t capacity() const;  // of the buffer
+    uint32_t to_u32() const;  // what from_u32() made (0 if it isn't 4 bytes)
+
+private:
+    PayloadBuffer *buf = nullptr;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    void release();
+};
+
+
+class PayloadPool{
+    /* free buffers by size class, taken and given back under a mutex. A warm pool costs no allocation per msg. */
+public:
+    static PayloadPool & get();  // the process' pool. never destroyed: payloads may outlive everything else
+    PayloadBuffer * take(size_t size);  // nullptr if it's more than PAYLOAD_MAX_BUFFER
+    void give(PayloadBuffer *b);
+    uint64_t in_use() const {  // buffers handed out and not back yet
+        return inUse.load(std::memory_order_relaxed);
+    };
+
+private:
+    PayloadPool() = default;
+    std::mutex mutex;
+    std::vector<PayloadBuffer *> freeBuffers[PAYLOAD_CLASSES];  // mutex
+    std::atomic<uint64_t> inUse{0};
+};
+
+#endif //PRJ1_PAYLOAD_H
@@ -4,72 +4,259 @@
 
 #include "reliable_multicast.h"
 
+static uint32_t packet_type(const unsigned char *serialized_packet){
+    return unpacku32(const_cast<unsigned char *>(serialized_packet));
+}
+
+
+static bool on_channel(uint32_t type){
+    // the snapshot records whole DATA msgs, not the fragments they travel in
+    return type != FRAGMSG_TYPE && type != FRAGNAKMSG_TYPE;
+}
+
+
+static bool packet_fits(const unsigned char *packet, size_t size){
+    /* whether a datagram holds everything the deserializer of its type reads at fixed offsets. what the FEC decoder
+     * rebuilds is exactly as long as the packet was, so a short one would be read past its end */
+    if (size < 4) return false;
+    switch (packet_type(packet)){
+        case DATAMSG_TYPE:  // a JOIN carries the joining host's name after the header
+            return size >= MAX_STRUCT_SIZE &&
+                   (unpacku32(const_cast<unsigned char *>(&packet[16])) != JOIN_MSG || size >= MAX_DATA_SIZE);
+        case AGGACKMSG_TYPE:  // deserialize_agg_ack_message checks the acked hosts
+            return size >= AGGACK_HEADER_SIZE;
+        case NAKMSG_TYPE:{
+            if (size < NAK_HEADER_SIZE) return false;
+            uint32_t count = std::min((uint32_t) unpacku32(const_cast<unsigned char *>(&packet[16])), (uint32_t) NAK_MAX_RANGES);
+            return size >= NAK_HEADER_SIZE + 8 * (size_t) count;
+        }
+        case FRAGMSG_TYPE:  // the reassembler checks
+            return true;
+        case FRAGNAKMSG_TYPE:  // deserialize_frag_nak_message checks the ranges
+            return size >= FRAGNAK_HEADER_SIZE;
+        default:  // everything else goes out in MAX_STRUCT_SIZE bytes
+            return size >= MAX_STRUCT_SIZE;
+    }
+}
+
+
 ReliableMulticast::ReliableMulticast(const char *hostFileName,
                                      const client_server::UDP_Server& comm,
-                                     double drop_rate, int delay_in_ms)
-        : communicator(comm), deliveryQueue{}, ackHistory{}, drop_rate(drop_rate),
-        delay_in_ms(delay_in_ms), snapshot(nullptr){
-    // user should make sure drop_rate and delay_in_ms are reasonable values.
-    hostNames = new char*[MAX_NUM_HOSTS];
-    num_hosts = wait_to_sync::read_from_file(hostFileName, hostNames);
-    // we wait for all the hosts to be ready before sending msgs
-    current_container_name = wait_to_sync::waittosync(hostNames, num_hosts);
-    if (current_container_name == nullptr){perror("Obtaining current container's name failed (from wait to sync). Exiting.\n");exit(1);}
-    // that also extracts the id
-    current_container_id = extract_int_from_string(std::string(current_container_name));
-    for (int i = 0; i<num_hosts; i++){
-        hostIDtoHostName.insert(std::make_pair(extract_int_from_string(hostNames[i]), std::string(hostNames[i])));
+                                     const LinkProfile &link, int failure_timeout_ms,
+                                     const char *joinSeed, const char *joinName, int tree_fanout, bool nak_mode,
+                                     int fec_n, int fec_k, uint32_t link_seed, const char *linkFile,
+                                     const char *shmGroup)
+        : udpRuntime(new UdpRuntime(comm, link, link_seed)), runtime(udpRuntime.get()), deliveryQueue{},
+        delay_in_ms(link.delay_ms), snapshot(nullptr), failureDetector(failure_timeout_ms),
+        failure_timeout_ms(failure_timeout_ms), joinServer(JOIN_PORT), tree_fanout(tree_fanout), nak_mode(nak_mode),
+        fec_n(fec_n), fec_k(fec_k){
+    // user should make sure the link profile has reasonable values.
+    if (linkFile != nullptr && udpRuntime->load_links(linkFile) == -1){
+        fprintf(stderr, "Bad link file %s. Exiting.\n", linkFile);
+        exit(1);
+    }
+    if (joinSeed != nullptr){  // we are joining a running group: the seed sponsors us, no Hostfile and no barrier
+        if (shmGroup != nullptr) use_shm(joinName, shmGroup);
+        join_group(joinSeed, joinName);
+    } else {
+        std::vector<std::string> hostFileLines;
+        wait_to_sync::read_from_file(hostFileName, hostFileLines);
+        // we wait for all the hosts to be ready before sending msgs
+        const char * synced_name = wait_to_sync::waittosync(hostFileLines);
+        if (synced_name == nullptr){perror("Obtaining current container's name failed (from wait to sync). Exiting.\n");exit(1);}
+        // the barrier still goes over the network: it's how we learn our name
+        if (shmGroup != nullptr) use_shm(synced_name, shmGroup);
+        start_group(hostFileLines, synced_name);
+    }
+    start_threads(true);
+}
+
+
+ReliableMulticast::ReliableMulticast(Runtime &runtime, const std::vector<std::string> &hostNames, const char *ourName,
+                                     int failure_timeout_ms, int tree_fanout, bool nak_mode, int fec_n, int fec_k)
+        : runtime(&runtime), deliveryQueue{}, delay_in_ms(0), snapshot(nullptr, 0), failureDetector(failure_timeout_ms),
+        failure_timeout_ms(failure_timeout_ms), joinServer(0), tree_fanout(tree_fanout), nak_mode(nak_mode),
+        fec_n(fec_n), fec_k(fec_k){
+    // no barrier: the simulator starts everybody at once. no joins and no snapshots either (those are tcp)
+    start_group(hostNames, ourName);
+    start_threads(false);
+}
+
+
+void ReliableMulticast::use_shm(const char *ourName, const char *shmGroup){
+    // before any thread uses the runtime. the udp socket stays open (nobody reads it)
+    shmRuntime.reset(new ShmRuntime(ourName, shmGroup));
+    runtime = shmRuntime.get();
+}
+
+
+void ReliableMulticast::start_group(const std::vector<std::string> &hostNames, const char *ourName){
+    for (const std::string &hostName : hostNames){
+        if (hosts.add_host(hostName) == -1){fprintf(stderr, "Bad host list (%s). Exiting.\n", hostName.c_str()); exit(1);}
     }
+    num_hosts = hosts.size();
+    // that also extracts the id
+    current_container_id = extract_int_from_string(std::string(ourName));
+    current_rank = hosts.rank_of(current_container_id);
+    if (current_rank == -1){fprintf(stderr, "%s is not in the host list. Exiting.\n", ourName); exit(1);}
+    current_container_name = hosts.name_of(current_rank);
     printf("Current container's name: %s and id: %d\n", current_container_name, current_container_id);
+    /* failure detection: everybody in the Hostfile is alive as of now */
+    for (int i = 0; i < num_hosts; i++) view.set(i);
+    memberSince.assign(num_hosts, 0);
+    for (int i = 0; i < num_hosts; i++){
+        if (i == current_rank) continue;
+        nakTracker.anchor(hosts.id_of(i), 0);
+        ackLog.anchor(hosts.id_of(i), 0);
+    }
+}
+
+
+void ReliableMulticast::start_threads(bool listeners){
+    // listeners: also take snapshot and join requests (tcp)
+    if (tree_fanout > 0)
+        printf("[Process %d] Sending through a %d-ary tree.\n", current_container_id, tree_fanout);
+    failureDetector.start(num_hosts, current_rank, runtime->now_ns());
+    if (failureDetector.enabled() || nak_mode)  // with -N the heartbeats also carry our trail and lead
+        runtime->spawn([this]{ heartbeat_loop(); });
+    if (fec_n > 0){
+        printf("[Process %d] Sending %d parity packets per block of %d DATA/SEQ.\n", current_container_id, fec_k, fec_n);
+        runtime->spawn([this]{ fec_flush_loop(); });
+    }
+    if (nak_mode){
+        printf("[Process %d] Receivers NAK what they miss (ring of %d msgs).\n", current_container_id, NAK_RING_SIZE);
+        runtime->spawn([this]{ nak_loop(); });
+    }
     /* global snapshot */
     recordMessages = false;
     snapshot.set_rm(this);
-    std::thread snapshotListener(&CL_Global_Snapshot::listen_for_incoming_connections, &snapshot);
-    snapshotListener.detach();  // maybe join elsewhere?
+    if (listeners){
+        runtime->spawn([this]{ snapshot.listen_for_incoming_connections(); });
+        /* joins: any member can sponsor a new host */
+        runtime->spawn([this]{ join_listener(); });
+    }
+    runtime->spawn([this]{ throughput_monitor(); });
 }
 
 [[noreturn]] void ReliableMulticast::msg_receiver(){
     int numbytes;
+    // datagrams land in a pooled buffer: a big DATA payload is delivered from right there (see PAYLOAD_ADOPT)
+    Payload recvBuffer = Payload::allocate(MAX_DATAGRAM);
+    std::vector<ByteVector> packets;
+    while (recv_cap < max_recv){
+        DPRINTF(("Waiting for new msg...\n"));
+        unsigned char *msg_buf = recvBuffer.mutable_data();
+        numbytes = runtime->recv(msg_buf, MAX_DATAGRAM);
+        if (numbytes == -1) {perror("msg_receiver: recvfrom error..."); exit(1);}
+        uint64_t read_ns = runtime->now_ns();
+        packet_rx_ns = runtime->rx_ns();
+        if (packet_rx_ns != 0 && packet_rx_ns <= read_ns) metrics.observe(H_SOCKET_QUEUE, read_ns - packet_rx_ns);
+        else packet_rx_ns = read_ns;  // no stamp: as if it had just come in
+        if (numbytes >= 4 && unpacku32(&msg_buf[0]) == FECMSG_TYPE){  // -F: unwrap (and maybe rebuild what was lost)
+            metrics.packet_in(FECMSG_TYPE);
+            packets.clear();
+            fecDecoder.receive(msg_buf, numbytes, packets);
+            for (ByteVector &pkt : packets){
+                if (handle_packet(pkt.data(), pkt.size())) recv_cap++;
+            }
+            metrics.observe(H_PROCESSING, runtime->now_ns() - read_ns);
+            dispatch_deliveries();
+            continue;
+        }
+        if (handle_packet(msg_buf, numbytes, &recvBuffer)) recv_cap++;
+        if (recvBuffer.shared()) recvBuffer = Payload::allocate(MAX_DATAGRAM);  // a payload kept it: we need another
+        metrics.observe(H_PROCESSING, runtime->now_ns() - read_ns);
+        dispatch_deliveries();
+    }
+    while(true){printf("Receiver received MAX timeout... Please exit.\n");runtime->sleep_us(100*1000000ULL);}  // for no return...
+}
+
+
+bool ReliableMulticast::handle_packet(unsigned char *msg_buf, size_t numbytes, const Payload *owner){
+    // returns whether the msg counts towards RECV_CAP
     unsigned long int type;
     DataMessage dataMessage;
     AckMessage ackMessage;
     SeqMessage seqMessage;
-    unsigned char msg_buf[MAX_STRUCT_SIZE];
-    while (recv_cap < RECV_CAP){
-        DPRINTF(("Waiting for new msg...\n"));
-        numbytes = communicator.recv(reinterpret_cast<char *>(msg_buf), MAX_MSG_SIZE);
-        if (numbytes == -1) {perror("msg_receiver: recvfrom error..."); exit(1);}
-        recordMessagesMutex.lock();  // this is for global snapshot
-        if (recordMessages){  // receiving msgs
-//            printf("[debug msg_receiver] we are told to record msgs!\n");
-            snapshot.inboundMessageBufferMutex.lock();
-            snapshot.inboundMessageBuffer.push(ByteVector(msg_buf, msg_buf+MAX_STRUCT_SIZE));
-            snapshot.inboundMessageBufferMutex.unlock();
-//            printf("[debug msg_receiver] successful recorded a msg!\n");
-        }
-        recordMessagesMutex.unlock();
-        type = unpacku32(&msg_buf[0]);
-//        DPRINTF(("Received msg is of type: %lu\n", type));
-        switch (type) {
-            case DATAMSG_TYPE:
-                deserialize_data_message(msg_buf, dataMessage);
-                handle_datamsg(dataMessage);
-                break;
-            case ACKMSG_TYPE:
-                deserialize_ack_message(msg_buf, ackMessage);
-                handle_ackmsg(ackMessage);
-                break;
-            case SEQMSG_TYPE:
-                deserialize_seq_message(msg_buf, seqMessage);
-                handle_seqmsg(seqMessage);
-                break;
-            default:
-                fprintf(stderr, "Received message wrong type: %lu....\n", type);
-                exit(1);
-        }
-        recv_cap++;
+    HeartbeatMessage heartbeatMessage;
+    FlushMessage flushMessage;
+    FlushDoneMessage flushDoneMessage;
+    JoinedMessage joinedMessage;
+    JoinedAckMessage joinedAckMessage;
+    AggAckMessage aggAckMessage;
+    NakMessage nakMessage;
+    FragNakMessage fragNakMessage;
+    if (!packet_fits(msg_buf, numbytes)){
+        fprintf(stderr, "[handle_packet] Dropping a %lu byte datagram, too short for its type\n", numbytes);
+        return false;
+    }
+    type = unpacku32(&msg_buf[0]);
+    recordMessagesMutex.lock();  // this is for global snapshot
+    if (recordMessages && on_channel((uint32_t) type)){  // receiving msgs
+//        printf("[debug msg_receiver] we are told to record msgs!\n");
+        snapshot.inboundMessageBufferMutex.lock();
+        snapshot.inboundMessageBuffer.push(ByteVector(msg_buf, msg_buf+numbytes));
+        snapshot.inboundMessageBufferMutex.unlock();
+//        printf("[debug msg_receiver] successful recorded a msg!\n");
+    }
+    recordMessagesMutex.unlock();
+    metrics.packet_in((uint32_t) type);
+//    DPRINTF(("Received msg is of type: %lu\n", type));
+    switch (type) {
+        case DATAMSG_TYPE:
+            deserialize_data_message(msg_buf, numbytes, dataMessage, owner);
+            handle_datamsg(dataMessage);
+            break;
+        case ACKMSG_TYPE:
+            deserialize_ack_message(msg_buf, ackMessage);
+            handle_ackmsg(ackMessage);
+            break;
+        case SEQMSG_TYPE:
+            deserialize_seq_message(msg_buf, seqMessage);
+            handle_seqmsg(seqMessage);
+            break;
+        case HBTMSG_TYPE:
+            deserialize_heartbeat_message(msg_buf, heartbeatMessage);
+            handle_heartbeatmsg(heartbeatMessage);
+            return false;  // heartbeats don't count towards RECV_CAP
+        case FLUSHMSG_TYPE:
+            deserialize_flush_message(msg_buf, flushMessage);
+            handle_flushmsg(flushMessage);
+            break;
+        case FLUSHDONEMSG_TYPE:
+            deserialize_flush_done_message(msg_buf, flushDoneMessage);
+            handle_flushdonemsg(flushDoneMessage);
+            break;
+        case JOINEDMSG_TYPE:
+            deserialize_joined_message(msg_buf, joinedMessage);
+            handle_joinedmsg(joinedMessage);
+            break;
+        case JOINEDACKMSG_TYPE:
+            deserialize_joined_ack_message(msg_buf, joinedAckMessage);
+            handle_joinedackmsg(joinedAckMessage);
+            break;
+        case AGGACKMSG_TYPE:
+            if (!deserialize_agg_ack_message(msg_buf, numbytes, aggAckMessage)){
+                fprintf(stderr, "[handle_packet] Dropping a short AggAckMessage (%lu bytes)\n", numbytes);
+                return false;
+            }
+            handle_aggackmsg(aggAckMessage);
+            break;
+        case NAKMSG_TYPE:
+            deserialize_nak_message(msg_buf, nakMessage);
+            handle_nakmsg(nakMessage);
+            break;
+        case FRAGMSG_TYPE:
+            return handle_fragment(msg_buf, numbytes);  // counts once its DATA is complete
+        case FRAGNAKMSG_TYPE:
+            deserialize_frag_nak_message(msg_buf, numbytes, fragNakMessage);
+            handle_fragnakmsg(fragNakMessage);
+            return false;
+        default:
+            fprintf(stderr, "Received message wrong type: %lu....\n", type);
+            exit(1);
     }
-    while(true){printf("Receiver received MAX timeout... Please exit.\n");sleep(100);}  // for no return...
+    return true;
 }
 
 
@@ -78,43 +265,83 @@ void ReliableMulticast::handle_datamsg(const DataMessage &dataMessage){
      * If we have seen this before (i.e. a duplicate message), we resend the old ack
      * otherwise we send a new ack
      * */
-    DPRINTF(("*** Received data message: type %d with sender_id %d and msg_id %d and data %d\n"
-            , dataMessage.type, dataMessage.sender, dataMessage.msg_id, dataMessage.data));
-    for (AckMessage am : alreadyAckedMessages){  // check to see if we have already acked this message
-        if (am.sender == dataMessage.sender && am.msg_id == dataMessage.msg_id){  // this dataMessage has already been acked
-            // we resend it
-            unsigned char serialized_packet[MAX_STRUCT_SIZE];
-            serialize_ack_message(am, serialized_packet);
-            reply_msg_with_drop_and_delay(serialized_packet);
-            return;
-        }
+    DPRINTF(("*** Received data message: type %d with sender_id %d and msg_id %d and %lu bytes\n"
+            , dataMessage.type, dataMessage.sender, dataMessage.msg_id, dataMessage.payload.size()));
+    if (dataMessage.sender == (uint32_t) current_container_id) return;  // our own ip multicast looping back
+    heard_from(dataMessage.sender);
+    if (!is_member(dataMessage.sender)){  // the sender was removed from the view. its msgs are the flush's business
+        DPRINTF(("handle_datamsg: ignoring msg (%d, %d) from removed host\n", dataMessage.msg_id, dataMessage.sender));
+        return;
+    }
+    if (nak_mode) nakTracker.got_data(dataMessage.sender, dataMessage.msg_id);  // even if it isn't for us: no gap
+    viewMutex.lock();
+    bool before_us = dataMessage.view_epoch < memberSince[current_rank];
+    int members = (int) view.count();
+    viewMutex.unlock();
+    if (before_us){  // sent before we joined (ip multicast reaches everybody). our sponsor relays it if it matters
+        DPRINTF(("handle_datamsg: ignoring msg (%d, %d) from before our JOIN\n", dataMessage.msg_id, dataMessage.sender));
+        return;
+    }
+    trace(T_DATA_RECV, dataMessage.sender, dataMessage.msg_id, dataMessage.sender);
+    uint32_t proposed;
+    int acked = ackLog.find(dataMessage.sender, dataMessage.msg_id, proposed);  // check to see if we have already acked this message
+    if (acked == -1){  // final at its sender: a late copy nobody waits on
+        metrics.count(M_DUPLICATE_DATA);
+        return;
+    }
+    if (acked == 1){  // this dataMessage has already been acked
+        // we resend it
+        AckMessage am = make_ack_msg(dataMessage.sender, dataMessage.msg_id, proposed, current_container_id);
+        metrics.count(M_DUPLICATE_DATA);
+        metrics.retransmit(hosts.rank_of(am.sender));
+        trace(T_RETRANSMIT, am.sender, am.msg_id, am.sender, ACKMSG_TYPE);
+        am.credit = advertised_credit(members);  // what we have now, not what we had then
+        unsigned char serialized_packet[MAX_STRUCT_SIZE];
+        serialize_ack_message(am, serialized_packet);
+        reply_msg_with_drop_and_delay(serialized_packet, sizeof(serialized_packet));
+        return;
+    }
+    if (dataMessage.kind == JOIN_MSG){  // the name is only carried by the JOIN itself: keep it for when it's delivered
+        std::lock_guard<std::mutex> lock(joinMutex);
+        joinNames[dataMessage.member] = std::string(dataMessage.member_name);
     }
     // we need to add the message in the queue (with the latest sequence number + 1) and marking it undeliverable
 //    curr_seq_number++;
-    QueuedMessage toQueue = make_queued_msg(curr_seq_number, UNDELIVERABLE, dataMessage.sender,
-                                            dataMessage.msg_id,dataMessage.data,current_container_id);
+    uint32_t proposal = curr_seq_number.fetch_add(1);  // the queue and the ack must carry the same seq
+    QueuedMessage toQueue = make_queued_msg(proposal, UNDELIVERABLE, dataMessage.sender,
+                                            dataMessage.msg_id,dataMessage.member,current_container_id,
+                                            dataMessage.kind, dataMessage.view_epoch, dataMessage.payload);
     deliveryQueueMutex.lock();
     push_msg_to_deliveryqueue(toQueue);
     deliveryQueueMutex.unlock();
 
     // then we send that latest sequence number as an acknowledgement to the sender of the message (along with our id)
-    AckMessage ackMessage = make_ack_msg(dataMessage.sender, dataMessage.msg_id, curr_seq_number, current_container_id);
-    alreadyAckedMessages.push_back(ackMessage);
-    // packing the message
-    unsigned char serialized_packet[MAX_STRUCT_SIZE];
-//    DPRINTF(("PREPARING TO REPLY ACK: type %d, sender %d, msg_id %d, proposed_seq %d, proposer %d\n",
-//            ackMessage.type, ackMessage.sender, ackMessage.msg_id, ackMessage.proposed_seq, ackMessage.proposer));
-    serialize_ack_message(ackMessage, serialized_packet);
-    // send it back to the sender
-    reply_msg_with_drop_and_delay(serialized_packet);
-    curr_seq_number++;
+    AckMessage ackMessage = make_ack_msg(dataMessage.sender, dataMessage.msg_id, proposal, current_container_id);
+    ackMessage.credit = advertised_credit(members);
+    ackLog.put(dataMessage.sender, dataMessage.msg_id, proposal);
+    // with a tree, an interior node sends its ack up together with its subtree's
+    if (tree_fanout == 0 || !start_tree_relay(dataMessage, ackMessage)){
+        // packing the message
+        unsigned char serialized_packet[MAX_STRUCT_SIZE];
+//        DPRINTF(("PREPARING TO REPLY ACK: type %d, sender %d, msg_id %d, proposed_seq %d, proposer %d\n",
+//                ackMessage.type, ackMessage.sender, ackMessage.msg_id, ackMessage.proposed_seq, ackMessage.proposer));
+        serialize_ack_message(ackMessage, serialized_packet);
+        // send it back to the sender (our parent in a tree)
+        reply_msg_with_drop_and_delay(serialized_packet, sizeof(serialized_packet));
+    }
+    trace(T_ACK_SENT, dataMessage.sender, dataMessage.msg_id, dataMessage.sender, ackMessage.proposed_seq,
+          ackMessage.proposer);
+    if (nak_mode){  // no watchdog: if the SEQ doesn't come, nak_loop asks for it
+        nakTracker.acked(dataMessage.sender, dataMessage.msg_id, runtime->now_ns());
+        return;
+    }
     // then we are supposed to hear back from the sender a final sequence number (which we can then handle elsewhere)
     // suppose we don't hear back after a while....
     //  --> we should send the ack again (bc the ack might be dropped or the seq might be dropped)
     DPRINTF(("handle_datamsg: spawning watchdog thread for sent out ack...\n"));
-    const char * rep_host_name = hostIDtoHostName[dataMessage.sender].c_str();
+    const char * rep_host_name = hosts.name_of_id(dataMessage.sender);
     // spawning this watchdog to resend ackmsg correspondingly
-    std::thread watchdog(&ReliableMulticast::ackmsg_watchdog, this, ackMessage, rep_host_name); watchdog.detach();
+    runtime->spawn([this, ackMessage, rep_host_name]{ ackmsg_watchdog(ackMessage, rep_host_name); });
 }
 
 
@@ -126,25 +353,26 @@ void ReliableMulticast::ackmsg_watchdog(const AckMessage &ackMessage, const char
     while (watchdog_resend_cap++ < WATCHDOG_RESEND_CAP){
         DPRINTF(("[ackmsg_watchdog] Attempt %d for msg (%d, %d) from host %s. Sleeping for %d miliseconds...\n",
                 watchdog_resend_cap, ackMessage.msg_id, ackMessage.sender, hostName, TIMEOUT));
-        usleep(TIMEOUT*1000);  // sleep for TIMEOUT miliseconds
+        runtime->sleep_us(TIMEOUT*1000);  // sleep for TIMEOUT miliseconds
+        if (!is_member(ackMessage.sender)){  // the sender failed. the view change decides what happens to the msg
+            DPRINTF(("[ackmsg_WATCHDOG FINISHED] Host %s was removed from the view. Terminating!\n", hostName));
+            return;
+        }
         // when wake up, we check if we have received a responding seq message for this msg
-        seqMessageHistoryMutex.lock();
-        for (SeqMessage sm : seqMessageHistory){  // a seq is in here if we receive a seqmsg or sent out one
-            if (sm.sender == ackMessage.sender && sm.msg_id == ackMessage.msg_id){  // we have found it in the SeqHistory
-                DPRINTF(("[ackmsg_WATCHDOG FINISHED] Found an SEQ for msg (%d, %d) and host %s. Terminating!\n",
-                        ackMessage.msg_id, ackMessage.sender, hostName));
-                seqMessageHistoryMutex.unlock();
-                return;
-            }
+        if (ackLog.has_seq(ackMessage.sender, ackMessage.msg_id)){  // we have got the SEQ
+            DPRINTF(("[ackmsg_WATCHDOG FINISHED] Found an SEQ for msg (%d, %d) and host %s. Terminating!\n",
+                    ackMessage.msg_id, ackMessage.sender, hostName));
+            return;
         }
-        seqMessageHistoryMutex.unlock();
         // we get here when we weren't able to find a corresponding seq msg for the ack in the seqhistory
         // we resend the ack to the host
         DPRINTF(("[ackmsg_WATCHDOG TIMEOUT] Haven't received Ack for msg (%d, %d) from host %s. Resending ack and Resleeping.\n ",
                 ackMessage.msg_id, ackMessage.sender, hostName));
         unsigned char serialized_packet[MAX_STRUCT_SIZE];
         serialize_ack_message(ackMessage, serialized_packet);
-        int rv = send_msg_with_drop_and_delay(hostName, serialized_packet);
+        metrics.retransmit(hosts.rank_of(ackMessage.sender));
+        trace(T_RETRANSMIT, ackMessage.sender, ackMessage.msg_id, ackMessage.sender, ACKMSG_TYPE);
+        int rv = send_msg_with_drop_and_delay(hostName, serialized_packet, sizeof(serialized_packet));
         if (rv == -1){perror("Error sending message. Exiting...\n");exit(1);}
         if (rv == -22) DPRINTF(("[FROM datamsg_WATCHDOG] Message (%d, %d) to %s was dropped\n",
                     ackMessage.msg_id, ackMessage.sender, hostName));
@@ -155,67 +383,108 @@ void ReliableMulticast::ackmsg_watchdog(const AckMessage &ackMessage, const char
 
 void ReliableMulticast::handle_ackmsg(const AckMessage &ackMessage){
     /* here we are receiving an AckMessage for some dataMessage that we sent out
-    *  ackHistory[ackMessage.msg_id] contains the history of received acks for this msg.
-    ** if the Ack is for an older msg, we resend the sequence number. Otherwise we handle the new one: */
+    *  ackHistory.find(ackMessage.msg_id) is the record of received acks for this msg while it's outstanding.
+    ** if the Ack is for an older (finalized) msg, we resend the sequence number. Otherwise we handle the new one: */
 
     DPRINTF(("*** Received ACK MSG with sender_id %d, msg_id %d, seq %d, and proposer %d\n"
         , ackMessage.sender, ackMessage.msg_id, ackMessage.proposed_seq, ackMessage.proposer));
 
     uint32_t msg_id = ackMessage.msg_id;
+    int proposer_rank = hosts.rank_of(ackMessage.proposer);
+    if (proposer_rank == -1){
+        fprintf(stderr, "[handle_ackmsg] Received ACK from unknown process %d. Ignoring...\n", ackMessage.proposer);
+        return;
+    }
+    heard_from(ackMessage.proposer);
+    flow.advertised(proposer_rank, ackMessage.credit);  // the same for every sender: ours too if it acks through us
+    trace(T_ACK_RECV, ackMessage.sender, ackMessage.msg_id, ackMessage.proposer, ackMessage.proposed_seq,
+          ackMessage.proposer);
+    if (ackMessage.sender != (uint32_t) current_container_id){  // a child in someone else's tree acks through us
+        AggAckMessage aggAckMessage{AGGACKMSG_TYPE, ackMessage.sender, ackMessage.msg_id, ackMessage.proposed_seq,
+                                    ackMessage.proposer, ackMessage.proposer, {ackMessage.proposer}};
+        merge_subtree_acks(aggAckMessage);
+        return;
+    }
+    HostSet members = get_view();
     ackHistoryMutex.lock();
-    if (ackHistory[msg_id].count(ackMessage.proposer) == 0){  // this means we haven't receive this ack before
-        // we add it to the history
-        curr_seq_number++;  // to avoid clashing
-        ackHistory[msg_id].insert(std::make_pair(ackMessage.proposer, ackMessage.proposed_seq));
-        if(ackHistory[msg_id].size() == num_hosts){  // we have collected enough ACKs for this msg
+    AckRecord * record = ackHistory.find(msg_id);
+    if (record != nullptr){  // the msg is still outstanding
+        if (!record->acks.add(proposer_rank, ackMessage.proposed_seq, ackMessage.proposer)){
+            // a duplicate ack for a msg that isn't finalized yet. nothing to do
+            metrics.count(M_DUPLICATE_ACK);
+            ackHistoryMutex.unlock();
+            return;
+        }
+        // this means we haven't receive this ack before (it's in the record now)
+        if (proposer_rank != current_rank && !record->resent.test(proposer_rank) && packet_rx_ns > record->sent_at_ns)
+            metrics.rtt(proposer_rank, packet_rx_ns - record->sent_at_ns);
+        curr_seq_number.fetch_add(1);  // to avoid clashing
+        // we need everybody that was in the view when we sent it and is still in it (later joiners never saw it)
+        if(record->acks.covers(record->quorum & members)){  // we have collected enough ACKs for this msg
 //            DPRINTF(("[handle_ACKmsg] we have received enough ACKS. Attempting to add and deliver.\n"));print_ack_history();
-            // we pick the max (noting the proposer of the max) and then send out a final sequence to everybody
-            std::pair<uint32_t, uint32_t> finalSeqAndProposer = get_max_sequence_from_proposerseq_map(ackHistory[msg_id]);
-            uint32_t finalseq = finalSeqAndProposer.first;
-            uint32_t finalseq_proposer = finalSeqAndProposer.second;
-            SeqMessage seqMessage = make_seq_msg(ackMessage.sender, ackMessage.msg_id, finalseq, finalseq_proposer);
-            seqMessageHistoryMutex.lock();
-            seqMessageHistory.push_back(seqMessage);
-            seqMessageHistoryMutex.unlock();
-            broadcast_seq_msg(seqMessage);  // this sends the seqMessage to everybody --> they should perform the step below
-            // now we need to update our own delivery queue with this max number -- it should be deliverable now
-            deliveryQueueMutex.lock();
-            change_queued_msg_seq_and_status(seqMessage.sender, seqMessage.msg_id, finalseq,
-                                             finalseq_proposer, DELIVERABLE);
-            deliveryQueueMutex.unlock();
-            // now that we've changed the deliveryqueue, we attempt to deliver new messages
-            deliver_msg_from_deliveryqueue();
+            finalize_msg(record);
         }
-    } // otherwise if we've seen it then we see if it's from an ACK sending process that hasn't received final seq after a while
-    else if (ackHistory[msg_id].size() == num_hosts){ // this means we have finalized and sent the seq before
+    } // otherwise it's from an ACK sending process that hasn't received final seq after a while
+    else { // this means we have finalized and sent the seq before
         // resend final sequence number
         DPRINTF(("RECEIVED A DUPLICATE ACK FROM %d FOR MSG (%d, %d). RESENDING SEQ...\n",
                 ackMessage.proposer, ackMessage.msg_id, ackMessage.sender));
-        int found = 0;
-        seqMessageHistoryMutex.lock();
-        for (SeqMessage sm : seqMessageHistory){
-            if(sm.msg_id == msg_id && sm.sender == ackMessage.sender){
-                found = 1;
-                unsigned char serialized_packet[MAX_STRUCT_SIZE];
-                serialize_seq_message(sm, serialized_packet);
-                int rv = reply_msg_with_drop_and_delay(serialized_packet);
-                if (rv == -1){perror("[handle_ackmsg] Error sending message. Exiting...\n"); seqMessageHistoryMutex.unlock();
-                exit(1);}
-                if (rv == -22) printf("[handle_ackmsg] Resending SeqMessage for (%d, %d) to process_id %d was dropped\n",
-                                      sm.msg_id, sm.sender, ackMessage.proposer);
-                break;
-            }
-        }
-        seqMessageHistoryMutex.unlock();
-        if (found == 0){  // we haven't found the seqMessage.... strange
-            perror("[handle_ackmsg] Cannot find seqmsg in history. Some weird error happened. Exiting...\n");
-            ackHistoryMutex.unlock(); exit(1);
+        SeqMessage sm;
+        if (own_final_seq(msg_id, sm)){
+            metrics.count(M_DUPLICATE_ACK);
+            metrics.retransmit(proposer_rank);
+            trace(T_RETRANSMIT, sm.sender, sm.msg_id, ackMessage.proposer, SEQMSG_TYPE);
+            unsigned char serialized_packet[MAX_STRUCT_SIZE];
+            serialize_seq_message(sm, serialized_packet);
+            int rv = reply_msg_with_drop_and_delay(serialized_packet, sizeof(serialized_packet));
+            if (rv == -1){perror("[handle_ackmsg] Error sending message. Exiting...\n"); ackHistoryMutex.unlock(); exit(1);}
+            if (rv == -22) RMLOG(LOG_DEBUG, "[handle_ackmsg] Resending SeqMessage for (%d, %d) to process_id %d was dropped\n",
+                                 sm.msg_id, sm.sender, ackMessage.proposer);
+        } else {  // we haven't found the seqMessage.... it's an ack for a msg we never sent
+            fprintf(stderr, "[handle_ackmsg] Received ACK from %d for unknown msg (%d, %d). Ignoring...\n",
+                    ackMessage.proposer, ackMessage.msg_id, ackMessage.sender);
         }
     }
     ackHistoryMutex.unlock();
 }
 
 
+void ReliableMulticast::propose_above(uint32_t seq){
+    // raise curr_seq_number past seq, unless some other thread already did
+    uint32_t curr = curr_seq_number.load();
+    while (curr <= seq && !curr_seq_number.compare_exchange_weak(curr, seq + 1)) {}
+}
+
+
+void ReliableMulticast::finalize_msg(AckRecord * record){
+    /* every host in the view has acked our msg: the max proposal (and its proposer) was kept while collecting.
+     * we send out the final sequence to everybody and recycle the record. must hold ackHistoryMutex */
+    uint32_t msg_id = record->msg_id;
+    uint32_t finalseq = record->acks.max_seq;
+    uint32_t finalseq_proposer = record->acks.max_proposer;
+    HostSet quorum = record->quorum;
+    uint64_t collected_ns = runtime->now_ns() - record->sent_at_ns;
+    DPRINTF(("[finalize_msg] Collected all acks for msg %d in %.3f ms\n", msg_id, (double) collected_ns / 1e6));
+    metrics.observe(H_ACK_COLLECTION, collected_ns);
+    ackHistory.release(msg_id);  // finalized: the record goes back to the pool
+    metrics.set(G_OUTSTANDING, (int64_t) ackHistory.size());
+    propose_above(finalseq);  // never propose below a final seq
+    SeqMessage seqMessage = make_seq_msg(current_container_id, msg_id, finalseq, finalseq_proposer);
+    trace(T_SEQ_SENT, current_container_id, msg_id, 0, finalseq, finalseq_proposer);
+    sendRingMutex.lock();
+    seqRing.put(msg_id, seqMessage);
+    sendRingMutex.unlock();
+    broadcast_seq_msg(seqMessage, quorum);  // this sends the seqMessage to everybody --> they should perform the step below
+    // now we need to update our own delivery queue with this max number -- it should be deliverable now
+    deliveryQueueMutex.lock();
+    change_queued_msg_seq_and_status(seqMessage.sender, seqMessage.msg_id, finalseq,
+                                     finalseq_proposer, DELIVERABLE);
+    deliveryQueueMutex.unlock();
+    // now that we've changed the deliveryqueue, we attempt to deliver new messages
+    deliver_msg_from_deliveryqueue();
+}
+
+
 void ReliableMulticast::handle_seqmsg(const SeqMessage &seqMessage){
     /* here we are receiving the final sequence for some message in our delivery queue
     * note that the first element in our queue is the smallest seq number msg (that is also undeliverable -- otherwise it would've been delivered
@@ -227,6 +496,39 @@ void ReliableMulticast::handle_seqmsg(const SeqMessage &seqMessage){
 #ifdef DEBUG
     print_delivery_queue();
 #endif
+    if (seqMessage.sender == (uint32_t) current_container_id) return;  // our own ip multicast looping back
+    trace(T_SEQ_RECV, seqMessage.sender, seqMessage.msg_id, seqMessage.sender, seqMessage.final_seq,
+          seqMessage.final_seq_proposer);
+    // we hold viewMutex while applying so a view change can't collect the seqs of this sender in between
+    viewMutex.lock();
+    int sender_rank = hosts.rank_of(seqMessage.sender);
+    if (sender_rank == -1 || !view.test(sender_rank)){
+        // the sender was removed: a late seq from it must not change anything. only the flush decides its msgs
+        DPRINTF(("handle_seqmsg: ignoring seq for (%d, %d) from removed host\n", seqMessage.msg_id, seqMessage.sender));
+        viewMutex.unlock();
+        return;
+    }
+    int rv = apply_seq_msg(seqMessage);
+    if (rv == -1 && runtime->in_group()){  // the group also reaches hosts that weren't in the msg's quorum
+        DPRINTF(("handle_seqmsg: ignoring seq for (%d, %d) we never got\n", seqMessage.msg_id, seqMessage.sender));
+        viewMutex.unlock();
+        return;
+    }
+    if (rv == -1){  // we throw an error just to be safe
+        perror("handle_seqmsg ERROR: COULDN'T LOCATE MESSAGE FOR INCOMING SEQMESSAGE. EXITING...\n");
+        viewMutex.unlock();
+        exit(1);
+    }
+    viewMutex.unlock();
+    if (rv == 1) metrics.count(M_DUPLICATE_SEQ);
+    if (rv == 0 && tree_fanout > 0) forward_seq_msg(seqMessage);
+    deliver_msg_from_deliveryqueue();  // not under viewMutex: delivering a JOIN changes the view
+}
+
+
+int ReliableMulticast::apply_seq_msg(const SeqMessage &seqMessage){
+    /* mark the msg deliverable with its final seq. the caller delivers (once it let go of viewMutex).
+     * return 0 if applied, 1 if the msg was already delivered (a duplicate) and -1 if we don't know this msg */
     deliveryQueueMutex.lock();
     int rv = change_queued_msg_seq_and_status(seqMessage.sender, seqMessage.msg_id,
                                               seqMessage.final_seq, seqMessage.final_seq_proposer, DELIVERABLE);
@@ -236,80 +538,195 @@ void ReliableMulticast::handle_seqmsg(const SeqMessage &seqMessage){
     if (rv == -1){  // we didn't find it in the deliveryqueue... it must've been in our deliveredMessage list
         for (QueuedMessage qm : deliveredMessage){
             if (qm.msg_id == seqMessage.msg_id && qm.sender == seqMessage.sender){
-                DPRINTF(("handle_seqmsg received duplicate seqmessage for sender %d and msg_id %d with finalsequence %d\n",
+                DPRINTF(("apply_seq_msg received duplicate seqmessage for sender %d and msg_id %d with finalsequence %d\n",
                         seqMessage.sender, seqMessage.msg_id, seqMessage.final_seq_proposer));
                 deliveredMessageMutex.unlock();
-                return;
+                if (nak_mode) nakTracker.sequenced(seqMessage.sender, seqMessage.msg_id);
+                return 1;
             }
-        } // so we couldn't find it in the deliveredMessage list also... we throw an error just to be safe
-        perror("handle_seqmsg ERROR: COULDN'T LOCATE MESSAGE FOR INCOMING SEQMESSAGE. EXITING...\n");
+        } // so we couldn't find it in the deliveredMessage list also
         deliveredMessageMutex.unlock();
-        exit(1);
+        return -1;
     }
     deliveredMessageMutex.unlock();
+    if (nak_mode) nakTracker.sequenced(seqMessage.sender, seqMessage.msg_id);
+    ackLog.sequenced(seqMessage.sender, seqMessage.msg_id);  // our ack watchdog can stop
+    // our later proposals must be above every final seq we know of, or a msg we ack later could be ordered before it
+    propose_above(seqMessage.final_seq);
+    return 0;
+}
 
-    // add it to the history if we haven't received it... then attempt to deliver
-    seqMessageHistoryMutex.lock();
-    seqMessageHistory.push_back(seqMessage);
-    seqMessageHistoryMutex.unlock();
-    deliver_msg_from_deliveryqueue();
+
+void ReliableMulticast::multicast_datamsg(const Payload &payload){
+    wait_for_credit();
+    multicast_msg(APP_MSG, 0, payload, nullptr, NO_COMPLETION, true);
+    sentCount++;
+}
+
+
+MulticastHandle ReliableMulticast::multicast_async(const Payload &payload, CompletionFn fn, void *arg){
+    wait_for_credit();
+    uint32_t slot = completions.acquire(fn, arg);
+    multicast_msg(APP_MSG, 0, payload, nullptr, slot, true);
+    sentCount++;
+    return slot == NO_COMPLETION ? MulticastHandle() : MulticastHandle(&completions, slot);
+}
+
+
+bool ReliableMulticast::try_multicast(const Payload &payload){
+    if (!reserve_credit(true)) return false;
+    multicast_msg(APP_MSG, 0, payload, nullptr, NO_COMPLETION, true);
+    sentCount++;
+    return true;
+}
+
+
+bool ReliableMulticast::try_multicast_async(const Payload &payload, MulticastHandle &handle, CompletionFn fn, void *arg){
+    if (!reserve_credit(true)) return false;
+    uint32_t slot = completions.acquire(fn, arg);
+    multicast_msg(APP_MSG, 0, payload, nullptr, slot, true);
+    sentCount++;
+    handle = slot == NO_COMPLETION ? MulticastHandle() : MulticastHandle(&completions, slot);
+    return true;
+}
+
+
+bool ReliableMulticast::reserve_credit(bool notify){
+    /* flow control: our msgs that aren't final yet (membership msgs too) plus the ones about to be sent must stay
+     * below the window. notify: if there's no room, creditCallback is called once there is */
+    uint32_t window = flow.window(get_view(), current_rank);
+    metrics.set(G_FLOW_WINDOW, (int64_t) window);
+    std::lock_guard<std::mutex> lock(ackHistoryMutex);
+    if (window == 0 || ackHistory.size() + creditsReserved < window){
+        creditsReserved++;  // until multicast_msg puts the msg in ackHistory
+        return true;
+    }
+    metrics.count(M_FLOW_BLOCKED);
+    // set under ackHistoryMutex: a msg finalized after we looked is followed by a notify_credit() that sees it
+    if (notify) creditWanted = true;
+    return false;
+}
+
+
+void ReliableMulticast::wait_for_credit(){
+    // like wait_for_ring_slot: a plain sleep, so it works on the simulator too
+    while (!reserve_credit()) runtime->sleep_us(FLOW_WAIT);
+}
+
+
+void ReliableMulticast::notify_credit(){
+    if (!creditWanted.load() || !creditCallback) return;
+    uint32_t window = flow.window(get_view(), current_rank);
+    {
+        std::lock_guard<std::mutex> lock(ackHistoryMutex);
+        if (window != 0 && ackHistory.size() + creditsReserved >= window) return;
+    }
+    if (creditWanted.exchange(false)) creditCallback();
+}
+
+
+uint32_t ReliableMulticast::advertised_credit(int members){
+    return CreditWindow::credit(queueDepth.load(std::memory_order_relaxed), members);
 }
 
 
-void ReliableMulticast::multicast_datamsg(uint32_t data){
+void ReliableMulticast::multicast_msg(uint32_t kind, uint32_t member, const Payload &payload, const char * memberName,
+                                      uint32_t completion, bool reserved){
     /* we wish to multicast a message to all other messages with total ordering guarantee
      * we must take note of which message has been sent (probably using msgid) and wait to collect ack after sending out
      * now, we must take into account that our msg is dropped. hence, we spawn a thread (watchdog) per other process that
      * -- after a certain timeout, check to see if an ack for this msg has been received from the proc. it's responsible for
      * -- if not, then we resend the data msg to that process and repeat but only for that process.
      * -- after repeating too many times, we declare that process dead and find a way to gracefully terminate (or notify)
+     * membership changes (JOIN_MSG/LEAVE_MSG) are sent the same way so they are ordered with everything else
      * */
 //    DPRINTF(("INSIDE multicast_datamsg: Sending data %d with delay %d and drop rate %.6f \n", data, delay_in_ms, drop_rate));
 
+    if (payload.size() > MAX_PAYLOAD){
+        fprintf(stderr, "A payload of %lu bytes is more than the %d a msg can carry. Exiting.\n", payload.size(), MAX_PAYLOAD);
+        exit(1);
+    }
     DataMessage dataMessage;
     dataMessage.type = DATAMSG_TYPE;
-    dataMessage.msg_id = curr_msg_id++;
-    dataMessage.data = data;
+    dataMessage.member = member;
+    dataMessage.payload = payload;  // shared, not copied: sendRing and our own delivery keep the same bytes
     dataMessage.sender = current_container_id;
-    // add this to the queuedmessage for self-delivery... but undeliverable
-    dataHistoryMutex.lock();
-    dataHistory.insert(std::make_pair(dataMessage.msg_id, dataMessage.data));
-    dataHistoryMutex.unlock();
-
-    curr_seq_number++;
-    ProposerSeq ackHistForThisMes;
-    ackHistForThisMes.insert(std::make_pair(current_container_id, curr_seq_number));
+    dataMessage.kind = kind;
+    memset(dataMessage.member_name, 0, MAX_MEMBER_NAME);
+    if (memberName != nullptr) strncpy(dataMessage.member_name, memberName, MAX_MEMBER_NAME - 1);
+    if (nak_mode) wait_for_ring_slot();
+    // our own proposal. like handle_datamsg we move past it, so the next msg we ack can't get the same (seq, us)
+    uint32_t proposal = curr_seq_number.fetch_add(1);
+    // the msg id, its epoch and its quorum are taken together: a JOIN delivered in between splits them.
+    // the id is outstanding as soon as it's taken (our heartbeat's trail must not pass it)
     ackHistoryMutex.lock();
-    ackHistory.insert(std::make_pair(dataMessage.msg_id, ackHistForThisMes));
+    viewMutex.lock();
+    dataMessage.msg_id = curr_msg_id++;
+    dataMessage.view_epoch = view_epoch;
+    HostSet members = view;
+    viewMutex.unlock();
+    if (completion != NO_COMPLETION){  // before anybody can deliver it
+        std::lock_guard<std::mutex> lock(completionMutex);
+        if (completionOf.empty()) completionBase = dataMessage.msg_id;
+        while (completionBase + completionOf.size() < dataMessage.msg_id) completionOf.push_back(NO_COMPLETION);
+        completionOf.push_back(completion);
+    }
+    AckRecord * record = ackHistory.insert(dataMessage.msg_id, runtime->now_ns());
+    if (reserved) creditsReserved--;  // counted in ackHistory now
+    metrics.set(G_OUTSTANDING, (int64_t) ackHistory.size());
+    record->quorum = members;
+    record->acks.add(current_rank, proposal, current_container_id);  // the self-ack
     ackHistoryMutex.unlock();
-    QueuedMessage queuedMessage = make_queued_msg(curr_seq_number, UNDELIVERABLE, dataMessage.sender, dataMessage.msg_id,
-                                                  dataMessage.data, current_container_id);
+    trace(T_DATA_SENT, current_container_id, dataMessage.msg_id, 0, proposal, current_container_id);
+    sendRingMutex.lock();
+    sendRing.put(dataMessage.msg_id, dataMessage);
+    sendRingMutex.unlock();
+    // add this to the queuedmessage for self-delivery... but undeliverable
+    QueuedMessage queuedMessage = make_queued_msg(proposal, UNDELIVERABLE, dataMessage.sender, dataMessage.msg_id,
+                                                  member, current_container_id, kind, dataMessage.view_epoch,
+                                                  payload);
     deliveryQueueMutex.lock();
     push_msg_to_deliveryqueue(queuedMessage);
     deliveryQueueMutex.unlock();
+    if (members.count() == 1) finalize_covered_msgs();  // nobody else to wait for
 
 
-    // first serialize the data message before multicast
-    unsigned char serialized_packet[MAX_STRUCT_SIZE];
-    serialize_data_message(dataMessage, serialized_packet);
+    // first serialize the data message before multicast (once, for all the targets)
+    Payload packet = serialized_data_message(dataMessage);
     int rv;
-    for (int i =0; i< num_hosts; i++){
-        if (strcmp(hostNames[i], current_container_name) != 0){
-            rv = send_msg_with_drop_and_delay(hostNames[i], serialized_packet);
-            if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
-            if (rv == -22)
-                DPRINTF(("[multicast_datamsg] Message (%d) to %s was dropped\n", dataMessage.msg_id, hostNames[i]));
-            else
-                DPRINTF(("*** Multicasted message of type %d with sender_id %d and msg_id %d and data %d to %s\n", dataMessage.type, dataMessage.sender, dataMessage.msg_id, dataMessage.data, hostNames[i]));
-            // after sending out a message, we must make sure that we receive an ack after a certain timeout
-            // -- this can be done by spawning a watch_dog thread that sleeps for the TIMEOUT period
-            // -- then after that period, it would check ackHistory[msg_id] that the hostID has some entry...
-            // -- if it's empty then we resend and repeat (maybe we have a cap and then declare the process dead)
-            // note we can make this thread detach since the main thread never terminates unless some severe error.
-            DPRINTF(("multicast_datamsg: spawning watchdog thread...\n"));
-            std::thread watchdog(&ReliableMulticast::datamsg_watchdog, this, dataMessage, hostNames[i]); watchdog.detach();
+    std::vector<int> targets;  // everybody else, only our children in the tree or nobody (ip multicast)
+    if (runtime->in_group()) targets.clear();
+    else if (tree_fanout > 0) targets = tree_children(members, current_rank, current_rank, tree_fanout);
+    else for (int i = 0; i < num_hosts; i++) if (i != current_rank && members.test(i)) targets.push_back(i);
+    for (int i : targets){
+        const char * hostName = hosts.name_of(i);
+        rv = send_data(hostName, packet);
+        if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        if (rv == -22){
+            DPRINTF(("[multicast_datamsg] Message (%d) to %s was dropped\n", dataMessage.msg_id, hostName));
+        } else {
+            DPRINTF(("*** Multicasted message of type %d with sender_id %d and msg_id %d and %lu bytes to %s\n", dataMessage.type, dataMessage.sender, dataMessage.msg_id, payload.size(), hostName));
+        }
+        // after sending out a message, we must make sure that we receive an ack after a certain timeout
+        // -- this can be done by spawning a watch_dog thread that sleeps for the TIMEOUT period
+        // -- then after that period, it would check the record of msg_id that the host has acked...
+        // -- if it's empty then we resend and repeat (maybe we have a cap and then declare the process dead)
+        // note we can make this thread detach since the main thread never terminates unless some severe error.
+        if (tree_fanout > 0 || nak_mode) continue;  // one watchdog for the whole tree below. with -N the receivers NAK
+        DPRINTF(("multicast_datamsg: spawning watchdog thread...\n"));
+        runtime->spawn([this, dataMessage, hostName]{ datamsg_watchdog(dataMessage, hostName); });
+    }
+    if (runtime->in_group() && members.count() > 1){  // one datagram for everybody
+        rv = send_data(nullptr, packet);
+        if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        if (rv == -22){
+            DPRINTF(("[multicast_datamsg] Message (%d) to the group was dropped\n", dataMessage.msg_id));
         }
     }
+    if ((tree_fanout > 0 || runtime->in_group()) && !nak_mode && members.count() > 1){
+        runtime->spawn([this, dataMessage]{ group_datamsg_watchdog(dataMessage); });
+    }
+    dispatch_deliveries();  // alone in the group we delivered it ourselves
 }
 
 
@@ -322,30 +739,33 @@ void ReliableMulticast::datamsg_watchdog(const DataMessage &dataMessage, const c
     while (watchdog_resend_cap++ < WATCHDOG_RESEND_CAP){
         DPRINTF(("[Attempt %d] Hello this is datamsg_watchdog for msg (%d, %d) and host %s. Sleeping for %d miliseconds...\n",
                 watchdog_resend_cap, dataMessage.msg_id, dataMessage.sender, hostName, TIMEOUT));
-        usleep(TIMEOUT*1000);  // first we sleep for TIMEOUT miliseconds
+        runtime->sleep_us(TIMEOUT*1000);  // first we sleep for TIMEOUT miliseconds
         // when we wake up, we check if that message has been acked by this host yet
         ackHistoryMutex.lock();
-        auto historyfordm = ackHistory.find(dataMessage.msg_id);
-        if (historyfordm == ackHistory.end()){
-            fprintf(stderr, "data_msg WATCHDOG: Cannot find data_msg %d in AckHistory!!!\n", dataMessage.msg_id);
+        AckRecord * historyfordm = ackHistory.find(dataMessage.msg_id);
+        int hostRank = hosts.rank_of(extract_int_from_string(hostName));
+        if (!is_member(hosts.id_of(hostRank))){  // the host failed. it's not part of the ack quorum anymore
+            DPRINTF(("[datamsg_WATCHDOG FINISHED] Host %s was removed from the view. Terminating!\n", hostName));
             ackHistoryMutex.unlock();
-            exit(1);
+            return;
         }
-        int hostID = extract_int_from_string(hostName);
-        if (historyfordm->second.count(hostID) == 0){  // this means we haven't received an Ack for that host
+        // no record means the msg was finalized (so everybody has acked it)
+        if (historyfordm != nullptr && !historyfordm->acks.has_acked(hostRank)){  // this means we haven't received an Ack for that host
             // we resend the data message and wait again...
             DPRINTF(("[datamsg_WATCHDOG TIMEOUT] Haven't received Ack for msg_id %d from host %s. Resending datamessage and Resleeping.\n ",
                     dataMessage.msg_id, hostName));
-            unsigned char serialized_packet[MAX_STRUCT_SIZE];
-            serialize_data_message(dataMessage, serialized_packet);
-            int rv = send_msg_with_drop_and_delay(hostName, serialized_packet);
+            Payload packet = serialized_data_message(dataMessage);
+            historyfordm->resent.set(hostRank);
+            metrics.retransmit(hostRank);
+            trace(T_RETRANSMIT, dataMessage.sender, dataMessage.msg_id, hosts.id_of(hostRank), DATAMSG_TYPE);
+            int rv = send_data(hostName, packet);
             if (rv == -1){
                 perror("Error sending message. Exiting...\n");
                 ackHistoryMutex.unlock();
                 exit(1);
             }
-            if (rv == -22) printf("[FROM datamsg_WATCHDOG] Message (%d, %d) to %s was dropped\n",
-                    dataMessage.msg_id, dataMessage.sender, hostName);
+            if (rv == -22) RMLOG(LOG_DEBUG, "[FROM datamsg_WATCHDOG] Message (%d, %d) to host %d was dropped\n",
+                                 dataMessage.msg_id, dataMessage.sender, hosts.id_of(hostRank));
         } else { // this means we have received an ACK !!! we can terminate
             DPRINTF(("[datamsg_WATCHDOG FINISHED] Found an ACK for msg_id %d and host %s. Terminating!\n", dataMessage.msg_id, hostName));
             ackHistoryMutex.unlock();
@@ -357,68 +777,169 @@ void ReliableMulticast::datamsg_watchdog(const DataMessage &dataMessage, const c
 }
 
 
-int ReliableMulticast::reply_msg_with_drop_and_delay(unsigned char (&serialized_packet)[MAX_STRUCT_SIZE]) {
-    start_delay();
-    if (random_uniform_from_0_to_1() < drop_rate){
-        DPRINTF(("[[Process %d] Replying dropped msg!\n", current_container_id));
-        return -22;
-    }
+static bool fec_protects(const unsigned char *serialized_packet){
+    // -F covers the DATA and SEQ paths, where a loss costs a whole TIMEOUT
+    uint32_t type = packet_type(serialized_packet);
+    return type == DATAMSG_TYPE || type == SEQMSG_TYPE || type == FRAGMSG_TYPE;
+}
+
+
+void ReliableMulticast::record_outbound(const unsigned char *serialized_packet, size_t size){
     recordMessagesMutex.lock();
-    if (recordMessages){
-//        printf("[debug reply] we are told to record msgs!\n");
+    if (recordMessages && on_channel(packet_type(serialized_packet))){
         snapshot.outboundMessageBufferMutex.lock();
-        snapshot.outboundMessageBuffer.push(ByteVector(serialized_packet, serialized_packet+MAX_STRUCT_SIZE));
+        snapshot.outboundMessageBuffer.push(ByteVector(serialized_packet, serialized_packet+size));
         snapshot.outboundMessageBufferMutex.unlock();
-//        printf("[debug reply] done recording msg!\n");
     }
     recordMessagesMutex.unlock();
-    return communicator.reply(reinterpret_cast<const char *>(serialized_packet), sizeof(serialized_packet));
 }
 
 
-int ReliableMulticast::send_msg_with_drop_and_delay(const char *hostname, unsigned char (&serialized_packet)[MAX_STRUCT_SIZE]) {
-    // this function also implements any delay and msg drop if applicable
-    start_delay();
-    if (random_uniform_from_0_to_1() < drop_rate){
+int ReliableMulticast::reply_msg_with_drop_and_delay(const unsigned char *serialized_packet, size_t size) {
+    // the link emulator implements any delay and msg drop if applicable (a delayed msg counts as sent already)
+    metrics.packet_out(packet_type(serialized_packet));
+    int rv = runtime->reply(serialized_packet, size);
+    if (rv == -22){
+        DPRINTF(("[[Process %d] Replying dropped msg!\n", current_container_id));
+        return -22;
+    }
+    record_outbound(serialized_packet, size);
+    return rv;
+}
+
+
+int ReliableMulticast::send_group_with_drop_and_delay(const unsigned char *serialized_packet, size_t size) {
+    // a drop loses the datagram for everybody (the watchdog then resends to each host directly)
+    metrics.packet_out(packet_type(serialized_packet));
+    if (fec_n > 0 && fec_protects(serialized_packet)) return send_fec(nullptr, serialized_packet, size);
+    int rv = runtime->send_to_group(serialized_packet, size);
+    if (rv != -22) record_outbound(serialized_packet, size);
+    return rv;
+}
+
+
+int ReliableMulticast::send_msg_with_drop_and_delay(const char *hostname, const unsigned char *serialized_packet, size_t size) {
+    // the link emulator implements any delay and msg drop if applicable
+    metrics.packet_out(packet_type(serialized_packet));
+    if (fec_n > 0 && fec_protects(serialized_packet)) return send_fec(hostname, serialized_packet, size);
+    int rv = runtime->send_to(hostname, serialized_packet, size);
+    if (rv == -22){
 //        DPRINTF(("[Testing] Message to %s was dropped!\n", hostname));
         return -22;
     }
-    recordMessagesMutex.lock();
-    if (recordMessages){
-//        printf("[debug send_msg] we are told to record msgs!\n");
-        snapshot.outboundMessageBufferMutex.lock();
-        snapshot.outboundMessageBuffer.push(ByteVector(serialized_packet, serialized_packet+MAX_STRUCT_SIZE));
-        snapshot.outboundMessageBufferMutex.unlock();
-//        printf("[debug msg_receiver] recorded msg!\n");
+    record_outbound(serialized_packet, size);
+    return rv;
+}
+
+
+int ReliableMulticast::send_data(const char *hostname, const Payload &packet){
+    /* a DATA datagram. one bigger than FRAG_MTU goes out in fragments, each dropped (or fec framed) on its own. the
+     * snapshot records the DATA itself, and the datagram is kept for NAKs of single fragments.
+     * returns -22 if a fragment was dropped */
+    if (packet.size() <= FRAG_MTU){
+        return hostname == nullptr ? send_group_with_drop_and_delay(packet.data(), packet.size())
+                                   : send_msg_with_drop_and_delay(hostname, packet.data(), packet.size());
     }
-    recordMessagesMutex.unlock();
-    return communicator.send_to(hostname, reinterpret_cast<const char *>(serialized_packet), sizeof(serialized_packet));  // -1 to use strlen
+    record_outbound(packet.data(), packet.size());
+    fragmenter.keep(packet);
+    int rv = 0;
+    for (uint32_t i = 0; i < Fragmenter::count(packet.size()); i++){
+        Payload frag = Fragmenter::fragment(packet, current_container_id, i);
+        int sent = hostname == nullptr ? send_group_with_drop_and_delay(frag.data(), frag.size())
+                                       : send_msg_with_drop_and_delay(hostname, frag.data(), frag.size());
+        if (sent == -1) return -1;
+        if (sent == -22) rv = -22;
+    }
+    return rv;
 }
 
 
-void ReliableMulticast::broadcast_seq_msg(const SeqMessage &seqMessage){
+int ReliableMulticast::send_fec(const char *hostname, const unsigned char *serialized_packet, size_t size){
+    /* the packet goes out in a frame of the current block to its destination (hostname nullptr: the ip multicast
+     * group) followed by the block's parity if that filled it. every frame is dropped on its own */
+    record_outbound(serialized_packet, size);
+    std::vector<ByteVector> frames;
+    fecMutex.lock();
+    std::string key = hostname == nullptr ? std::string() : std::string(hostname);
+    auto it = fecEncoders.find(key);
+    if (it == fecEncoders.end()) it = fecEncoders.emplace(key, FecEncoder(fec_n, fec_k, current_container_id)).first;
+    if (!it->second.in_block()) fecBlock++;
+    it->second.add(serialized_packet, size, fecBlock, runtime->now_ns(), frames);
+    fecMutex.unlock();
+    return send_frames(hostname, frames);
+}
+
+
+int ReliableMulticast::send_frames(const char *hostname, const std::vector<ByteVector> &frames){
+    // returns -22 if the first frame (the packet itself) was dropped
+    int rv = 0;
+    for (size_t i = 0; i < frames.size(); i++){
+        int sent = hostname == nullptr ? runtime->send_to_group(frames[i].data(), frames[i].size())
+                                       : runtime->send_to(hostname, frames[i].data(), frames[i].size());
+        if (sent == -1) return -1;
+        if (sent == -22 && i == 0) rv = -22;
+    }
+    return rv;
+}
+
+
+[[noreturn]] void ReliableMulticast::fec_flush_loop(){
+    // a block that doesn't fill up still gets its parity, FEC_FLUSH after it started
+    while (true){
+        runtime->sleep_us(FEC_FLUSH*1000);
+        std::vector<std::pair<std::string, std::vector<ByteVector>>> parity;
+        fecMutex.lock();
+        uint64_t now = runtime->now_ns();
+        for (auto &kv : fecEncoders){
+            std::vector<ByteVector> frames;
+            kv.second.flush(now, frames);
+            if (!frames.empty()) parity.emplace_back(kv.first, frames);
+        }
+        fecMutex.unlock();
+        for (const auto &p : parity){
+            if (send_frames(p.first.empty() ? nullptr : p.first.c_str(), p.second) == -1)
+                perror("[fec_flush_loop] Error sending parity");
+        }
+    }
+}
+
+
+void ReliableMulticast::broadcast_seq_msg(const SeqMessage &seqMessage, const HostSet &quorum){
     // first pack the message
     unsigned char serialized_packet[MAX_STRUCT_SIZE];
     serialize_seq_message(seqMessage, serialized_packet);
-    // then send it to everybody
+    // then send it to everybody. a host that joined after we sent the msg never saw it (its sponsor relays it)
+    // with a tree it only goes to our children, they pass it on
     int rv;
-    for (int i =0; i< num_hosts; i++){
-        if (strcmp(hostNames[i], current_container_name) != 0){
-//            rv = communicator.send_to(hostNames[i], reinterpret_cast<const char *>(serialized_packet), sizeof(serialized_packet));
-            rv = send_msg_with_drop_and_delay(hostNames[i], serialized_packet);
-            if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
-            if (rv == -22) printf("[Process %d] SeqMessage for (%d, %d) to %s was dropped\n", current_container_id,
-                                  seqMessage.msg_id, seqMessage.sender, hostNames[i]);
-
-        }
+    HostSet members = get_view() & quorum;
+    std::vector<int> targets;
+    if (runtime->in_group()){  // one datagram. hosts that aren't in the quorum don't know the msg and ignore it
+        if (members.count() == 1) return;
+        rv = send_group_with_drop_and_delay(serialized_packet, sizeof(serialized_packet));
+        if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        if (rv == -22) RMLOG(LOG_DEBUG, "[Process %d] SeqMessage for (%d, %d) to the group was dropped\n",
+                             current_container_id, seqMessage.msg_id, seqMessage.sender);
+        return;
+    }
+    if (tree_fanout > 0) targets = tree_children(members, current_rank, current_rank, tree_fanout);
+    else for (int i = 0; i < num_hosts; i++) if (i != current_rank && members.test(i)) targets.push_back(i);
+    for (int i : targets){
+//        rv = communicator.send_to(hosts.name_of(i), reinterpret_cast<const char *>(serialized_packet), sizeof(serialized_packet));
+        rv = send_msg_with_drop_and_delay(hosts.name_of(i), serialized_packet, sizeof(serialized_packet));
+        if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        if (rv == -22) RMLOG(LOG_DEBUG, "[Process %d] SeqMessage for (%d, %d) to host %d was dropped\n",
+                             current_container_id, seqMessage.msg_id, seqMessage.sender, hosts.id_of(i));
     }
 }
 
 
 void ReliableMulticast::push_msg_to_deliveryqueue(QueuedMessage qm){
     // this guarantees that our deliveryqueue is indeep a minheap w.r.t. the sequence number and then sender_id
+   qm.queued_ns = runtime->now_ns();
    deliveryQueue.push_back(qm);
    std::push_heap(deliveryQueue.begin(), deliveryQueue.end(), cmp);
+   metrics.set(G_DELIVERY_QUEUE, (int64_t) deliveryQueue.size());
+   queueDepth.store(deliveryQueue.size(), std::memory_order_relaxed);
 }
 
 
@@ -435,30 +956,20 @@ void ReliableMulticast::print_delivery_queue(){
 }
 
 void ReliableMulticast::print_ack_history(){
-    printf("=== ackHistory (size %lu) ====\n", ackHistory.size());
-    for (const auto &seq: ackHistory){
-        printf("\tmsg_id %d", seq.first);
-        for (const auto &kv : seq.second){
-            printf("prop %d seq %d, ", kv.first, kv.second);
+    printf("=== ackHistory (%lu outstanding, %lu pooled) ====\n", ackHistory.size(), ackHistory.capacity());
+    uint64_t now = runtime->now_ns();
+    ackHistory.for_each([&](const AckRecord &r){
+        printf("\tmsg_id %d: %d/%d acks, max seq %d by %d, sent %.3f ms ago, acked:", r.msg_id, r.acks.num_acked(),
+               (int) r.quorum.count(), r.acks.max_seq, r.acks.max_proposer, (double) (now - r.sent_at_ns) / 1e6);
+        for (int i = 0; i < num_hosts; i++){
+            if (r.acks.has_acked(i)) printf(" %d", hosts.id_of(i));
         }
         printf("\n");
-    }
+    });
     printf("=================================\n");
 }
 
 
-void ReliableMulticast::start_delay() const{
-    if (delay_in_ms == 0) return;
-    DPRINTF(("Delaying %d ms...\n", delay_in_ms));
-    usleep(delay_in_ms*1000);  // sleep for duration
-}
-
-
-double ReliableMulticast::random_uniform_from_0_to_1() {
-    return (double)rand() / (double)RAND_MAX;
-}
-
-
 void ReliableMulticast::print_delivered_messages() {
     deliveredMessageMutex.lock();
     printf("=== [Process %d] delivered messages so far (size %lu) ====\n", current_container_id, deliveredMessage.size());
@@ -472,34 +983,181 @@ void ReliableMulticast::print_delivered_messages() {
 }
 
 
+std::vector<QueuedMessage> ReliableMulticast::get_delivered_messages(){
+    std::lock_guard<std::mutex> lock(deliveredMessageMutex);
+    return deliveredMessage;
+}
+
+
+std::vector<uint64_t> ReliableMulticast::get_delivery_times(){
+    std::lock_guard<std::mutex> lock(deliveredMessageMutex);
+    return deliveredAt;
+}
+
+
+void ReliableMulticast::serve_metrics(const char *socketPath, const char *dumpFile){
+    if (socketPath != nullptr){
+        int fd = metrics.open_socket(socketPath);
+        if (fd == -1){
+            fprintf(stderr, "Couldn't open the stats socket %s. Exiting.\n", socketPath);
+            exit(1);
+        }
+        runtime->spawn([this, fd]{ metrics.serve(fd, hosts); });
+    }
+    if (dumpFile != nullptr){
+        std::string fileName(dumpFile);
+        runtime->spawn([this, fileName]{
+            while (true){
+                runtime->sleep_us(METRICS_DUMP_PERIOD * 1000ULL);
+                metrics.dump(fileName.c_str(), hosts);
+            }
+        });
+    }
+}
+
+
+void ReliableMulticast::start_tracing(const char *fileName){
+    tracer.store(new Tracer(fileName, (uint32_t) current_container_id), std::memory_order_release);
+    runtime->spawn([this]{
+        while (true){
+            runtime->sleep_us(TRACE_FLUSH_PERIOD * 1000ULL);
+            flush_trace();
+        }
+    });
+}
+
+
+void ReliableMulticast::flush_trace(){
+    Tracer *t = tracer.load(std::memory_order_acquire);
+    if (t == nullptr) return;
+    t->flush();
+    if (t->dropped() > 0){
+        DPRINTF(("[flush_trace] %lu trace events dropped so far\n", t->dropped()));
+    }
+}
+
+
 void ReliableMulticast::deliver_msg_from_deliveryqueue() {
     // we check if the front of the deliveryQueue (assumed it's a heap from the other operations)
     // -- if the front is DELIVERABLE then we deliver it and then pop it from the queue
     // -- we repeat until the front is UNDELIVERABLE
+    // must not be called with viewMutex held (a delivered JOIN changes the view)
 //    DPRINTF(("INSIDE deliver_msg_from_deliveryqueue. Trying to deliver:\n"));
 #ifdef DEBUG
     print_delivery_queue();
 #endif
-    bool delivered_flag = false;
-    deliveryQueueMutex.lock();
-    deliveredMessageMutex.lock();
-    while((!deliveryQueue.empty()) && deliveryQueue[0].status == DELIVERABLE){  // we found a deliverable msg with the smallest seq number
-        QueuedMessage delivered_msg = deliveryQueue[0];
-        deliveredMessage.push_back(delivered_msg);  // we deliver it in the queue
-        printf("ProcessID %d: Processed message %d from sender %d with seq (%d, %d).\n", current_container_id,
-               delivered_msg.msg_id, delivered_msg.sender, delivered_msg.sequence_number, delivered_msg.proposer);
-        // then we pop the first element
-        std::pop_heap(deliveryQueue.begin(), deliveryQueue.end(), cmp);
-        deliveryQueue.pop_back();
-        delivered_flag = true;
+    std::vector<uint32_t> leaving;
+    deliver_batches(leaving);
+    // a delivered LEAVE is handled like a failure (the flush settles the leaving host's msgs).
+    // that finalizes our msgs (ackHistoryMutex) so it's done once we are out of the delivery
+    for (uint32_t hostID : leaving){
+        RMLOG(LOG_INFO, "[Process %d] Host %d left the group.\n", current_container_id, hostID);
+        start_view_change(hostID);
+    }
+}
+
+
+void ReliableMulticast::deliver_batches(std::vector<uint32_t> &leaving){
+    /* a batch stops right after a membership change so the change takes effect exactly at its place in the order:
+     * everything delivered before a JOIN is the joiner's past and everything after it is relayed or sent to it */
+    std::lock_guard<std::mutex> deliveryLock(deliveryMutex);
+    if (!synced) return;  // we are joining: wait for the state transfer
+    while (true){
+        std::vector<QueuedMessage> batch;
+        uint64_t now_ns = runtime->now_ns();
+        deliveryQueueMutex.lock();
+        deliveredMessageMutex.lock();
+        while((!deliveryQueue.empty()) && deliveryQueue[0].status == DELIVERABLE){  // we found a deliverable msg with the smallest seq number
+            QueuedMessage delivered_msg = deliveryQueue[0];
+            deliveredMessage.push_back(delivered_msg);  // we deliver it in the queue
+            deliveredMessage.back().payload = Payload();  // the history is the order: it doesn't pin the bytes
+            deliveredAt.push_back(now_ns);
+            // how long it waited for the msgs before it in the order
+            if (delivered_msg.final_ns != 0 && now_ns > delivered_msg.final_ns)
+                metrics.observe(H_HOL_BLOCKING, now_ns - delivered_msg.final_ns);
+            if (delivered_msg.queued_ns != 0 && now_ns > delivered_msg.queued_ns)
+                metrics.observe(H_DELIVERY_QUEUE, now_ns - delivered_msg.queued_ns);
+            trace(T_DELIVERED, delivered_msg.sender, delivered_msg.msg_id, 0, delivered_msg.sequence_number,
+                  delivered_msg.proposer);
+            RMLOG(LOG_INFO, "ProcessID %d: Processed message %d from sender %d with seq (%d, %d).\n",
+                  current_container_id, delivered_msg.msg_id, delivered_msg.sender, delivered_msg.sequence_number,
+                  delivered_msg.proposer);
+            // then we pop the first element
+            std::pop_heap(deliveryQueue.begin(), deliveryQueue.end(), cmp);
+            deliveryQueue.pop_back();
+            batch.push_back(delivered_msg);
+            if (delivered_msg.kind != APP_MSG) break;
+        }
+        metrics.set(G_DELIVERY_QUEUE, (int64_t) deliveryQueue.size());
+        queueDepth.store(deliveryQueue.size(), std::memory_order_relaxed);
+        deliveredMessageMutex.unlock();
+        deliveryQueueMutex.unlock();
+        if (batch.empty()) break;
+        metrics.count(M_DELIVERED, batch.size());
+        deliveredCount += batch.size();
+        std::vector<Completed> completed;
+        completionMutex.lock();
+        for (const QueuedMessage &qm : batch){
+            if (qm.sender != (uint32_t) current_container_id || completionOf.empty()) continue;
+            uint32_t i = qm.msg_id - completionBase;
+            if (qm.msg_id < completionBase || i >= completionOf.size() || completionOf[i] == NO_COMPLETION) continue;
+            completed.push_back(Completed{completionOf[i], qm.sequence_number, qm.proposer});
+            completionOf[i] = NO_COMPLETION;
+        }
+        while (!completionOf.empty() && completionOf.front() == NO_COMPLETION){
+            completionOf.pop_front();
+            completionBase++;
+        }
+        completionMutex.unlock();
+        if (deliveryCallback || !completed.empty()){  // in order: we hold deliveryMutex
+            std::lock_guard<std::mutex> lock(handoffMutex);
+            if (deliveryCallback) handoff.insert(handoff.end(), batch.begin(), batch.end());
+            completedHandoff.insert(completedHandoff.end(), completed.begin(), completed.end());
+        }
+        record_deliveries(batch);  // relay to the hosts we are bringing in
+#ifdef DEBUG
+        print_delivered_messages();  // the whole history every time: only for debugging
+#endif
+        const QueuedMessage &last = batch.back();
+        if (last.kind == JOIN_MSG) install_join(last);
+        else if (last.kind == LEAVE_MSG){
+            membershipChanges++;
+            if (last.member == (uint32_t) current_container_id) left = true;
+            else leaving.push_back(last.member);
+        }
     }
-    deliveredMessageMutex.unlock();
-    deliveryQueueMutex.unlock();
-    if (delivered_flag) print_delivered_messages();
 //    DPRINTF(("EXIT deliver_msg_from_deliveryqueue\n"));
 }
 
 
+void ReliableMulticast::dispatch_deliveries(){
+    /* deliveries happen deep inside the handlers, with locks held. they're handed to the application (the callback
+     * and the async multicasts' completions) from the top of a thread instead: after each packet, a send or a
+     * heartbeat. whoever finds nobody dispatching keeps at it until nothing is left, so msgs delivered by other
+     * threads meanwhile go out after the ones before them. a sender waiting for credit hears about it here too */
+    std::unique_lock<std::mutex> lock(handoffMutex);
+    if (dispatching){  // the thread that is dispatching takes ours too
+        lock.unlock();
+        notify_credit();
+        return;
+    }
+    dispatching = true;
+    while (!handoff.empty() || !completedHandoff.empty()){
+        handoff.swap(dispatched);  // the buffers go back and forth: no allocation once they're big enough
+        completedHandoff.swap(completedDispatched);
+        lock.unlock();
+        if (!dispatched.empty()) deliveryCallback(dispatched.data(), dispatched.size());
+        for (const Completed &c : completedDispatched) completions.complete(c.slot, c.final_seq, c.proposer);
+        dispatched.clear();
+        completedDispatched.clear();
+        lock.lock();
+    }
+    dispatching = false;
+    lock.unlock();
+    notify_credit();
+}
+
+
 int ReliableMulticast::change_queued_msg_seq_and_status(uint32_t sender, uint32_t msg_id, uint32_t seq_to_change, uint32_t seq_proposer, unsigned char status){
     /* return 0 for success and -1 for failure (i.e. cannot find a matching msg with sender and msg_id */
     // we find in the deliveryqueue with sender_id and msg_id and then change their seq and status correspondingly
@@ -511,6 +1169,7 @@ int ReliableMulticast::change_queued_msg_seq_and_status(uint32_t sender, uint32_
             qm.sequence_number = seq_to_change;
             qm.status = status;
             qm.proposer = seq_proposer;
+            if (status == DELIVERABLE && qm.final_ns == 0) qm.final_ns = runtime->now_ns();
             // now that we changed sequence number, we must make it a heap again
             std::make_heap(deliveryQueue.begin(), deliveryQueue.end(), cmp);
 
@@ -521,21 +1180,6 @@ int ReliableMulticast::change_queued_msg_seq_and_status(uint32_t sender, uint32_
 }
 
 
-std::pair<uint32_t, uint32_t> ReliableMulticast::get_max_sequence_from_proposerseq_map(const ProposerSeq &pm){
-    uint32_t result_seq         = 0;
-    uint32_t result_proposer    = 0;
-    for (auto const& kv: pm){
-        uint32_t proposer = kv.first;
-        uint32_t sequence_num = kv.second;
-        if (sequence_num > result_seq){
-            result_seq = sequence_num;
-            result_proposer = proposer;
-        }
-    }
-    return std::make_pair(result_seq, result_proposer);
-}
-
-
 AckMessage ReliableMulticast::make_ack_msg(uint32_t sender, uint32_t msg_id, uint32_t proposed_seq, uint32_t proposer){
     AckMessage ackMessage;
     ackMessage.type = ACKMSG_TYPE;
@@ -543,6 +1187,7 @@ AckMessage ReliableMulticast::make_ack_msg(uint32_t sender, uint32_t msg_id, uin
     ackMessage.msg_id = msg_id;
     ackMessage.sender = sender;
     ackMessage.proposed_seq = proposed_seq;
+    ackMessage.credit = 0;
     return ackMessage;
 }
 
@@ -558,14 +1203,20 @@ SeqMessage ReliableMulticast::make_seq_msg(uint32_t sender, uint32_t msg_id, uin
 }
 
 QueuedMessage ReliableMulticast::make_queued_msg(uint32_t sequence_number, unsigned char status, uint32_t sender,
-                                     uint32_t msg_id, uint32_t data, uint32_t proposer){
+                                     uint32_t msg_id, uint32_t member, uint32_t proposer,
+                                     uint32_t kind, uint32_t view_epoch, const Payload &payload){
     QueuedMessage toQueue;
-    toQueue.data = data;
+    toQueue.kind = kind;
+    toQueue.view_epoch = view_epoch;
+    toQueue.member = member;
+    toQueue.payload = payload;
     toQueue.msg_id = msg_id;
     toQueue.sender = sender;
     toQueue.proposer = proposer;
     toQueue.status = status;
     toQueue.sequence_number = sequence_number;
+    toQueue.final_ns = 0;
+    toQueue.queued_ns = 0;
     return toQueue;
 }
 
@@ -579,48 +1230,1164 @@ void ReliableMulticast::start_msg_receiver(ReliableMulticast* rm) {
 }
 
 
-ReliableMulticast::~ReliableMulticast() {
-    for (int i =0; i< num_hosts; i++){
-        delete [] hostNames[i];
-    }
-    delete [] hostNames;
-}
+ReliableMulticast::~ReliableMulticast() = default;
 
-void packi32(unsigned char *buf, unsigned long int i)
-{
-    *buf++ = i>>24; *buf++ = i>>16;
-    *buf++ = i>>8;  *buf++ = i;
+/* For failure detection and view changes */
+HostSet ReliableMulticast::get_view(){
+    std::lock_guard<std::mutex> lock(viewMutex);
+    return view;
 }
 
 
-unsigned long int unpacku32(unsigned char *buf)
-{
-    return ((unsigned long int)buf[0]<<24) |
-           ((unsigned long int)buf[1]<<16) |
-           ((unsigned long int)buf[2]<<8)  |
-           buf[3];
+bool ReliableMulticast::is_member(uint32_t hostID){
+    int rank = hosts.rank_of(hostID);
+    if (rank == -1) return false;
+    std::lock_guard<std::mutex> lock(viewMutex);
+    return view.test(rank);
 }
 
-void serialize_data_message(const DataMessage &dataMessage, unsigned char * buf){
-    packi32(&buf[0], dataMessage.type);
-    packi32(&buf[4], dataMessage.sender);
-    packi32(&buf[8], dataMessage.msg_id);
-    packi32(&buf[12], dataMessage.data);
-}
 
-void deserialize_data_message(unsigned char * buf, DataMessage &dataMessage){
-    dataMessage.type = unpacku32(&buf[0]);
-    dataMessage.sender = unpacku32(&buf[4]);
-    dataMessage.msg_id = unpacku32(&buf[8]);
-    dataMessage.data = unpacku32(&buf[12]);
+void ReliableMulticast::heard_from(uint32_t hostID){
+    failureDetector.heard_from(hosts.rank_of(hostID), runtime->now_ns());
 }
 
-void serialize_ack_message(const AckMessage &ackMessage, unsigned char * buf){
-    packi32(&buf[0], ackMessage.type);
-    packi32(&buf[4], ackMessage.sender);
-    packi32(&buf[8], ackMessage.msg_id);
+
+[[noreturn]] void ReliableMulticast::heartbeat_loop(){
+    /* every HEARTBEAT_INTERVAL we tell everybody in the view that we're alive (and where our msgs stand, for -N),
+     * look for hosts that went silent and resend our part of the flushes we haven't installed yet
+     * (flush msgs can be dropped too) */
+    unsigned char serialized_packet[MAX_STRUCT_SIZE];
+    while (true){
+        runtime->sleep_us(HEARTBEAT_INTERVAL*1000);
+        uint32_t trail = oldest_outstanding();
+        viewMutex.lock();
+        HeartbeatMessage heartbeatMessage{HBTMSG_TYPE, (uint32_t) current_container_id, (uint32_t) view_id, trail,
+                                          (uint32_t) curr_msg_id, advertised_credit((int) view.count())};
+        HostSet members = view;
+        std::vector<ViewChange> pending;
+        for (const auto &kv : viewChanges){
+            if (!kv.second.installed) pending.push_back(kv.second);
+        }
+        viewMutex.unlock();
+
+        serialize_heartbeat_message(heartbeatMessage, serialized_packet);
+        for (int i = 0; i < num_hosts; i++){
+            if (i == current_rank || !members.test(i)) continue;
+            if (send_msg_with_drop_and_delay(hosts.name_of(i), serialized_packet, sizeof(serialized_packet)) == -1)
+                perror("[heartbeat_loop] Error sending heartbeat");
+        }
+
+        for (int rank : failureDetector.check(runtime->now_ns())){
+            printf("[Process %d] Haven't heard from host %s for %d ms. Declaring it failed.\n",
+                   current_container_id, hosts.name_of(rank), failure_timeout_ms);
+            start_view_change(hosts.id_of(rank));
+        }
+        dispatch_deliveries();  // what the view changes let through
+
+        for (const ViewChange &vc : pending){
+            for (int i = 0; i < num_hosts; i++){
+                if (i != current_rank && members.test(i) && vc.survivors.test(i)) send_flush(vc, hosts.name_of(i));
+            }
+        }
+    }
+}
+
+
+void ReliableMulticast::start_view_change(uint32_t failedID){
+    /* take the failed host out of the view and start its flush:
+     * -- our msgs that were only waiting on its ack are finalized right away
+     * -- we forward every final seq we got from it to the survivors and say how many that was
+     * the msgs of the failed host are decided in try_install_view once every survivor has done the same */
+    int failedRank = hosts.rank_of(failedID);
+    if (failedRank == -1 || failedRank == current_rank) return;
+    viewMutex.lock();
+    if (!view.test(failedRank)){  // we have already started (or finished) this one
+        viewMutex.unlock();
+        return;
+    }
+    view.reset(failedRank);
+    view_id++;
+    ViewChange vc;
+    vc.failed = failedID;
+    vc.installed = false;
+    // every final seq of its msgs we know: the ones we delivered and the ones waiting in our queue
+    deliveredMessageMutex.lock();
+    for (const QueuedMessage &qm : deliveredMessage){
+        if (qm.sender == failedID) vc.ownFlush.push_back(make_seq_msg(failedID, qm.msg_id, qm.sequence_number, qm.proposer));
+    }
+    deliveredMessageMutex.unlock();
+    deliveryQueueMutex.lock();
+    for (const QueuedMessage &qm : deliveryQueue){
+        if (qm.sender == failedID && qm.status == DELIVERABLE)
+            vc.ownFlush.push_back(make_seq_msg(failedID, qm.msg_id, qm.sequence_number, qm.proposer));
+    }
+    deliveryQueueMutex.unlock();
+    vc.survivors = view;
+    viewChanges[failedID] = vc;
+    int vid = view_id;
+    HostSet members = view;
+    viewMutex.unlock();
+    failureDetector.suspect(failedRank);
+    nakTracker.forget(failedID);  // its msgs are the flush's business now
+    ackLog.forget(failedID);
+    treeMutex.lock();  // nothing of the failed host's is relayed anymore: the flush decides its msgs
+    for (auto it = treeRelays.begin(); it != treeRelays.end(); ){
+        if (it->first.first == failedID) it = treeRelays.erase(it);
+        else ++it;
+    }
+    treeMutex.unlock();
+    printf("[Process %d] Removing host %s from the view (view %d). Flushing %lu of its final seqs.\n",
+           current_container_id, hosts.name_of(failedRank), vid, vc.ownFlush.size());
+
+    finalize_covered_msgs();
+    for (int i = 0; i < num_hosts; i++){
+        if (i != current_rank && members.test(i)) send_flush(vc, hosts.name_of(i));
+    }
+    try_install_view(failedID);  // we might be the only one left
+}
+
+
+void ReliableMulticast::send_flush(const ViewChange &vc, const char * hostName){
+    unsigned char serialized_packet[MAX_STRUCT_SIZE];
+    for (const SeqMessage &sm : vc.ownFlush){
+        FlushMessage flushMessage{FLUSHMSG_TYPE, (uint32_t) current_container_id, vc.failed, sm.msg_id,
+                                  sm.final_seq, sm.final_seq_proposer};
+        serialize_flush_message(flushMessage, serialized_packet);
+        if (send_msg_with_drop_and_delay(hostName, serialized_packet, sizeof(serialized_packet)) == -1)
+            perror("[send_flush] Error sending flush");
+    }
+    FlushDoneMessage flushDoneMessage{FLUSHDONEMSG_TYPE, (uint32_t) current_container_id, vc.failed,
+                                      (uint32_t) vc.ownFlush.size(), (uint32_t) view_id};
+    serialize_flush_done_message(flushDoneMessage, serialized_packet);
+    if (send_msg_with_drop_and_delay(hostName, serialized_packet, sizeof(serialized_packet)) == -1)
+        perror("[send_flush] Error sending flush done");
+}
+
+
+void ReliableMulticast::try_install_view(uint32_t failedID){
+    /* once every survivor has told us how many final seqs of the failed host it has and we got all of them,
+     * everybody has applied the same set of final seqs. The failed host's msgs that are still undeliverable
+     * never got a final seq anywhere (so nobody delivered them): we drop them and delivery can move on. */
+    viewMutex.lock();
+    auto it = viewChanges.find(failedID);
+    if (it == viewChanges.end() || it->second.installed){
+        viewMutex.unlock();
+        return;
+    }
+    ViewChange &vc = it->second;
+    for (int i = 0; i < num_hosts; i++){
+        if (i == current_rank || !view.test(i) || !vc.survivors.test(i)) continue;
+        uint32_t survivor = hosts.id_of(i);
+        auto done = vc.flushDone.find(survivor);
+        if (done == vc.flushDone.end() || vc.flushed[survivor].size() < done->second){  // still waiting on it
+            viewMutex.unlock();
+            return;
+        }
+    }
+    vc.installed = true;
+    deliveryQueueMutex.lock();
+    size_t before = deliveryQueue.size();
+    deliveryQueue.erase(std::remove_if(deliveryQueue.begin(), deliveryQueue.end(), [&](const QueuedMessage &qm){
+        return qm.sender == failedID && qm.status == UNDELIVERABLE;
+    }), deliveryQueue.end());
+    std::make_heap(deliveryQueue.begin(), deliveryQueue.end(), cmp);
+    size_t dropped = before - deliveryQueue.size();
+    queueDepth.store(deliveryQueue.size(), std::memory_order_relaxed);
+    deliveryQueueMutex.unlock();
+    int vid = view_id;
+    viewMutex.unlock();
+    printf("[Process %d] Installed view %d without host %d. Dropped %lu of its msgs that never got a final seq.\n",
+           current_container_id, vid, failedID, dropped);
+    deliver_msg_from_deliveryqueue();
+    std::lock_guard<std::mutex> deliveryLock(deliveryMutex);
+    advance_state_transfers();  // a joiner might have been waiting on the failed host's old msgs
+}
+
+
+void ReliableMulticast::finalize_covered_msgs(){
+    // after a host is removed, our outstanding msgs that have been acked by everybody left can be finalized
+    HostSet members = get_view();
+    ackHistoryMutex.lock();
+    std::vector<uint32_t> covered;
+    ackHistory.for_each([&](const AckRecord &r){
+        if (r.acks.covers(r.quorum & members)) covered.push_back(r.msg_id);
+    });
+    for (uint32_t msg_id : covered){  // collected first since finalizing releases the record
+        finalize_msg(ackHistory.find(msg_id));
+    }
+    ackHistoryMutex.unlock();
+}
+
+
+void ReliableMulticast::handle_heartbeatmsg(const HeartbeatMessage &heartbeatMessage){
+    heard_from(heartbeatMessage.sender);
+    flow.advertised(hosts.rank_of(heartbeatMessage.sender), heartbeatMessage.credit);
+    if (!is_member(heartbeatMessage.sender)) return;
+    ackLog.advertised(heartbeatMessage.sender, heartbeatMessage.trail);
+    if (nak_mode)
+        nakTracker.advertised(heartbeatMessage.sender, heartbeatMessage.trail, heartbeatMessage.lead, runtime->now_ns());
+}
+
+
+void ReliableMulticast::handle_flushmsg(const FlushMessage &flushMessage){
+    /* a survivor forwards a final seq of the failed host. if we haven't noticed the failure yet, this is how we do */
+    heard_from(flushMessage.from);
+    if (!is_member(flushMessage.from)) return;
+    start_view_change(flushMessage.failed);
+    viewMutex.lock();
+    auto it = viewChanges.find(flushMessage.failed);
+    if (it == viewChanges.end() || it->second.installed){  // unknown host or we already have everybody's flush
+        viewMutex.unlock();
+        return;
+    }
+    std::vector<uint32_t> &got = it->second.flushed[flushMessage.from];
+    bool applied = false;
+    if (std::find(got.begin(), got.end(), flushMessage.msg_id) == got.end()){
+        got.push_back(flushMessage.msg_id);
+        // applied while holding viewMutex so the install (which drops what's left) can't run in between
+        SeqMessage seqMessage = make_seq_msg(flushMessage.failed, flushMessage.msg_id, flushMessage.final_seq,
+                                             flushMessage.final_seq_proposer);
+        if (apply_seq_msg(seqMessage) == -1)
+            fprintf(stderr, "[handle_flushmsg] Flushed msg (%d, %d) is unknown here. Skipping...\n",
+                    flushMessage.msg_id, flushMessage.failed);
+        else applied = true;
+    }
+    viewMutex.unlock();
+    if (applied) deliver_msg_from_deliveryqueue();
+    try_install_view(flushMessage.failed);
+}
+
+
+void ReliableMulticast::handle_flushdonemsg(const FlushDoneMessage &flushDoneMessage){
+    heard_from(flushDoneMessage.from);
+    if (!is_member(flushDoneMessage.from)) return;
+    start_view_change(flushDoneMessage.failed);
+    viewMutex.lock();
+    auto it = viewChanges.find(flushDoneMessage.failed);
+    if (it == viewChanges.end()){
+        viewMutex.unlock();
+        return;
+    }
+    it->second.flushDone[flushDoneMessage.from] = flushDoneMessage.count;
+    bool installed = it->second.installed;
+    ViewChange vc = it->second;
+    viewMutex.unlock();
+    if (installed){  // they are still waiting on (some of) our flush
+        send_flush(vc, hosts.name_of_id(flushDoneMessage.from));
+        return;
+    }
+    try_install_view(flushDoneMessage.failed);
+}
+
+
+/* For joins and leaves */
+void ReliableMulticast::join_group(const char * seed, const char * name){
+    /* we ask a member (the seed) to sponsor us. It orders a JOIN for us like any other msg and, once it delivered it,
+     * sends us the view and relays the older msgs ordered after the JOIN (see Sponsorship). Nobody stops sending. */
+    join_started_at_ns = runtime->now_ns();
+    if (name == nullptr || strlen(name) == 0 || strlen(name) >= MAX_MEMBER_NAME){
+        fprintf(stderr, "Bad host name to join with (at most %d chars). Exiting.\n", MAX_MEMBER_NAME - 1);
+        exit(1);
+    }
+    synced = false;
+    int sock;
+    while ((sock = joinServer.connect_and_get_socket(seed)) == -1){
+        printf("Couldn't reach %s to join the group. Trying again in 1 second...\n", seed);
+        runtime->sleep_us(1000000);
+    }
+    if (client_server::TCP_Server::sendall(sock, name, strlen(name)) == -1){
+        perror("join_group: sending our name failed. Exiting");
+        exit(1);
+    }
+    unsigned char header[VIEWREC_SIZE];
+    if (client_server::TCP_Server::recvall(sock, reinterpret_cast<char *>(header), VIEWREC_SIZE) <= 0
+            || unpacku32(&header[0]) != VIEWREC_TYPE){
+        fprintf(stderr, "%s refused to sponsor %s (id taken or it isn't a full member yet). Exiting.\n", seed, name);
+        exit(1);
+    }
+    uint32_t epoch = unpacku32(&header[4]);
+    uint32_t count = unpacku32(&header[8]);
+    uint32_t join_seq = unpacku32(&header[12]);
+    uint32_t sponsor_seq = unpacku32(&header[16]);
+    uint32_t sponsor = unpacku32(&header[20]);
+    unsigned char member[MEMBERREC_SIZE];
+    for (uint32_t i = 0; i < count; i++){
+        if (client_server::TCP_Server::recvall(sock, reinterpret_cast<char *>(member), MEMBERREC_SIZE) <= 0){
+            fprintf(stderr, "join_group: lost %s while getting the view. Exiting.\n", seed);
+            exit(1);
+        }
+        member[MEMBERREC_SIZE - 1] = '\0';
+        int rank = hosts.add_host(std::string(reinterpret_cast<char *>(&member[4])));
+        if (rank == -1){fprintf(stderr, "join_group: bad view from %s. Exiting.\n", seed); exit(1);}
+        view.set(rank);
+    }
+    num_hosts = hosts.size();
+    current_container_id = extract_int_from_string(std::string(name));
+    current_rank = hosts.rank_of(current_container_id);
+    if (current_rank == -1){fprintf(stderr, "join_group: we are not in the view from %s. Exiting.\n", seed); exit(1);}
+    memberSince.assign(num_hosts, 0);  // the others were there before us: they are in everything we get
+    memberSince[current_rank] = epoch;
+    current_container_name = hosts.name_of(current_rank);
+    view_epoch = (int) epoch;
+    // everything we will deliver is ordered after our JOIN
+    propose_above(std::max(join_seq, sponsor_seq));
+    printf("Current container's name: %s and id: %d\n", current_container_name, current_container_id);
+    printf("[Process %d] Got the view (epoch %d, %d members) from sponsor %d after %.3f ms. Waiting for the state transfer...\n",
+           current_container_id, epoch, count, sponsor, (double) (runtime->now_ns() - join_started_at_ns) / 1e6);
+    runtime->spawn([this, sock]{ state_transfer_receiver(sock); });
+}
+
+
+void ReliableMulticast::state_transfer_receiver(int sock){
+    /* the rest of the stream from our sponsor: relayed msgs (already final) until SYNCDONE. msgs sent to us directly
+     * are acked and queued meanwhile, we only hold back delivery until we have everything ordered before them */
+    unsigned char rec[RELAYREC_SIZE];
+    uint32_t relayed = 0;
+    while (client_server::TCP_Server::recvall(sock, reinterpret_cast<char *>(rec), 4) > 0){
+        uint32_t type = unpacku32(&rec[0]);
+        if (type == SYNCDONEREC_TYPE){
+            close(sock);
+            printf("[Process %d] Joined the group: state transfer done after %.3f ms (%d msgs relayed).\n",
+                   current_container_id, (double) (runtime->now_ns() - join_started_at_ns) / 1e6, relayed);
+            synced = true;
+            deliver_msg_from_deliveryqueue();
+            dispatch_deliveries();
+            return;
+        }
+        if (type != RELAYREC_TYPE ||
+            client_server::TCP_Server::recvall(sock, reinterpret_cast<char *>(rec + 4), RELAYREC_SIZE - 4) <= 0) break;
+        QueuedMessage qm;
+        std::string memberName;
+        deserialize_relay_record(rec, qm, memberName);
+        size_t length = unpacku32(&rec[32]);
+        if (length > MAX_PAYLOAD) break;
+        if (length > 0){  // straight into the buffer it's delivered from
+            qm.payload = Payload::allocate(length);
+            if (client_server::TCP_Server::recvall(sock, reinterpret_cast<char *>(qm.payload.mutable_data()),
+                                                   length) <= 0) break;
+        }
+        if (qm.kind == JOIN_MSG){
+            std::lock_guard<std::mutex> lock(joinMutex);
+            joinNames[qm.member] = memberName;
+        }
+        deliveryQueueMutex.lock();
+        push_msg_to_deliveryqueue(qm);
+        deliveryQueueMutex.unlock();
+        propose_above(qm.sequence_number);
+        relayed++;
+    }
+    fprintf(stderr, "[Process %d] Lost our sponsor before the state transfer was done. Exiting.\n", current_container_id);
+    exit(1);
+}
+
+
+[[noreturn]] void ReliableMulticast::join_listener(){
+    char buf[MAX_MEMBER_NAME];  // a joining host sends its name
+    while (true){
+        int sock = joinServer.accept_and_recv(buf, MAX_MEMBER_NAME);
+        if (sock == -1) continue;
+        std::string name(buf);
+        runtime->spawn([this, sock, name]{ sponsor_join(sock, name); });
+    }
+}
+
+
+void ReliableMulticast::sponsor_join(int sock, std::string name){
+    /* a host asked us to bring it in. we order its JOIN like any msg. the delivery path then queues its
+     * state transfer (view, relays, SYNCDONE) and we write it out here */
+    uint32_t joinerID = extract_int_from_string(name);
+    bool refuse = !synced || left || name.empty() || hosts.rank_of(joinerID) != -1;
+    joinMutex.lock();
+    if (!refuse && sponsorships.count(joinerID) == 0){
+        Sponsorship sp{};
+        sp.joiner = joinerID;
+        sp.sock = sock;
+        sp.requested_at_ns = runtime->now_ns();
+        sponsorships[joinerID] = sp;
+        joinNames[joinerID] = name;
+    } else refuse = true;
+    joinMutex.unlock();
+    if (refuse){
+        fprintf(stderr, "[Process %d] Refusing to sponsor %s (id taken, already joining or we aren't a full member).\n",
+                current_container_id, name.c_str());
+        close(sock);
+        return;
+    }
+    printf("[Process %d] Sponsoring the join of %s.\n", current_container_id, name.c_str());
+    multicast_msg(JOIN_MSG, joinerID, Payload(), name.c_str());
+
+    std::unique_lock<std::mutex> lock(joinMutex);
+    Sponsorship &sp = sponsorships[joinerID];
+    bool failed = false;
+    while (true){
+        joinCv.wait(lock, [&]{ return !sp.outbox.empty() || sp.done; });
+        if (sp.outbox.empty()) break;  // SYNCDONE is out
+        ByteVector rec = sp.outbox.front();
+        sp.outbox.pop_front();
+        lock.unlock();
+        int rv = client_server::TCP_Server::sendall(sock, reinterpret_cast<const char *>(rec.data()), rec.size());
+        lock.lock();
+        if (rv == -1){  // the joiner is gone. the failure detector takes it out of the view
+            perror("[sponsor_join] Lost the joining host");
+            sp.done = true;
+            sp.outbox.clear();
+            failed = true;
+        }
+    }
+    if (!failed)
+        printf("[Process %d] Brought %s in: JOIN ordered after %.3f ms, state transfer done after %.3f ms (%d msgs relayed).\n",
+               current_container_id, name.c_str(), (double) (sp.ordered_at_ns - sp.requested_at_ns) / 1e6,
+               (double) (runtime->now_ns() - sp.requested_at_ns) / 1e6, sp.relayed);
+    lock.unlock();
+    close(sock);
+}
+
+
+void ReliableMulticast::install_join(const QueuedMessage &joinMsg){
+    /* a JOIN was delivered: from here on the joiner is a member. the msgs we send from now on include it and we tell
+     * its sponsor where our older msgs stop (those that get delivered after the JOIN are relayed to it).
+     * must hold deliveryMutex */
+    uint32_t joinerID = joinMsg.member;
+    std::string name;
+    joinMutex.lock();
+    auto it = joinNames.find(joinerID);
+    if (it != joinNames.end()) name = it->second;
+    joinMutex.unlock();
+    int rank = name.empty() ? -1 : hosts.add_host(name);
+    if (rank == -1){
+        fprintf(stderr, "[Process %d] Can't add joining host %d. Ignoring its JOIN.\n", current_container_id, joinerID);
+        return;
+    }
+    viewMutex.lock();
+    HostSet oldMembers = view;
+    view.set(rank);
+    uint32_t epoch = ++view_epoch;
+    if ((int) memberSince.size() <= rank) memberSince.resize(rank + 1, 0);
+    memberSince[rank] = epoch;
+    uint32_t nextMsgId = curr_msg_id;
+    viewMutex.unlock();
+    num_hosts = hosts.size();
+    failureDetector.watch(rank, runtime->now_ns());
+    if (joinerID != (uint32_t) current_container_id){  // all its msgs include us
+        nakTracker.anchor(joinerID, 0);
+        ackLog.anchor(joinerID, 0);
+    }
+    membershipChanges++;
+    printf("[Process %d] Host %s joined the group (epoch %d), sponsored by %d.\n", current_container_id, name.c_str(),
+           epoch, joinMsg.sender);
+    if (joinMsg.sender == (uint32_t) current_container_id){
+        start_state_transfer(joinerID, epoch, oldMembers, nextMsgId, joinMsg);
+        advance_state_transfers();  // we might be the only old member
+    } else {
+        JoinedMessage joinedMessage{JOINEDMSG_TYPE, (uint32_t) current_container_id, joinerID, nextMsgId, epoch};
+        const char * sponsorName = hosts.name_of_id(joinMsg.sender);
+        if (sponsorName == nullptr) return;
+        runtime->spawn([this, joinedMessage, sponsorName]{ joined_watchdog(joinedMessage, sponsorName); });
+    }
+}
+
+
+void ReliableMulticast::start_state_transfer(uint32_t joinerID, uint32_t epoch, const HostSet &oldMembers,
+                                             uint32_t nextMsgId, const QueuedMessage &joinMsg){
+    // we sponsor the joiner and just delivered its JOIN: the view goes out first. must hold deliveryMutex
+    HostSet members = get_view();
+    std::vector<int> ranks;
+    for (int i = 0; i < num_hosts; i++) if (members.test(i)) ranks.push_back(i);
+    ByteVector rec(VIEWREC_SIZE + ranks.size() * MEMBERREC_SIZE, 0);
+    packi32(&rec[0], VIEWREC_TYPE);
+    packi32(&rec[4], epoch);
+    packi32(&rec[8], ranks.size());
+    packi32(&rec[12], joinMsg.sequence_number);
+    packi32(&rec[16], curr_seq_number.load());
+    packi32(&rec[20], current_container_id);
+    for (size_t i = 0; i < ranks.size(); i++){
+        unsigned char * m = &rec[VIEWREC_SIZE + i * MEMBERREC_SIZE];
+        packi32(m, hosts.id_of(ranks[i]));
+        strncpy(reinterpret_cast<char *>(m + 4), hosts.name_of(ranks[i]), MAX_MEMBER_NAME - 1);
+    }
+    std::lock_guard<std::mutex> lock(joinMutex);
+    auto it = sponsorships.find(joinerID);
+    if (it == sponsorships.end() || it->second.done) return;
+    Sponsorship &sp = it->second;
+    sp.delivered = true;
+    sp.epoch = epoch;
+    sp.oldMembers = oldMembers;
+    sp.ordered_at_ns = runtime->now_ns();
+    sp.firstNewMsgId[current_container_id] = nextMsgId;
+    for (const auto &kv : sp.firstNewMsgId){  // ours and the reports that beat the JOIN here
+        sp.missing[kv.first] = kv.second - count_delivered_below(kv.first, kv.second);
+    }
+    sp.outbox.push_back(rec);
+    joinCv.notify_all();
+}
+
+
+void ReliableMulticast::record_deliveries(const std::vector<QueuedMessage> &batch){
+    // every msg delivered after a JOIN that its joiner wasn't in the quorum of is relayed. must hold deliveryMutex
+    bool queued = false;
+    joinMutex.lock();
+    for (auto &kv : sponsorships){
+        Sponsorship &sp = kv.second;
+        if (!sp.delivered || sp.done) continue;
+        for (const QueuedMessage &qm : batch){
+            auto first = sp.firstNewMsgId.find(qm.sender);
+            if (first != sp.firstNewMsgId.end() && qm.msg_id < first->second) sp.missing[qm.sender]--;
+            if (qm.view_epoch >= sp.epoch) continue;  // the joiner got this one directly
+            ByteVector rec(RELAYREC_SIZE + qm.payload.size());
+            serialize_relay_record(qm, qm.kind == JOIN_MSG ? joinNames[qm.member] : std::string(), rec.data());
+            sp.outbox.push_back(rec);
+            sp.relayed++;
+            queued = true;
+        }
+    }
+    if (queued) joinCv.notify_all();
+    joinMutex.unlock();
+    advance_state_transfers();
+}
+
+
+void ReliableMulticast::advance_state_transfers(){
+    /* a joiner has everything it needs once every old member
+     * -- told us where its old msgs stop and we delivered all of them, or
+     * -- was removed, its flush is installed and none of its msgs are left in our queue (the rest never will be)
+     * then SYNCDONE goes out after the last relay. must hold deliveryMutex so no relay is still on its way */
+    HostSet members;
+    std::set<uint32_t> flushed;
+    std::set<uint32_t> queuedSenders;
+    viewMutex.lock();
+    members = view;
+    for (const auto &kv : viewChanges) if (kv.second.installed) flushed.insert(kv.first);
+    viewMutex.unlock();
+    deliveryQueueMutex.lock();
+    for (const QueuedMessage &qm : deliveryQueue) queuedSenders.insert(qm.sender);
+    deliveryQueueMutex.unlock();
+
+    bool queued = false;
+    std::lock_guard<std::mutex> lock(joinMutex);
+    for (auto &kv : sponsorships){
+        Sponsorship &sp = kv.second;
+        if (!sp.delivered || sp.done) continue;
+        bool ready = true;
+        for (int i = 0; i < num_hosts && ready; i++){
+            if (!sp.oldMembers.test(i)) continue;
+            uint32_t id = hosts.id_of(i);
+            bool reported = sp.firstNewMsgId.count(id) != 0 && sp.missing[id] == 0;
+            bool gone = !members.test(i) && flushed.count(id) != 0 && queuedSenders.count(id) == 0;
+            ready = reported || gone;
+        }
+        if (!ready) continue;
+        ByteVector rec(4);
+        packi32(rec.data(), SYNCDONEREC_TYPE);
+        sp.outbox.push_back(rec);
+        sp.done = true;
+        queued = true;
+    }
+    if (queued) joinCv.notify_all();
+}
+
+
+uint32_t ReliableMulticast::count_delivered_below(uint32_t sender, uint32_t msg_id){
+    uint32_t n = 0;
+    deliveredMessageMutex.lock();
+    for (const QueuedMessage &qm : deliveredMessage){
+        if (qm.sender == sender && qm.msg_id < msg_id) n++;
+    }
+    deliveredMessageMutex.unlock();
+    return n;
+}
+
+
+void ReliableMulticast::joined_watchdog(const JoinedMessage &joinedMessage, const char * sponsorName){
+    // keep telling the sponsor where our old msgs stop until it acks (the joiner can't start before that)
+    unsigned char serialized_packet[MAX_STRUCT_SIZE];
+    serialize_joined_message(joinedMessage, serialized_packet);
+    uint32_t sponsorID = extract_int_from_string(std::string(sponsorName));
+    int watchdog_resend_cap = 0;
+    while (watchdog_resend_cap++ < WATCHDOG_RESEND_CAP){
+        int rv = send_msg_with_drop_and_delay(sponsorName, serialized_packet, sizeof(serialized_packet));
+        if (rv == -1) perror("[joined_watchdog] Error sending message");
+        if (rv == -22){
+            DPRINTF(("[joined_WATCHDOG] Joined msg for %d to %s was dropped\n", joinedMessage.joiner, sponsorName));
+        }
+        runtime->sleep_us(TIMEOUT*1000);
+        joinMutex.lock();
+        bool acked = joinedAcked.count(joinedMessage.joiner) != 0;
+        joinMutex.unlock();
+        if (acked || !is_member(sponsorID)) return;  // a joiner whose sponsor failed can't finish anyway
+    }
+    printf("joined_WATCHDOG WAITED MAXIMUM TIMES! SOMETHING WENT WRONG...HOST %s EITHER CRASHED OR NETWORK PROBLEM\n", sponsorName);
+}
+
+
+void ReliableMulticast::handle_joinedmsg(const JoinedMessage &joinedMessage){
+    /* an old member delivered the JOIN of a host we sponsor. its msgs from next_msg_id on include the joiner */
+    heard_from(joinedMessage.from);
+    JoinedAckMessage joinedAckMessage{JOINEDACKMSG_TYPE, (uint32_t) current_container_id, joinedMessage.joiner};
+    unsigned char serialized_packet[MAX_STRUCT_SIZE];
+    serialize_joined_ack_message(joinedAckMessage, serialized_packet);
+    reply_msg_with_drop_and_delay(serialized_packet, sizeof(serialized_packet));
+    DPRINTF(("handle_joinedmsg: %d delivered the JOIN of %d (epoch %d). Its old msgs are below %d\n", joinedMessage.from,
+            joinedMessage.joiner, joinedMessage.view_epoch, joinedMessage.next_msg_id));
+
+    std::lock_guard<std::mutex> deliveryLock(deliveryMutex);  // no delivery between counting and recording
+    joinMutex.lock();
+    auto it = sponsorships.find(joinedMessage.joiner);
+    if (it == sponsorships.end() || it->second.done || it->second.firstNewMsgId.count(joinedMessage.from) != 0){
+        joinMutex.unlock();
+        return;
+    }
+    Sponsorship &sp = it->second;
+    sp.firstNewMsgId[joinedMessage.from] = joinedMessage.next_msg_id;
+    if (sp.delivered)  // otherwise it's counted when we deliver the JOIN
+        sp.missing[joinedMessage.from] = joinedMessage.next_msg_id -
+                                         count_delivered_below(joinedMessage.from, joinedMessage.next_msg_id);
+    joinMutex.unlock();
+    advance_state_transfers();
+}
+
+
+void ReliableMulticast::handle_joinedackmsg(const JoinedAckMessage &joinedAckMessage){
+    heard_from(joinedAckMessage.from);
+    std::lock_guard<std::mutex> lock(joinMutex);
+    joinedAcked.insert(joinedAckMessage.joiner);
+}
+
+
+void ReliableMulticast::leave(){
+    /* leave the group: our LEAVE is ordered like any msg and everybody removes us where it delivers it, through the
+     * same flush as for a failure (so our msgs end up the same everywhere). We keep answering for LEAVE_LINGER
+     * afterwards so the others can still get our seqs. */
+    while (true){  // first everybody has to have acked our msgs
+        ackHistoryMutex.lock();
+        size_t outstanding = ackHistory.size();
+        ackHistoryMutex.unlock();
+        if (outstanding == 0) break;
+        runtime->sleep_us(HEARTBEAT_INTERVAL*1000);
+    }
+    uint64_t start = runtime->now_ns();
+    printf("[Process %d] Leaving the group.\n", current_container_id);
+    multicast_msg(LEAVE_MSG, current_container_id, Payload(), nullptr);
+    while (!left) runtime->sleep_us(10*1000);
+    printf("[Process %d] Left the group: LEAVE delivered after %.3f ms. Answering for another %d ms.\n",
+           current_container_id, (double) (runtime->now_ns() - start) / 1e6, LEAVE_LINGER);
+    runtime->sleep_us(LEAVE_LINGER*1000);
+}
+
+
+/* For tree dissemination */
+HostSet ReliableMulticast::tree_members(uint32_t sender, uint32_t epoch){
+    // the hosts in our view that were members when a msg of this epoch was sent: the tree its sender built
+    std::lock_guard<std::mutex> lock(viewMutex);
+    HostSet members;
+    for (int i = 0; i < num_hosts && i < (int) memberSince.size(); i++){
+        if (view.test(i) && memberSince[i] <= epoch) members.set(i);
+    }
+    int senderRank = hosts.rank_of(sender);
+    if (senderRank != -1) members.set(senderRank);
+    return members;
+}
+
+
+bool ReliableMulticast::start_tree_relay(const DataMessage &dataMessage, const AckMessage &ownAck){
+    /* a new DATA in someone's tree: pass it down to our children and collect their acks with ours.
+     * return false if we are a leaf (our ack goes straight back to our parent) */
+    int senderRank = hosts.rank_of(dataMessage.sender);
+    HostSet members = tree_members(dataMessage.sender, dataMessage.view_epoch);
+    std::vector<int> children = tree_children(members, senderRank, current_rank, tree_fanout);
+    if (children.empty()) return false;
+    TreeRelay relay;
+    relay.parent = hosts.id_of(tree_parent(members, senderRank, current_rank, tree_fanout));
+    for (int c : children){
+        relay.children.push_back(hosts.id_of(c));
+        relay.waiting.insert(hosts.id_of(c));
+    }
+    relay.acked.push_back(current_container_id);
+    relay.max_seq = ownAck.proposed_seq;
+    relay.max_proposer = ownAck.proposer;
+    relay.passed_up = false;
+    treeMutex.lock();
+    treeRelays[std::make_pair(dataMessage.sender, dataMessage.msg_id)] = relay;
+    treeMutex.unlock();
+
+    Payload packet = serialized_data_message(dataMessage);
+    for (int c : children){
+        int rv = send_data(hosts.name_of(c), packet);
+        if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        if (rv == -22){
+            DPRINTF(("[start_tree_relay] Message (%d, %d) to %s was dropped\n",
+                    dataMessage.msg_id, dataMessage.sender, hosts.name_of(c)));
+        }
+    }
+    uint32_t sender = dataMessage.sender, msg_id = dataMessage.msg_id;
+    runtime->spawn([this, sender, msg_id]{ tree_relay_watchdog(sender, msg_id); });
+    return true;
+}
+
+
+void ReliableMulticast::merge_subtree_acks(const AggAckMessage &aggAckMessage){
+    /* acks for someone else's msg: they come from a child of ours in its tree. once all our children reported they
+     * go up in one msg. late ones (we passed up already, or don't relay this msg) go straight on */
+    auto key = std::make_pair(aggAckMessage.sender, aggAckMessage.msg_id);
+    treeMutex.lock();
+    auto it = treeRelays.find(key);
+    if (it == treeRelays.end() || it->second.passed_up){
+        uint32_t to = it == treeRelays.end() ? aggAckMessage.sender : it->second.parent;
+        treeMutex.unlock();
+        AggAckMessage late = aggAckMessage;
+        late.from = current_container_id;
+        send_agg_ack(late, to);
+        return;
+    }
+    TreeRelay &relay = it->second;
+    for (uint32_t id : aggAckMessage.acked){
+        if (std::find(relay.acked.begin(), relay.acked.end(), id) == relay.acked.end()) relay.acked.push_back(id);
+    }
+    // same tie-break as the delivery queue: on equal sequence the larger proposer comes later
+    if (aggAckMessage.proposed_seq > relay.max_seq ||
+        (aggAckMessage.proposed_seq == relay.max_seq && aggAckMessage.proposer > relay.max_proposer)){
+        relay.max_seq = aggAckMessage.proposed_seq;
+        relay.max_proposer = aggAckMessage.proposer;
+    }
+    relay.waiting.erase(aggAckMessage.from);
+    bool complete = relay.waiting.empty();
+    treeMutex.unlock();
+    if (complete) pass_up(aggAckMessage.sender, aggAckMessage.msg_id);
+}
+
+
+void ReliableMulticast::pass_up(uint32_t sender, uint32_t msg_id){
+    // send the acks we collected for (sender, msg_id) to our parent. only once: later ones are passed on as they come
+    treeMutex.lock();
+    auto it = treeRelays.find(std::make_pair(sender, msg_id));
+    if (it == treeRelays.end() || it->second.passed_up){
+        treeMutex.unlock();
+        return;
+    }
+    TreeRelay &relay = it->second;
+    relay.passed_up = true;
+    AggAckMessage aggAckMessage{AGGACKMSG_TYPE, sender, msg_id, relay.max_seq, relay.max_proposer,
+                                (uint32_t) current_container_id, relay.acked};
+    uint32_t parent = relay.parent;
+    if (!relay.waiting.empty()){
+        DPRINTF(("[pass_up] %lu children haven't acked msg (%d, %d) after %d ms. Passing up what we have\n",
+                relay.waiting.size(), msg_id, sender, TREE_ACK_WAIT));
+    }
+    treeMutex.unlock();
+    send_agg_ack(aggAckMessage, parent);
+}
+
+
+void ReliableMulticast::send_agg_ack(const AggAckMessage &aggAckMessage, uint32_t toID){
+    const char * hostName = hosts.name_of_id(toID);
+    if (hostName == nullptr) return;
+    ByteVector packet(agg_ack_message_size(aggAckMessage));
+    serialize_agg_ack_message(aggAckMessage, packet.data());
+    int rv = send_msg_with_drop_and_delay(hostName, packet.data(), packet.size());
+    if (rv == -1) perror("[send_agg_ack] Error sending acks");
+    if (rv == -22){
+        DPRINTF(("[send_agg_ack] Acks for (%d, %d) to %s were dropped\n",
+                aggAckMessage.msg_id, aggAckMessage.sender, hostName));
+    }
+}
+
+
+void ReliableMulticast::handle_aggackmsg(const AggAckMessage &aggAckMessage){
+    DPRINTF(("*** Received acks of %lu hosts for msg (%d, %d) from %d, max seq %d by %d\n", aggAckMessage.acked.size(),
+            aggAckMessage.msg_id, aggAckMessage.sender, aggAckMessage.from, aggAckMessage.proposed_seq, aggAckMessage.proposer));
+    heard_from(aggAckMessage.from);
+    if (aggAckMessage.sender == (uint32_t) current_container_id) collect_acks(aggAckMessage);
+    else merge_subtree_acks(aggAckMessage);
+}
+
+
+void ReliableMulticast::collect_acks(const AggAckMessage &aggAckMessage){
+    // the acks of one of our subtrees for our msg. a late one changes nothing: a host that's still missing the seq
+    // asks for it with its own ack (ackmsg_watchdog)
+    HostSet members = get_view();
+    ackHistoryMutex.lock();
+    AckRecord * record = ackHistory.find(aggAckMessage.msg_id);
+    if (record == nullptr){
+        ackHistoryMutex.unlock();
+        return;
+    }
+    bool added = false;
+    for (uint32_t id : aggAckMessage.acked){
+        int rank = hosts.rank_of(id);
+        if (rank != -1 && record->acks.add(rank, aggAckMessage.proposed_seq, aggAckMessage.proposer)) added = true;
+    }
+    if (added){
+        curr_seq_number.fetch_add(1);  // to avoid clashing
+        if (record->acks.covers(record->quorum & members)) finalize_msg(record);
+    }
+    ackHistoryMutex.unlock();
+}
+
+
+void ReliableMulticast::forward_seq_msg(const SeqMessage &seqMessage){
+    // a new final seq for a msg we relay: it goes down to the children we gave the DATA to and we are done with it
+    std::vector<uint32_t> children;
+    treeMutex.lock();
+    auto it = treeRelays.find(std::make_pair(seqMessage.sender, seqMessage.msg_id));
+    if (it != treeRelays.end()){
+        children = it->second.children;
+        treeRelays.erase(it);
+    }
+    treeMutex.unlock();
+    unsigned char serialized_packet[MAX_STRUCT_SIZE];
+    serialize_seq_message(seqMessage, serialized_packet);
+    for (uint32_t child : children){
+        if (!is_member(child)) continue;
+        int rv = send_msg_with_drop_and_delay(hosts.name_of_id(child), serialized_packet, sizeof(serialized_packet));
+        if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        if (rv == -22){
+            DPRINTF(("[forward_seq_msg] SeqMessage for (%d, %d) to %d was dropped\n",
+                    seqMessage.msg_id, seqMessage.sender, child));
+        }
+    }
+}
+
+
+void ReliableMulticast::tree_relay_watchdog(uint32_t sender, uint32_t msg_id){
+    // a dropped msg or a dead child must not hold up the acks we have. the root covers whoever is missing
+    runtime->sleep_us(TREE_ACK_WAIT*1000);
+    pass_up(sender, msg_id);
+}
+
+
+void ReliableMulticast::group_datamsg_watchdog(const DataMessage &dataMessage){
+    /* one watchdog per msg when it doesn't go to each host directly (tree or ip multicast). every TIMEOUT we send the
+     * DATA straight to every host we are still missing an ack from (it was lost somewhere or a relay failed) */
+    Payload packet = serialized_data_message(dataMessage);
+    int watchdog_resend_cap = 0;
+    while (watchdog_resend_cap++ < WATCHDOG_RESEND_CAP){
+        runtime->sleep_us(TIMEOUT*1000);
+        HostSet members = get_view();
+        std::vector<int> missing;
+        ackHistoryMutex.lock();
+        AckRecord * record = ackHistory.find(dataMessage.msg_id);
+        if (record == nullptr){  // finalized: everybody has acked
+            ackHistoryMutex.unlock();
+            DPRINTF(("[group_datamsg_WATCHDOG FINISHED] msg_id %d is final. Terminating!\n", dataMessage.msg_id));
+            return;
+        }
+        for (int i = 0; i < num_hosts; i++){
+            if (i != current_rank && record->quorum.test(i) && members.test(i) && !record->acks.has_acked(i)){
+                record->resent.set(i);
+                missing.push_back(i);
+            }
+        }
+        ackHistoryMutex.unlock();
+        for (int rank : missing){
+            DPRINTF(("[group_datamsg_WATCHDOG TIMEOUT] No ack for msg_id %d from %s. Sending it directly.\n",
+                    dataMessage.msg_id, hosts.name_of(rank)));
+            metrics.retransmit(rank);
+            trace(T_RETRANSMIT, dataMessage.sender, dataMessage.msg_id, hosts.id_of(rank), DATAMSG_TYPE);
+            int rv = send_data(hosts.name_of(rank), packet);
+            if (rv == -1){perror("Error sending message. Exiting...\n"); exit(1);}
+        }
+    }
+    printf("group_datamsg_WATCHDOG WAITED MAXIMUM TIMES! SOMETHING WENT WRONG...MSG %d STILL MISSING ACKS\n", dataMessage.msg_id);
+}
+
+
+/* For the NAK mode (-N) */
+[[noreturn]] void ReliableMulticast::nak_loop(){
+    // replaces the per msg data and ack watchdogs: every NAK_INTERVAL we ask each sender for what we are missing
+    while (true){
+        runtime->sleep_us(NAK_INTERVAL*1000);
+        send_naks(NAK_DATA);
+        send_naks(NAK_SEQ);
+    }
+}
+
+
+void ReliableMulticast::send_naks(int what){
+    unsigned char serialized_packet[MAX_MSG_SIZE];
+    for (const auto &kv : nakTracker.sweep(what, runtime->now_ns())){
+        if (!is_member(kv.first)) continue;
+        NakMessage nakMessage{NAKMSG_TYPE, (uint32_t) current_container_id, kv.first, (uint32_t) what, kv.second};
+        DPRINTF(("[send_naks] NAKing %lu ranges of %s from %d (first %d-%d)\n", kv.second.size(),
+                what == NAK_DATA ? "DATA" : "SEQs", kv.first, kv.second[0].lo, kv.second[0].hi));
+        serialize_nak_message(nakMessage, serialized_packet);
+        int rv = send_msg_with_drop_and_delay(hosts.name_of_id(kv.first), serialized_packet, nak_message_size(nakMessage));
+        if (rv == -1) perror("[send_naks] Error sending NAK");
+    }
+}
+
+
+void ReliableMulticast::handle_nakmsg(const NakMessage &nakMessage){
+    /* a receiver is missing some of our msgs or their SEQs:
+     * -- a msg that isn't final and that it hasn't acked: it gets the DATA again from sendRing
+     *    (for a missing SEQ that means its ACK got lost, the duplicate DATA makes it resend it)
+     * -- a final msg it asks the SEQ for: it gets the SEQ again
+     * anything else is either waiting on somebody else's ACK or a msg it wasn't in the quorum of */
+    heard_from(nakMessage.from);
+    int rank = hosts.rank_of(nakMessage.from);
+    if (rank == -1 || nakMessage.sender != (uint32_t) current_container_id || !is_member(nakMessage.from)) return;
+    std::vector<DataMessage> resendData;
+    std::vector<uint32_t> resendSeq;
+    ackHistoryMutex.lock();
+    sendRingMutex.lock();
+    for (const NakRange &range : nakMessage.ranges){
+        for (uint64_t id = range.lo; id <= range.hi && id - range.lo < NAK_RING_SIZE; id++){
+            AckRecord * record = ackHistory.find(id);
+            const DataMessage * dm = sendRing.get(id);
+            if (record != nullptr){
+                if (record->quorum.test(rank) && !record->acks.has_acked(rank) && dm != nullptr){
+                    record->resent.set(rank);
+                    resendData.push_back(*dm);
+                }
+            } else if (nakMessage.what == NAK_SEQ) resendSeq.push_back(id);
+        }
+    }
+    sendRingMutex.unlock();
+    ackHistoryMutex.unlock();
+
+    for (const DataMessage &dm : resendData){
+        Payload packet = serialized_data_message(dm);
+        metrics.retransmit(rank);
+        trace(T_RETRANSMIT, dm.sender, dm.msg_id, nakMessage.from, DATAMSG_TYPE);
+        // the host that NAKed (a reply would do, but a big DATA goes out in fragments)
+        int rv = send_data(hosts.name_of(rank), packet);
+        if (rv == -1){perror("[handle_nakmsg] Error sending message. Exiting...\n"); exit(1);}
+    }
+    unsigned char serialized_packet[MAX_STRUCT_SIZE];
+    for (uint32_t id : resendSeq){
+        SeqMessage sm;
+        if (!own_final_seq(id, sm)) continue;
+        serialize_seq_message(sm, serialized_packet);
+        metrics.retransmit(rank);
+        trace(T_RETRANSMIT, sm.sender, sm.msg_id, nakMessage.from, SEQMSG_TYPE);
+        int rv = reply_msg_with_drop_and_delay(serialized_packet, MAX_STRUCT_SIZE);
+        if (rv == -1){perror("[handle_nakmsg] Error sending message. Exiting...\n"); exit(1);}
+    }
+    DPRINTF(("[handle_nakmsg] %d asked for %lu ranges: resent %lu DATA and %lu SEQs\n", nakMessage.from,
+            nakMessage.ranges.size(), resendData.size(), resendSeq.size()));
+}
+
+
+bool ReliableMulticast::own_final_seq(uint32_t msg_id, SeqMessage &seqMessage){
+    /* the final seq of one of our msgs. it's in seqRing unless the msg is more than NAK_RING_SIZE back: then we take
+     * it from our queue or what we delivered (slow, but only a receiver that lost a SEQ long ago gets here) */
+    sendRingMutex.lock();
+    const SeqMessage * sm = seqRing.get(msg_id);
+    if (sm != nullptr) seqMessage = *sm;
+    sendRingMutex.unlock();
+    if (sm != nullptr) return true;
+    const QueuedMessage * found = nullptr;
+    uint32_t self = current_container_id;
+    deliveryQueueMutex.lock();
+    for (const QueuedMessage &qm : deliveryQueue){
+        if (qm.sender == self && qm.msg_id == msg_id && qm.status == DELIVERABLE) {found = &qm; break;}
+    }
+    if (found != nullptr) seqMessage = make_seq_msg(self, msg_id, found->sequence_number, found->proposer);
+    deliveryQueueMutex.unlock();
+    if (found != nullptr) return true;
+    deliveredMessageMutex.lock();
+    for (const QueuedMessage &qm : deliveredMessage){
+        if (qm.sender == self && qm.msg_id == msg_id) {found = &qm; break;}
+    }
+    if (found != nullptr) seqMessage = make_seq_msg(self, msg_id, found->sequence_number, found->proposer);
+    deliveredMessageMutex.unlock();
+    return found != nullptr;
+}
+
+
+uint32_t ReliableMulticast::oldest_outstanding(){
+    // our heartbeat's trail: msgs below it are final (everybody in their quorum has them)
+    std::lock_guard<std::mutex> lock(ackHistoryMutex);
+    uint32_t oldest = UINT32_MAX;
+    ackHistory.for_each([&](const AckRecord &r){ oldest = std::min(oldest, r.msg_id); });
+    if (oldest != UINT32_MAX) return oldest;
+    std::lock_guard<std::mutex> viewLock(viewMutex);
+    return (uint32_t) curr_msg_id;
+}
+
+
+void ReliableMulticast::wait_for_ring_slot(){
+    // a msg can only be retransmitted while it's in sendRing: we don't reuse the slot of a msg that isn't final yet
+    while (true){
+        viewMutex.lock();
+        uint32_t next = curr_msg_id;
+        viewMutex.unlock();
+        if (next < NAK_RING_SIZE) return;
+        ackHistoryMutex.lock();
+        bool busy = ackHistory.find(next - NAK_RING_SIZE) != nullptr;
+        ackHistoryMutex.unlock();
+        if (!busy) return;
+        runtime->sleep_us(1000);
+    }
+}
+
+
+/* For fragmentation (DATA bigger than FRAG_MTU) */
+bool ReliableMulticast::handle_fragment(const unsigned char *frag, size_t size){
+    // a piece of a DATA: once we have them all, the DATA is handled as if it came in one datagram (and only then acked)
+    if (size >= FRAG_HEADER_SIZE && unpacku32(const_cast<unsigned char *>(&frag[4])) == (uint32_t) current_container_id)
+        return false;  // our own ip multicast looping back
+    if (!fragLoopStarted.exchange(true)) runtime->spawn([this]{ frag_loop(); });
+    Payload whole;
+    int rv = reassembler.add(frag, size, runtime->now_ns(), whole);
+    if (rv == FRAG_DROPPED) metrics.count(M_FRAGMENTS_DROPPED);
+    metrics.set(G_REASSEMBLY, (int64_t) reassembler.held_bytes());
+    if (rv != FRAG_COMPLETE) return false;
+    return handle_packet(whole.mutable_data(), whole.size(), &whole);
+}
+
+
+void ReliableMulticast::handle_fragnakmsg(const FragNakMessage &fragNakMessage){
+    // resend just the fragments asked for, if we still have the datagram (if not, the whole DATA comes again later)
+    heard_from(fragNakMessage.from);
+    const char *hostName = hosts.name_of_id(fragNakMessage.from);
+    Payload packet = fragmenter.find(fragNakMessage.sender, fragNakMessage.msg_id);
+    if (hostName == nullptr || packet.empty()) return;
+    uint32_t count = Fragmenter::count(packet.size());
+    int rank = hosts.rank_of(fragNakMessage.from);
+    if (fragNakMessage.sender == (uint32_t) current_container_id && rank != -1){  // its ack won't tell us the rtt
+        std::lock_guard<std::mutex> lock(ackHistoryMutex);
+        AckRecord * record = ackHistory.find(fragNakMessage.msg_id);
+        if (record != nullptr) record->resent.set(rank);
+    }
+    for (const NakRange &range : fragNakMessage.ranges){
+        for (uint32_t i = range.lo; i <= range.hi && i < count; i++){
+            Payload frag = Fragmenter::fragment(packet, current_container_id, i);
+            metrics.retransmit(rank);
+            trace(T_RETRANSMIT, fragNakMessage.sender, fragNakMessage.msg_id, fragNakMessage.from, FRAGMSG_TYPE);
+            int rv = send_msg_with_drop_and_delay(hostName, frag.data(), frag.size());
+            if (rv == -1){perror("[handle_fragnakmsg] Error sending message. Exiting...\n"); exit(1);}
+        }
+    }
+}
+
+
+[[noreturn]] void ReliableMulticast::frag_loop(){
+    // every FRAG_RETRY we NAK the fragments of partial msgs that stopped coming, and give up on the stale ones
+    unsigned char serialized_packet[FRAGNAK_HEADER_SIZE + 8 * FRAG_MAX_RANGES];
+    while (true){
+        runtime->sleep_us(FRAG_RETRY*1000);
+        uint64_t expired = 0;
+        for (const FragNak &n : reassembler.sweep(current_container_id, runtime->now_ns(), expired)){
+            const char *hostName = hosts.name_of_id(n.to);
+            if (hostName == nullptr || !is_member(n.to)) continue;
+            DPRINTF(("[frag_loop] NAKing %lu ranges of fragments of (%d, %d) from %d\n", n.nak.ranges.size(),
+                    n.nak.msg_id, n.nak.sender, n.to));
+            serialize_frag_nak_message(n.nak, serialized_packet);
+            int rv = send_msg_with_drop_and_delay(hostName, serialized_packet, frag_nak_message_size(n.nak));
+            if (rv == -1) perror("[frag_loop] Error sending NAK");
+        }
+        if (expired > 0) metrics.count(M_FRAGMENTS_DROPPED, expired);
+        metrics.set(G_REASSEMBLY, (int64_t) reassembler.held_bytes());
+    }
+}
+
+
+[[noreturn]] void ReliableMulticast::throughput_monitor(){
+    /* samples our send and delivery rates every THROUGHPUT_SAMPLE. nothing is printed until the membership changes:
+     * then we print the rates before the change and for MEMBERSHIP_REPORT samples after it (how much senders slow
+     * down while a host joins or leaves) */
+    uint64_t lastSent = 0, lastDelivered = 0;
+    int lastChanges = 0, reportLeft = 0;
+    double baseSent = 0, baseDelivered = 0;  // moving averages while nothing changes
+    while (true){
+        runtime->sleep_us(THROUGHPUT_SAMPLE*1000);
+        uint64_t sent = sentCount, delivered = deliveredCount;
+        double sentRate = (double) (sent - lastSent) * 1000.0 / THROUGHPUT_SAMPLE;
+        double deliveredRate = (double) (delivered - lastDelivered) * 1000.0 / THROUGHPUT_SAMPLE;
+        lastSent = sent;
+        lastDelivered = delivered;
+        int changes = membershipChanges;
+        if (changes != lastChanges){
+            if (reportLeft == 0)
+                RMLOG(LOG_INFO, "[Process %d] Membership changed. Rates before: sent %.1f msgs/s, delivered %.1f msgs/s\n",
+                      current_container_id, baseSent, baseDelivered);
+            lastChanges = changes;
+            reportLeft = MEMBERSHIP_REPORT;
+        }
+        if (reportLeft > 0){
+            reportLeft--;
+            RMLOG(LOG_INFO, "[Process %d] Rates: sent %.1f msgs/s (%.0f%% of before), delivered %.1f msgs/s (%.0f%% of before)\n",
+                  current_container_id, sentRate, baseSent > 0 ? 100.0 * sentRate / baseSent : 100.0,
+                  deliveredRate, baseDelivered > 0 ? 100.0 * deliveredRate / baseDelivered : 100.0);
+        } else {
+            baseSent = 0.7 * baseSent + 0.3 * sentRate;
+            baseDelivered = 0.7 * baseDelivered + 0.3 * deliveredRate;
+        }
+    }
+}
+
+
+void packi32(unsigned char *buf, unsigned long int i)
+{
+    *buf++ = i>>24; *buf++ = i>>16;
+    *buf++ = i>>8;  *buf++ = i;
+}
+
+
+unsigned long int unpacku32(unsigned char *buf)
+{
+    return ((unsigned long int)buf[0]<<24) |
+           ((unsigned long int)buf[1]<<16) |
+           ((unsigned long int)buf[2]<<8)  |
+           buf[3];
+}
+
+size_t data_message_size(const DataMessage &dataMessage){
+    // only a JOIN carries the name of the joining host. the payload comes last
+    return (dataMessage.kind == JOIN_MSG ? MAX_DATA_SIZE : MAX_STRUCT_SIZE) + dataMessage.payload.size();
+}
+
+void serialize_data_message(const DataMessage &dataMessage, unsigned char * buf){
+    packi32(&buf[0], dataMessage.type);
+    packi32(&buf[4], dataMessage.sender);
+    packi32(&buf[8], dataMessage.msg_id);
+    packi32(&buf[12], dataMessage.member);
+    packi32(&buf[16], dataMessage.kind);
+    packi32(&buf[20], dataMessage.view_epoch);
+    size_t header = MAX_STRUCT_SIZE;
+    if (dataMessage.kind == JOIN_MSG){
+        memcpy(&buf[MAX_STRUCT_SIZE], dataMessage.member_name, MAX_MEMBER_NAME);
+        header = MAX_DATA_SIZE;
+    }
+    if (!dataMessage.payload.empty()) memcpy(&buf[header], dataMessage.payload.data(), dataMessage.payload.size());
+}
+
+Payload serialized_data_message(const DataMessage &dataMessage){
+    // the one copy of the payload on the way out: runtimes take a datagram in one piece
+    Payload packet = Payload::allocate(data_message_size(dataMessage));
+    serialize_data_message(dataMessage, packet.mutable_data());
+    return packet;
+}
+
+void deserialize_data_message(unsigned char * buf, size_t size, DataMessage &dataMessage, const Payload *owner){
+    dataMessage.type = unpacku32(&buf[0]);
+    dataMessage.sender = unpacku32(&buf[4]);
+    dataMessage.msg_id = unpacku32(&buf[8]);
+    dataMessage.member = unpacku32(&buf[12]);
+    dataMessage.kind = unpacku32(&buf[16]);
+    dataMessage.view_epoch = unpacku32(&buf[20]);
+    memset(dataMessage.member_name, 0, MAX_MEMBER_NAME);
+    size_t header = MAX_STRUCT_SIZE;
+    if (dataMessage.kind == JOIN_MSG){
+        memcpy(dataMessage.member_name, &buf[MAX_STRUCT_SIZE], MAX_MEMBER_NAME);
+        dataMessage.member_name[MAX_MEMBER_NAME - 1] = '\0';
+        header = MAX_DATA_SIZE;
+    }
+    dataMessage.payload = Payload();
+    if (size <= header) return;
+    // a big payload stays where it was received (the receiver takes another buffer), a small one gets its own
+    // small buffer rather than pinning a whole datagram's worth
+    if (owner != nullptr && size - header >= PAYLOAD_ADOPT && owner->data() == buf)
+        dataMessage.payload = owner->slice(header, size - header);
+    else dataMessage.payload = Payload::copy_of(&buf[header], size - header);
+}
+
+void serialize_ack_message(const AckMessage &ackMessage, unsigned char * buf){
+    packi32(&buf[0], ackMessage.type);
+    packi32(&buf[4], ackMessage.sender);
+    packi32(&buf[8], ackMessage.msg_id);
     packi32(&buf[12], ackMessage.proposed_seq);
     packi32(&buf[16], ackMessage.proposer);
+    packi32(&buf[20], ackMessage.credit);
 }
 
 void deserialize_ack_message(unsigned char * buf, AckMessage &ackMessage){
@@ -629,6 +2396,7 @@ void deserialize_ack_message(unsigned char * buf, AckMessage &ackMessage){
     ackMessage.msg_id = unpacku32(&buf[8]);
     ackMessage.proposed_seq = unpacku32(&buf[12]);
     ackMessage.proposer = unpacku32(&buf[16]);
+    ackMessage.credit = unpacku32(&buf[20]);
 }
 
 void serialize_seq_message(const SeqMessage &seqMessage, unsigned char * buf){
@@ -647,17 +2415,175 @@ void deserialize_seq_message(unsigned char * buf, SeqMessage &seqMessage){
     seqMessage.final_seq_proposer = unpacku32(&buf[16]);
 }
 
-int extract_int_from_string(std::string str){
-    // For atoi, the input string has to start with a digit, so lets search for the first digit
-    size_t i = 0;
-    for ( ; i < str.length(); i++ ){ if ( isdigit(str[i]) ) break; }
+void serialize_heartbeat_message(const HeartbeatMessage &heartbeatMessage, unsigned char * buf){
+    packi32(&buf[0], heartbeatMessage.type);
+    packi32(&buf[4], heartbeatMessage.sender);
+    packi32(&buf[8], heartbeatMessage.view_id);
+    packi32(&buf[12], heartbeatMessage.trail);
+    packi32(&buf[16], heartbeatMessage.lead);
+    packi32(&buf[20], heartbeatMessage.credit);
+}
+
+void deserialize_heartbeat_message(unsigned char * buf, HeartbeatMessage &heartbeatMessage){
+    heartbeatMessage.type = unpacku32(&buf[0]);
+    heartbeatMessage.sender = unpacku32(&buf[4]);
+    heartbeatMessage.view_id = unpacku32(&buf[8]);
+    heartbeatMessage.trail = unpacku32(&buf[12]);
+    heartbeatMessage.lead = unpacku32(&buf[16]);
+    heartbeatMessage.credit = unpacku32(&buf[20]);
+}
+
+void serialize_flush_message(const FlushMessage &flushMessage, unsigned char * buf){
+    packi32(&buf[0], flushMessage.type);
+    packi32(&buf[4], flushMessage.from);
+    packi32(&buf[8], flushMessage.failed);
+    packi32(&buf[12], flushMessage.msg_id);
+    packi32(&buf[16], flushMessage.final_seq);
+    packi32(&buf[20], flushMessage.final_seq_proposer);
+}
+
+void deserialize_flush_message(unsigned char * buf, FlushMessage &flushMessage){
+    flushMessage.type = unpacku32(&buf[0]);
+    flushMessage.from = unpacku32(&buf[4]);
+    flushMessage.failed = unpacku32(&buf[8]);
+    flushMessage.msg_id = unpacku32(&buf[12]);
+    flushMessage.final_seq = unpacku32(&buf[16]);
+    flushMessage.final_seq_proposer = unpacku32(&buf[20]);
+}
+
+void serialize_flush_done_message(const FlushDoneMessage &flushDoneMessage, unsigned char * buf){
+    packi32(&buf[0], flushDoneMessage.type);
+    packi32(&buf[4], flushDoneMessage.from);
+    packi32(&buf[8], flushDoneMessage.failed);
+    packi32(&buf[12], flushDoneMessage.count);
+    packi32(&buf[16], flushDoneMessage.view_id);
+}
+
+void deserialize_flush_done_message(unsigned char * buf, FlushDoneMessage &flushDoneMessage){
+    flushDoneMessage.type = unpacku32(&buf[0]);
+    flushDoneMessage.from = unpacku32(&buf[4]);
+    flushDoneMessage.failed = unpacku32(&buf[8]);
+    flushDoneMessage.count = unpacku32(&buf[12]);
+    flushDoneMessage.view_id = unpacku32(&buf[16]);
+}
+
+void serialize_joined_message(const JoinedMessage &joinedMessage, unsigned char * buf){
+    packi32(&buf[0], joinedMessage.type);
+    packi32(&buf[4], joinedMessage.from);
+    packi32(&buf[8], joinedMessage.joiner);
+    packi32(&buf[12], joinedMessage.next_msg_id);
+    packi32(&buf[16], joinedMessage.view_epoch);
+}
+
+void deserialize_joined_message(unsigned char * buf, JoinedMessage &joinedMessage){
+    joinedMessage.type = unpacku32(&buf[0]);
+    joinedMessage.from = unpacku32(&buf[4]);
+    joinedMessage.joiner = unpacku32(&buf[8]);
+    joinedMessage.next_msg_id = unpacku32(&buf[12]);
+    joinedMessage.view_epoch = unpacku32(&buf[16]);
+}
+
+void serialize_joined_ack_message(const JoinedAckMessage &joinedAckMessage, unsigned char * buf){
+    packi32(&buf[0], joinedAckMessage.type);
+    packi32(&buf[4], joinedAckMessage.from);
+    packi32(&buf[8], joinedAckMessage.joiner);
+}
+
+void deserialize_joined_ack_message(unsigned char * buf, JoinedAckMessage &joinedAckMessage){
+    joinedAckMessage.type = unpacku32(&buf[0]);
+    joinedAckMessage.from = unpacku32(&buf[4]);
+    joinedAckMessage.joiner = unpacku32(&buf[8]);
+}
 
-    // remove the first chars, which aren't digits
-    str = str.substr(i, str.length() - i );
+size_t agg_ack_message_size(const AggAckMessage &aggAckMessage){
+    return AGGACK_HEADER_SIZE + 4 * aggAckMessage.acked.size();
+}
+
+void serialize_agg_ack_message(const AggAckMessage &aggAckMessage, unsigned char * buf){
+    packi32(&buf[0], aggAckMessage.type);
+    packi32(&buf[4], aggAckMessage.sender);
+    packi32(&buf[8], aggAckMessage.msg_id);
+    packi32(&buf[12], aggAckMessage.proposed_seq);
+    packi32(&buf[16], aggAckMessage.proposer);
+    packi32(&buf[20], aggAckMessage.from);
+    packi32(&buf[24], aggAckMessage.acked.size());
+    for (size_t i = 0; i < aggAckMessage.acked.size(); i++) packi32(&buf[AGGACK_HEADER_SIZE + 4 * i], aggAckMessage.acked[i]);
+}
+
+bool deserialize_agg_ack_message(unsigned char * buf, size_t size, AggAckMessage &aggAckMessage){
+    if (size < AGGACK_HEADER_SIZE) return false;
+    aggAckMessage.type = unpacku32(&buf[0]);
+    aggAckMessage.sender = unpacku32(&buf[4]);
+    aggAckMessage.msg_id = unpacku32(&buf[8]);
+    aggAckMessage.proposed_seq = unpacku32(&buf[12]);
+    aggAckMessage.proposer = unpacku32(&buf[16]);
+    aggAckMessage.from = unpacku32(&buf[20]);
+    uint32_t count = unpacku32(&buf[24]);
+    if (count > MAX_GROUP_SIZE || size < AGGACK_HEADER_SIZE + 4 * (size_t) count) return false;
+    aggAckMessage.acked.resize(count);
+    for (uint32_t i = 0; i < count; i++) aggAckMessage.acked[i] = unpacku32(&buf[AGGACK_HEADER_SIZE + 4 * i]);
+    return true;
+}
+
+size_t nak_message_size(const NakMessage &nakMessage){
+    return NAK_HEADER_SIZE + 8 * nakMessage.ranges.size();
+}
+
+void serialize_nak_message(const NakMessage &nakMessage, unsigned char * buf){
+    packi32(&buf[0], nakMessage.type);
+    packi32(&buf[4], nakMessage.from);
+    packi32(&buf[8], nakMessage.sender);
+    packi32(&buf[12], nakMessage.what);
+    packi32(&buf[16], nakMessage.ranges.size());
+    for (size_t i = 0; i < nakMessage.ranges.size(); i++){
+        packi32(&buf[NAK_HEADER_SIZE + 8 * i], nakMessage.ranges[i].lo);
+        packi32(&buf[NAK_HEADER_SIZE + 8 * i + 4], nakMessage.ranges[i].hi);
+    }
+}
+
+void deserialize_nak_message(unsigned char * buf, NakMessage &nakMessage){
+    nakMessage.type = unpacku32(&buf[0]);
+    nakMessage.from = unpacku32(&buf[4]);
+    nakMessage.sender = unpacku32(&buf[8]);
+    nakMessage.what = unpacku32(&buf[12]);
+    uint32_t count = std::min((uint32_t) unpacku32(&buf[16]), (uint32_t) NAK_MAX_RANGES);
+    nakMessage.ranges.resize(count);
+    for (uint32_t i = 0; i < count; i++){
+        nakMessage.ranges[i].lo = unpacku32(&buf[NAK_HEADER_SIZE + 8 * i]);
+        nakMessage.ranges[i].hi = unpacku32(&buf[NAK_HEADER_SIZE + 8 * i + 4]);
+    }
+}
+
+void serialize_relay_record(const QueuedMessage &qm, const std::string &memberName, unsigned char * buf){
+    // a delivered msg as the sponsor relays it: its final seq plus the joining host's name for a JOIN, then its
+    // payload (buf holds RELAYREC_SIZE + the payload)
+    packi32(&buf[0], RELAYREC_TYPE);
+    packi32(&buf[4], qm.sender);
+    packi32(&buf[8], qm.msg_id);
+    packi32(&buf[12], qm.member);
+    packi32(&buf[16], qm.kind);
+    packi32(&buf[20], qm.view_epoch);
+    packi32(&buf[24], qm.sequence_number);
+    packi32(&buf[28], qm.proposer);
+    packi32(&buf[32], qm.payload.size());
+    memset(&buf[36], 0, MAX_MEMBER_NAME);
+    memcpy(&buf[36], memberName.c_str(), std::min(memberName.size(), (size_t) MAX_MEMBER_NAME - 1));
+    if (!qm.payload.empty()) memcpy(&buf[RELAYREC_SIZE], qm.payload.data(), qm.payload.size());
+}
 
-    // convert the remaining text to an integer
-    int id = atoi(str.c_str());
-    return id;
+void deserialize_relay_record(unsigned char * buf, QueuedMessage &qm, std::string &memberName){
+    qm.sender = unpacku32(&buf[4]);
+    qm.msg_id = unpacku32(&buf[8]);
+    qm.member = unpacku32(&buf[12]);
+    qm.kind = unpacku32(&buf[16]);
+    qm.view_epoch = unpacku32(&buf[20]);
+    qm.sequence_number = unpacku32(&buf[24]);
+    qm.proposer = unpacku32(&buf[28]);
+    qm.status = DELIVERABLE;
+    qm.final_ns = 0;
+    qm.queued_ns = 0;
+    buf[36 + MAX_MEMBER_NAME - 1] = '\0';
+    memberName = std::string(reinterpret_cast<char *>(&buf[36]));
 }
 
 int ReliableMulticast::get_delay() const {
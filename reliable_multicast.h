@@ -15,24 +15,53 @@
 #include <functional>
 #include <thread>
 #include <mutex>  // std::mutex
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <set>
 #include <map>
 #include <chrono>  // for sleep
 #include <algorithm>
+#include <memory>
 
 #include "networkagent.h"
 #include "waittosync.h"
+#include "membership.h"
+#include "ack_table.h"
+#include "failure_detector.h"
+#include "nak_stream.h"
+#include "fec.h"
+#include "fragmentation.h"
+#include "runtime.h"
+#include "shm_transport.h"
+#include "metrics.h"
+#include "trace.h"
+#include "logger.h"
+#include "completion.h"
+#include "flow_control.h"
+#include "payload.h"
 #include "CL_global_snapshot.h"
 
 // low-level params
 #define SERVER_PORT         4646
-#define MAX_MSG_SIZE        256
-#define MAX_NUM_HOSTS       16  // max 16 hosts
+#define MAX_MSG_SIZE        2048    // fits an AggAckMessage covering MAX_GROUP_SIZE hosts
 #define MAX_HOST_NAME       256
+#define MCAST_PORT          4647    // udp port of the ip multicast group (-m)
+#define JOIN_PORT           9346    // tcp port members listen on for joining hosts (and their state transfer)
+#define MAX_MEMBER_NAME     64      // longest host name that can join (it travels inside the JOIN)
+#define MAX_DATA_SIZE       (MAX_STRUCT_SIZE + MAX_MEMBER_NAME)  // the header of a DataMessage carrying a JOIN
+#define MAX_DATAGRAM        65507   // largest udp payload (ipv4)
+#define MAX_PAYLOAD         (PAYLOAD_MAX_BUFFER - MAX_DATA_SIZE)  // a whole DATA fits a pooled buffer (sent in fragments)
+#define PAYLOAD_ADOPT       16384   // a received payload this big keeps the receive buffer. smaller ones are copied out
 
 // tunable parameters
 #define RECV_CAP            10000   // maximum number of messages a process can receive
 #define TIMEOUT             5000    // in miliseconds
 #define WATCHDOG_RESEND_CAP 500     // number of times for a watchdog
+#define LEAVE_LINGER        (2*TIMEOUT)  // in miliseconds. a leaving host keeps answering this long after its LEAVE
+#define THROUGHPUT_SAMPLE   500     // in miliseconds. sampling period of the send/delivery rates around joins and leaves
+#define MEMBERSHIP_REPORT   10      // number of samples reported after a join or leave
+#define TREE_ACK_WAIT       (TIMEOUT/2)  // in miliseconds. an interior node passes up the acks it has after this long
 
 // do not modify below def
 #define UNDELIVERABLE       0
@@ -40,13 +69,39 @@
 #define DATAMSG_TYPE        1
 #define ACKMSG_TYPE         2
 #define SEQMSG_TYPE         3
+#define HBTMSG_TYPE         4
+#define FLUSHMSG_TYPE       5
+#define FLUSHDONEMSG_TYPE   6
+#define JOINEDMSG_TYPE      7
+#define JOINEDACKMSG_TYPE   8
+// records on the state transfer stream (tcp, sponsor --> joining host)
+#define VIEWREC_TYPE        9
+#define RELAYREC_TYPE       10
+#define SYNCDONEREC_TYPE    11
+#define AGGACKMSG_TYPE      12  // acks of a whole subtree (tree dissemination, -k)
+#define AGGACK_HEADER_SIZE  28  // + 4 per acked host
+#define NAKMSG_TYPE         13  // a receiver asks a sender for DATA or SEQs it's missing (-N)
+#define NAK_HEADER_SIZE     20  // + 8 per range
+// 14 is FECMSG_TYPE (fec.h): a DATA or SEQ (or parity) inside an fec frame (-F)
+// 15 and 16 are FRAGMSG_TYPE and FRAGNAKMSG_TYPE (fragmentation.h): a piece of a big DATA and the NAK for lost pieces
+#define VIEWREC_SIZE        24  // + MEMBERREC_SIZE per member
+#define MEMBERREC_SIZE      (4 + MAX_MEMBER_NAME)
+#define RELAYREC_SIZE       (36 + MAX_MEMBER_NAME)  // + the payload
+// DataMessage kinds: membership changes go through the same total order as everything else
+#define APP_MSG             0
+#define JOIN_MSG            1
+#define LEAVE_MSG           2
 
 
 typedef struct {
     uint32_t type;      // must be 1
     uint32_t sender;    // sender's id
     uint32_t msg_id;    // the id of message generated by sender
-    uint32_t data;      // a dummy integer
+    uint32_t member;    // the id of the joining/leaving host for membership msgs (0 otherwise)
+    uint32_t kind;      // APP_MSG, JOIN_MSG or LEAVE_MSG
+    uint32_t view_epoch;    // number of joins the sender had delivered (decides who is in the msg's quorum)
+    char member_name[MAX_MEMBER_NAME];  // JOIN_MSG only: the joining host's name (not sent otherwise)
+    Payload payload;    // the application's bytes, after the header (their size is what's left of the datagram)
 } DataMessage;
 
 
@@ -56,9 +111,21 @@ typedef struct {
     uint32_t msg_id;        // the id of Datamessage generated by sender
     uint32_t proposed_seq;  // proposed sequence number
     uint32_t proposer;      // process id of proposer
+    uint32_t credit;        // how many outstanding msgs the proposer lets each sender have (flow control)
 } AckMessage;
 
 
+typedef struct {
+    uint32_t type;          // must be 12
+    uint32_t sender;        // sender of DataMessage (the root of the tree)
+    uint32_t msg_id;        // the id of Datamessage generated by sender
+    uint32_t proposed_seq;  // largest proposal in the subtree
+    uint32_t proposer;      // process id of its proposer (the larger id wins ties)
+    uint32_t from;          // process id of the host passing the acks up
+    std::vector<uint32_t> acked;    // process ids of the hosts these acks are from
+} AggAckMessage;
+
+
 typedef struct {
     uint32_t type;                  // must be 3
     uint32_t sender;                // sender of DataMessage
@@ -68,6 +135,108 @@ typedef struct {
 } SeqMessage;
 
 
+typedef struct {
+    uint32_t type;          // must be 4
+    uint32_t sender;        // process id of the host that is alive
+    uint32_t view_id;       // number of view changes the sender has installed
+    uint32_t trail;         // the sender's oldest msg_id that isn't final yet (its next msg_id if there's none)
+    uint32_t lead;          // the sender's next msg_id (a receiver missing the tail of a burst sees it here)
+    uint32_t credit;        // as on its acks
+} HeartbeatMessage;
+
+
+typedef struct {
+    uint32_t type;          // must be 13
+    uint32_t from;          // process id of the receiver asking
+    uint32_t sender;        // process id of the sender of the msgs
+    uint32_t what;          // NAK_DATA or NAK_SEQ
+    std::vector<NakRange> ranges;   // msg_ids missing
+} NakMessage;
+
+
+typedef struct {
+    uint32_t type;                  // must be 5
+    uint32_t from;                  // process id of the survivor forwarding this seq
+    uint32_t failed;                // process id of the failed host (sender of the DataMessage)
+    uint32_t msg_id;                // the id of Datamessage generated by the failed host
+    uint32_t final_seq;             // final sequence the failed host sent out for it
+    uint32_t final_seq_proposer;    // process id of proposer who poposed the final seq
+} FlushMessage;
+
+
+typedef struct {
+    uint32_t type;          // must be 6
+    uint32_t from;          // process id of the survivor
+    uint32_t failed;        // process id of the failed host
+    uint32_t count;         // number of FlushMessages the survivor has for the failed host
+    uint32_t view_id;       // view the survivor is leaving (for the logs)
+} FlushDoneMessage;
+
+
+typedef struct {
+    uint32_t type;          // must be 7
+    uint32_t from;          // process id of the member that delivered the JOIN
+    uint32_t joiner;        // process id of the joining host
+    uint32_t next_msg_id;   // the member's msgs below this id were sent before the JOIN (the joiner never saw them)
+    uint32_t view_epoch;    // the joiner's first view_epoch (for the logs)
+} JoinedMessage;
+
+
+typedef struct {
+    uint32_t type;          // must be 8
+    uint32_t from;          // process id of the sponsor
+    uint32_t joiner;        // process id of the joining host
+} JoinedAckMessage;
+
+
+typedef struct {
+    /* we are an interior node of the tree for someone else's msg: we forwarded the DATA to our children and collect
+     * their (subtree) acks along with ours. They go up to our parent in one AggAckMessage once every child reported,
+     * or after TREE_ACK_WAIT with whatever we have (the root resends directly to the hosts it's still missing).
+     * The SEQ is forwarded to the same children, then the record goes. */
+    uint32_t parent;                    // process id we pass the acks up to
+    std::vector<uint32_t> children;     // process ids we forwarded the DATA to
+    std::set<uint32_t> waiting;         // children that haven't reported yet
+    std::vector<uint32_t> acked;        // process ids covered so far (us included)
+    uint32_t max_seq;
+    uint32_t max_proposer;
+    bool passed_up;
+} TreeRelay;
+
+
+typedef struct {
+    /* the flush for one failed host. every survivor forwards the final seqs it got from the failed host to
+     * every other survivor, then says how many it forwarded. Once we have all of them from everybody, every survivor
+     * has the same set of final seqs for the failed host: those msgs get delivered and the rest is dropped. */
+    uint32_t failed;
+    std::vector<SeqMessage> ownFlush;                   // the final seqs we forward
+    std::map<uint32_t, uint32_t> flushDone;             // survivor id --> number of seqs it forwards
+    std::map<uint32_t, std::vector<uint32_t>> flushed;  // survivor id --> msg_ids we got from it
+    HostSet survivors;  // the view right after the removal. hosts that join later have nothing to flush
+    bool installed;
+} ViewChange;
+
+
+typedef struct {
+    /* state transfer to a joining host we sponsor. The joiner is in the quorum of every msg sent by a member after
+     * that member delivered the JOIN (view_epoch >= epoch) and gets those directly. The older msgs that are delivered
+     * after the JOIN are relayed to it by us. Once every old member has told us where its old msgs stop (JoinedMessage)
+     * and we delivered all of them, the joiner has everything ordered after the JOIN and can start delivering. */
+    uint32_t joiner;
+    int sock;                                       // tcp stream to the joiner
+    bool delivered;                                 // we delivered the JOIN (relaying starts)
+    bool done;                                      // SYNCDONE is queued
+    uint32_t epoch;                                 // the joiner's first view_epoch
+    HostSet oldMembers;                             // our view when we delivered the JOIN (without the joiner)
+    std::map<uint32_t, uint32_t> firstNewMsgId;     // old member id --> next_msg_id from its JoinedMessage
+    std::map<uint32_t, uint32_t> missing;           // old member id --> its old msgs we haven't delivered yet
+    std::deque<ByteVector> outbox;                  // records waiting to be written to the joiner
+    uint32_t relayed;
+    uint64_t requested_at_ns;
+    uint64_t ordered_at_ns;
+} Sponsorship;
+
+
 //typedef struct {
 //    uint32_t        sequence_number;
 //    unsigned char   status;     // 0 means undeliverable while 1 means deliverable
@@ -80,36 +249,91 @@ typedef struct {
 
 void packi32(unsigned char *buf, unsigned long int i);
 unsigned long int unpacku32(unsigned char *buf);
+size_t data_message_size(const DataMessage &dataMessage);
 void serialize_data_message(const DataMessage &dataMessage, unsigned char * buf);
-void deserialize_data_message(unsigned char * buf, DataMessage &dataMessage);
+Payload serialized_data_message(const DataMessage &dataMessage);  // in a pooled buffer
+// owner: the buffer holding buf, so a big payload can stay there instead of being copied out
+void deserialize_data_message(unsigned char * buf, size_t size, DataMessage &dataMessage, const Payload *owner = nullptr);
 void serialize_ack_message(const AckMessage &ackMessage, unsigned char * buf);
 void deserialize_ack_message(unsigned char * buf, AckMessage &ackMessage);
 void serialize_seq_message(const SeqMessage &seqMessage, unsigned char * buf);
 void deserialize_seq_message(unsigned char * buf, SeqMessage &seqMessage);
-int extract_int_from_string(std::string str);
-
-
-auto cmp = [](QueuedMessage left, QueuedMessage right){
+void serialize_heartbeat_message(const HeartbeatMessage &heartbeatMessage, unsigned char * buf);
+void deserialize_heartbeat_message(unsigned char * buf, HeartbeatMessage &heartbeatMessage);
+void serialize_flush_message(const FlushMessage &flushMessage, unsigned char * buf);
+void deserialize_flush_message(unsigned char * buf, FlushMessage &flushMessage);
+void serialize_flush_done_message(const FlushDoneMessage &flushDoneMessage, unsigned char * buf);
+void deserialize_flush_done_message(unsigned char * buf, FlushDoneMessage &flushDoneMessage);
+void serialize_joined_message(const JoinedMessage &joinedMessage, unsigned char * buf);
+void deserialize_joined_message(unsigned char * buf, JoinedMessage &joinedMessage);
+void serialize_joined_ack_message(const JoinedAckMessage &joinedAckMessage, unsigned char * buf);
+void deserialize_joined_ack_message(unsigned char * buf, JoinedAckMessage &joinedAckMessage);
+size_t agg_ack_message_size(const AggAckMessage &aggAckMessage);
+void serialize_agg_ack_message(const AggAckMessage &aggAckMessage, unsigned char * buf);
+bool deserialize_agg_ack_message(unsigned char * buf, size_t size, AggAckMessage &aggAckMessage);  // false if it's cut short
+size_t nak_message_size(const NakMessage &nakMessage);
+void serialize_nak_message(const NakMessage &nakMessage, unsigned char * buf);
+void deserialize_nak_message(unsigned char * buf, NakMessage &nakMessage);
+void serialize_relay_record(const QueuedMessage &qm, const std::string &memberName, unsigned char * buf);
+void deserialize_relay_record(unsigned char * buf, QueuedMessage &qm, std::string &memberName);
+
+
+static auto cmp = [](QueuedMessage left, QueuedMessage right){
     return left.sequence_number == right.sequence_number ?
            left.proposer > right.proposer : left.sequence_number > right.sequence_number;
 };
 
 
-typedef std::map<int, int> ProposerSeq;
-
-
 class ReliableMulticast{
 public:
     ReliableMulticast(const char *hostfile,
                       const client_server::UDP_Server& communicator,
-                      double drop_rate = 0.0, int delay_in_ms=0);
+                      const LinkProfile &link = LinkProfile{}, int failure_timeout_ms=FAILURE_TIMEOUT,  // link: emulated on every send
+                      const char *joinSeed=nullptr, const char *joinName=nullptr,  // joinSeed: join through that member instead of the Hostfile
+                      int tree_fanout=0,  // 0: the sender unicasts to everybody. k: k-ary tree (same k everywhere)
+                      bool nak_mode=false,  // receivers NAK what they miss instead of per-msg watchdogs (same everywhere)
+                      int fec_n=0, int fec_k=0,  // k parity packets per n DATA/SEQ (0: no fec)
+                      uint32_t link_seed=0, const char *linkFile=nullptr,  // linkFile: per-link profiles
+                      const char *shmGroup=nullptr);  // everybody is on this box: talk through shared memory, not udp
+    // a node of the simulator (or any other runtime): the group is hostNames, we are ourName. no joins or snapshots
+    ReliableMulticast(Runtime &runtime, const std::vector<std::string> &hostNames, const char *ourName,
+                      int failure_timeout_ms=FAILURE_TIMEOUT, int tree_fanout=0, bool nak_mode=false,
+                      int fec_n=0, int fec_k=0);
     ~ReliableMulticast();
 
     // thread function
     void handle_datamsg(const DataMessage &dataMessage);
     void handle_ackmsg(const AckMessage &ackMessage);
     void handle_seqmsg(const SeqMessage &seqMessage);
-    void multicast_datamsg(uint32_t data);
+    void handle_heartbeatmsg(const HeartbeatMessage &heartbeatMessage);
+    void handle_flushmsg(const FlushMessage &flushMessage);
+    void handle_flushdonemsg(const FlushDoneMessage &flushDoneMessage);
+    void handle_joinedmsg(const JoinedMessage &joinedMessage);
+    void handle_joinedackmsg(const JoinedAckMessage &joinedAckMessage);
+    void handle_aggackmsg(const AggAckMessage &aggAckMessage);
+    void handle_nakmsg(const NakMessage &nakMessage);
+    // payloads of up to MAX_PAYLOAD bytes. they're kept (not copied) for retransmission: don't change them after this
+    void multicast_datamsg(const Payload &payload);  // waits while our flow control window is full
+    void multicast_datamsg(uint32_t data){  // a 4 byte payload
+        multicast_datamsg(Payload::from_u32(data));
+    };
+    // the same, but the handle completes (and fn is called) with the final seq once the msg is delivered here.
+    // an invalid handle if too many are outstanding (the msg is still sent)
+    MulticastHandle multicast_async(const Payload &payload, CompletionFn fn = nullptr, void *arg = nullptr);
+    // never wait: false (nothing is sent) if the window is full. the credit callback says when to try again
+    bool try_multicast(const Payload &payload);
+    bool try_multicast_async(const Payload &payload, MulticastHandle &handle, CompletionFn fn = nullptr, void *arg = nullptr);
+    // called once the window opens after a try was refused. like the delivery callback: no locks held, keep it short
+    void set_credit_callback(std::function<void()> callback){
+        creditCallback = std::move(callback);
+    };
+    void set_flow_window(uint32_t limit){  // most msgs outstanding at once (FLOW_WINDOW). 0: no flow control
+        flow.set_limit(limit);
+    };
+    int completion_fd(){  // readable when some async multicast completed. -1 if no eventfd
+        return completions.event_fd();
+    };
+    void leave();  // leave the group once our msgs are finalized. returns after LEAVE_LINGER
     void static start_msg_receiver(ReliableMulticast* rm);  // for use in a thread
     void initiate_snapshot();
 
@@ -118,54 +342,119 @@ public:
     int get_num_hosts() const {
         return num_hosts;
     };
+    uint64_t get_delivered_count() const {
+        return deliveredCount;
+    };
+    std::vector<QueuedMessage> get_delivered_messages();  // in delivery order
+    std::vector<uint64_t> get_delivery_times();  // runtime->now_ns() at each of those deliveries
+    void set_max_recv(int n){  // before the receiver starts. benchmarks need more than RECV_CAP
+        max_recv = n;
+    };
+    // the stats endpoint (a unix socket, -M) and/or a file rewritten every METRICS_DUMP_PERIOD ms (-W)
+    void serve_metrics(const char *socketPath, const char *dumpFile);
+    std::string metrics_text(){
+        return metrics.render(hosts);
+    };
+    // record the lifecycle of every msg into fileName (-Z), drained every TRACE_FLUSH_PERIOD ms
+    void start_tracing(const char *fileName);
+    void flush_trace();
+    /* the application's side of delivery: every delivered msg (membership changes included, see kind) is handed to
+     * the callback once, in the total order, in batches. it runs on a protocol thread (mostly the receiver) with
+     * none of our locks held, one call at a time. it may multicast. a slow callback holds up the receiver: hand the
+     * msgs to another thread if there's real work to do (DeliveryRing does that). set it before the receiver starts */
+    using DeliveryCallback = std::function<void(const QueuedMessage *msgs, size_t n)>;
+    void set_delivery_callback(DeliveryCallback callback){
+        deliveryCallback = std::move(callback);
+    };
 private:
-    std::map<int,std::string> hostIDtoHostName;  // the other way can be obtained from extract_int_from_string
+    HostTable hosts;  // Hostfile order. maps host id <--> rank <--> host name
     /* private attributes */
-    int num_hosts = 0;          // read by threads?
+    std::atomic<int> num_hosts{0};  // size of the host table (grows with joins)
     const char * current_container_name = nullptr;
     int current_container_id;
-    int curr_msg_id = 0;
-    int curr_seq_number = 1;
-    char** hostNames;
-    client_server::UDP_Server communicator;
+    int current_rank;           // our position in the Hostfile
+    int curr_msg_id = 0;        // protected by viewMutex (msg ids are split at joins)
+    std::atomic<uint32_t> curr_seq_number{1};  // next seq we propose (receive, sender and join threads all bump it)
+    std::unique_ptr<UdpRuntime> udpRuntime;  // unless we were given a runtime
+    std::unique_ptr<ShmRuntime> shmRuntime;  // instead of udpRuntime once we know our name (shmGroup)
+    Runtime *runtime;  // sockets, clock, sleeping and threads
     std::vector<QueuedMessage> deliveryQueue;       // [SHARED BY THREADS]
     std::vector<QueuedMessage> deliveredMessage;  // this is to hold the final delivered msg
-    std::vector<AckMessage> alreadyAckedMessages;  // for resending acks
-    std::vector<SeqMessage> seqMessageHistory;      // [SHARED BY THREADS] keep track of all received/sent seq messages
-    std::map<int, ProposerSeq> ackHistory;  // ackHistory[msg_id] --> access
-    std::map<int, int> dataHistory;  // to store the data of sent items
+    std::vector<uint64_t> deliveredAt;  // when each of them was delivered (deliveredMessageMutex too)
+    AckLog ackLog;  // what we acked of the other senders' msgs (for resending acks) and which SEQs came
+    AckTable ackHistory;  // ackHistory.find(msg_id) --> acks received so far for our outstanding msg_id
+    SendRing<DataMessage> sendRing;  // our last NAK_RING_SIZE msgs, for retransmission
+    SendRing<SeqMessage> seqRing;  // and the final seqs of those that are final (sendRingMutex too)
     // std::vector<std::thread> watchdogThreads;  // to join them at the end
     int recv_cap = 1;
+    int max_recv = RECV_CAP;
+    uint64_t packet_rx_ns = 0;  // when the datagram the receiver is handling arrived (only the receiver thread)
     // for help with testing variables
-    double drop_rate;
     int delay_in_ms;
     std::mutex ackHistoryMutex;  // protect ackHistory: sending thread create new entry and rcving threads modifying curr
-    std::mutex dataHistoryMutex;  // protect dataHistory
+    std::mutex sendRingMutex;  // protect sendRing and seqRing
     std::mutex deliveryQueueMutex;
-    std::mutex seqMessageHistoryMutex;
     std::mutex deliveredMessageMutex;
+    std::mutex deliveryMutex;  // one delivery pass at a time so membership changes take effect in delivery order
+    DeliveryCallback deliveryCallback;
+    std::vector<QueuedMessage> handoff;  // delivered but not given to the callback yet (handoffMutex)
+    std::vector<QueuedMessage> dispatched;  // what the callback is being given (only the dispatching thread)
+    bool dispatching = false;  // a thread is calling the callback (handoffMutex)
+    std::mutex handoffMutex;  // taken last, after any other
+    // async multicasts
+    struct Completed{
+        uint32_t slot;
+        uint32_t final_seq;
+        uint32_t proposer;
+    };
+    CompletionPool completions;
+    std::deque<uint32_t> completionOf;  // the completion of our msg completionBase + i, or NO_COMPLETION (completionMutex)
+    uint32_t completionBase = 0;
+    std::mutex completionMutex;  // taken last, after any other
+    std::vector<Completed> completedHandoff;  // delivered, to be completed (handoffMutex)
+    std::vector<Completed> completedDispatched;  // being completed (only the dispatching thread)
+    // flow control: receivers advertise credits, we keep our outstanding msgs within the window they allow
+    CreditWindow flow;
+    uint32_t creditsReserved = 0;  // senders that got room but haven't put their msg in ackHistory yet (ackHistoryMutex)
+    std::atomic<bool> creditWanted{false};  // a try was refused: call creditCallback once there's room
+    std::function<void()> creditCallback;
+    std::atomic<size_t> queueDepth{0};  // size of the delivery queue, for the credit we advertise
+    bool reserve_credit(bool notify = false);  // room for one more msg? then it's ours
+    void wait_for_credit();
+    void notify_credit();  // call with no locks held
+    uint32_t advertised_credit(int members);
 
     // function
+    void use_shm(const char *ourName, const char *shmGroup);  // the shared memory runtime instead of udp
+    void start_group(const std::vector<std::string> &hostNames, const char *ourName);  // everybody is in the view
+    void start_threads(bool listeners);
     void datamsg_watchdog(const DataMessage &dataMessage, const char * hostName);  // keep resending datamsg until we have received an ack
+    void group_datamsg_watchdog(const DataMessage &dataMessage);  // the same for all hosts at once (tree or ip multicast)
     void ackmsg_watchdog(const AckMessage &ackMessage, const char * hostName);
     [[noreturn]] void msg_receiver();
-    void broadcast_seq_msg(const SeqMessage &seqMessage);  // simply send seqMessage to everybody
-    static std::pair<uint32_t, uint32_t> get_max_sequence_from_proposerseq_map(const ProposerSeq &pm);
+    bool handle_packet(unsigned char *msg_buf, size_t numbytes, const Payload *owner = nullptr);  // owner: holds msg_buf
+    bool handle_fragment(const unsigned char *frag, size_t size);
+    void handle_fragnakmsg(const FragNakMessage &fragNakMessage);
+    void broadcast_seq_msg(const SeqMessage &seqMessage, const HostSet &quorum);  // simply send seqMessage to everybody (that got the msg)
     static AckMessage make_ack_msg(uint32_t sender, uint32_t msg_id, uint32_t proposed_seq, uint32_t proposer);
     static SeqMessage make_seq_msg(uint32_t sender, uint32_t msg_id, uint32_t final_seq, uint32_t final_seq_proposer);
     static QueuedMessage make_queued_msg(uint32_t sequence_number, unsigned char status, uint32_t sender,
-                                         uint32_t msg_id, uint32_t data, uint32_t proposer);
+                                         uint32_t msg_id, uint32_t member, uint32_t proposer,
+                                         uint32_t kind = APP_MSG, uint32_t view_epoch = 0,
+                                         const Payload &payload = Payload());
     int change_queued_msg_seq_and_status(uint32_t sender, uint32_t msg_id, uint32_t seq_to_change, uint32_t seq_proposer, unsigned char status);
     void push_msg_to_deliveryqueue(QueuedMessage qm);
     void deliver_msg_from_deliveryqueue();
+    void deliver_batches(std::vector<uint32_t> &leaving);
+    void dispatch_deliveries();  // hand what was delivered to the callback. call with no locks held
     void print_delivery_queue();
     void print_delivered_messages();
 
     void print_ack_history();
-    static double random_uniform_from_0_to_1();
-    int send_msg_with_drop_and_delay(const char *hostname, unsigned char (&serialized_packet)[MAX_STRUCT_SIZE]);  // this is to implement extra testing for sending
-    int reply_msg_with_drop_and_delay(unsigned char (&serialized_packet)[MAX_STRUCT_SIZE]);  // this is to implement extra testing for sending
-    void start_delay() const;
+    void record_outbound(const unsigned char *serialized_packet, size_t size);  // for global snapshot
+    int send_msg_with_drop_and_delay(const char *hostname, const unsigned char *serialized_packet, size_t size);  // this is to implement extra testing for sending
+    int reply_msg_with_drop_and_delay(const unsigned char *serialized_packet, size_t size);  // this is to implement extra testing for sending
+    int send_group_with_drop_and_delay(const unsigned char *serialized_packet, size_t size);  // one datagram to the ip multicast group
 
     // for global snapshot
     CL_Global_Snapshot snapshot;
@@ -173,7 +462,108 @@ private:
     LocalStateSnapshot get_local_state_snapshot();  // return deliveryQueue and deliveredMessage
     bool recordMessages;  // only the global snapshot daemon modify this
     std::mutex recordMessagesMutex;
+    uint64_t snapshotStarted_ns = 0;  // when recordMessages went on (recordMessagesMutex)
+
+    Metrics metrics;  // packets, retransmits, duplicates, queue depth, and how long things took
+    std::atomic<Tracer *> tracer{nullptr};  // unless tracing is on
+    void trace(uint32_t kind, uint32_t sender, uint32_t msg_id, uint32_t peer = 0, uint32_t seq = 0,
+               uint32_t proposer = 0){
+        Tracer *t = tracer.load(std::memory_order_acquire);
+        if (t != nullptr) t->record(runtime->now_ns(), kind, sender, msg_id, peer, seq, proposer);
+    };
 
+    // for failure detection and view changes
+    FailureDetector failureDetector;
+    int failure_timeout_ms;  // 0 turns off failure detection
+    HostSet view;  // ranks of the hosts we consider alive (we are always in it)
+    int view_id = 0;  // number of hosts removed so far
+    std::map<uint32_t, ViewChange> viewChanges;  // failed host id --> its flush
+    std::mutex viewMutex;  // protect view, view_id and viewChanges
+    [[noreturn]] void heartbeat_loop();
+    HostSet get_view();
+    bool is_member(uint32_t hostID);
+    void heard_from(uint32_t hostID);
+    void start_view_change(uint32_t failedID);
+    void send_flush(const ViewChange &vc, const char * hostName);
+    void try_install_view(uint32_t failedID);
+    void finalize_covered_msgs();
+    void finalize_msg(AckRecord * record);
+    void propose_above(uint32_t seq);
+    int apply_seq_msg(const SeqMessage &seqMessage);
+
+    // for joins and leaves
+    client_server::TCP_Server joinServer;  // joining hosts connect here (and we connect to a seed's from here)
+    int view_epoch = 0;  // number of joins delivered so far (the same at everybody: joins are totally ordered)
+    std::atomic<bool> synced{true};  // a joining host doesn't deliver until its state transfer is done
+    std::atomic<bool> left{false};  // we delivered our own LEAVE
+    std::map<uint32_t, Sponsorship> sponsorships;  // joiner id --> its state transfer (if we sponsor it)
+    std::map<uint32_t, std::string> joinNames;  // joiner id --> its host name (from the JOIN)
+    std::set<uint32_t> joinedAcked;  // joiners whose sponsor has our JoinedMessage
+    std::mutex joinMutex;  // protect the three above
+    std::condition_variable joinCv;  // a sponsorship's outbox got records
+    uint64_t join_started_at_ns = 0;
+    void multicast_msg(uint32_t kind, uint32_t member, const Payload &payload, const char * memberName,
+                       uint32_t completion = NO_COMPLETION, bool reserved = false);  // reserved: took a credit with reserve_credit()
+    void join_group(const char * seed, const char * name);
+    void state_transfer_receiver(int sock);
+    [[noreturn]] void join_listener();
+    void sponsor_join(int sock, std::string name);
+    void install_join(const QueuedMessage &joinMsg);
+    void start_state_transfer(uint32_t joinerID, uint32_t epoch, const HostSet &oldMembers, uint32_t nextMsgId,
+                              const QueuedMessage &joinMsg);
+    void record_deliveries(const std::vector<QueuedMessage> &batch);
+    void advance_state_transfers();
+    uint32_t count_delivered_below(uint32_t sender, uint32_t msg_id);
+    void joined_watchdog(const JoinedMessage &joinedMessage, const char * sponsorName);
+
+    // send/delivery rates around membership changes
+    std::atomic<uint64_t> sentCount{0};
+    std::atomic<uint64_t> deliveredCount{0};
+    std::atomic<int> membershipChanges{0};
+    [[noreturn]] void throughput_monitor();
+
+    // tree dissemination (-k): the sender only talks to its k children, interior nodes forward DATA/SEQ and merge acks
+    int tree_fanout;  // 0 turns it off
+    std::vector<uint32_t> memberSince;  // rank --> view_epoch its JOIN created (0 for the Hostfile). protected by viewMutex
+    std::map<std::pair<uint32_t, uint32_t>, TreeRelay> treeRelays;  // (sender, msg_id) --> what we relay for it
+    std::mutex treeMutex;  // protect treeRelays
+    HostSet tree_members(uint32_t sender, uint32_t epoch);  // who was in the quorum of a msg sent at epoch
+    bool start_tree_relay(const DataMessage &dataMessage, const AckMessage &ownAck);
+    void merge_subtree_acks(const AggAckMessage &aggAckMessage);
+    void pass_up(uint32_t sender, uint32_t msg_id);
+    void collect_acks(const AggAckMessage &aggAckMessage);
+    void forward_seq_msg(const SeqMessage &seqMessage);
+    void tree_relay_watchdog(uint32_t sender, uint32_t msg_id);
+    void send_agg_ack(const AggAckMessage &aggAckMessage, uint32_t toID);
+
+    // NAK mode (-N): receivers find gaps in each sender's msg_ids and NAK them, senders retransmit from sendRing.
+    // heartbeats carry the sender's trail and lead so a lost tail shows up too
+    bool nak_mode;
+    NakTracker nakTracker;
+    [[noreturn]] void nak_loop();
+    void send_naks(int what);
+    uint32_t oldest_outstanding();
+    bool own_final_seq(uint32_t msg_id, SeqMessage &seqMessage);
+    void wait_for_ring_slot();
+
+    // forward error correction (-F n,k) on the DATA and SEQ paths: k parity packets per block of n
+    int fec_n;  // 0 turns it off
+    int fec_k;
+    std::map<std::string, FecEncoder> fecEncoders;  // destination host name ("" for the ip multicast group) --> its blocks
+    uint32_t fecBlock = 0;  // our blocks are numbered across all destinations
+    std::mutex fecMutex;  // protect the two above
+    FecDecoder fecDecoder;  // only used by the receiving thread
+    int send_fec(const char *hostname, const unsigned char *serialized_packet, size_t size);
+    int send_frames(const char *hostname, const std::vector<ByteVector> &frames);
+    [[noreturn]] void fec_flush_loop();
+
+    // fragmentation: a DATA bigger than FRAG_MTU goes out in fragments. receivers put it together before they ack it,
+    // so it's ordered once, and NAK single fragments they miss (to whoever sent them: the sender or a tree relay)
+    Fragmenter fragmenter;  // the DATA datagrams we fragmented lately
+    Reassembler reassembler;
+    std::atomic<bool> fragLoopStarted{false};  // frag_loop only runs once we get a fragment
+    int send_data(const char *hostname, const Payload &packet);  // hostname nullptr: the ip multicast group
+    [[noreturn]] void frag_loop();
 };
 
 
@@ -0,0 +1,121 @@
+//
+// What the protocol needs from around it: datagrams, a clock, sleeping and threads.
+//
+
+#include <thread>
+
+#include "runtime.h"
+#include "clock.h"
+#include "membership.h"
+
+
+UdpRuntime::UdpRuntime(const client_server::UDP_Server &comm, const LinkProfile &link, uint32_t link_seed)
+        : communicator(comm), linkEmulator(communicator, link, link_seed){
+}
+
+
+int UdpRuntime::load_links(const char *fileName){
+    return linkEmulator.load_links(fileName);
+}
+
+
+int UdpRuntime::send_to(const char *hostname, const unsigned char *msg, size_t size){
+    return linkEmulator.send_to(hostname, msg, size);
+}
+
+
+int UdpRuntime::reply(const unsigned char *msg, size_t size){
+    return linkEmulator.reply(msg, size);
+}
+
+
+int UdpRuntime::send_to_group(const unsigned char *msg, size_t size){
+    return linkEmulator.send_to_group(msg, size);
+}
+
+
+bool UdpRuntime::in_group() const{
+    return communicator.in_group();
+}
+
+
+int UdpRuntime::recv(unsigned char *msg, size_t max_size){
+    return communicator.recv(reinterpret_cast<char *>(msg), max_size);
+}
+
+
+uint64_t UdpRuntime::rx_ns(){
+    return communicator.rx_ns();
+}
+
+
+uint64_t UdpRuntime::now_ns(){
+    return monotonic_now_ns();
+}
+
+
+void UdpRuntime::sleep_us(uint64_t us){
+    usleep(us);
+}
+
+
+void UdpRuntime::spawn(std::function<void()> fn){
+    std::thread t(std::move(fn));
+    t.detach();
+}
+
+
+LoopbackRuntime::LoopbackRuntime(const char *ourName, int base_port)
+        : basePort(base_port), communicator(base_port + extract_int_from_string(ourName)){
+}
+
+
+int LoopbackRuntime::send_to(const char *hostname, const unsigned char *msg, size_t size){
+    struct sockaddr_storage addr{};
+    auto *in = reinterpret_cast<struct sockaddr_in *>(&addr);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(basePort + extract_int_from_string(hostname));
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return communicator.send_to_addr(addr, reinterpret_cast<const char *>(msg), size);
+}
+
+
+int LoopbackRuntime::reply(const unsigned char *msg, size_t size){
+    return communicator.reply(reinterpret_cast<const char *>(msg), size);
+}
+
+
+int LoopbackRuntime::send_to_group(const unsigned char * /*msg*/, size_t /*size*/){
+    return -1;
+}
+
+
+bool LoopbackRuntime::in_group() const{
+    return false;
+}
+
+
+int LoopbackRuntime::recv(unsigned char *msg, size_t max_size){
+    return communicator.recv(reinterpret_cast<char *>(msg), max_size);
+}
+
+
+uint64_t LoopbackRuntime::rx_ns(){
+    return communicator.rx_ns();
+}
+
+
+uint64_t LoopbackRuntime::now_ns(){
+    return monotonic_now_ns();
+}
+
+
+void LoopbackRuntime::sleep_us(uint64_t us){
+    usleep(us);
+}
+
+
+void LoopbackRuntime::spawn(std::function<void()> fn){
+    std::thread t(std::move(fn));
+    t.detach();
+}
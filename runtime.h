@@ -0,0 +1,79 @@
+//
+// What the protocol needs from around it: datagrams, a clock, sleeping and threads.
+//
+
+#ifndef PRJ1_RUNTIME_H
+#define PRJ1_RUNTIME_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+#include "networkagent.h"
+#include "link_emulator.h"
+
+
+class Runtime{
+    /* ReliableMulticast only gets to the network, the clock and new threads through this. The same protocol code
+     * then runs on UDP sockets (UdpRuntime) or on the in-memory network of the simulator (simulator.h), where time
+     * is virtual. Sends return like the UDP_Server's: -1 on an error, -22 if the (emulated) network lost it. */
+public:
+    virtual ~Runtime() = default;
+    virtual int send_to(const char *hostname, const unsigned char *msg, size_t size) = 0;
+    virtual int reply(const unsigned char *msg, size_t size) = 0;  // to the sender of the datagram we got last
+    virtual int send_to_group(const unsigned char *msg, size_t size) = 0;  // the ip multicast group (-m)
+    virtual bool in_group() const = 0;
+    virtual int recv(unsigned char *msg, size_t max_size) = 0;  // blocks until a datagram comes. returns its size
+    virtual uint64_t rx_ns() = 0;  // now_ns() when that datagram got to us, before it waited to be read. 0: unknown
+    virtual uint64_t now_ns() = 0;  // monotonic
+    virtual void sleep_us(uint64_t us) = 0;
+    virtual void spawn(std::function<void()> fn) = 0;  // runs fn on a new (detached) thread
+};
+
+
+class UdpRuntime : public Runtime{
+    /* the real thing: our UDP_Server with every send going through the link emulator, the steady clock,
+     * usleep and std::thread */
+public:
+    UdpRuntime(const client_server::UDP_Server &comm, const LinkProfile &link, uint32_t link_seed);
+    int load_links(const char *fileName);
+    int send_to(const char *hostname, const unsigned char *msg, size_t size) override;
+    int reply(const unsigned char *msg, size_t size) override;
+    int send_to_group(const unsigned char *msg, size_t size) override;
+    bool in_group() const override;
+    int recv(unsigned char *msg, size_t max_size) override;
+    uint64_t rx_ns() override;
+    uint64_t now_ns() override;
+    void sleep_us(uint64_t us) override;
+    void spawn(std::function<void()> fn) override;
+
+private:
+    client_server::UDP_Server communicator;
+    LinkEmulator linkEmulator;  // every datagram we send goes through it
+};
+
+
+class LoopbackRuntime : public Runtime{
+    /* one node of a group that all runs in one process on real udp sockets over loopback: the host called
+     * containerK listens on 127.0.0.1 port base_port + K. no link emulation and no ip multicast */
+public:
+    LoopbackRuntime(const char *ourName, int base_port);
+    int enable_timestamps(int mode){  // see UDP_Server::enable_timestamps
+        return communicator.enable_timestamps(mode);
+    };
+    int send_to(const char *hostname, const unsigned char *msg, size_t size) override;
+    int reply(const unsigned char *msg, size_t size) override;
+    int send_to_group(const unsigned char *msg, size_t size) override;
+    bool in_group() const override;
+    int recv(unsigned char *msg, size_t max_size) override;
+    uint64_t rx_ns() override;
+    uint64_t now_ns() override;
+    void sleep_us(uint64_t us) override;
+    void spawn(std::function<void()> fn) override;
+
+private:
+    int basePort;
+    client_server::UDP_Server communicator;
+};
+
+#endif //PRJ1_RUNTIME_H
@@ -0,0 +1,230 @@
+//
+// Shared memory transport for group members on the same box: per pair lock free rings, futex wakeups.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <thread>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_transport.h"
+#include "clock.h"
+#include "membership.h"
+
+#define SHM_WRAP    0xffffffffu  // the rest of the ring is empty: the next datagram is at its start
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "the rings are shared between processes");
+static_assert((SHM_RING_BYTES & (SHM_RING_BYTES - 1)) == 0, "SHM_RING_BYTES must be a power of 2");
+
+
+static size_t record_size(size_t size){  // the header and the bytes, 8 byte aligned
+    return (SHM_RECORD_HEADER + size + 7) & ~(size_t) 7;
+}
+
+
+static void futex_wait(std::atomic<uint32_t> *word, uint32_t expected){
+    // not FUTEX_PRIVATE: the sender is another process
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+
+static void futex_wake(std::atomic<uint32_t> *word){
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+
+static inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+ShmRuntime::ShmRuntime(const char *ourName, const char *group) : groupName(group){
+    ourId = extract_int_from_string(ourName);
+    if (ourId < 0 || ourId >= SHM_HOSTS){
+        fprintf(stderr, "%s: shared memory needs container ids below %d. Exiting.\n", ourName, SHM_HOSTS);
+        exit(1);
+    }
+    inbox = map_inbox(ourId, true);
+    if (inbox == nullptr){
+        fprintf(stderr, "Couldn't set up the shared memory inbox of %s in group %s. Exiting.\n", ourName, group);
+        exit(1);
+    }
+    // a previous run's inbox: whatever is still in it was for that run. senders that have it mapped keep writing
+    for (ShmRing &ring : inbox->rings) ring.head.store(ring.tail.load(std::memory_order_acquire), std::memory_order_release);
+    inbox->waiting.store(0);
+    inbox->magic.store(SHM_MAGIC, std::memory_order_release);
+    cpu_set_t cpus;
+    spin = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 1 ? SHM_SPIN : 0;
+}
+
+
+ShmRuntime::~ShmRuntime(){
+    munmap(inbox, sizeof(ShmInbox));
+    for (ShmInbox *p : peers) if (p != nullptr) munmap(p, sizeof(ShmInbox));
+}
+
+
+ShmInbox * ShmRuntime::map_inbox(int id, bool create){
+    std::string name = "/prj1." + groupName + "." + std::to_string(id);
+    int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT : O_RDWR, 0666);
+    if (fd == -1){
+        if (create) perror("shm_open");
+        return nullptr;  // not there yet
+    }
+    struct stat st{};
+    if (create) fchmod(fd, 0666);  // whatever our umask: the other members may run as other users
+    if (create ? ftruncate(fd, sizeof(ShmInbox)) == -1 : fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(ShmInbox)){
+        if (create) perror("ftruncate");
+        close(fd);
+        return nullptr;
+    }
+    void *mem = mmap(nullptr, sizeof(ShmInbox), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED){
+        perror("mmap");
+        return nullptr;
+    }
+    auto *box = static_cast<ShmInbox *>(mem);
+    if (!create && box->magic.load(std::memory_order_acquire) != SHM_MAGIC){  // its host is still setting it up
+        munmap(mem, sizeof(ShmInbox));
+        return nullptr;
+    }
+    return box;
+}
+
+
+ShmInbox * ShmRuntime::peer(int id){
+    std::lock_guard<std::mutex> lock(peersMutex);
+    if (peers[id] == nullptr) peers[id] = id == ourId ? inbox : map_inbox(id, false);
+    return peers[id];
+}
+
+
+int ShmRuntime::send_to_id(int id, const unsigned char *msg, size_t size){
+    size_t need = record_size(size);
+    if (need > SHM_RING_BYTES / 2) return -1;
+    ShmInbox *box = peer(id);
+    if (box == nullptr) return -22;  // it isn't up yet
+    {
+        std::lock_guard<std::mutex> lock(ringMutex[id]);
+        ShmRing &ring = box->rings[ourId];
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        size_t pos = tail & (SHM_RING_BYTES - 1);
+        size_t skip = SHM_RING_BYTES - pos < need ? SHM_RING_BYTES - pos : 0;
+        if (SHM_RING_BYTES - (tail - head) < skip + need) return -22;  // full: the receiver is behind
+        if (skip > 0){
+            uint32_t wrap = SHM_WRAP;
+            memcpy(&ring.data[pos], &wrap, 4);
+            pos = 0;
+        }
+        uint32_t len = (uint32_t) size;
+        uint64_t written = monotonic_now_ns();
+        memcpy(&ring.data[pos], &len, 4);
+        memcpy(&ring.data[pos + 8], &written, 8);
+        memcpy(&ring.data[pos + SHM_RECORD_HEADER], msg, size);
+        ring.tail.store(tail + skip + need, std::memory_order_release);
+    }
+    box->seq.fetch_add(1);
+    if (box->waiting.load() != 0) futex_wake(&box->seq);
+    return (int) size;
+}
+
+
+int ShmRuntime::take(unsigned char *msg, size_t max_size){
+    for (int k = 0; k < SHM_HOSTS; k++){
+        int i = (nextRing + k) % SHM_HOSTS;
+        ShmRing &ring = inbox->rings[i];
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        if (head == ring.tail.load(std::memory_order_acquire)) continue;
+        size_t pos = head & (SHM_RING_BYTES - 1);
+        uint32_t len;
+        memcpy(&len, &ring.data[pos], 4);
+        if (len == SHM_WRAP){
+            head += SHM_RING_BYTES - pos;
+            pos = 0;
+            memcpy(&len, &ring.data[0], 4);
+        }
+        size_t n = len < max_size ? len : max_size;  // cut like a udp datagram that doesn't fit
+        memcpy(&lastWritten, &ring.data[pos + 8], 8);
+        memcpy(msg, &ring.data[pos + SHM_RECORD_HEADER], n);
+        ring.head.store(head + record_size(len), std::memory_order_release);
+        nextRing = i + 1;
+        lastFrom = i;
+        return (int) n;
+    }
+    return -1;
+}
+
+
+int ShmRuntime::send_to(const char *hostname, const unsigned char *msg, size_t size){
+    int id = extract_int_from_string(hostname);
+    if (id < 0 || id >= SHM_HOSTS) return -1;
+    return send_to_id(id, msg, size);
+}
+
+
+int ShmRuntime::reply(const unsigned char *msg, size_t size){
+    if (lastFrom == -1) return -1;
+    return send_to_id(lastFrom, msg, size);
+}
+
+
+int ShmRuntime::send_to_group(const unsigned char * /*msg*/, size_t /*size*/){
+    return -1;
+}
+
+
+bool ShmRuntime::in_group() const{
+    return false;
+}
+
+
+int ShmRuntime::recv(unsigned char *msg, size_t max_size){
+    while (true){
+        for (int i = 0; i < spin; i++){  // a busy sender usually has the next one ready by now
+            int n = take(msg, max_size);
+            if (n >= 0) return n;
+            cpu_relax();
+        }
+        // say we are going to sleep, then look once more: a sender either sees waiting or changed seq before we wait
+        inbox->waiting.store(1);
+        uint32_t seq = inbox->seq.load();
+        int n = take(msg, max_size);
+        if (n < 0) futex_wait(&inbox->seq, seq);
+        inbox->waiting.store(0);
+        if (n >= 0) return n;
+    }
+}
+
+
+uint64_t ShmRuntime::rx_ns(){
+    return lastWritten;
+}
+
+
+uint64_t ShmRuntime::now_ns(){
+    return monotonic_now_ns();
+}
+
+
+void ShmRuntime::sleep_us(uint64_t us){
+    usleep(us);
+}
+
+
+void ShmRuntime::spawn(std::function<void()> fn){
+    std::thread t(std::move(fn));
+    t.detach();
+}
@@ -0,0 +1,81 @@
+//
+// Shared memory transport for group members on the same box: per pair lock free rings, futex wakeups.
+//
+
+#ifndef PRJ1_SHM_TRANSPORT_H
+#define PRJ1_SHM_TRANSPORT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "runtime.h"
+
+#define SHM_HOSTS       32          // rings per inbox: the senders' container ids must be below this
+#define SHM_RING_BYTES  (1 << 20)   // per ring (a power of 2). a datagram that doesn't fit is lost, like a full socket
+#define SHM_SPIN        2000        // times recv() looks at the rings before it sleeps on the futex (with 2+ cpus)
+#define SHM_MAGIC       0x70726a32  // "prj2": the inbox is set up (with stamped records)
+#define SHM_RECORD_HEADER 16        // the length, 4 bytes of padding and when it was written
+
+
+struct ShmRing{
+    /* one sender --> one receiver. head and tail count bytes ever read and written (the position is mod
+     * SHM_RING_BYTES). a datagram is a 4 byte length, padding, the sender's CLOCK_MONOTONIC when it wrote it (the
+     * clock is the box's, so it is ours too) and its bytes, 8 byte aligned. a length of SHM_WRAP skips
+     * to the start of the ring. only the sender moves tail and only the receiver moves head */
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) unsigned char data[SHM_RING_BYTES];
+};
+
+
+struct ShmInbox{
+    /* what a host receives on: shm_open("/prj1.<group>.<id>"), one ring per sender. wakeups go through seq:
+     * a sender bumps it after every datagram and FUTEX_WAKEs the receiver if it said it's waiting */
+    std::atomic<uint32_t> magic;
+    std::atomic<uint32_t> seq;      // the futex
+    std::atomic<uint32_t> waiting;  // the receiver is (about to be) asleep on seq
+    ShmRing rings[SHM_HOSTS];       // by the sender's container id
+};
+
+
+class ShmRuntime : public Runtime{
+    /* every node of the group on this box (processes, or containers that share /dev/shm: docker run --ipc=host).
+     * the host called containerK receives on its own inbox. we map the inboxes of the hosts we send to the first time
+     * we send to them: until a host has set its inbox up, what we send it is lost (and resent by the protocol).
+     * several threads may send (one ring per pair, so a mutex per ring on our side), one thread receives.
+     * a restarted host takes over its old inbox, so nobody has to map it again. no link emulation and no ip
+     * multicast. inboxes stay in /dev/shm after we exit */
+public:
+    ShmRuntime(const char *ourName, const char *group);
+    ~ShmRuntime() override;
+    int send_to(const char *hostname, const unsigned char *msg, size_t size) override;
+    int reply(const unsigned char *msg, size_t size) override;
+    int send_to_group(const unsigned char *msg, size_t size) override;
+    bool in_group() const override;
+    int recv(unsigned char *msg, size_t max_size) override;
+    uint64_t rx_ns() override;  // when the sender put it in our ring
+    uint64_t now_ns() override;
+    void sleep_us(uint64_t us) override;
+    void spawn(std::function<void()> fn) override;
+
+private:
+    std::string groupName;
+    int ourId;
+    ShmInbox *inbox;  // ours
+    ShmInbox *peers[SHM_HOSTS] = {};  // peersMutex. mapped once, never unmapped before we are destroyed
+    std::mutex peersMutex;
+    std::mutex ringMutex[SHM_HOSTS];  // we write to peers[id]->rings[ourId]
+    int lastFrom = -1;  // who sent what recv() returned last. only the receiving thread
+    uint64_t lastWritten = 0;  // and when they wrote it
+    int nextRing = 0;   // where recv() looks first, so no sender gets ahead of the others
+    int spin;  // SHM_SPIN, or 0 on one cpu: the sender can't run while we spin
+    ShmInbox * map_inbox(int id, bool create);
+    ShmInbox * peer(int id);
+    int send_to_id(int id, const unsigned char *msg, size_t size);
+    int take(unsigned char *msg, size_t max_size);  // -1 if every ring is empty
+};
+
+#endif //PRJ1_SHM_TRANSPORT_H
@@ -0,0 +1,214 @@
+//
+// In-process cluster simulator: N ReliableMulticast nodes on an in-memory network, in virtual time.
+//
+
+#include <thread>
+
+#include "simulator.h"
+
+
+class Simulator::Node : public Runtime{
+    // what one node sees of the simulator
+public:
+    Node(Simulator *sim, int index, std::string name) : sim(sim), index(index), name(std::move(name)){}
+    int send_to(const char *hostname, const unsigned char *msg, size_t size) override {
+        return sim->send_to(index, hostname, msg, size);
+    };
+    int reply(const unsigned char *msg, size_t size) override {
+        return sim->reply(index, msg, size);
+    };
+    int send_to_group(const unsigned char *msg, size_t size) override {
+        return sim->send_to_group(index, msg, size);
+    };
+    bool in_group() const override {
+        return sim->multicast;
+    };
+    int recv(unsigned char *msg, size_t max_size) override {
+        return sim->recv(index, msg, max_size);
+    };
+    uint64_t rx_ns() override {  // the virtual time it arrived (it may have waited while we were busy)
+        return lastArrival;
+    };
+    uint64_t now_ns() override {
+        return sim->now_ns();
+    };
+    void sleep_us(uint64_t us) override {
+        sim->sleep_us(us);
+    };
+    void spawn(std::function<void()> fn) override {
+        sim->spawn(std::move(fn));
+    };
+
+    Simulator *sim;
+    int index;
+    std::string name;
+    struct Datagram{
+        int from;
+        uint64_t at_ns;
+        std::vector<unsigned char> msg;
+    };
+    std::deque<Datagram> inbox;
+    Thread *waiting = nullptr;  // the thread blocked in recv
+    int lastFrom = -1;  // where a reply goes
+    uint64_t lastArrival = 0;
+};
+
+
+Simulator::Simulator(uint32_t seed, const SimLink &link, bool multicast) : link(link), multicast(multicast), rng(seed){
+}
+
+
+Runtime * Simulator::add_node(const std::string &name){
+    std::lock_guard<std::mutex> lock(mutex);
+    int index = (int) nodes.size();
+    nodes.emplace_back(new Node(this, index, name));
+    byName[name] = index;
+    return nodes.back().get();
+}
+
+
+void Simulator::run(const std::function<void()> &driver){
+    std::unique_lock<std::mutex> lock(mutex);
+    Thread *self = new Thread();
+    running = self;
+    lock.unlock();
+    driver();
+    // nobody else is handed the run, so every other thread stays where it is
+}
+
+
+uint64_t Simulator::now_ns(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return now;
+}
+
+
+Simulator::Thread * Simulator::pick_next(){
+    while (runnable.empty()){
+        bool arrival = !arrivals.empty() && (wakeups.empty() || arrivals.top().at_ns <= wakeups.top().at_ns);
+        if (arrival){
+            const Arrival &a = arrivals.top();
+            now = a.at_ns;
+            Node &node = *nodes[a.to];
+            if (link.rcvbuf > 0 && node.inbox.size() >= (size_t) link.rcvbuf){  // the node isn't reading fast enough
+                lost++;
+                overflowed++;
+            } else node.inbox.push_back(Node::Datagram{a.from, a.at_ns, a.msg});
+            if (node.waiting != nullptr){
+                runnable.push_back(node.waiting);
+                node.waiting = nullptr;
+            }
+            arrivals.pop();
+        } else if (!wakeups.empty()){
+            now = wakeups.top().at_ns;
+            runnable.push_back(wakeups.top().thread);
+            wakeups.pop();
+        } else {
+            fprintf(stderr, "[Simulator] Every thread is waiting for a datagram that will never come. Exiting.\n");
+            exit(1);
+        }
+    }
+    Thread *next = runnable.front();
+    runnable.pop_front();
+    return next;
+}
+
+
+void Simulator::switch_away(std::unique_lock<std::mutex> &lock){
+    Thread *self = running;
+    Thread *next = pick_next();
+    if (next == self) return;
+    running = next;
+    next->cv.notify_one();
+    if (self->done) return;
+    self->cv.wait(lock, [&]{ return running == self; });
+}
+
+
+void Simulator::sleep_us(uint64_t us){
+    std::unique_lock<std::mutex> lock(mutex);
+    wakeups.push(Wakeup{now + us * 1000, nextOrder++, running});
+    switch_away(lock);
+}
+
+
+void Simulator::spawn(std::function<void()> fn){
+    std::lock_guard<std::mutex> lock(mutex);
+    Thread *t = new Thread();
+    runnable.push_back(t);
+    std::thread([this, t, fn]{
+        std::unique_lock<std::mutex> lock(mutex);
+        t->cv.wait(lock, [&]{ return running == t; });
+        lock.unlock();
+        fn();
+        lock.lock();
+        t->done = true;
+        switch_away(lock);
+        delete t;
+    }).detach();
+}
+
+
+int Simulator::recv(int node, unsigned char *msg, size_t max_size){
+    std::unique_lock<std::mutex> lock(mutex);
+    Node &n = *nodes[node];
+    while (n.inbox.empty()){
+        n.waiting = running;
+        switch_away(lock);
+    }
+    Node::Datagram d = std::move(n.inbox.front());
+    n.inbox.pop_front();
+    n.lastFrom = d.from;
+    n.lastArrival = d.at_ns;
+    size_t size = std::min(d.msg.size(), max_size);
+    memcpy(msg, d.msg.data(), size);
+    return (int) size;
+}
+
+
+void Simulator::transmit(int from, int to, const unsigned char *msg, size_t size){
+    // call with the mutex held
+    sent++;
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    if (link.loss > 0 && uniform(rng) < link.loss){
+        lost++;
+        return;
+    }
+    int64_t delay_us = link.delay_us;
+    if (link.jitter_us > 0) delay_us += (int64_t) ((uniform(rng) * 2 - 1) * link.jitter_us);
+    if (delay_us < 0) delay_us = 0;
+    arrivals.push(Arrival{now + (uint64_t) delay_us * 1000, nextOrder++, to, from,
+                          std::vector<unsigned char>(msg, msg + size)});
+}
+
+
+int Simulator::send_to(int from, const char *hostname, const unsigned char *msg, size_t size){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byName.find(std::string(hostname));
+    if (it == byName.end()){
+        printf("[Simulator] No node called %s.\n", hostname);
+        return -1;
+    }
+    uint64_t before = lost;
+    transmit(from, it->second, msg, size);
+    return lost != before ? -22 : (int) size;
+}
+
+
+int Simulator::reply(int from, const unsigned char *msg, size_t size){
+    std::lock_guard<std::mutex> lock(mutex);
+    int to = nodes[from]->lastFrom;
+    if (to == -1) return -1;
+    uint64_t before = lost;
+    transmit(from, to, msg, size);
+    return lost != before ? -22 : (int) size;
+}
+
+
+int Simulator::send_to_group(int from, const unsigned char *msg, size_t size){
+    // like ip multicast every other node gets its own copy, lost on its own
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t before = lost;
+    for (int to = 0; to < (int) nodes.size(); to++) if (to != from) transmit(from, to, msg, size);
+    return lost - before == nodes.size() - 1 && nodes.size() > 1 ? -22 : (int) size;
+}
@@ -0,0 +1,107 @@
+//
+// In-process cluster simulator: N ReliableMulticast nodes on an in-memory network, in virtual time.
+//
+
+#ifndef PRJ1_SIMULATOR_H
+#define PRJ1_SIMULATOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+
+#include "runtime.h"
+
+
+typedef struct {
+    int delay_us;       // one way
+    int jitter_us;      // +- uniformly on top of the delay
+    double loss;        // probability a datagram is lost
+    int rcvbuf = 0;     // datagrams a node's socket holds. more are dropped, like a full socket buffer (0: no limit)
+} SimLink;
+
+
+class Simulator{
+    /* every thread of every node is a real thread, but only one of them runs at a time: a thread runs until it
+     * sleeps, waits for a datagram or ends, then hands over to the next runnable one (in the order they became
+     * runnable). When nothing is runnable the clock jumps to the next wakeup or arrival. Loss, delay and jitter
+     * come from one seeded generator, so the same seed gives the same run, and a minute of protocol time takes
+     * only as long as the cpu work in it.
+     * A thread must not sleep or wait for a datagram while it holds a lock another node thread may want (the
+     * protocol doesn't). Nodes and the simulator are never destroyed: their threads stay parked once run() returns. */
+public:
+    Simulator(uint32_t seed, const SimLink &link, bool multicast = false);  // multicast: nodes can send to a group
+    Runtime * add_node(const std::string &name);  // the runtime to give that node's ReliableMulticast
+    // runs driver as the first thread (on the calling one) until it returns. the driver creates the nodes, starts
+    // their receivers and sleeps on any node's runtime to let time pass
+    void run(const std::function<void()> &driver);
+    uint64_t now_ns();
+    uint64_t datagrams_sent() const {
+        return sent;
+    };
+    uint64_t datagrams_lost() const {
+        return lost;
+    };
+    uint64_t datagrams_overflowed() const {  // arrived at a full socket (SimLink::rcvbuf). counted in lost too
+        return overflowed;
+    };
+
+private:
+    struct Thread{
+        std::condition_variable cv;
+        bool done = false;
+    };
+    struct Arrival{
+        uint64_t at_ns;
+        uint64_t order;
+        int to;
+        int from;
+        std::vector<unsigned char> msg;
+        bool operator>(const Arrival &o) const {
+            return at_ns == o.at_ns ? order > o.order : at_ns > o.at_ns;
+        };
+    };
+    struct Wakeup{
+        uint64_t at_ns;
+        uint64_t order;
+        Thread *thread;
+        bool operator>(const Wakeup &o) const {
+            return at_ns == o.at_ns ? order > o.order : at_ns > o.at_ns;
+        };
+    };
+    class Node;
+
+    std::mutex mutex;  // protects everything below (only the running thread touches it anyway)
+    Thread *running = nullptr;
+    std::deque<Thread *> runnable;
+    std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<Wakeup>> wakeups;
+    std::priority_queue<Arrival, std::vector<Arrival>, std::greater<Arrival>> arrivals;
+    uint64_t nextOrder = 0;
+    uint64_t now = 1000000000;  // virtual ns (starts at 1 s so nothing looks like an unset timestamp)
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::map<std::string, int> byName;
+    SimLink link;
+    bool multicast;
+    std::mt19937_64 rng;
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    uint64_t overflowed = 0;
+
+    void switch_away(std::unique_lock<std::mutex> &lock);  // the running thread blocked (or ended)
+    Thread * pick_next();
+    void transmit(int from, int to, const unsigned char *msg, size_t size);
+    void sleep_us(uint64_t us);
+    void spawn(std::function<void()> fn);
+    int recv(int node, unsigned char *msg, size_t max_size);
+    int send_to(int from, const char *hostname, const unsigned char *msg, size_t size);
+    int reply(int from, const unsigned char *msg, size_t size);
+    int send_to_group(int from, const unsigned char *msg, size_t size);
+};
+
+#endif //PRJ1_SIMULATOR_H
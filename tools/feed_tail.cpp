@@ -0,0 +1,48 @@
+//
+// Follows the delivered msgs a daemon publishes with -O, from another process on the same box. One line per msg:
+// its place in the feed, sender, msg id, final seq number, payload size and how long it took from being published
+// to being read here. Says so when it was lapped (fell FEED_SLOTS msgs behind) and how many msgs it skipped.
+//
+// g++ -O2 -pthread -o feed_tail tools/feed_tail.cpp delivery_feed.cpp payload.cpp
+// ./feed_tail <feed> [oldest]
+//      oldest: start with the oldest msg still in the feed instead of the next one
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "../delivery_feed.h"
+#include "../clock.h"
+
+
+int main(int argc, char *argv[]){
+    if (argc < 2 || (argc > 2 && strcmp(argv[2], "oldest") != 0)){
+        fprintf(stderr, "Usage: %s <feed> [oldest]\n", argv[0]);
+        exit(1);
+    }
+    FeedReader *reader = new FeedReader(argv[1], argc > 2);
+    while (!reader->attached()){  // the daemon isn't up yet
+        delete reader;
+        usleep(100000);
+        reader = new FeedReader(argv[1], argc > 2);
+    }
+    FeedEntry e;
+    while (true){
+        int rv = reader->next(e);
+        if (rv == FEED_EMPTY){
+            fflush(stdout);
+            reader->wait(1000);
+        } else if (rv == FEED_LAGGED){
+            uint64_t from = reader->cursor();
+            uint64_t skipped = reader->catch_up();
+            printf("lapped at %lu: skipped %lu msgs\n", from, skipped);
+        } else {
+            uint64_t late = monotonic_now_ns() - e.published_ns;
+            if (reader->intact(e))
+                printf("%lu sender %u msg %u seq %u.%u %lu bytes after %.1f us\n", e.seq, e.sender, e.msg_id,
+                       e.sequence_number, e.proposer, e.size, late / 1e3);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+//
+// Turns the binary traces of one or more nodes (-Z) into one Chrome trace JSON file, for chrome://tracing or Perfetto.
+// Every node is a process. On each node every msg is an async span from its DATA (sent or received) to its delivery,
+// with the ACKs, SEQs and retransmits as instants in it and a nested "blocked" span from its SEQ to its delivery
+// (how long it waited for the msgs before it in the order). The timestamps are the nodes' own CLOCK_MONOTONIC, so
+// traces of nodes on different machines are only as aligned as their clocks are.
+//
+// g++ -O2 -o trace2chrome tools/trace2chrome.cpp
+// ./trace2chrome <out.json> <node.trace> [<node.trace> ...]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "../trace.h"
+
+struct NodeEvent{
+    uint32_t node;
+    TraceEvent e;
+};
+
+struct Span{
+    bool open = false;
+    bool delivered = false;  // what comes after (duplicates, late acks) is left out
+    bool blocked = false;  // the nested "blocked" span is open
+};
+
+static const char * kindNames[] = {"?", "DATA sent", "DATA received", "ACK sent", "ACK received", "SEQ sent",
+                                   "SEQ received", "delivered", "retransmit"};
+static const char * packetNames[] = {"?", "DATA", "ACK", "SEQ"};
+
+bool read_trace(const char *fileName, std::vector<NodeEvent> &events);
+
+
+int main(int argc, char *argv[]){
+    if (argc < 3){
+        printf("Usage: %s <out.json> <node.trace> [<node.trace> ...]\n", argv[0]);
+        exit(1);
+    }
+    std::vector<NodeEvent> events;
+    for (int i = 2; i < argc; i++) if (!read_trace(argv[i], events)) exit(1);
+    // the rings are drained one after the other: put everything back in time order
+    std::stable_sort(events.begin(), events.end(), [](const NodeEvent &a, const NodeEvent &b){
+        return a.e.ts_ns < b.e.ts_ns;
+    });
+    uint64_t origin = events.empty() ? 0 : events[0].e.ts_ns;
+
+    FILE *out = fopen(argv[1], "w");
+    if (out == nullptr){
+        perror("Couldn't create the output file");
+        exit(1);
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first = true;
+    auto emit = [&](const char *json){
+        fprintf(out, "%s%s", first ? "" : ",\n", json);
+        first = false;
+    };
+    char line[512];
+    std::map<uint32_t, bool> nodes;
+    for (const NodeEvent &ne : events){
+        if (nodes.count(ne.node) != 0) continue;
+        nodes[ne.node] = true;
+        snprintf(line, sizeof line, "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %u, \"tid\": 0, "
+                                    "\"args\": {\"name\": \"container%u\"}}", ne.node, ne.node);
+        emit(line);
+    }
+
+    std::map<std::pair<uint32_t, uint64_t>, Span> spans;  // (node, sender << 32 | msg_id)
+    size_t orphans = 0, late = 0;
+    for (const NodeEvent &ne : events){
+        const TraceEvent &e = ne.e;
+        uint64_t msg = (uint64_t) e.sender << 32 | e.msg_id;
+        Span &span = spans[std::make_pair(ne.node, msg)];
+        double ts = (double) (e.ts_ns - origin) / 1e3;
+        // an async event of this msg on this node. the id is local to the node: every node has its own span
+        auto async = [&](const char *ph, const char *name, const char *args){
+            snprintf(line, sizeof line, "{\"ph\": \"%s\", \"cat\": \"msg\", \"name\": \"%s\", \"pid\": %u, "
+                                        "\"tid\": 0, \"ts\": %.3f, \"id2\": {\"local\": \"0x%lx\"}%s%s}", ph, name,
+                     ne.node, ts, msg, args[0] ? ", \"args\": " : "", args);
+            emit(line);
+        };
+        char name[64], args[256];
+        snprintf(name, sizeof name, "msg %u:%u", e.sender, e.msg_id);
+        if (span.delivered){
+            late++;
+            continue;
+        }
+        if ((e.kind == T_DATA_SENT || e.kind == T_DATA_RECV) && !span.open){
+            span.open = true;
+            async("b", name, "");
+        }
+        if (!span.open){  // its DATA was before the trace started (or dropped)
+            orphans++;
+            continue;
+        }
+        const char *kind = e.kind < sizeof kindNames / sizeof kindNames[0] ? kindNames[e.kind] : kindNames[0];
+        switch (e.kind){
+            case T_DELIVERED:
+                snprintf(args, sizeof args, "{\"seq\": %u, \"proposer\": %u}", e.seq, e.proposer);
+                if (span.blocked) async("e", "blocked", "");
+                async("e", name, args);
+                span.open = false;
+                span.delivered = true;
+                break;
+            case T_SEQ_SENT:
+            case T_SEQ_RECV:
+                snprintf(args, sizeof args, "{\"final_seq\": %u, \"proposer\": %u}", e.seq, e.proposer);
+                async("n", kind, args);
+                if (!span.blocked){
+                    span.blocked = true;
+                    async("b", "blocked", "");
+                }
+                break;
+            case T_RETRANSMIT:
+                snprintf(args, sizeof args, "{\"packet\": \"%s\", \"to\": %u}", e.seq <= 3 ? packetNames[e.seq] : "?",
+                         e.peer);
+                async("n", kind, args);
+                break;
+            default:  // DATA, ACKs
+                snprintf(args, sizeof args, "{\"peer\": %u, \"seq\": %u, \"proposer\": %u}", e.peer, e.seq,
+                         e.proposer);
+                async("n", kind, args);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    size_t undelivered = 0;
+    for (auto &kv : spans) if (kv.second.open) undelivered++;
+    fprintf(stderr, "%lu events from %lu nodes. %lu msgs were not delivered by the end of the trace. left out: %lu "
+                    "events after their msg was delivered, %lu of msgs whose DATA isn't in the trace\n", events.size(),
+            nodes.size(), undelivered, late, orphans);
+    return 0;
+}
+
+
+bool read_trace(const char *fileName, std::vector<NodeEvent> &events){
+    FILE *fp = fopen(fileName, "r");
+    if (fp == nullptr){
+        perror(fileName);
+        return false;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof header, 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0 ||
+        header.event_size != sizeof(TraceEvent)){
+        fprintf(stderr, "%s is not a trace file (or is from another build)\n", fileName);
+        fclose(fp);
+        return false;
+    }
+    TraceEvent e;
+    while (fread(&e, sizeof e, 1, fp) == 1) events.push_back(NodeEvent{header.node, e});
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,112 @@
+//
+// Per-message lifecycle tracing: fixed-size binary events in per-thread rings, drained to a file in the background.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include "trace.h"
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of 2");
+static_assert(sizeof(TraceEvent) == 32, "trace events are 32 bytes on disk");
+
+// the tracers that are alive, so a thread that ends doesn't mark a ring of one that's gone
+static std::mutex liveMutex;
+static std::set<uint64_t> live;
+static uint64_t nextID = 1;
+
+
+struct ThreadRings{
+    // the rings the calling thread has, in every tracer it recorded to. the last one used is cached
+    std::vector<std::pair<uint64_t, Tracer::Ring *>> mine;
+    ~ThreadRings(){
+        std::lock_guard<std::mutex> lock(liveMutex);
+        for (auto &m : mine) if (live.count(m.first) != 0) m.second->done.store(true, std::memory_order_release);
+    };
+};
+static thread_local ThreadRings threadRings;
+static thread_local uint64_t lastID = 0;
+static thread_local Tracer::Ring * lastRing = nullptr;
+
+
+Tracer::Tracer(const char *fileName, uint32_t node){
+    fp = fopen(fileName, "w");
+    if (fp == nullptr){
+        perror("Tracer: couldn't create the trace file");
+        exit(1);
+    }
+    TraceFileHeader header{};
+    memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+    header.node = node;
+    header.event_size = sizeof(TraceEvent);
+    fwrite(&header, sizeof header, 1, fp);
+    std::lock_guard<std::mutex> lock(liveMutex);
+    id = nextID++;
+    live.insert(id);
+}
+
+
+Tracer::~Tracer(){
+    {
+        std::lock_guard<std::mutex> lock(liveMutex);
+        live.erase(id);
+    }
+    flush();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Ring *r : rings) delete r;
+    fclose(fp);
+}
+
+
+Tracer::Ring * Tracer::ring(){
+    if (lastID == id) return lastRing;
+    Ring *r = nullptr;
+    for (auto &m : threadRings.mine) if (m.first == id) r = m.second;
+    if (r == nullptr){
+        r = new Ring();
+        threadRings.mine.push_back(std::make_pair(id, r));
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(r);
+    }
+    lastID = id;
+    lastRing = r;
+    return r;
+}
+
+
+void Tracer::record(uint64_t ts_ns, uint32_t kind, uint32_t sender, uint32_t msg_id, uint32_t peer, uint32_t seq,
+                    uint32_t proposer){
+    Ring *r = ring();
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    if (head - r->tail.load(std::memory_order_acquire) >= TRACE_RING_SIZE){  // the flusher is behind: never wait for it
+        numDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    r->events[head & (TRACE_RING_SIZE - 1)] = TraceEvent{ts_ns, kind, sender, msg_id, peer, seq, proposer};
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+
+void Tracer::flush(){
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < rings.size();){
+        Ring *r = rings[i];
+        bool done = r->done.load(std::memory_order_acquire);  // before head: a done thread records nothing more
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        while (tail < head){  // at most two pieces: up to the end of the ring and from its start
+            uint64_t at = tail & (TRACE_RING_SIZE - 1);
+            uint64_t n = std::min(head - tail, (uint64_t) TRACE_RING_SIZE - at);
+            fwrite(&r->events[at], sizeof(TraceEvent), n, fp);
+            tail += n;
+        }
+        r->tail.store(tail, std::memory_order_release);
+        if (done){
+            delete r;
+            rings[i] = rings.back();
+            rings.pop_back();
+        } else i++;
+    }
+    fflush(fp);
+}
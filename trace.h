@@ -0,0 +1,86 @@
+//
+// Per-message lifecycle tracing: fixed-size binary events in per-thread rings, drained to a file in the background.
+//
+
+#ifndef PRJ1_TRACE_H
+#define PRJ1_TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define TRACE_RING_SIZE     4096    // events per thread (a power of 2). when a ring is full new events are dropped
+#define TRACE_FLUSH_PERIOD  100     // in miliseconds. how often the rings are drained to the file
+#define TRACE_MAGIC         "RMTRACE1"
+
+
+enum TraceKind{
+    T_DATA_SENT = 1,    // we multicast (sender, msg_id). seq: our own proposal
+    T_DATA_RECV,        // peer: who it came from
+    T_ACK_SENT,         // seq: our proposal
+    T_ACK_RECV,         // peer: the acker. seq/proposer: its proposal
+    T_SEQ_SENT,         // seq/proposer: the final
+    T_SEQ_RECV,
+    T_DELIVERED,        // seq/proposer: the final it was delivered with
+    T_RETRANSMIT,       // peer: where it went again. seq: the packet type
+};
+
+
+struct TraceEvent{  // 32 bytes, written as is (host byte order)
+    uint64_t ts_ns;     // runtime->now_ns(): CLOCK_MONOTONIC, or virtual time on the simulator
+    uint32_t kind;
+    uint32_t sender;    // (sender, msg_id) is the msg
+    uint32_t msg_id;
+    uint32_t peer;
+    uint32_t seq;
+    uint32_t proposer;
+};
+
+struct TraceFileHeader{  // at the start of a trace file, followed by TraceEvents (not in time order)
+    char magic[8];
+    uint32_t node;      // our host id
+    uint32_t event_size;
+};
+
+
+class Tracer{
+    /* Every thread that records gets its own ring: one producer (that thread) and one consumer (the flusher), so
+     * recording is a store of 32 bytes and a release store of the head. Nothing blocks: if the flusher fell behind
+     * and the ring is full, the event is dropped and counted.
+     * The flusher (start() runs it on a thread of the caller's choosing) drains every ring into the file each
+     * TRACE_FLUSH_PERIOD ms. Rings of threads that ended are dropped once they're drained.
+     * tools/trace2chrome.cpp turns one or more of these files (one per node) into Chrome trace JSON. */
+public:
+    Tracer(const char *fileName, uint32_t node);  // exits if the file can't be created
+    ~Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void record(uint64_t ts_ns, uint32_t kind, uint32_t sender, uint32_t msg_id, uint32_t peer = 0,
+                uint32_t seq = 0, uint32_t proposer = 0);
+    void flush();  // drain the rings into the file now
+    uint64_t dropped() const {
+        return numDropped.load(std::memory_order_relaxed);
+    };
+
+    struct Ring{
+        TraceEvent events[TRACE_RING_SIZE];
+        std::atomic<uint64_t> head{0};  // written by the thread
+        std::atomic<uint64_t> tail{0};  // written by the flusher
+        std::atomic<bool> done{false};  // the thread ended
+    };
+
+private:
+    uint64_t id;
+    FILE *fp;
+    std::mutex mutex;  // guards rings and the file
+    std::vector<Ring *> rings;
+    std::atomic<uint64_t> numDropped{0};
+
+    Ring * ring();  // the calling thread's
+};
+
+#endif //PRJ1_TRACE_H
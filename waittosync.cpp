@@ -1,175 +1,136 @@
 /*
 ** prj0.c
-** Read from a host file containing n-1 other hosts
-** Spawn n-1 thread to send out "I'm alive" signals and watch for acks... do this periodically.
-** Spawn another thread to listen for incoming signal and only stop why
+** Startup barrier: wait until every host in the Hostfile is up (and knows that we are up).
+** All the hosts are handled by one UDP socket and one poll loop:
+** -- the name lookups all go out at once (getaddrinfo_a). A failed lookup (the container isn't up yet) is retried
+**    with exponential backoff starting at BOOT_BACKOFF_MIN ms.
+** -- we send "hi <our index>" to every resolved host until it answers "ACK <its index>", with the same backoff.
+** -- we answer every "hi" with an ACK.
+** We are READY once every other host has acked our hello and said hi to us. We keep answering hellos for a while
+** after that since our last ACK to a slower host may have been lost.
 */
 //#define DEBUG   // comment this to turn off debug
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <pthread.h>
+#include <algorithm>
+#include <thread>
 #include "waittosync.h"
+#include "clock.h"
 // socket programming stuff
 #include <cerrno>
+#include <csignal>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <unistd.h>  // gethostname
+#include <ifaddrs.h>
+#include <unistd.h>
 #include <poll.h>
 
 
 #define SERVERPORT "4950"
 
-#define ARRAY_MAX_SIZE 16  // max 16 hosts
 #define MAX_HOST_NAME 256
-#define THREAD_SLEEP_TIME 3 // in seconds
 #define MAX_BUF_LEN 100
-#define TIMEOUT 3000 // max time to receive ACK
 
 namespace wait_to_sync {
 
-    pthread_mutex_t num_hosts_mutex = PTHREAD_MUTEX_INITIALIZER;  // so we read properly
-    int num_hosts = 1;  // global var for threads to read from
+    struct BootPeer{
+        const char *        name;
+        struct gaicb        lookup;             // the getaddrinfo_a request in flight (must not move: a vector sized once)
+        struct addrinfo     hints;
+        bool                looking_up = false;
+        bool                resolved = false;
+        struct sockaddr_in  addr{};
+        int                 lookups = 0;
+        uint64_t            next_lookup_ns = 0;
+        uint64_t            lookup_backoff_ns = (uint64_t) BOOT_BACKOFF_MIN * 1000000;
+        int                 hellos = 0;
+        uint64_t            next_hello_ns = 0;
+        uint64_t            hello_backoff_ns = (uint64_t) BOOT_BACKOFF_MIN * 1000000;
+        bool                acked_us = false;   // it got our hello
+        bool                said_hi = false;    // we got its hello
+        // for the startup report (ns since the start of the barrier, 0 = not yet)
+        uint64_t            resolved_at_ns = 0;
+        uint64_t            first_contact_ns = 0;
+        uint64_t            done_at_ns = 0;     // acked_us && said_hi
+    };
 
     char *current_container_name = nullptr;
 
-    const char *waittosync(char **hostNames, int numHosts){
-        printf("Waiting for other hosts....\n");
-        num_hosts = numHosts;  // only place. no need for mutex
-        /* now we spawn threads to go out and send message to the other hosts */
-        pthread_t workers[numHosts];
-        int ret[numHosts];
-        for (int i = 0; i < numHosts; i++) {
-            ret[i] = pthread_create(&workers[i], nullptr, check_up_with_host, (void *) hostNames[i]);
-        }
-
-        for (int i = 0; i < numHosts; i++) {
-            pthread_join(workers[i], nullptr);
-        }
-
-        for (int i = 0; i < numHosts; i++) {
-            DPRINTF(("Thread %d returns: %d\n", i, ret[i]));
-        }
-
-        printf("READY\n");
+    static double ms(uint64_t ns){
+        return (double) ns / 1e6;
+    }
 
-        return current_container_name;
+    static uint64_t backoff(uint64_t &backoff_ns){  // return the current backoff and double it for next time
+        uint64_t current = backoff_ns;
+        backoff_ns = std::min(2 * backoff_ns, (uint64_t) BOOT_BACKOFF_MAX * 1000000);
+        return current;
     }
 
-// this is the main function that thread will use to communicate with other processes
-    void *check_up_with_host(void *ptr) {
-        char *hostname = (char *) ptr;
-        struct hostent *host_entry;
-        struct addrinfo hints{}, *hostai;  // ai stands for addrinfo
-        int rv;
-        /* first get localhost for debugging */
-        char hostipstr[INET6_ADDRSTRLEN], ipbuf[INET6_ADDRSTRLEN];
-        char *localipstr;
-        gethostname(ipbuf, sizeof(ipbuf));
-        host_entry = gethostbyname(ipbuf);
-        if (host_entry == nullptr) {
-            perror("gethostbyname");
-            exit(1);
-        }  // error checking
-        localipstr = inet_ntoa(*((struct in_addr *) host_entry->h_addr_list[0]));
+    static void lookup_done(union sigval sv){  // runs on a glibc thread: just wake up the poll loop
+        uint64_t one = 1;
+        ssize_t rv = write(sv.sival_int, &one, sizeof one);
+        (void) rv;
+    }
 
-        // getaddrinfo to check for host
-        memset(&hints, 0, sizeof hints);
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
-        // we get the host addrinfo
-        while ((rv = getaddrinfo(hostname, SERVERPORT, &hints, &hostai)) != 0) {
-            DPRINTF(("[Thread(%s)] Failed to getaddrinfo for %s (%s). Trying again after %d seconds...\n", localipstr, hostname, gai_strerror(
-                    rv), THREAD_SLEEP_TIME));
-            sleep(THREAD_SLEEP_TIME);  // try again until we find
-        }
-        // first we need to check whether if this hostname is ours (so we do a different job)
-        // get the str to print debug
-        auto *host_sai = (struct sockaddr_in *) hostai->ai_addr;
-        inet_ntop(AF_INET, &(host_sai->sin_addr), hostipstr, sizeof hostipstr);
-        DPRINTF(("Thread: local (%s) vs. host (%s)\n", localipstr, hostipstr));
-        if (strcmp(localipstr, hostipstr) == 0) {
-            // this is the name of the current docker's container
-            current_container_name = hostname;  // this should only be set by only 1 thread
-            DPRINTF(("Thread(%s): Same!\n", localipstr));
-            /* This is the receiving thread. We wait for incoming signals and send them acks. We stop after we have received n-1 signals and send out n-1 acks. */
-            receive_signals_and_send_ack();
-        } else {
-            DPRINTF(("Thread(%s): Different!\n", localipstr));
-            send_signals_and_wait_for_acks(hostai, hostname);
+    static void start_lookup(BootPeer &peer, int eventFd, uint64_t now){
+        memset(&peer.hints, 0, sizeof peer.hints);
+        peer.hints.ai_family = AF_INET;
+        peer.hints.ai_socktype = SOCK_DGRAM;
+        memset(&peer.lookup, 0, sizeof peer.lookup);
+        peer.lookup.ar_name = peer.name;
+        peer.lookup.ar_service = SERVERPORT;
+        peer.lookup.ar_request = &peer.hints;
+        struct sigevent sev{};
+        sev.sigev_notify = SIGEV_THREAD;
+        sev.sigev_notify_function = lookup_done;
+        sev.sigev_value.sival_int = eventFd;
+        struct gaicb *list[1] = {&peer.lookup};
+        peer.lookups++;
+        int rv = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+        if (rv != 0){
+            DPRINTF(("[Boot] getaddrinfo_a(%s) failed: %s\n", peer.name, gai_strerror(rv)));
+            peer.next_lookup_ns = now + backoff(peer.lookup_backoff_ns);
+            return;
         }
-
-        freeaddrinfo(hostai); // free the linked list
-        return nullptr;
+        peer.looking_up = true;
     }
 
-
-/* read from hostFileName and store each line into lineArray */
-    int read_from_file(const char *fileName, char *lineArray[]) {
-        int numHosts = 0;
-        FILE *file = fopen(fileName, "r");
-        if (file == nullptr) {
-            fprintf(stderr, "Error reading file %s", fileName);
+    static std::vector<in_addr_t> local_addresses(){
+        std::vector<in_addr_t> addrs;
+        struct ifaddrs *ifs;
+        if (getifaddrs(&ifs) == -1){
+            perror("getifaddrs");
             exit(1);
         }
-        char line[MAX_HOST_NAME];
-        while (fgets(line, sizeof(line), file)) {
-            if (numHosts == ARRAY_MAX_SIZE) {
-                perror("Exceeded maximum hosts threshold. Please fix parameter in prj0.c");
-                exit(1);
-            }
-            line[strcspn(line, "\r\n")] = 0;
-            lineArray[numHosts] = new char[MAX_HOST_NAME];
-            strcpy(lineArray[numHosts], line);
-            numHosts++;
-        }
-        // for (int i = 0; i < numHosts; i++){
-        //     DPRINTF(("%d: %s\n", i, lineArray[i]));
-        // }
-        fclose(file);
-        return numHosts;
-    }
-
-// get sockaddr, IPv4 or IPv6:
-    void *get_in_addr(struct sockaddr *sa) {
-        if (sa->sa_family == AF_INET) {
-            return &(((struct sockaddr_in *) sa)->sin_addr);
+        for (struct ifaddrs *p = ifs; p != nullptr; p = p->ifa_next){
+            if (p->ifa_addr != nullptr && p->ifa_addr->sa_family == AF_INET)
+                addrs.push_back(((struct sockaddr_in *) p->ifa_addr)->sin_addr.s_addr);
         }
-        return &(((struct sockaddr_in6 *) sa)->sin6_addr);
+        freeifaddrs(ifs);
+        return addrs;
     }
 
-    void receive_signals_and_send_ack() {
-        int sockfd;  // the socket for receiving incoming msg
+    static int bind_boot_socket(){
+        int sockfd;
         struct addrinfo hints{}, *servinfo, *p;
-        int rv;  // return value
-        int numbytes;
-        struct sockaddr_storage their_addr{};
-        char buf[MAX_BUF_LEN];
-        socklen_t addr_len;
-        char s[INET6_ADDRSTRLEN];
-
-        // first obtain num_hosts-1
-        pthread_mutex_lock(&num_hosts_mutex);
-        int numHost = num_hosts;
-        pthread_mutex_unlock(&num_hosts_mutex);
-
-        /* first we get a socket to receive message from */
+        int rv;
         memset(&hints, 0, sizeof hints);
-        hints.ai_family = AF_UNSPEC; // set to AF_INET to force IPv4
+        hints.ai_family = AF_INET;
         hints.ai_socktype = SOCK_DGRAM;
         hints.ai_flags = AI_PASSIVE; // use my IP
         if ((rv = getaddrinfo(nullptr, SERVERPORT, &hints, &servinfo)) != 0) {
             fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-            return;
+            exit(1);
         }
         // loop through all the results and bind to the first we can
         for (p = servinfo; p != nullptr; p = p->ai_next) {
-            if ((sockfd = socket(p->ai_family, p->ai_socktype,
-                                 p->ai_protocol)) == -1) {
+            if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
                 perror("listener: socket error");
                 continue;
             }
@@ -185,106 +146,209 @@ namespace wait_to_sync {
             exit(2);
         }
         freeaddrinfo(servinfo);
+        return sockfd;
+    }
 
-        /* NOW WE ARE READY TO RECEIVE MESSAGES AND REPLY WITH ACKS*/
-        int num_encountered_ips = 0;
-        char *encountered_ips[numHost - 1];
-        addr_len = sizeof their_addr;
-        int numHostminus1 = numHost - 1;
-        while (num_encountered_ips < numHostminus1) {
-            // listen
-            DPRINTF(("[Listener] Listening for input (num_encountered_ips = %d vs. numHostminus1 = %d)...\n", num_encountered_ips, numHostminus1));
-            if ((numbytes = recvfrom(sockfd, buf, MAX_BUF_LEN - 1, 0, (struct sockaddr *) &their_addr, &addr_len)) ==
-                -1) {
-                perror("recvfrom error.... trying again...");
-                continue;
-            }
-            // GOT A PACKET!
-            const char *their_ip = inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr *) &their_addr), s,
-                                             sizeof s);
-            buf[numbytes] = '\0';
-            DPRINTF(("[Listener] got packet from %s with content %s\n", their_ip, buf));
-            // Now we send an ACK back. If we haven't send an ACK to them before, we increment num_encountered_ips
-            auto *theirs = (struct sockaddr *) &their_addr;
-            if ((numbytes = sendto(sockfd, "ACK", strlen("ACK"), 0, (const struct sockaddr *) &their_addr,
-                                   sizeof(their_addr))) == -1) {
-                DPRINTF(("[Listener] Sent ACK failed... try again later"));
-                continue;
-            };
-            int already_added = 0;
-            for (int i = 0; i < num_encountered_ips; i++) {  // check if we have seen this ip before
-                if (strcmp(encountered_ips[i], their_ip) == 0) {  // this means it has already been added
-                    DPRINTF(("WARNING: IP %s is already encountered.\n", encountered_ips[i]));
-                    already_added = 1;
-                    break;
-                }
-            }
-            if (already_added == 0) { // if we haven't added this ip
-                encountered_ips[num_encountered_ips] = new char[50];
-                strcpy(encountered_ips[num_encountered_ips],
-                       inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr *) &their_addr), s, sizeof s));
-                DPRINTF(("[Listerner] Adding ip %s to encountered list\n", encountered_ips[num_encountered_ips]));
-                num_encountered_ips++;
-            }
-        }
-
-        /* cleanup */
-        for (int i = 0; i < numHostminus1; i++) {
-            delete[] encountered_ips[i];
+    static void send_word(int sockfd, const char *word, int selfIdx, const struct sockaddr *to, socklen_t toLen){
+        char buf[MAX_BUF_LEN];
+        int len = snprintf(buf, sizeof buf, "%s %d", word, selfIdx);
+        if (sendto(sockfd, buf, len, 0, to, toLen) == -1) {
+            DPRINTF(("[Boot] sendto failed (%s)... try again later\n", strerror(errno)));
         }
-        close(sockfd);
     }
 
-    void send_signals_and_wait_for_acks(struct addrinfo *hostai, const char *hostname) {
-        // we need to create a socket
-        int sockfd;
-        char buf[MAX_BUF_LEN], s[INET6_ADDRSTRLEN];
+    static void linger_and_ack(int sockfd, int selfIdx){
+        /* some host may still be waiting for our ACK (the one we sent got lost). keep answering for a while. */
+        struct pollfd pfd = {sockfd, POLLIN, 0};
+        uint64_t until = monotonic_now_ns() + (uint64_t) BOOT_LINGER * 1000000;
+        char buf[MAX_BUF_LEN], word[8];
         struct sockaddr_storage their_addr{};
         socklen_t addr_len;
+        uint64_t now;
+        while ((now = monotonic_now_ns()) < until){
+            if (poll(&pfd, 1, (int) ((until - now) / 1000000) + 1) <= 0) continue;
+            addr_len = sizeof their_addr;
+            ssize_t numbytes = recvfrom(sockfd, buf, MAX_BUF_LEN - 1, MSG_DONTWAIT, (struct sockaddr *) &their_addr, &addr_len);
+            if (numbytes <= 0) continue;
+            buf[numbytes] = '\0';
+            int idx;
+            if (sscanf(buf, "%7s %d", word, &idx) == 2 && strcmp(word, "hi") == 0)
+                send_word(sockfd, "ACK", selfIdx, (struct sockaddr *) &their_addr, addr_len);
+        }
+        close(sockfd);
+    }
 
-        // Creating socket file descriptor
-        if ((sockfd = socket(hostai->ai_family, hostai->ai_socktype, hostai->ai_protocol)) < 0) {
-            perror("socket creation failed");
-            exit(EXIT_FAILURE);
+    static void print_startup_report(const std::vector<BootPeer> &peers, int selfIdx, uint64_t doneNs){
+        int slowestLookup = 0, lastDone = -1, retries = 0, hellos = 0;
+        uint64_t firstContact = 0;
+        for (int i = 0; i < (int) peers.size(); i++){
+            const BootPeer &p = peers[i];
+            retries += p.lookups - 1;
+            hellos += p.hellos;
+            if (p.resolved_at_ns > peers[slowestLookup].resolved_at_ns) slowestLookup = i;
+            if (i == selfIdx) continue;
+            if (firstContact == 0 || p.first_contact_ns < firstContact) firstContact = p.first_contact_ns;
+            if (lastDone == -1 || p.done_at_ns > peers[lastDone].done_at_ns) lastDone = i;
+            DPRINTF(("[Boot] %s: resolved after %.1f ms (%d lookups), first contact after %.1f ms, done after %.1f ms (%d hellos)\n",
+                     p.name, ms(p.resolved_at_ns), p.lookups, ms(p.first_contact_ns), ms(p.done_at_ns), p.hellos));
         }
-        const char *msg = "hi";
-        int numbytes;
-        int received_ack = 0;
+        printf("Startup (%d hosts): names resolved after %.1f ms (slowest %s, %d retries), first contact after %.1f ms, "
+               "barrier done after %.1f ms (last %s, %d hellos sent)\n",
+               (int) peers.size(), ms(peers[slowestLookup].resolved_at_ns), peers[slowestLookup].name, retries,
+               ms(firstContact), ms(doneNs), lastDone == -1 ? "-" : peers[lastDone].name, hellos);
+    }
 
-        struct pollfd pfds[1]; // More if you want to monitor more
+    const char *waittosync(const std::vector<std::string> &hostNames){
+        int numHosts = (int) hostNames.size();
+        printf("Waiting for other hosts....\n");
+        uint64_t start = monotonic_now_ns();
 
-        pfds[0].fd = sockfd;          // Standard input
-        pfds[0].events = POLLIN; // Tell me when ready to read
+        std::vector<in_addr_t> localAddrs = local_addresses();
+        int sockfd = bind_boot_socket();
+        int eventFd = eventfd(0, EFD_NONBLOCK);
+        if (eventFd == -1){
+            perror("eventfd");
+            exit(1);
+        }
 
-        while (received_ack == 0) {
-            if ((numbytes = sendto(sockfd, msg, strlen(msg), 0, hostai->ai_addr, hostai->ai_addrlen)) == -1) {
-                DPRINTF(("Sent to host failed... try again later"));
-            }
-            else {  // it sent through... wait to receive msg. Will timeout after TIMEOUT msec if does not receive ack.
-                int num_events = poll(pfds, 1, TIMEOUT);
-                if (num_events == 0) {
-                    DPRINTF(("Poll timed out! Waiting for %s\n", hostname));
-                } else {
-                    int pollin_happened = pfds[0].revents & POLLIN;
-                    if (pollin_happened) {
-                        if ((numbytes = recvfrom(sockfd, buf, MAX_BUF_LEN - 1, 0, (struct sockaddr *) &their_addr,
-                                                 &addr_len)) == -1) {
-                            perror("recvfrom error.... trying again...");
-                            continue;
+        std::vector<BootPeer> peers(numHosts);  // never resized: the gaicbs in flight point into it
+        for (int i = 0; i < numHosts; i++){
+            peers[i].name = hostNames[i].c_str();
+            start_lookup(peers[i], eventFd, start);
+        }
+
+        int selfIdx = -1, numResolved = 0, numDone = 0;
+        struct pollfd pfds[2] = {{sockfd, POLLIN, 0}, {eventFd, POLLIN, 0}};
+        char buf[MAX_BUF_LEN], word[8];
+        struct sockaddr_storage their_addr{};
+        socklen_t addr_len;
+        uint64_t now = start;
+        while (selfIdx == -1 || numDone < numHosts - 1){
+            now = monotonic_now_ns();
+            /* collect finished lookups and restart the failed ones whose backoff is over */
+            for (int i = 0; i < numHosts; i++){
+                BootPeer &p = peers[i];
+                if (p.resolved) continue;
+                if (p.looking_up){
+                    int rv = gai_error(&p.lookup);
+                    if (rv == EAI_INPROGRESS) continue;
+                    p.looking_up = false;
+                    if (rv != 0){
+                        DPRINTF(("[Boot] Failed to resolve %s (%s). Trying again...\n", p.name, gai_strerror(rv)));
+                        p.next_lookup_ns = now + backoff(p.lookup_backoff_ns);
+                        continue;
+                    }
+                    p.addr = *(struct sockaddr_in *) p.lookup.ar_result->ai_addr;
+                    freeaddrinfo(p.lookup.ar_result);
+                    p.resolved = true;
+                    p.resolved_at_ns = now - start;
+                    numResolved++;
+                    for (in_addr_t a : localAddrs){
+                        if (a == p.addr.sin_addr.s_addr && selfIdx == -1){
+                            selfIdx = i;  // this is the name of the current docker's container
+                            current_container_name = (char *) p.name;
+                            DPRINTF(("[Boot] %s is us\n", p.name));
                         }
-                        // GOT A PACKET!
-                        const char *their_ip = inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr *) &their_addr), s,
-                                                         sizeof s);
-                        buf[numbytes] = '\0';
-                        DPRINTF(("[POLL for %s] Received msg %s from %s\n", hostname, buf, their_ip));
-                        received_ack = 1;
-                    } else {
-                        fprintf(stderr, "[POLL for %s] Unexpected event occurred: %d\n", hostname, pfds[0].revents);
                     }
+                } else if (now >= p.next_lookup_ns){
+                    start_lookup(p, eventFd, now);
+                }
+            }
+            if (selfIdx == -1 && numResolved == numHosts){
+                fprintf(stderr, "None of the %d hosts in the Hostfile resolves to this machine.\n", numHosts);
+                exit(1);
+            }
+            if (selfIdx != -1 && numDone == numHosts - 1) break;
+
+            /* hello everybody that hasn't acked us yet */
+            uint64_t nextEvent = UINT64_MAX;
+            for (int i = 0; i < numHosts; i++){
+                BootPeer &p = peers[i];
+                if (!p.resolved){
+                    if (!p.looking_up) nextEvent = std::min(nextEvent, p.next_lookup_ns);
+                    continue;
+                }
+                if (i == selfIdx || selfIdx == -1 || p.acked_us) continue;
+                if (now >= p.next_hello_ns){
+                    send_word(sockfd, "hi", selfIdx, (struct sockaddr *) &p.addr, sizeof p.addr);
+                    p.hellos++;
+                    p.next_hello_ns = now + backoff(p.hello_backoff_ns);
+                }
+                nextEvent = std::min(nextEvent, p.next_hello_ns);
+            }
+
+            int timeout = -1;
+            if (nextEvent != UINT64_MAX) timeout = nextEvent <= now ? 0 : (int) ((nextEvent - now + 999999) / 1000000);
+            if (poll(pfds, 2, timeout) == -1 && errno != EINTR){
+                perror("poll");
+                exit(1);
+            }
+            if (pfds[1].revents & POLLIN){
+                uint64_t count;
+                ssize_t rv = read(eventFd, &count, sizeof count);  // just a wakeup. the lookups are checked above
+                (void) rv;
+            }
+            if (!(pfds[0].revents & POLLIN)) continue;
+            now = monotonic_now_ns();
+            while (true){
+                addr_len = sizeof their_addr;
+                ssize_t numbytes = recvfrom(sockfd, buf, MAX_BUF_LEN - 1, MSG_DONTWAIT, (struct sockaddr *) &their_addr, &addr_len);
+                if (numbytes == -1){
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recvfrom error.... trying again...");
+                    break;
+                }
+                buf[numbytes] = '\0';
+                int idx;
+                if (sscanf(buf, "%7s %d", word, &idx) != 2 || idx < 0 || idx >= numHosts || idx == selfIdx){
+                    DPRINTF(("[Boot] ignoring packet %s\n", buf));
+                    continue;
+                }
+                BootPeer &p = peers[idx];
+                DPRINTF(("[Boot] got %s from %s\n", buf, p.name));
+                if (strcmp(word, "hi") == 0){
+                    if (selfIdx == -1) continue;  // can't answer before we know who we are. it will try again
+                    send_word(sockfd, "ACK", selfIdx, (struct sockaddr *) &their_addr, addr_len);
+                    p.said_hi = true;
+                } else if (strcmp(word, "ACK") == 0){
+                    p.acked_us = true;
+                } else continue;
+                if (p.first_contact_ns == 0) p.first_contact_ns = now - start;
+                if (p.acked_us && p.said_hi && p.done_at_ns == 0){
+                    p.done_at_ns = now - start;
+                    numDone++;
                 }
             }
         }
+        close(eventFd);
+
+        printf("READY\n");
+        print_startup_report(peers, selfIdx, monotonic_now_ns() - start);
+        std::thread(linger_and_ack, sockfd, selfIdx).detach();
+
+        return current_container_name;
     }
 
 
-}
\ No newline at end of file
+/* read from hostFileName and store each (non-empty) line into lines */
+    int read_from_file(const char *fileName, std::vector<std::string> &lines) {
+        int numHosts = 0;
+        FILE *file = fopen(fileName, "r");
+        if (file == nullptr) {
+            fprintf(stderr, "Error reading file %s", fileName);
+            exit(1);
+        }
+        char line[MAX_HOST_NAME];
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0] == '\0') continue;  // skip blank lines (e.g. a trailing newline)
+            lines.emplace_back(line);
+            numHosts++;
+        }
+        // for (int i = 0; i < numHosts; i++){
+        //     DPRINTF(("%d: %s\n", i, lines[i].c_str()));
+        // }
+        fclose(file);
+        return numHosts;
+    }
+
+}
@@ -12,12 +12,18 @@
 #endif
 
 #include <netdb.h>
+#include <string>
+#include <vector>
+
+#define BOOT_BACKOFF_MIN    5       // in miliseconds. first retry of a hello (or of a failed name lookup)
+#define BOOT_BACKOFF_MAX    1000    // in miliseconds. retries double up to this
+#define BOOT_LINGER         5000    // in miliseconds. keep answering hellos this long after we are READY
+
 namespace wait_to_sync {
-    int read_from_file(const char *fileName, char *lineArray[]);
-    const char *waittosync(char **hostNames, int numHosts);
-    void *check_up_with_host(void *ptr);
-    /* perform message collecting and synchronization (for threads) */
-    void receive_signals_and_send_ack();
-    void send_signals_and_wait_for_acks(struct addrinfo *hostai, const char *hostname);
+    int read_from_file(const char *fileName, std::vector<std::string> &lines);
+    /* Barrier with every host in hostNames. Returns the name (from hostNames) of this machine.
+     * All the lookups are started at once (getaddrinfo_a) and all the hellos/acks go through one UDP socket,
+     * so the barrier completes roughly one round trip after the last host comes up. */
+    const char *waittosync(const std::vector<std::string> &hostNames);
 }
 #endif //PRJ1_WAITTOSYNC_H